@@ -54,6 +54,14 @@
  *  (cf. irc_set_connect_timeout()) */
 #define DEF_SCTO_US 15000000ul
 
+/** \brief Default ISON polling interval in microsecs
+ *  (cf. irc_set_monitor_ison()) */
+#define DEF_MONISON_US 60000000ul
+
+/** \brief Default keepalive idle time in microsecs, 0 meaning off
+ *  (cf. irc_set_keepalive()) */
+#define DEF_KAIDLE_US 0ul
+
 /** \brief RFC1459 case mapping as per the 005 ISUPPORT spec.
  *
  * In the RFC1459 case mapping, which is the default, the characters
@@ -239,6 +247,63 @@ typedef void (*fp_mut_nick)(char *nick, size_t nick_sz);
  */
 typedef bool (*uhnd_fn)(irc *ctx, tokarr *msg, size_t nargs, bool pre);
 
+/** \brief Number of buckets in irc_lagstats' histogram */
+#define IRC_LAG_NBUCK 16
+
+/** \brief Round trip times measured by the keepalive, see irc_lag_stats() */
+struct irc_lagstats {
+	uint64_t last_us;   /**< The most recent round trip */
+	uint64_t min_us;    /**< The shortest one */
+	uint64_t max_us;    /**< The longest one */
+	uint64_t sum_us;    /**< All of them added up (divide by `npong`) */
+	uint64_t nping;     /**< PINGs we sent */
+	uint64_t npong;     /**< PONGs we got for them in time */
+	uint64_t nmissed;   /**< PINGs that went unanswered for too long */
+	uint64_t nanswered; /**< PINGs from the server we answered */
+
+	/** Round trips by duration: hist[0] counts those below 1 ms, hist[i]
+	 * those of at least 2^(i-1) and below 2^i ms; the last bucket also
+	 * counts all that took even longer */
+	uint64_t hist[IRC_LAG_NBUCK];
+};
+
+/** \brief Counters kept for every context, see irc_stats() */
+struct irc_stats {
+	uint64_t bytes_in;   /**< Bytes read from the server */
+	uint64_t bytes_out;  /**< Bytes written to it */
+	uint64_t lines_in;   /**< Lines read */
+	uint64_t lines_out;  /**< Lines written */
+	uint64_t reads;      /**< Calls to read() (or SSL_read()) */
+	uint64_t writes;     /**< Calls to write() (or SSL_write()) */
+	uint64_t parse_errs; /**< Lines that couldn't be taken apart */
+	uint64_t proto_errs; /**< Messages with too few or malformed arguments */
+	uint64_t connects;   /**< Successful irc_connect()s */
+	uint64_t connfails;  /**< Failed ones */
+	uint64_t reconnects; /**< irc_connect()s after the first successful one */
+	uint64_t tls_us;     /**< How long the last TLS handshake took, 0 if none */
+};
+
+/** \brief Number of buckets in struct irc_hndtime's histogram */
+#define IRC_HNDT_NBUCK 64
+
+/** \brief How long the handlers of one module took for one command, see
+ * irc_hndtime()
+ *
+ * The histogram is log-linear: bucket 0 counts dispatches that took less than
+ * 64ns, then every power of two is split in two linear halves (64-95ns,
+ * 96-127ns, 128-191ns, ...), up to the last bucket, which counts everything
+ * beyond.  irc_hndtime_bucket() tells where each begins. */
+struct irc_hndtime {
+	char cmd[32];     /**< The protocol command */
+	char module[32];  /**< Who handled it; "user-pre"/"user-post" for
+	                   *   handlers registered with irc_reg_msghnd() */
+	uint64_t n;       /**< Dispatches */
+	uint64_t sum_ns;  /**< Total time taken */
+	uint64_t max_ns;  /**< Longest time taken */
+	uint64_t nslow;   /**< Dispatches over irc_set_hndtime_slow()'s limit */
+	uint64_t hist[IRC_HNDT_NBUCK]; /**< Dispatches, by time taken */
+};
+
 /** @} */
 
 #endif /* LIBSRSIRC_IRC_DEFS_H */
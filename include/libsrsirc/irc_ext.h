@@ -316,6 +316,50 @@ const char *irc_005modepfx(irc *ctx, bool symbols);
  */
 const char *irc_005attr(irc *ctx, const char *name);
 
+/** \brief Tell the maximum nickname length as per 005 NICKLEN.
+ *
+ * \return The value of the 005 NICKLEN attribute, or 0 if we don't know it.
+ * \sa irc_005attr()
+ */
+size_t irc_005nicklen(irc *ctx);
+
+/** \brief Tell the maximum length of a protocol line as per 005 LINELEN.
+ *
+ * \return The value of the 005 LINELEN attribute, or 512 (the RFC limit,
+ *         including CRLF) if it wasn't given.
+ * \sa irc_005attr()
+ */
+size_t irc_005linelen(irc *ctx);
+
+/** \brief Tell the maximum number of entries of a list mode as per 005
+ * MAXLIST.
+ *
+ * \param mode   A list mode character (e.g. 'b')
+ * \return The maximum number of entries on the list of mode `mode` (a
+ *         channel's ban list, for example), or 0 if we don't know it.
+ * \sa irc_005attr()
+ */
+size_t irc_005maxlist(irc *ctx, char mode);
+
+/** \brief Tell how many channels of a given type we may join as per 005
+ * CHANLIMIT (or MAXCHANNELS, on older servers).
+ *
+ * \param chantype   A channel type character (e.g. '#')
+ * \return The maximum number of channels of type `chantype` we may be in
+ *         at the same time, or 0 if there is no limit (or we don't know it).
+ * \sa irc_005attr()
+ */
+size_t irc_005chanlimit(irc *ctx, char chantype);
+
+/** \brief Tell how many targets a given command accepts as per 005 TARGMAX.
+ *
+ * \param cmd   An IRC command (e.g. "PRIVMSG")
+ * \return The maximum number of targets `cmd` accepts, or 0 if there is no
+ *         limit (or we don't know it).
+ * \sa irc_005attr()
+ */
+size_t irc_005targmax(irc *ctx, const char *cmd);
+
 /** \brief Register callback for protocol messages that are read at logon time.
  *
  * If for some reason the messages received at logon time (while irc_connect()
@@ -397,6 +441,122 @@ bool irc_set_ssl(irc *ctx, bool on);
  */
 void irc_set_connect_timeout(irc *ctx, uint64_t soft, uint64_t hard);
 
+/** \brief Have the library keep the connection alive
+ *
+ * By default, PINGs are only answered during logon; answering them later
+ * is up to the user.  With keepalive on, the library answers every PING
+ * right away.  It also sends PINGs of its own once it hasn't heard from the
+ * server for `idle_us`, measures how long the PONGs take (see
+ * irc_lag_stats()), and, if `maxmiss` PINGs in a row went unanswered for
+ * `idle_us` each, considers the connection dead: irc_read() fails then, as it
+ * would if the server had closed the connection, and irc_lasterror() says
+ * what happened.
+ *
+ * All of this happens in irc_read(), which doesn't block for longer than
+ * needed for it (while still returning only when a message arrived or its
+ * timeout is up), so it must be called regularly.  A user answering PINGs
+ * as well does no harm, other than to the bandwidth.
+ *
+ * \param idle_us   PING after this long without traffic, 0 to turn keepalive
+ *                  off (which is the default)
+ * \param maxmiss   Give up after this many unanswered PINGs, 0 to never
+ */
+void irc_set_keepalive(irc *ctx, uint64_t idle_us, unsigned maxmiss);
+
+/** \brief Get the round trip times measured by the keepalive
+ *
+ * Counting starts over at every irc_connect().
+ *
+ * \param dest   Where to put them
+ * \return true if at least one round trip was measured, false otherwise
+ *         (`dest` is filled in anyway)
+ * \sa irc_set_keepalive()
+ */
+bool irc_lag_stats(irc *ctx, struct irc_lagstats *dest);
+
+/** \brief Get the counters kept for a context
+ *
+ * Counting starts at irc_init() and goes on across reconnects.  These are
+ * plain counters; for rates, sample them and take differences.
+ *
+ * \param dest   Where to put them
+ * \return true
+ * \sa struct irc_stats, irc_stats_cmd(), irc_stats_prom()
+ */
+bool irc_stats(irc *ctx, struct irc_stats *dest);
+
+/** \brief Get how many messages with a given command were received
+ *
+ * Commands are indexed in the order first seen, starting at 0; iterate until
+ * this returns false.  Only 127 distinct commands are counted by name, any
+ * beyond that are counted as "*".
+ *
+ * \param ind     Which command
+ * \param cmd     Where to put the command (points into the context and is
+ *                valid until it is irc_dispose()d), may be NULL
+ * \param count   Where to put the count, may be NULL
+ * \return true if there was a command at `ind`, false otherwise
+ */
+bool irc_stats_cmd(irc *ctx, size_t ind, const char **cmd, uint64_t *count);
+
+/** \brief Render the counters of all contexts, Prometheus text format
+ *
+ * This covers every context that currently exists, labelled by an id
+ * (unique within the process), server and nick, plus the keepalive's round
+ * trip times (see irc_set_keepalive()) and messages by command, summed over
+ * all contexts.
+ *
+ * This may be called from any thread.  The counters are read without
+ * synchronization, so unless all contexts are driven by the calling thread,
+ * the numbers may be slightly off; they are never torn on platforms with 64
+ * bit stores, though.  The server and nick labels are as of the last message
+ * the context processed (or the last irc_set_server()/irc_set_nick()).
+ *
+ * \param dest     Where to put the output, may be NULL if `destsz` is 0
+ * \param destsz   Size of `dest`.  If too small, the output is truncated
+ *                 (but still '\0'-terminated)
+ * \return The length of the complete output, like snprintf()
+ */
+size_t irc_stats_prom(char *dest, size_t destsz);
+
+/** \brief Get how long the message handlers of one module took for one command
+ *
+ * Only available if libsrsirc was configured with --enable-hndtime; without
+ * it, handlers aren't timed at all and this always returns false.
+ *
+ * Every call of a message handler, be it one of ours (tracking, IRCv3, ...)
+ * or one registered with irc_reg_msghnd(), is timed with a monotonic clock
+ * and accounted for by command and module.  Those are indexed in the order
+ * first seen, starting at 0; iterate until this returns false.  Counting
+ * starts at irc_init() and goes on across reconnects.
+ *
+ * \param ind    Which command/module pair
+ * \param dest   Where to put its numbers
+ * \return true if there was a pair at `ind`, false otherwise
+ * \sa struct irc_hndtime, irc_hndtime_bucket(), irc_set_hndtime_slow()
+ */
+bool irc_hndtime(irc *ctx, size_t ind, struct irc_hndtime *dest);
+
+/** \brief Tell where a bucket of struct irc_hndtime's histogram begins
+ *
+ * \param ind   The bucket, 0 <= `ind` < IRC_HNDT_NBUCK
+ * \return The shortest time (in nanoseconds) counted in that bucket; it ends
+ *         where the next one begins
+ */
+uint64_t irc_hndtime_bucket(size_t ind);
+
+/** \brief Complain about message handlers taking too long
+ *
+ * Whenever a single call of a handler takes longer than this, a warning
+ * naming the command and the handler is logged, and the handler's `nslow`
+ * (see struct irc_hndtime) is bumped.  Does nothing unless libsrsirc was
+ * configured with --enable-hndtime.
+ *
+ * \param thresh_us   The limit, in microseconds, or 0 to never complain
+ *                    (which is the default)
+ */
+void irc_set_hndtime_slow(irc *ctx, uint64_t thresh_us);
+
 /** \brief Set proxy server to use
  *
  * libsrsirc supports redirecting the IRC connection through a proxy server.
@@ -478,6 +638,19 @@ bool irc_set_service_info(irc *ctx, const char *info);
  * encountered. irc_tracking_enab() can be used to tell whether tracking
  * is actually active.
  *
+ * Tracking state survives a reconnect (a subsequent irc_connect()).  The
+ * channels we were in are kept around, along with their members and any tags
+ * (see irc_tag_chan(), irc_tag_user()), and are reconciled with the server's
+ * view as soon as we JOIN them again.  Channels that have not been re-JOINed
+ * by the time the server first PINGs us are dropped (but see
+ * irc_set_track_grace()).
+ *
+ * With tracking enabled, we ask for the IRCv3 capabilities batch,
+ * userhost-in-names, extended-join, account-notify, away-notify, chghost and
+ * multi-prefix (if the server offers them).  These keep usernames, hosts,
+ * full names, accounts and away states of the users we see up to date
+ * without having to WHO them (but see irc_set_track_whosync()).
+ *
  * \param on   True to enable tracking, false to disable
  *
  * This setting will take effect not before the next call to irc_connect().
@@ -485,6 +658,50 @@ bool irc_set_service_info(irc *ctx, const char *info);
  */
 bool irc_set_track(irc *ctx, bool on);
 
+/** \brief Set how long channels kept across a reconnect may go un-JOINed
+ *
+ * Channels we were in before a reconnect (or that came from
+ * irc_track_load()) are dropped at the first PING after logon unless we
+ * JOINed them again by then.  Joining many channels can take a while, though,
+ * so this can be used to put off dropping them until `grace_us` microseconds
+ * after logon.  Default is 0 (drop at the first PING).
+ *
+ * \param grace_us   Minimum time (in microseconds) to keep them around
+ * \sa irc_set_track(), irc_track_load()
+ */
+void irc_set_track_grace(irc *ctx, uint64_t grace_us);
+
+/** \brief Enable or disable the host index of tracked users
+ *
+ * With the index, irc_match_members() and irc_match_users() only look at
+ * users with matching hosts, provided the mask ends in a literal host suffix
+ * (like `*!*\@*.example.com`).  The index is rebuilt lazily on the first
+ * such match after users came, went or changed their host, so it pays off
+ * when many masks are matched at a time (e.g. all bans of a channel), and
+ * in large channels.  Disabled by default.
+ *
+ * \param on   True to enable, false to disable (and free) the index
+ * \sa irc_match_members(), irc_match_users()
+ */
+void irc_set_track_hostidx(irc *ctx, bool on);
+
+/** \brief Enable or disable WHOing channels as we JOIN them
+ *
+ * NAMES replies tell little more than nicknames.  With this enabled, we send
+ * a WHO for every channel we JOIN (and start tracking, see
+ * irc_track_filter_add()) to fill in the username, host and full name of its
+ * members, as well as their services account if the server supports WHOX.
+ *
+ * Only one of these WHOs is out at a time, so JOINing many channels at once
+ * won't get us disconnected for flooding; it does mean the details of later
+ * channels' members show up some time after JOINing.  Disabled by default.
+ *
+ * \param on   True to enable, false to disable (channels yet to be WHOed are
+ *             skipped)
+ * \sa irc_set_track(), struct userrep
+ */
+void irc_set_track_whosync(irc *ctx, bool on);
+
 /** \brief Tell the name or address of the IRC server we use or intend to use
  * \return The hostname-part of what was set using irc_set_server()
  * \sa irc_set_server()
@@ -607,6 +824,10 @@ bool irc_get_dumb(irc *ctx);
  *              called afterwards (see uhnd_fn).  Registering both a pre- and
  *              a post- handler for the same command is okay.
  *
+ * Lines inside an IRCv3 "netsplit" or "netjoin" batch (the QUITs and JOINs of
+ * a netsplit and of its end) are passed to handlers one by one, unless asked
+ * otherwise using irc_set_quiet_batches().
+ *
  * \return true if the handler was registered, false if the maximum number of
  *              handlers is exceeded, in which case you should probably email
  *              me to disprove my assumption about how many would be enough for
@@ -616,6 +837,22 @@ bool irc_get_dumb(irc *ctx);
  */
 bool irc_reg_msghnd(irc *ctx, const char *cmd, uhnd_fn hndfn, bool pre);
 
+/** \brief Keep the lines of netsplit and netjoin batches from handlers
+ *
+ * A netsplit can come as thousands of QUITs (and its end as thousands of
+ * JOINs), wrapped in an IRCv3 "netsplit" ("netjoin") batch if the server
+ * supports the "batch" capability, which is requested when tracking is
+ * enabled (see irc_set_track()).  With this enabled, the lines inside such
+ * a batch are not passed to handlers registered using irc_reg_msghnd(),
+ * only the BATCH lines opening and closing it are.  irc_read() still hands
+ * out every line.  The `batch` callback of struct irc_trkcb tells who was
+ * affected.  Disabled by default.
+ *
+ * \param on   True to enable, false to disable
+ * \sa irc_reg_msghnd(), irc_regcb_track()
+ */
+void irc_set_quiet_batches(irc *ctx, bool on);
+
 /** \brief Tell whether the connection was closed gracefully
  *
  * If we were disconnected, this function can be used to tell whether the
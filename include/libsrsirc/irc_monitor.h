@@ -0,0 +1,95 @@
+/* irc_monitor.h - have the server tell us when nicks come and go
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_IRC_MONITOR_H
+#define LIBSRSIRC_IRC_MONITOR_H 1
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libsrsirc/defs.h>
+
+/** @file
+ * \defgroup monitorif Notify list interface provided by irc_monitor.h
+ * \addtogroup monitorif
+ *  @{
+ */
+
+/** \brief Callbacks for the notify list, see irc_regcb_monitor()
+ *
+ * All members are optional; those left NULL are simply not called.  Only
+ * changes are reported: a nick that is online after a reconnect and was
+ * online before that is reported again, though, since we don't know what
+ * happened in between. */
+struct irc_moncb {
+	/** \brief A nick on the list is online.  `ident` is nick!user@host
+	 * if the server told us, otherwise just the nick */
+	void (*online)(irc *ctx, const char *ident, void *tag);
+
+	/** \brief A nick on the list is offline */
+	void (*offline)(irc *ctx, const char *nick, void *tag);
+
+	/** \brief The server's MONITOR list is full, so it won't notify us
+	 * about `nick`.  It is polled for using ISON instead, unless that was
+	 * disabled (see irc_set_monitor_ison()) */
+	void (*full)(irc *ctx, const char *nick, void *tag);
+};
+
+/** \brief Add a nick to the notify list
+ *
+ * The notify list is kept by the library, across reconnects.  If the server
+ * supports MONITOR, nicks are put on its MONITOR list and the server tells us
+ * when they come and go.  Otherwise (or if the server's list is full), we poll
+ * for them using ISON, see irc_set_monitor_ison().
+ *
+ * Changes aren't sent right away but collected until the next irc_read(), so
+ * that adding (or removing) many nicks takes only as many MONITOR lines as it
+ * takes to fit them.  Nicks are compared using the server's casemapping;
+ * adding one that is already on the list does nothing.
+ *
+ * \param nick   The nick to add
+ * \return true on success, false if we ran out of memory
+ * \sa irc_regcb_monitor(), irc_monitor_del()
+ */
+bool irc_monitor_add(irc *ctx, const char *nick);
+
+/** \brief Remove a nick from the notify list
+ * \return true if it was on the list, false otherwise */
+bool irc_monitor_del(irc *ctx, const char *nick);
+
+/** \brief Remove all nicks from the notify list */
+void irc_monitor_clear(irc *ctx);
+
+/** \brief Tell how many nicks are on the notify list */
+size_t irc_monitor_count(irc *ctx);
+
+/** \brief Tell whether a nick on the notify list is online
+ * \return 1 if online, 0 if offline, -1 if we don't know (yet), or the nick
+ *         isn't on the list */
+int irc_monitor_state(irc *ctx, const char *nick);
+
+/** \brief Set how often to ISON for nicks the server won't MONITOR for us
+ *
+ * That's all of them if the server doesn't support MONITOR, or the ones that
+ * didn't fit on its list if it does.  They are packed into as few ISON lines
+ * as possible.  Polling is driven by irc_read(), so it won't happen more
+ * often than that is called.  Defaults to 60 seconds.
+ *
+ * \param ival_us   Interval in microseconds, 0 to disable polling
+ */
+void irc_set_monitor_ison(irc *ctx, uint64_t ival_us);
+
+/** \brief Register callbacks for the notify list
+ *
+ * \param cbs   The callbacks (copied), or NULL to stop calling any
+ * \param tag   Userdata handed back to every callback
+ *
+ * \sa struct irc_moncb */
+void irc_regcb_monitor(irc *ctx, const struct irc_moncb *cbs, void *tag);
+
+/** @} */
+
+#endif /* LIBSRSIRC_IRC_MONITOR_H */
@@ -47,6 +47,11 @@ struct userrep {
 	const char *uname; /**< \brief Username, or NULL if unknown */ //XXX rly?
 	const char *host; /**< \brief Hostname, or NULL if unknown */
 	const char *fname; /**< \brief Full name, or NULL if unknown */
+	/** \brief Services account name, or NULL if unknown or not logged in */
+	const char *account;
+	/** \brief Away message if the user is away ("" if we don't know the
+	 * message), NULL if not away or unknown */
+	const char *away;
 	size_t nchans; /**< \brief Number of channels we know the user is in */
 	void *tag; /**< \brief Opaque user (as in, libsrsirc user) data */
 };
@@ -57,6 +62,40 @@ typedef struct chanrep chanrep;
 /** \brief Convenience typedef for struct userrep. Probably a bad idea. */
 typedef struct userrep userrep;
 
+/** \brief Iterator over channels, users or the members of a channel
+ *
+ * Unlike the irc_all_*() functions, iterators don't need an array sized to
+ * fit everything.  They are plain objects allocated by the caller (typically
+ * on the stack) and hold all of their state themselves, so iterations can be
+ * nested (e.g. over the members of each channel while iterating over the
+ * channels) or abandoned at any point without cleaning up.
+ *
+ * The members of this struct are private.  An iterator is only valid until
+ * the next call to irc_read(). */
+struct irc_iter {
+	void *map_;
+	size_t bit_;
+	void *pos_;
+};
+
+/** \brief Iterator over the channels we're in, see irc_chan_iter_init() */
+typedef struct irc_iter irc_chan_iter;
+
+/** \brief Iterator over the users we're seeing, see irc_user_iter_init() */
+typedef struct irc_iter irc_user_iter;
+
+/** \brief Iterator over the members of a channel, see irc_memb_iter_init() */
+typedef struct irc_iter irc_memb_iter;
+
+/** \brief Visitor callback for channels, see irc_foreach_chan()
+ * \return true to continue, false to stop the iteration */
+typedef bool (*irc_chan_visit_fn)(irc *ctx, const chanrep *chan, void *arg);
+
+/** \brief Visitor callback for users and members, see irc_foreach_user()
+ * and irc_foreach_member()
+ * \return true to continue, false to stop the iteration */
+typedef bool (*irc_user_visit_fn)(irc *ctx, const userrep *user, void *arg);
+
 
 /* the results of these functions (i.e. the strings pointed to by the various
  * members of the structs above) are only valid until the next time irc_read
@@ -87,6 +126,68 @@ size_t irc_all_chans(irc *ctx, chanrep *chanarr, size_t chanarr_cnt);
  *         only valid until the next call to irc_read() */
 chanrep *irc_chan(irc *ctx, chanrep *dest, const char *name);
 
+/** \brief Look up a (non-list) mode of a channel
+ *
+ * This covers the modes of the CHANMODES classes B, C and D (see the 005
+ * ISUPPORT specification), i.e. everything that is either set or not set.
+ * List modes (class A, e.g. bans) are accessed using irc_num_chanlist(),
+ * irc_all_chanlist() and irc_chanlist_has().
+ *
+ * \param chnam   Name of the channel
+ * \param mode   The mode character (e.g. 'k' or 'm')
+ * \param arg   If non-NULL, the argument of the mode (e.g. the channel key)
+ *              is stored here, or NULL if the mode has no argument
+ * \return True if the mode is set, false if it isn't, or we don't know the
+ *         channel.
+ *
+ * *NOTE:* The string pointed to by `arg` is only valid until the next call
+ *         to irc_read() */
+bool irc_chanmode(irc *ctx, const char *chnam, char mode, const char **arg);
+
+/** \brief Count the entries in a list mode of a channel
+ *
+ * List modes are those of CHANMODES class A, e.g. 'b' (bans), 'e' (ban
+ * exceptions) or 'I' (invite exceptions).  Their contents are learned from
+ * MODE changes and the respective list numerics (367, 348, 346, 728).
+ *
+ * \param chnam   Name of the channel
+ * \param mode   The list mode character (e.g. 'b')
+ * \return The number of masks on that list */
+size_t irc_num_chanlist(irc *ctx, const char *chnam, char mode);
+
+/** \brief Retrieve all masks of a list mode of a channel
+ *
+ * \param chnam   Name of the channel
+ * \param mode   The list mode character (e.g. 'b')
+ * \param maskarr   Pointer into an array of at least `maskarr_cnt` elements.
+ *                  The array is populated with the masks.
+ * \param maskarr_cnt   Maximum number of masks to retrieve
+ * \return The number of masks that were put into `maskarr`
+ *
+ * *NOTE:* The retrieved strings are only valid until the next call to
+ *         irc_read() */
+size_t irc_all_chanlist(irc *ctx, const char *chnam, char mode,
+    const char **maskarr, size_t maskarr_cnt);
+
+/** \brief Check whether a mask is on a list mode of a channel
+ *
+ * The mask is compared as a whole (i.e. case-insensitively according to the
+ * server's CASEMAPPING, but not a wildcard match).
+ *
+ * \param chnam   Name of the channel
+ * \param mode   The list mode character (e.g. 'b')
+ * \param mask   The mask to look for
+ * \param setby   If non-NULL, who set the entry is stored here (may be NULL
+ *                if unknown)
+ * \param tsset   If non-NULL, when the entry was set (seconds since Epoch, 0
+ *                if unknown) is stored here
+ * \return True if the mask is on the list
+ *
+ * *NOTE:* The string pointed to by `setby` is only valid until the next call
+ *         to irc_read() */
+bool irc_chanlist_has(irc *ctx, const char *chnam, char mode, const char *mask,
+    const char **setby, uint64_t *tsset);
+
 /** \brief Associate opaque user data with a channel
  *
  * This is a general-purpose mechanism to associate a piece of user-defined
@@ -164,6 +265,50 @@ size_t irc_num_members(irc *ctx, const char *chnam);
 size_t irc_all_members(irc *ctx, const char *chnam, userrep *userarr,
     size_t userarr_cnt);
 
+/** \brief Retrieve members of a channel in the order a client shows them
+ *
+ * Members are ordered by their strongest mode prefix (e.g. ops before
+ * voiced users before everyone else), then by nickname (ignoring case
+ * according to the server's CASEMAPPING).  That order is kept up to date as
+ * members come and go, so fetching a window of it (say, the part of a
+ * nick list that is on screen) takes O(log n + `userarr_cnt`) time.
+ *
+ * \param chnam   Name of the channel
+ * \param first   Position (0-based) of the first member to retrieve
+ * \param userarr   Pointer into an array of at least `userarr_cnt` elements
+ * \param userarr_cnt   Maximum number of members to retrieve
+ * \return The number of members that were put into `userarr`
+ *
+ * *NOTE:* The information contained in the retrieved userrep structures is
+ *         only valid until the next call to irc_read() */
+size_t irc_sorted_members(irc *ctx, const char *chnam, size_t first,
+    userrep *userarr, size_t userarr_cnt);
+
+/** \brief Retrieve members of a channel whose nickname starts with `pfx`
+ *
+ * This is for nick completion.  The members come in the same order as with
+ * irc_sorted_members(), case is ignored as there.
+ *
+ * \param chnam   Name of the channel
+ * \param pfx   What the nicknames have to start with
+ * \param userarr   Pointer into an array of at least `userarr_cnt` elements
+ * \param userarr_cnt   Maximum number of members to retrieve
+ * \return The number of members that were put into `userarr`
+ *
+ * *NOTE:* The information contained in the retrieved userrep structures is
+ *         only valid until the next call to irc_read() */
+size_t irc_complete_member(irc *ctx, const char *chnam, const char *pfx,
+    userrep *userarr, size_t userarr_cnt);
+
+/** \brief Count the members of a channel that have a given mode prefix
+ *
+ * Members having several prefixes count for each of them.  Takes O(1).
+ *
+ * \param chnam   Name of the channel
+ * \param sym   The prefix symbol, e.g. '@' for ops or '+' for voices
+ * \return The number of members of `chnam` with prefix `sym` */
+size_t irc_num_prefixed(irc *ctx, const char *chnam, char sym);
+
 
 /** \brief Retrieve one member representation by nickname and channel
  * \param dest   Pointer to a userrep where we put the result
@@ -177,6 +322,416 @@ size_t irc_all_members(irc *ctx, const char *chnam, userrep *userarr,
  *         only valid until the next call to irc_read() */
 userrep *irc_member(irc *ctx, userrep *dest, const char *chnam, const char *ident);
 
+
+/** \brief Start iterating over the channels we're in
+ * \param it   The iterator to (re)initialize */
+void irc_chan_iter_init(irc *ctx, irc_chan_iter *it);
+
+/** \brief Retrieve the next channel of an iteration
+ * \param it   An iterator set up by irc_chan_iter_init()
+ * \param dest   Pointer to a chanrep where we put the result
+ * \return `dest`, or NULL if there are no more channels
+ *
+ * *NOTE:* The information contained in the retrieved chanrep structure is
+ *         only valid until the next call to irc_read() */
+chanrep *irc_chan_iter_next(irc_chan_iter *it, chanrep *dest);
+
+/** \brief Start iterating over the users we're seeing
+ * \param it   The iterator to (re)initialize */
+void irc_user_iter_init(irc *ctx, irc_user_iter *it);
+
+/** \brief Retrieve the next user of an iteration
+ * \param it   An iterator set up by irc_user_iter_init()
+ * \param dest   Pointer to a userrep where we put the result
+ * \return `dest`, or NULL if there are no more users
+ *
+ * *NOTE:* The information contained in the retrieved userrep structure is
+ *         only valid until the next call to irc_read() */
+userrep *irc_user_iter_next(irc_user_iter *it, userrep *dest);
+
+/** \brief Start iterating over the members of a channel
+ * \param it   The iterator to (re)initialize
+ * \param chnam   Name of the channel
+ * \return False if we don't know channel `chnam`.  The iterator is still
+ *         usable then, it just yields nothing. */
+bool irc_memb_iter_init(irc *ctx, irc_memb_iter *it, const char *chnam);
+
+/** \brief Retrieve the next member of an iteration
+ * \param it   An iterator set up by irc_memb_iter_init()
+ * \param dest   Pointer to a userrep where we put the result (including
+ *               the `modepfx`)
+ * \return `dest`, or NULL if there are no more members
+ *
+ * *NOTE:* The information contained in the retrieved userrep structure is
+ *         only valid until the next call to irc_read() */
+userrep *irc_memb_iter_next(irc_memb_iter *it, userrep *dest);
+
+/** \brief Call a function for each channel we're in
+ *
+ * Nothing is copied out; `fn` gets a chanrep that is only valid during the
+ * call.  `fn` may use the other functions of this interface (including
+ * nested irc_foreach_*() calls), but must not call irc_read().
+ *
+ * \param fn   Called for every channel, returns false to stop early
+ * \param arg   Passed through to `fn`
+ * \return The number of times `fn` was called */
+size_t irc_foreach_chan(irc *ctx, irc_chan_visit_fn fn, void *arg);
+
+/** \brief Call a function for each user we're seeing
+ *
+ * Like irc_foreach_chan(), but for users.
+ *
+ * \param fn   Called for every user, returns false to stop early
+ * \param arg   Passed through to `fn`
+ * \return The number of times `fn` was called */
+size_t irc_foreach_user(irc *ctx, irc_user_visit_fn fn, void *arg);
+
+/** \brief Call a function for each member of a channel
+ *
+ * Like irc_foreach_chan(), but for the members of channel `chnam`.  The
+ * userrep passed to `fn` has its `modepfx` set.
+ *
+ * \param chnam   Name of the channel
+ * \param fn   Called for every member, returns false to stop early
+ * \param arg   Passed through to `fn`
+ * \return The number of times `fn` was called (0 if we don't know `chnam`) */
+size_t irc_foreach_member(irc *ctx, const char *chnam, irc_user_visit_fn fn,
+    void *arg);
+
+/** \brief Call a function for each member of a channel matching a mask
+ *
+ * Like irc_foreach_member(), but only for members whose nick!user\@host
+ * matches `mask`, a wildcard mask as used for bans (`*` matches any number
+ * of characters, `?` exactly one).  Case is ignored according to the
+ * server's CASEMAPPING.  Parts of an identity we don't know (e.g. the host
+ * of a user we only saw in a NAMES reply) count as empty.
+ *
+ * If the host index is enabled (see irc_set_track_hostidx()) and `mask`
+ * ends in a literal host suffix (as in `*!*\@*.example.com`), only users
+ * with such a host are looked at.
+ *
+ * \param chnam   Name of the channel
+ * \param mask   The mask to match against
+ * \param fn   Called for every matching member, returns false to stop early
+ * \param arg   Passed through to `fn`
+ * \return The number of times `fn` was called */
+size_t irc_match_members(irc *ctx, const char *chnam, const char *mask,
+    irc_user_visit_fn fn, void *arg);
+
+/** \brief Call a function for each user we're seeing matching a mask
+ *
+ * Like irc_match_members(), but for all users.  The `modepfx` of the
+ * userreps passed to `fn` is empty.
+ *
+ * \param mask   The mask to match against
+ * \param fn   Called for every matching user, returns false to stop early
+ * \param arg   Passed through to `fn`
+ * \return The number of times `fn` was called */
+size_t irc_match_users(irc *ctx, const char *mask, irc_user_visit_fn fn,
+    void *arg);
+
+
+/** \brief Callbacks for changes to the tracked state
+ *
+ * Instead of comparing snapshots (e.g. of irc_all_members()) after every
+ * irc_read(), applications can have the tracker tell them what changed, and
+ * update whatever they derive from it incrementally.  All members are
+ * optional; those left NULL are simply not called.  See irc_regcb_track().
+ *
+ * The reps handed to the callbacks are only valid during the call.  Callbacks
+ * may query the tracking interface, but must not call irc_read().
+ *
+ * Only changes are reported, not the state learned while joining a channel
+ * (NAMES, the mode and list numerics) or while resyncing after a reconnect;
+ * use the iterators or visitors for that once it's complete. */
+struct irc_trkcb {
+	/** \brief `memb` joined `chan` (this includes us) */
+	void (*join)(irc *ctx, const chanrep *chan, const userrep *memb,
+	    void *tag);
+
+	/** \brief `memb` left `chan` by PART, or was KICKed by `kicker`
+	 * (NULL for a PART).  `reason` may be NULL.  If `memb` is us, the
+	 * channel and all of its memberships are gone after this; there
+	 * are no separate events for the other members then. */
+	void (*part)(irc *ctx, const chanrep *chan, const userrep *memb,
+	    const char *kicker, const char *reason, void *tag);
+
+	/** \brief `user` QUIT; all their memberships are gone after this.
+	 * `reason` may be NULL */
+	void (*quit)(irc *ctx, const userrep *user, const char *reason,
+	    void *tag);
+
+	/** \brief `user` (under their new nick) was formerly known as
+	 * `oldnick` */
+	void (*nick)(irc *ctx, const userrep *user, const char *oldnick,
+	    void *tag);
+
+	/** \brief The mode prefix of `memb` in `chan` changed from
+	 * `oldpfx` to memb->modepfx */
+	void (*prefix)(irc *ctx, const chanrep *chan, const userrep *memb,
+	    const char *oldpfx, void *tag);
+
+	/** \brief Channel mode `mode` was set (`set`) or unset on `chan`.
+	 * `arg` is the mode's argument (e.g. the ban mask), or NULL.
+	 * Prefix modes are reported through `prefix` instead */
+	void (*mode)(irc *ctx, const chanrep *chan, char mode, bool set,
+	    const char *arg, void *tag);
+
+	/** \brief Someone changed the topic of `chan` from `oldtopic`
+	 * (NULL if there was none or we didn't know it) to chan->topic.
+	 * The topic we're told about when joining doesn't count */
+	void (*topic)(irc *ctx, const chanrep *chan, const char *oldtopic,
+	    void *tag);
+
+	/** \brief An IRCv3 "netsplit" (`split`) or "netjoin" batch ended;
+	 * `users` (`nusers` of them) are those who QUIT in it (and are about
+	 * to be gone), or JOINed some channel in it.  While this is set,
+	 * those QUITs and JOINs are not reported through `quit` and `join`
+	 * one by one.  With a shared store (see irc_set_track_share()),
+	 * netsplits are applied line by line, though, and reported through
+	 * `quit` as usual */
+	void (*batch)(irc *ctx, bool split, const userrep *users,
+	    size_t nusers, void *tag);
+};
+
+/** \brief Register callbacks for changes to the tracked state
+ *
+ * \param cbs   The callbacks (copied), or NULL to stop calling any
+ * \param tag   Userdata handed back to every callback
+ *
+ * \sa struct irc_trkcb */
+void irc_regcb_track(irc *ctx, const struct irc_trkcb *cbs, void *tag);
+
+
+/** \brief Immutable snapshot of the tracking state, see irc_snap_publish()
+ *
+ * The tracking state is changed by irc_read() and can't be looked at from
+ * other threads meanwhile.  Snapshots can: the thread calling irc_read()
+ * (the "I/O thread") publishes them, and any thread may acquire the current
+ * one, query it for as long as it likes, and release it.  Neither side takes
+ * a lock or ever waits for the other.
+ *
+ * A snapshot covers the channels we're in, their topics and non-list modes,
+ * and their members (with mode prefixes).  Tags are not included (the `tag`
+ * members of the reps are NULL), nor is the `nchans` of users (0). */
+typedef struct irc_snap irc_snap;
+
+/** \brief Publish a snapshot of the current tracking state
+ *
+ * Must be called by the I/O thread, e.g. after every irc_read() (or every
+ * few).  Only channels that changed since the previous snapshot are copied;
+ * if nothing changed, this is cheap.  Snapshots replaced earlier and no
+ * longer held by anyone are freed here, too.
+ *
+ * \return False if we ran out of memory (the previous snapshot stays
+ *         current then) */
+bool irc_snap_publish(irc *ctx);
+
+/** \brief Acquire the most recently published snapshot (from any thread)
+ * \return The snapshot, or NULL if none was published yet.  Must be handed
+ *         back using irc_snap_release() eventually, and in any case before
+ *         irc_dispose() */
+irc_snap *irc_snap_acquire(irc *ctx);
+
+/** \brief Release a snapshot acquired by irc_snap_acquire()
+ *
+ * Everything retrieved from the snapshot becomes invalid. */
+void irc_snap_release(irc_snap *snap);
+
+/** \brief Count the channels in a snapshot */
+size_t irc_snap_num_chans(const irc_snap *snap);
+
+/** \brief Retrieve the `i`th channel of a snapshot
+ * \return `dest`, or NULL if `i` is out of range */
+chanrep *irc_snap_chan_at(const irc_snap *snap, chanrep *dest, size_t i);
+
+/** \brief Retrieve a channel of a snapshot by name
+ * \return `dest`, or NULL if the channel is not in the snapshot */
+chanrep *irc_snap_chan(const irc_snap *snap, chanrep *dest, const char *chnam);
+
+/** \brief Like irc_chanmode(), on a snapshot (list modes not included) */
+bool irc_snap_chanmode(const irc_snap *snap, const char *chnam, char mode,
+    const char **arg);
+
+/** \brief Count the members of a channel in a snapshot */
+size_t irc_snap_num_members(const irc_snap *snap, const char *chnam);
+
+/** \brief Retrieve the `i`th member of a channel in a snapshot
+ * \return `dest`, or NULL if `i` is out of range or there is no such
+ *         channel */
+userrep *irc_snap_member_at(const irc_snap *snap, userrep *dest,
+    const char *chnam, size_t i);
+
+/** \brief Retrieve a member of a channel in a snapshot by nickname
+ * \param ident   A nickname, or a nick!user\@host-style identity
+ * \return `dest`, or NULL if there is no such channel or member */
+userrep *irc_snap_member(const irc_snap *snap, userrep *dest,
+    const char *chnam, const char *ident);
+
+/** \brief Only track channels matching `pat`
+ *
+ * By default, every channel we're in is tracked.  Once a pattern is added
+ * using this function, only channels matching any of the patterns added so
+ * far are; for the rest, we remember no more than that we're in them.  In
+ * particular, users we only share untracked channels with are not tracked.
+ *
+ * A pattern is a channel name, optionally containing the wildcards '*' and
+ * '?' (e.g. "#foo" or "#proj-*").  Case is ignored according to the
+ * server's CASEMAPPING.
+ *
+ * This may be used at any time.  Channels we're in that start matching are
+ * resynchronized right away (we send NAMES, MODE and TOPIC for them), those
+ * that stop matching (see irc_track_filter_del()) are forgotten.
+ *
+ * \param pat   Channel name or pattern to track
+ * \return False if we ran out of memory or failed to send the queries
+ * \sa irc_track_filter_del(), irc_track_filter_clear() */
+bool irc_track_filter_add(irc *ctx, const char *pat);
+
+/** \brief Remove a pattern added by irc_track_filter_add()
+ *
+ * Channels that no longer match any pattern are forgotten.  Removing the
+ * last pattern leaves us tracking no channel at all; use
+ * irc_track_filter_clear() to go back to tracking all of them.
+ *
+ * \param pat   The pattern, as given to irc_track_filter_add()
+ * \return False if there is no such pattern, or if we ran out of memory */
+bool irc_track_filter_del(irc *ctx, const char *pat);
+
+/** \brief Remove all patterns and go back to tracking every channel
+ *
+ * \return False if we ran out of memory or failed to send the queries
+ *         for the channels we now start tracking */
+bool irc_track_filter_clear(irc *ctx);
+
+/** \brief User store shared by several contexts, see irc_set_track_share()
+ *
+ * Contexts connected to the same network tend to see many of the same users.
+ * Attached to the same store, they keep one record per user between them,
+ * rather than one each.  Every context still has its own channels (and
+ * member lists), i.e. its own view of which channels it is in.
+ *
+ * Users are dropped along with their last channel membership, in whichever
+ * context that was.  Consequently, the user-related functions of the
+ * tracking interface (irc_num_users(), irc_all_users(), irc_user(),
+ * irc_match_users(), ...) see the users of all attached contexts, and the
+ * `nchans` of a userrep counts memberships across all of them.
+ *
+ * Contexts sharing a store must not be used concurrently, i.e. they need to
+ * be driven from the same thread (or the caller has to serialize them). */
+typedef struct irc_trkshare irc_trkshare;
+
+/** \brief Create a store for sharing users between contexts
+ * \return The store, or NULL if we ran out of memory
+ * \sa irc_set_track_share(), irc_trkshare_dispose() */
+irc_trkshare *irc_trkshare_init(void);
+
+/** \brief Let go of a store created by irc_trkshare_init()
+ *
+ * The store is freed once the last context using it is disposed of (or set
+ * to use another one), so this may be called right after attaching the
+ * contexts. */
+void irc_trkshare_dispose(irc_trkshare *sh);
+
+/** \brief Keep the users tracked by `ctx` in the shared store `sh`
+ *
+ * Must not be called while connected.  Any tracking state `ctx` has is
+ * dropped.  The store is used once tracking becomes active, i.e. once we
+ * learn the server's casemapping, which has to match that of the other
+ * contexts using the store at that time (if it doesn't, `ctx` tracks its
+ * users on its own).
+ *
+ * Saving and loading the tracking state (irc_track_save(),
+ * irc_track_load()) is not available with a shared store.
+ *
+ * \param sh   The store, or NULL to go back to tracking users on our own
+ * \return False if we're connected
+ * \sa irc_trkshare */
+bool irc_set_track_share(irc *ctx, irc_trkshare *sh);
+
+/** \brief Save the tracking state to a file
+ *
+ * Writes the channels we know about, their topics, modes (including list
+ * modes) and members, and the users we know about, to `path`.  The file is
+ * replaced atomically.  Tags are not saved.
+ *
+ * This is meant to be used together with irc_track_load() to get going
+ * quickly after restarting a process that is in many channels.
+ *
+ * \return False if tracking is not active, or on I/O or memory errors
+ * \sa irc_track_load() */
+bool irc_track_save(irc *ctx, const char *path);
+
+/** \brief Load tracking state saved by irc_track_save()
+ *
+ * Replaces whatever tracking state we have with the contents of `path`.
+ * Tracking must be enabled (see irc_set_track()), and we must not be
+ * connected.
+ *
+ * The loaded state can be queried right away, but it may be outdated.  It is
+ * treated like state kept across a reconnect (see irc_set_track()): once
+ * connected, each channel is reconciled with the server as soon as we JOIN it
+ * again, and channels not JOINed in time are dropped (see
+ * irc_set_track_grace()).  All of it is dropped if the server's casemapping
+ * differs from the one the file was saved with.
+ *
+ * \return False if the file can't be read, is corrupt, was written by a
+ *         machine of different byte order, or if we ran out of memory.
+ *         The tracking state is left empty in the latter case */
+bool irc_track_load(irc *ctx, const char *path);
+
+/** \brief Memory used by the tracking state, see irc_track_memstats()
+ *
+ * All figures are in bytes, and count what was requested from malloc();
+ * the allocator's own overhead is not included.  Neither are tags, the host
+ * index (see irc_set_track_hostidx()) and snapshots (see irc_snap_publish()).
+ */
+struct irc_trkmem {
+	size_t users;   /**< \brief Users, with nick, uname, host and fname */
+	size_t chans;   /**< \brief Channels, without what's listed below */
+	size_t members; /**< \brief Channel memberships */
+	size_t modes;   /**< \brief Channel modes, including list modes */
+	size_t topics;  /**< \brief Channel topics, and who set them */
+	size_t maps;    /**< \brief Hash maps holding all of the above */
+	size_t total;   /**< \brief The sum of the above */
+};
+
+/** \brief Tell how much memory the tracking state takes up
+ *
+ * This walks the entire tracking state, so it takes time proportional to
+ * the amount of channels, users and memberships.  With a shared store (see
+ * irc_set_track_share()), `users` includes the users of all contexts.
+ *
+ * \param dest   Where to put the figures
+ * \return False if tracking is not active
+ * \sa irc_set_track_memcap() */
+bool irc_track_memstats(irc *ctx, struct irc_trkmem *dest);
+
+/** \brief Limit the memory taken up by the tracking state
+ *
+ * Once the tracking state (as told by irc_track_memstats()) exceeds `bytes`,
+ * data we can ask the server for again is dropped: first the username and
+ * full name of the users that have been quiet for the longest, then the
+ * topics of the channels that were looked at least recently.  Who is in
+ * which channel, hosts and channel modes are always kept, so this is a
+ * limit on the optional part only, not a hard one.
+ *
+ * The cap is checked when it is set, and then at most once a second, at the
+ * end of a NAMES reply and on PING.  It may thus be exceeded for a while.
+ *
+ * Looking up a user with irc_user() or irc_member() (a channel with
+ * irc_chan()) whose data was dropped asks the server for it again (using
+ * WHO and TOPIC, respectively).  The request is sent by the next irc_read(),
+ * and only one is out at a time (along with those of
+ * irc_set_track_whosync()), so looking at many of them at once won't get us
+ * disconnected for flooding; the data shows up once the reply arrives.  Note
+ * that until then, masks with a username part (see irc_match_users()) don't
+ * match such a user.
+ *
+ * \param bytes   The cap, or 0 for none (the default)
+ * \sa irc_track_memstats() */
+void irc_set_track_memcap(irc *ctx, size_t bytes);
+
 /* for debugging */
 
 /** \brief Dump tracking state for debugging purposes
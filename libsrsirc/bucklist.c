@@ -25,10 +25,14 @@
 #include "common.h"
 
 
+/* `fkey` is `key` as folded by the cmap, so that comparing keys is a
+ * memcmp() rather than two table lookups per char */
 struct pl_node {
 	char *key;
 	void *val;
 	struct pl_node *next;
+	size_t flen;
+	uint8_t fkey[];
 };
 
 struct bucklist {
@@ -38,7 +42,8 @@ struct bucklist {
 	const uint8_t *cmap;
 };
 
-static bool pfxeq(const char *n1, const char *n2, const uint8_t *cmap);
+static bool fkeyeq(const struct pl_node *n, const uint8_t *fkey, size_t flen);
+static void link_node(bucklist *l, size_t i, struct pl_node *newnode);
 
 bucklist *
 lsi_bucklist_init(const uint8_t *cmap)
@@ -76,6 +81,23 @@ lsi_bucklist_count(bucklist *l)
 	return c;
 }
 
+/* bytes taken by the list, its nodes and their keys (not the values) */
+size_t
+lsi_bucklist_memsize(bucklist *l)
+{
+	if (!l)
+		return 0;
+
+	size_t sz = sizeof *l;
+	for (struct pl_node *n = l->head; n; n = n->next) {
+		size_t klen = strlen(n->key);
+		/* the node has room for a folded key as long as the key */
+		sz += sizeof *n + klen + klen + 1;
+	}
+
+	return sz;
+}
+
 bool
 lsi_bucklist_isempty(bucklist *l)
 {
@@ -102,68 +124,96 @@ lsi_bucklist_clear(bucklist *l)
 bool
 lsi_bucklist_insert(bucklist *l, size_t i, char *key, void *val)
 {
-	struct pl_node *n = l->head;
-	struct pl_node *prev = NULL;
-
-	struct pl_node *newnode = MALLOC(sizeof *newnode);
+	/* the folded key is never longer than the key itself */
+	size_t klen = strlen(key);
+	struct pl_node *newnode = MALLOC(sizeof *newnode + klen);
 	if (!newnode)
 		return false;
 
+	newnode->flen = lsi_cmap_fold(newnode->fkey, key, klen, l->cmap);
 	newnode->key = key;
 	newnode->val = val;
+	link_node(l, i, newnode);
+	return true;
+}
 
-	if (!n) { //special case: list is empty
-		newnode->next = NULL;
-		l->head = newnode;
-		return true;
-	}
-
-	while (n->next && i) {
-		i--;
-		prev = n;
-		n = n->next;
-	}
-
-	if (i) {
-		n->next = newnode;
-		newnode->next = NULL;
-	} else {
-		newnode->next = n;
-		if (prev)
-			prev->next = newnode;
-		else
-			l->head = newnode;
-	}
+/* like the above, with `key` already folded into `fkey` by the list's cmap */
+bool
+lsi_bucklist_insert_f(bucklist *l, size_t i, char *key, const uint8_t *fkey,
+    size_t flen, void *val)
+{
+	/* same size as lsi_bucklist_insert()'s, see lsi_bucklist_memsize() */
+	struct pl_node *newnode = MALLOC(sizeof *newnode + strlen(key));
+	if (!newnode)
+		return false;
 
+	memcpy(newnode->fkey, fkey, flen);
+	newnode->flen = flen;
+	newnode->key = key;
+	newnode->val = val;
+	link_node(l, i, newnode);
 	return true;
 }
 
 /* key or val == NULL means don't touch */
 bool
 lsi_bucklist_replace(bucklist *l, const char *key, void *val)
+{
+	uint8_t buf[CMAP_FOLDBUF];
+	size_t flen;
+	uint8_t *fk = lsi_cmap_foldkey(buf, sizeof buf, key, SIZE_MAX, l->cmap,
+	    &flen);
+	if (!fk)
+		return false;
+
+	bool r = lsi_bucklist_replace_f(l, fk, flen, val);
+	if (fk != buf)
+		free(fk);
+	return r;
+}
+
+/* the _f versions take a key that was lsi_cmap_fold()ed by the caller, with
+ * the same cmap the list uses */
+bool
+lsi_bucklist_replace_f(bucklist *l, const uint8_t *fkey, size_t flen,
+    void *val)
 {
 	if (!val)
 		return false;
 
-	struct pl_node *n = l->head;
-	while (n) {
-		if (pfxeq(n->key, key, l->cmap)) {
+	for (struct pl_node *n = l->head; n; n = n->next)
+		if (fkeyeq(n, fkey, flen)) {
 			n->val = val;
 			return true;
 		}
-		n = n->next;
-	}
 
 	return false;
 }
 
 void *
 lsi_bucklist_remove(bucklist *l, const char *key, char **origkey)
+{
+	uint8_t buf[CMAP_FOLDBUF];
+	size_t flen;
+	uint8_t *fk = lsi_cmap_foldkey(buf, sizeof buf, key, SIZE_MAX, l->cmap,
+	    &flen);
+	if (!fk)
+		return NULL;
+
+	void *r = lsi_bucklist_remove_f(l, fk, flen, origkey);
+	if (fk != buf)
+		free(fk);
+	return r;
+}
+
+void *
+lsi_bucklist_remove_f(bucklist *l, const uint8_t *fkey, size_t flen,
+    char **origkey)
 {
 	struct pl_node *n = l->head;
 	struct pl_node *prev = NULL;
 	while (n) {
-		if (pfxeq(n->key, key, l->cmap)) {
+		if (fkeyeq(n, fkey, flen)) {
 			if (origkey)
 				*origkey = n->key;
 			void *val = n->val;
@@ -208,15 +258,37 @@ lsi_bucklist_get(bucklist *l, size_t i, char **key, void **val)
 void *
 lsi_bucklist_find(bucklist *l, const char *key, char **origkey)
 {
-	struct pl_node *n = l->head;
-	while (n) {
-		if (pfxeq(n->key, key, l->cmap)) {
+	return lsi_bucklist_find_n(l, key, SIZE_MAX, origkey);
+}
+
+/* like the above, but `key` is only the first `len` chars of what it points
+ * to (e.g. the nick in a nick!uname@host) */
+void *
+lsi_bucklist_find_n(bucklist *l, const char *key, size_t len, char **origkey)
+{
+	uint8_t buf[CMAP_FOLDBUF];
+	size_t flen;
+	uint8_t *fk = lsi_cmap_foldkey(buf, sizeof buf, key, len, l->cmap,
+	    &flen);
+	if (!fk)
+		return NULL;
+
+	void *r = lsi_bucklist_find_f(l, fk, flen, origkey);
+	if (fk != buf)
+		free(fk);
+	return r;
+}
+
+void *
+lsi_bucklist_find_f(bucklist *l, const uint8_t *fkey, size_t flen,
+    char **origkey)
+{
+	for (struct pl_node *n = l->head; n; n = n->next)
+		if (fkeyeq(n, fkey, flen)) {
 			if (origkey)
 				*origkey = n->key;
 			return n->val;
 		}
-		n = n->next;
-	}
 
 	return NULL;
 }
@@ -251,6 +323,20 @@ lsi_bucklist_next(bucklist *l, char **key, void **val)
 	return true;
 }
 
+bool
+lsi_bucklist_iter(bucklist *l, void **pos, char **key, void **val)
+{
+	struct pl_node *n = *pos ? ((struct pl_node *)*pos)->next : l->head;
+	if (!n)
+		return false;
+
+	*pos = n;
+	if (key) *key = n->key;
+	if (val) *val = n->val;
+
+	return true;
+}
+
 void
 lsi_bucklist_del_iter(bucklist *l)
 {
@@ -288,17 +374,41 @@ lsi_bucklist_dump(bucklist *l, bucklist_op_fn op)
 }
 
 
-static bool
-pfxeq(const char *n1, const char *n2, const uint8_t *cmap)
+/* put `newnode` at index `i` (or at the end, if there aren't that many) */
+static void
+link_node(bucklist *l, size_t i, struct pl_node *newnode)
 {
-	unsigned char c1, c2;
-	while ((c1 = cmap[(unsigned char)*n1]) & /* avoid short circuit */
-	    (c2 = cmap[(unsigned char)*n2])) {
-		if (c1 != c2)
-			return false;
+	struct pl_node *n = l->head;
+	struct pl_node *prev = NULL;
+
+	if (!n) { //special case: list is empty
+		newnode->next = NULL;
+		l->head = newnode;
+		return;
+	}
 
-		n1++; n2++;
+	while (n->next && i) {
+		i--;
+		prev = n;
+		n = n->next;
 	}
 
-	return c1 == c2;
+	if (i) {
+		n->next = newnode;
+		newnode->next = NULL;
+	} else {
+		newnode->next = n;
+		if (prev)
+			prev->next = newnode;
+		else
+			l->head = newnode;
+	}
+
+	return;
+}
+
+static bool
+fkeyeq(const struct pl_node *n, const uint8_t *fkey, size_t flen)
+{
+	return n->flen == flen && memcmp(n->fkey, fkey, flen) == 0;
 }
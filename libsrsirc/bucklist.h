@@ -21,6 +21,7 @@ typedef bool (*bucklist_eq_fn)(const void *e1, const void *e2);
 bucklist *lsi_bucklist_init(const uint8_t *cmap);
 void lsi_bucklist_dispose(bucklist *l);
 size_t lsi_bucklist_count(bucklist *l);
+size_t lsi_bucklist_memsize(bucklist *l);
 bool lsi_bucklist_isempty(bucklist *l);
 void lsi_bucklist_clear(bucklist *l);
 
@@ -30,14 +31,30 @@ bool lsi_bucklist_get(bucklist *l, size_t i, char **key, void **val);
 
 /* linear search */
 void *lsi_bucklist_find(bucklist *l, const char *key, char **origkey);
+void *lsi_bucklist_find_n(bucklist *l, const char *key, size_t len,
+    char **origkey);
 void *lsi_bucklist_remove(bucklist *l, const char *key, char **origkey);
 bool lsi_bucklist_replace(bucklist *l, const char *key, void *val);
 
+/* same, with the key already folded by the list's cmap (see cmap.h) */
+void *lsi_bucklist_find_f(bucklist *l, const uint8_t *fkey, size_t flen,
+    char **origkey);
+void *lsi_bucklist_remove_f(bucklist *l, const uint8_t *fkey, size_t flen,
+    char **origkey);
+bool lsi_bucklist_replace_f(bucklist *l, const uint8_t *fkey, size_t flen,
+    void *val);
+bool lsi_bucklist_insert_f(bucklist *l, size_t i, char *key,
+    const uint8_t *fkey, size_t flen, void *val);
+
 /* iteration */
 bool lsi_bucklist_first(bucklist *l, char **key, void **val);
 bool lsi_bucklist_next(bucklist *l, char **key, void **val);
 void lsi_bucklist_del_iter(bucklist *l);
 
+/* iteration without touching the list's own iteration state.  `pos` is kept
+ * by the caller, NULL to start; any number of these may run at once */
+bool lsi_bucklist_iter(bucklist *l, void **pos, char **key, void **val);
+
 /* debug */
 void lsi_bucklist_dump(bucklist *l, bucklist_op_fn op);
 
@@ -6,7 +6,12 @@
 # include <config.h>
 #endif
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
+#include <string.h>
+
+#include <platform/base_misc.h>
 
 #include "cmap.h"
 
@@ -118,5 +123,213 @@ static const uint8_t s_lower_strict_rfc1459[256] = {
 	0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
 };
 
-const uint8_t *g_cmap[3] =
-    { s_lower_rfc1459, s_lower_strict_rfc1459, s_lower_ascii };
+/* same as the above, except that '!' and '@' are ordinary characters.  used
+ * for keys that aren't nicknames or identities, such as ban masks */
+
+static const uint8_t s_whole_ascii[256] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+	0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+	0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+	0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+	0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
+	0x40,  'A',  'B',  'C',  'D',  'E',  'F',  'G',
+	 'H',  'I',  'J',  'K',  'L',  'M',  'N',  'O',
+	 'P',  'Q',  'R',  'S',  'T',  'U',  'V',  'W',
+	 'X',  'Y',  'Z', 0x5b, 0x5c, 0x5d, 0x5e, 0x5f,
+	0x60,  'A',  'B',  'C',  'D',  'E',  'F',  'G',
+	 'H',  'I',  'J',  'K',  'L',  'M',  'N',  'O',
+	 'P',  'Q',  'R',  'S',  'T',  'U',  'V',  'W',
+	 'X',  'Y',  'Z', 0x7b, 0x7c, 0x7d, 0x7e, 0x7f,
+	0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+	0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
+	0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
+	0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+	0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf,
+	0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7,
+	0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf,
+	0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+	0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+	0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7,
+	0xd8, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf,
+	0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7,
+	0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef,
+	0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+	0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+};
+
+static const uint8_t s_whole_rfc1459[256] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+	0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+	0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+	0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+	0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
+	0x40,  'A',  'B',  'C',  'D',  'E',  'F',  'G',
+	 'H',  'I',  'J',  'K',  'L',  'M',  'N',  'O',
+	 'P',  'Q',  'R',  'S',  'T',  'U',  'V',  'W',
+	 'X',  'Y',  'Z',  '[', '\\',  ']', 0x5e, 0x5f,
+	0x60,  'A',  'B',  'C',  'D',  'E',  'F',  'G',
+	 'H',  'I',  'J',  'K',  'L',  'M',  'N',  'O',
+	 'P',  'Q',  'R',  'S',  'T',  'U',  'V',  'W',
+	 'X',  'Y',  'Z',  '[', '\\',  ']', 0x7e, 0x7f,
+	0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+	0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
+	0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
+	0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+	0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf,
+	0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7,
+	0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf,
+	0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+	0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+	0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7,
+	0xd8, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf,
+	0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7,
+	0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef,
+	0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+	0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+};
+
+static const uint8_t s_whole_strict_rfc1459[256] = {
+	0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+	0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+	0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+	0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f,
+	0x20, 0x21, 0x22, 0x23, 0x24, 0x25, 0x26, 0x27,
+	0x28, 0x29, 0x2a, 0x2b, 0x2c, 0x2d, 0x2e, 0x2f,
+	0x30, 0x31, 0x32, 0x33, 0x34, 0x35, 0x36, 0x37,
+	0x38, 0x39, 0x3a, 0x3b, 0x3c, 0x3d, 0x3e, 0x3f,
+	0x40,  'A',  'B',  'C',  'D',  'E',  'F',  'G',
+	 'H',  'I',  'J',  'K',  'L',  'M',  'N',  'O',
+	 'P',  'Q',  'R',  'S',  'T',  'U',  'V',  'W',
+	 'X',  'Y',  'Z',  '[', '\\',  ']',  '^', 0x5f,
+	0x60,  'A',  'B',  'C',  'D',  'E',  'F',  'G',
+	 'H',  'I',  'J',  'K',  'L',  'M',  'N',  'O',
+	 'P',  'Q',  'R',  'S',  'T',  'U',  'V',  'W',
+	 'X',  'Y',  'Z',  '[', '\\',  ']',  '^', 0x7f,
+	0x80, 0x81, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	0x88, 0x89, 0x8a, 0x8b, 0x8c, 0x8d, 0x8e, 0x8f,
+	0x90, 0x91, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97,
+	0x98, 0x99, 0x9a, 0x9b, 0x9c, 0x9d, 0x9e, 0x9f,
+	0xa0, 0xa1, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+	0xa8, 0xa9, 0xaa, 0xab, 0xac, 0xad, 0xae, 0xaf,
+	0xb0, 0xb1, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7,
+	0xb8, 0xb9, 0xba, 0xbb, 0xbc, 0xbd, 0xbe, 0xbf,
+	0xc0, 0xc1, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7,
+	0xc8, 0xc9, 0xca, 0xcb, 0xcc, 0xcd, 0xce, 0xcf,
+	0xd0, 0xd1, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7,
+	0xd8, 0xd9, 0xda, 0xdb, 0xdc, 0xdd, 0xde, 0xdf,
+	0xe0, 0xe1, 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7,
+	0xe8, 0xe9, 0xea, 0xeb, 0xec, 0xed, 0xee, 0xef,
+	0xf0, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7,
+	0xf8, 0xf9, 0xfa, 0xfb, 0xfc, 0xfd, 0xfe, 0xff
+};
+
+const uint8_t *g_cmap[6] =
+    { s_lower_rfc1459, s_lower_strict_rfc1459, s_lower_ascii,
+      s_whole_rfc1459, s_whole_strict_rfc1459, s_whole_ascii };
+
+
+/* All the tables above leave everything alone except for 'a'..hi, which
+ * they fold to upper case, with hi being 'z', '}' or '~' (ascii, rfc1459,
+ * strict-rfc1459), and, for the nick variants, '!' and '@', which they map to
+ * '\0'.  That lets us fold 16 chars at a time rather than looking up every
+ * single one of them.  Whoever adds a table that doesn't fit this pattern
+ * gets to teach lsi_cmap_fold() about it.
+ *
+ * The 16 byte loads may read past the end of the string (though never into
+ * another page), which ASan rightfully complains about; with it, we stick to
+ * the plain loop. */
+
+#if defined(__SSE2__) && defined(__GNUC__) && !defined(__SANITIZE_ADDRESS__)
+# if defined(__has_feature)
+#  if !__has_feature(address_sanitizer)
+#   define FOLD_SSE2 1
+#  endif
+# else
+#  define FOLD_SSE2 1
+# endif
+#endif
+
+#if FOLD_SSE2
+# include <emmintrin.h>
+
+/* whether a 16 byte load at `p` could fault even though the string at `p`
+ * ends before; that's only if it spans two pages */
+# define PAGECROSS(P) (((uintptr_t)(P) & 4095) > 4096 - 16)
+#endif
+
+size_t
+lsi_cmap_fold(uint8_t *dst, const char *s, size_t n, const uint8_t *cmap)
+{
+	size_t len = 0;
+#if FOLD_SSE2
+	uint8_t hi = cmap['~'] != '~' ? '~' : cmap['}'] != '}' ? '}' : 'z';
+	bool nick = !cmap['!'];
+
+	const __m128i lo1 = _mm_set1_epi8('a' - 1);
+	const __m128i hi1 = _mm_set1_epi8((char)(hi + 1));
+	const __m128i d = _mm_set1_epi8('a' - 'A');
+	const __m128i z = _mm_setzero_si128();
+	const __m128i ex = _mm_set1_epi8(nick ? '!' : '\0');
+	const __m128i at = _mm_set1_epi8(nick ? '@' : '\0');
+
+	while (n - len >= 16) {
+		uint8_t c;
+		if (PAGECROSS(s + len)) {
+			if (!(c = cmap[(uint8_t)s[len]]))
+				return len;
+			dst[len++] = c;
+			continue;
+		}
+
+		__m128i v = _mm_loadu_si128((const void *)(s + len));
+		/* chars >= 0x80 are negative here and thus never in range */
+		__m128i in = _mm_and_si128(_mm_cmpgt_epi8(v, lo1),
+		    _mm_cmplt_epi8(v, hi1));
+		_mm_storeu_si128((void *)(dst + len),
+		    _mm_sub_epi8(v, _mm_and_si128(in, d)));
+
+		__m128i t = _mm_or_si128(_mm_cmpeq_epi8(v, z),
+		    _mm_or_si128(_mm_cmpeq_epi8(v, ex), _mm_cmpeq_epi8(v, at)));
+		unsigned m = (unsigned)_mm_movemask_epi8(t);
+		if (m)
+			return len + (size_t)__builtin_ctz(m);
+
+		len += 16;
+	}
+#endif
+	uint8_t c;
+	while (len < n && (c = cmap[(uint8_t)s[len]]))
+		dst[len++] = c;
+
+	return len;
+}
+
+/* fold all of `s` into `buf`, or into a heap buffer if it doesn't fit, in
+ * which case that's what is returned (to be free()d); NULL if that failed */
+uint8_t *
+lsi_cmap_foldkey(uint8_t *buf, size_t bufsz, const char *s, size_t n,
+    const uint8_t *cmap, size_t *flen)
+{
+	*flen = lsi_cmap_fold(buf, s, n < bufsz ? n : bufsz, cmap);
+	if (*flen < bufsz || *flen == n)
+		return buf;
+
+	/* rare enough not to care about folding the first bufsz chars twice */
+	size_t len = strlen(s);
+	if (len > n)
+		len = n;
+
+	uint8_t *hb = MALLOC(len);
+	if (hb)
+		*flen = lsi_cmap_fold(hb, s, len, cmap);
+
+	return hb;
+}
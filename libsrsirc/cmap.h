@@ -6,7 +6,30 @@
 #define LIBSRSIRC_CMAP_H 1
 
 
+#include <stddef.h>
+#include <stdint.h>
+
+/* turns a CMAP_* constant into the index of its variant that does not
+ * stop comparing at '!' or '@' (for masks rather than nicknames) */
+#define CMAP_WHOLE(CM) ((CM) + 3)
+
 extern const uint8_t *g_cmap[];
 
+/* write what `cmap` makes of `s` to `dst`, up to where it yields '\0' but no
+ * more than `n` chars.  returns the number of chars written; if that's `n`,
+ * `s` may go on.  `dst` isn't terminated, and anything in it past the
+ * returned length (but within `n`) may have been scribbled on */
+size_t lsi_cmap_fold(uint8_t *dst, const char *s, size_t n,
+    const uint8_t *cmap);
+
+/* lsi_cmap_fold() all of `s` (or its first `n` chars), into `buf` if it fits,
+ * otherwise into a heap buffer, which is returned then (NULL if we ran out
+ * of memory).  `*flen` is set to the folded length */
+uint8_t *lsi_cmap_foldkey(uint8_t *buf, size_t bufsz, const char *s, size_t n,
+    const uint8_t *cmap, size_t *flen);
+
+/* stack buffer size for folded keys; anything longer goes to the heap */
+#define CMAP_FOLDBUF 128
+
 
 #endif /* LIBSRSIRC_CMAP_H */
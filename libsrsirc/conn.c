@@ -29,6 +29,7 @@
 
 #include "common.h"
 #include "io.h"
+#include "probes.h"
 #include "px.h"
 
 #include <libsrsirc/util.h>
@@ -68,6 +69,7 @@ lsi_conn_init(void)
 	r->sh.shnd = NULL;
 	r->sh.sck = -1;
 	r->sctx = NULL;
+	memset(&r->st, 0, sizeof r->st);
 
 	D("Connection context initialized (%p)", (void *)r);
 
@@ -150,6 +152,8 @@ lsi_conn_connect(iconn *ctx, uint64_t softto_us, uint64_t hardto_us)
 		    ctx->host, realport, ps, softto_us, hardto_us);
 	}
 
+	PROBE3(conn_start, host, port, ctx->ptype);
+
 	char peerhost[256];
 	uint16_t peerport;
 
@@ -160,10 +164,12 @@ lsi_conn_connect(iconn *ctx, uint64_t softto_us, uint64_t hardto_us)
 
 	if (sh.sck < 0) {
 		W("lsi_com_consocket failed for %s:%"PRIu16"", host, port);
+		PROBE1(conn_fail, "tcp");
 		return false;
 	}
 
 	D("connected socket %d for %s:%"PRIu16"", sh.sck, host, port);
+	PROBE1(conn_tcp, sh.sck);
 
 	ctx->sh = sh; //must be set here for px_logon
 
@@ -197,11 +203,13 @@ lsi_conn_connect(iconn *ctx, uint64_t softto_us, uint64_t hardto_us)
 
 		if (!ok) {
 			W("proxy logon failed");
+			PROBE1(conn_fail, "proxy");
 			lsi_b_close(sh.sck);
 			ctx->sh.sck = -1;
 			return false;
 		}
 		D("sent proxy logon sequence");
+		PROBE1(conn_proxy, sh.sck);
 
 	}
 
@@ -215,13 +223,17 @@ lsi_conn_connect(iconn *ctx, uint64_t softto_us, uint64_t hardto_us)
 			return false;
 		}
 
+		uint64_t tls0 = lsi_b_tstamp_us();
 		if (!(ctx->sh.shnd = lsi_b_sslize(sh.sck, ctx->sctx))) {
 			lsi_b_close(sh.sck);
 			ctx->sh.sck = -1;
 			W("connect bailing out; couldn't initiate ssl");
+			PROBE1(conn_fail, "tls");
 			return false;
 		}
 
+		ctx->st.tls_us = lsi_b_tstamp_us() - tls0;
+		PROBE2(conn_tls, sh.sck, ctx->st.tls_us);
 		D("setting to nonblocking mode after ssl connect");
 
 		if (!lsi_b_blocking(sh.sck, false)) {
@@ -250,7 +262,7 @@ lsi_conn_read(iconn *ctx, tokarr *tok, char **tags, size_t *ntags,
 
 	int n;
 	if (!(n = lsi_io_read(ctx->sh, &ctx->rctx, tok,
-	    tags, ntags, to_us)))
+	    tags, ntags, to_us, &ctx->st)))
 		return 0; /* timeout */
 
 	if (n < 0) {
@@ -279,7 +291,7 @@ lsi_conn_write_raw(iconn *ctx, const void *buf, size_t n)
 		return false;
 	}
 
-	if (!lsi_io_write(ctx->sh, buf, n)) {
+	if (!lsi_io_write(ctx->sh, buf, n, &ctx->st)) {
 		W("failed to write '%.*s'", (int) n, (const char *) buf);
 		lsi_conn_reset(ctx);
 		ctx->eof = false;
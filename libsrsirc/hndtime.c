@@ -0,0 +1,176 @@
+/* hndtime.c - how long message handlers take
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_IMSG
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include "hndtime.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/base_misc.h>
+#include <platform/base_string.h>
+
+#include <logger/intlog.h>
+
+#include <libsrsirc/irc_ext.h>
+
+#include "intdefs.h"
+#include "skmap.h"
+
+/* Every handler slot (struct msghnd, struct umsghnd) caches a pointer to the
+ * struct irc_hndtime it counts into, so that the common case is a clock read
+ * on either side of the call and a few additions.  The structs themselves are
+ * found by "module command" in ctx->hndt, and kept (in the order first seen)
+ * in ctx->hndtv until the context is disposed of, because the handlers are
+ * unregistered and registered again on every irc_connect(). */
+
+/* bucket 0 is below 1<<MIN_SHIFT ns */
+#define MIN_SHIFT 6
+
+
+#if WITH_HNDTIME
+static struct irc_hndtime *lookup(irc *ctx, const char *cmd,
+    const char *module);
+static size_t bucket(uint64_t ns);
+#endif
+
+
+bool
+irc_hndtime(irc *ctx, size_t ind, struct irc_hndtime *dest)
+{
+#if WITH_HNDTIME
+	if (ind >= ctx->hndtv_cnt)
+		return false;
+
+	*dest = *ctx->hndtv[ind];
+	return true;
+#else
+	return false;
+#endif
+}
+
+uint64_t
+irc_hndtime_bucket(size_t ind)
+{
+	if (ind == 0)
+		return 0;
+
+	ind--;
+	unsigned m = MIN_SHIFT + (unsigned)(ind / 2);
+	return (uint64_t)(2 + ind % 2) << (m - 1);
+}
+
+void
+irc_set_hndtime_slow(irc *ctx, uint64_t thresh_us)
+{
+#if WITH_HNDTIME
+	ctx->hndt_slow = thresh_us * 1000;
+#endif
+	return;
+}
+
+
+#if WITH_HNDTIME
+void
+lsi_hndt_record(irc *ctx, struct irc_hndtime **htp, const char *cmd,
+    const char *module, size_t ind, uint64_t ns)
+{
+	struct irc_hndtime *ht = *htp;
+	if (!ht && !(ht = *htp = lookup(ctx, cmd, module)))
+		return;
+
+	ht->n++;
+	ht->sum_ns += ns;
+	if (ns > ht->max_ns)
+		ht->max_ns = ns;
+	ht->hist[bucket(ns)]++;
+
+	if (ctx->hndt_slow && ns > ctx->hndt_slow) {
+		ht->nslow++;
+		W("slow handler: '%s' (%s, #%zu) took %" PRIu64 " us",
+		    cmd, module, ind, ns / 1000);
+	}
+
+	return;
+}
+
+static struct irc_hndtime *
+lookup(irc *ctx, const char *cmd, const char *module)
+{
+	char key[80];
+	snprintf(key, sizeof key, "%s %s", module, cmd);
+
+	struct irc_hndtime *ht;
+	if (!ctx->hndt && !(ctx->hndt = lsi_skmap_init(64, CMAP_ASCII)))
+		return NULL;
+
+	if ((ht = lsi_skmap_get(ctx->hndt, key)))
+		return ht;
+
+	if (ctx->hndtv_cnt == ctx->hndtv_sz) {
+		size_t nsz = ctx->hndtv_sz ? ctx->hndtv_sz * 2 : 32;
+		struct irc_hndtime **nv = MALLOC(nsz * sizeof *nv);
+		if (!nv)
+			return NULL;
+
+		if (ctx->hndtv_cnt)
+			memcpy(nv, ctx->hndtv, ctx->hndtv_cnt * sizeof *nv);
+		free(ctx->hndtv);
+		ctx->hndtv = nv;
+		ctx->hndtv_sz = nsz;
+	}
+
+	if (!(ht = MALLOC(sizeof *ht)))
+		return NULL;
+
+	memset(ht, 0, sizeof *ht);
+	STRACPY(ht->cmd, cmd);
+	STRACPY(ht->module, module);
+	if (!lsi_skmap_put(ctx->hndt, key, ht)) {
+		free(ht);
+		return NULL;
+	}
+
+	ctx->hndtv[ctx->hndtv_cnt++] = ht;
+	return ht;
+}
+
+/* the inverse of irc_hndtime_bucket() */
+static size_t
+bucket(uint64_t ns)
+{
+	if (ns < (1u << MIN_SHIFT))
+		return 0;
+
+	unsigned m = MIN_SHIFT;
+	while (m < 63 && ns >> (m + 1))
+		m++;
+
+	size_t b = 1 + (m - MIN_SHIFT) * 2 + ((ns >> (m - 1)) & 1);
+	return b < IRC_HNDT_NBUCK ? b : IRC_HNDT_NBUCK - 1;
+}
+#endif
+
+void
+lsi_hndt_dispose(irc *ctx)
+{
+#if WITH_HNDTIME
+	for (size_t i = 0; i < ctx->hndtv_cnt; i++)
+		free(ctx->hndtv[i]);
+	free(ctx->hndtv);
+	ctx->hndtv = NULL;
+	ctx->hndtv_cnt = ctx->hndtv_sz = 0;
+	lsi_skmap_dispose(ctx->hndt);
+	ctx->hndt = NULL;
+#endif
+	return;
+}
@@ -0,0 +1,36 @@
+/* hndtime.h - how long message handlers take, interface
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_HNDTIME_H
+#define LIBSRSIRC_HNDTIME_H 1
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libsrsirc/defs.h>
+
+/* Unless configured with --enable-hndtime, these expand to nothing, so that
+ * the dispatch loops in msg.c don't so much as look at the clock. */
+#if WITH_HNDTIME
+# include <platform/base_time.h>
+
+# define HNDT_START(T) uint64_t T = lsi_b_mono_ns()
+# define HNDT_STOP(CTX, HTP, CMD, MOD, IND, T) \
+    lsi_hndt_record((CTX), (HTP), (CMD), (MOD), (IND), lsi_b_mono_ns() - (T))
+
+/* account for one dispatch of `cmd` to `module`'s handler (at index `ind`).
+ * `*htp` caches where to count; it's looked up if NULL */
+void lsi_hndt_record(irc *ctx, struct irc_hndtime **htp, const char *cmd,
+    const char *module, size_t ind, uint64_t ns);
+#else
+# define HNDT_START(T)
+# define HNDT_STOP(CTX, HTP, CMD, MOD, IND, T)
+#endif
+
+void lsi_hndt_dispose(irc *ctx);
+
+
+#endif /* LIBSRSIRC_HNDTIME_H */
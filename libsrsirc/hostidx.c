@@ -0,0 +1,195 @@
+/* hostidx.c - index of tracked users by host
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_TRACK
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include "hostidx.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/base_misc.h>
+
+#include <logger/intlog.h>
+
+#include "cmap.h"
+#include "intdefs.h"
+#include "skmap.h"
+#include "ucbase.h"
+
+/* The users (that we know the host of), sorted by their casefolded host
+ * spelled backwards.  The users with hosts ending in a given suffix then
+ * form a contiguous range, found by binary search.
+ *
+ * Keeping that order up to date on every JOIN and QUIT isn't worth it; the
+ * index is rebuilt on the first lookup after users changed (see
+ * ctx->usergen).  That pays off for the typical burst of lookups, e.g.
+ * checking every ban of a channel, but not for a lookup after every
+ * message. */
+
+struct hostent {
+	const char *rhost; //reversed, casefolded, not NUL-terminated
+	size_t len;
+	user *u;
+};
+
+struct hostidx {
+	size_t gen; //ctx->usergen as of when we were built
+	struct hostent *ent;
+	size_t cnt;
+	char *buf; //the rhosts
+};
+
+
+static bool build(irc *ctx);
+static int entcmp(const void *v1, const void *v2);
+static int pfxcmp(const struct hostent *e, const char *rs, size_t len);
+
+
+static int
+entcmp(const void *v1, const void *v2)
+{
+	const struct hostent *e1 = v1, *e2 = v2;
+	size_t n = e1->len < e2->len ? e1->len : e2->len;
+	int r = memcmp(e1->rhost, e2->rhost, n);
+	if (r)
+		return r;
+
+	return e1->len < e2->len ? -1 : e1->len > e2->len;
+}
+
+/* compare `e` to `rs`, considering only the first `len` bytes of `e` */
+static int
+pfxcmp(const struct hostent *e, const char *rs, size_t len)
+{
+	size_t n = e->len < len ? e->len : len;
+	int r = memcmp(e->rhost, rs, n);
+	if (r)
+		return r;
+
+	return e->len < len ? -1 : 0;
+}
+
+static bool
+build(irc *ctx)
+{
+	const uint8_t *cm = g_cmap[CMAP_WHOLE(ctx->trkcasemap)];
+	struct hostidx *ix = ctx->hostidx;
+	if (!ix) {
+		if (!(ix = ctx->hostidx = MALLOC(sizeof *ix)))
+			return false;
+		ix->ent = NULL;
+		ix->buf = NULL;
+	}
+
+	free(ix->ent);
+	free(ix->buf);
+	ix->ent = NULL;
+	ix->buf = NULL;
+	ix->cnt = 0;
+
+	size_t nusers = lsi_ucb_num_users(ctx), bufsz = 0;
+	skmap_iter it;
+	void *e;
+	lsi_ucb_iter_users(ctx, &it);
+	while (lsi_skmap_iter_next(&it, NULL, &e)) {
+		user *u = e;
+		lsi_ucb_user_details(u);
+		if (u->host)
+			bufsz += strlen(u->host);
+	}
+
+	if (!(ix->ent = MALLOC((nusers + 1) * sizeof *ix->ent))
+	    || !(ix->buf = MALLOC(bufsz + 1)))
+		return false;
+
+	char *p = ix->buf;
+	lsi_ucb_iter_users(ctx, &it);
+	while (lsi_skmap_iter_next(&it, NULL, &e)) {
+		user *u = e;
+		if (!u->host)
+			continue;
+
+		struct hostent *he = &ix->ent[ix->cnt++];
+		size_t len = strlen(u->host);
+		he->rhost = p;
+		he->len = len;
+		he->u = u;
+		while (len)
+			*p++ = (char)cm[(unsigned char)u->host[--len]];
+	}
+
+	qsort(ix->ent, ix->cnt, sizeof *ix->ent, entcmp);
+	ix->gen = *ctx->usergen;
+	D("built host index of %zu users", ix->cnt);
+	return true;
+}
+
+size_t
+lsi_hidx_range(irc *ctx, const char *sfx, size_t len, size_t *first)
+{
+	struct hostidx *ix = ctx->hostidx;
+	if ((!ix || !ix->ent || ix->gen != *ctx->usergen) && !build(ctx)) {
+		E("failed to build host index");
+		return SIZE_MAX;
+	}
+
+	ix = ctx->hostidx;
+
+	char rsbuf[MAX_HOST_LEN];
+	if (len > sizeof rsbuf)
+		return *first = 0, 0; //no host is that long anyway
+
+	for (size_t i = 0; i < len; i++)
+		rsbuf[i] = sfx[len - 1 - i];
+
+	/* first entry not less than rs, then first one greater */
+	size_t lo = 0, hi = ix->cnt;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (pfxcmp(&ix->ent[mid], rsbuf, len) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	*first = lo;
+	hi = ix->cnt;
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (pfxcmp(&ix->ent[mid], rsbuf, len) <= 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo - *first;
+}
+
+user *
+lsi_hidx_user(irc *ctx, size_t i)
+{
+	struct hostidx *ix = ctx->hostidx;
+	return ix->ent[i].u;
+}
+
+void
+lsi_hidx_free(irc *ctx)
+{
+	struct hostidx *ix = ctx->hostidx;
+	if (!ix)
+		return;
+
+	free(ix->ent);
+	free(ix->buf);
+	free(ix);
+	ctx->hostidx = NULL;
+	return;
+}
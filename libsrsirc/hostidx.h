@@ -0,0 +1,27 @@
+/* hostidx.h - index of tracked users by host, interface (lib-internal)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_HOSTIDX_H
+#define LIBSRSIRC_HOSTIDX_H 1
+
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <libsrsirc/defs.h>
+
+#include "ucbase.h"
+
+
+/* find the users whose host ends in `sfx` (`len` bytes, casefolded with
+ * CMAP_WHOLE()).  they're lsi_hidx_user(ctx, *first) and the (return
+ * value - 1) following ones.  the index is (re)built if users changed since
+ * it was last used; returns SIZE_MAX if that failed */
+size_t lsi_hidx_range(irc *ctx, const char *sfx, size_t len, size_t *first);
+user  *lsi_hidx_user(irc *ctx, size_t i);
+
+void   lsi_hidx_free(irc *ctx);
+
+
+#endif /* LIBSRSIRC_HOSTIDX_H */
@@ -11,6 +11,9 @@
 
 #include <platform/base_net.h>
 
+#include <libsrsirc/irc_monitor.h>
+#include <libsrsirc/irc_track.h>
+
 #include "skmap.h"
 
 /* receive buffer size */
@@ -40,7 +43,12 @@
 #define MAX_V3CAPS 16
 #define MAX_V3TAGLEN 512
 #define MAX_V3CAPLEN 128
+#define MAX_CMDSTAT 128 // Distinct commands counted, the last one being "*"
 #define MAX_V3CAPLINE 512
+#define MAX_005_TARGMAX 16
+#define MAX_V3BATCHES 8 // concurrently open IRCv3 batches
+#define MAX_V3BATCHREF 64
+#define MAX_V3BATCHTYPE 32
 
 
 /* this allows us to handle both plaintext and ssl connections the same way */
@@ -63,12 +71,18 @@ struct msghnd {
 	char cmd[32];
 	hnd_fn hndfn;
 	const char *module;
+#if WITH_HNDTIME
+	struct irc_hndtime *ht; /* where to count, see hndtime.c */
+#endif
 };
 
 /* protocol message handler function pointers */
 struct umsghnd {
 	char cmd[32];
 	uhnd_fn hndfn;
+#if WITH_HNDTIME
+	struct irc_hndtime *ht;
+#endif
 };
 
 struct v3tag
@@ -86,6 +100,47 @@ struct v3cap
 	bool enabled;
 };
 
+/* 005 ISUPPORT, compiled into lookup tables and integers whenever it
+ * changes (see lsi_imh_compile_005()), so that MODE and NAMES processing
+ * needn't dig through the strings in struct irc_s every time */
+struct isupp {
+	uint8_t mdclass[256];   // CHANMODE_CLASS_* by mode char, 0 if none
+	uint8_t pfxrank[256];   // 1 + rank (0 = strongest) by prefix symbol
+	uint8_t pfxmdrank[256]; // 1 + rank (0 = strongest) by prefix letter
+	size_t npfx;            // Number of prefixes (at most 32)
+	size_t nicklen;         // NICKLEN, 0 if unknown
+	size_t linelen;         // LINELEN, 512 if not given
+	uint16_t maxlist[256];  // MAXLIST by list mode char, 0 if unknown
+	uint16_t chanlimit[256]; // CHANLIMIT by chantype, 0 if none/unknown
+	struct {
+		char cmd[16];
+		size_t max;     // 0 if unlimited
+	} targmax[MAX_005_TARGMAX]; // TARGMAX by command
+	size_t ntargmax;        // Number of used elements in the above
+	bool whox;              // WHOX
+	size_t monitor;         // MONITOR target limit, SIZE_MAX if none, 0 if unsupported
+};
+
+/* the prefix of a message (nick!user@host) taken apart without copying.  the
+ * parts point into the message and aren't terminated, hence the lengths;
+ * `user` and `host` are NULL if absent.  a server name ends up as `nick` */
+struct idspan
+{
+	const char *nick;
+	const char *user;
+	const char *host;
+	size_t nicklen;
+	size_t userlen;
+	size_t hostlen;
+};
+
+/* an IRCv3 batch the server has opened (BATCH +ref) but not yet closed */
+struct v3batch
+{
+	char ref[MAX_V3BATCHREF]; // empty if unused
+	char type[MAX_V3BATCHTYPE];
+};
+
 /* this is a relict of the former design */
 typedef struct iconn_s iconn;
 struct iconn_s {
@@ -106,6 +161,8 @@ struct iconn_s {
 	bool colon_trail;
 	bool ssl;
 	SSLCTXTYPE sctx;
+
+	struct irc_stats st; // see irc_stats(); the irc_s layer counts here too
 };
 
 /* this is our main IRC context context structure (typedef'd as `irc') */
@@ -130,6 +187,9 @@ struct irc_s {
 	char *m005modepfx[2];   // Supported channel mode prefixes as per 005
 	char *m005chantypes;    // Supported channel types as per 005
 	skmap *m005attrs;       // Stores all seen 005 attributes
+	struct isupp isupp;     // The above, compiled
+
+	struct idspan pfx;      // Prefix of the msg being handled, see lsi_msg_handle()
 
 	char *v3tags_raw[MAX_V3TAGS]; // IRCv3 tags of the last-read msg
 	size_t v3ntags;         // Number of tags in the last-read msg
@@ -138,6 +198,7 @@ struct irc_s {
 
 	struct v3cap *v3caps[MAX_V3CAPS];
 	char v3capreq[MAX_V3CAPLINE];
+	struct v3batch v3batches[MAX_V3BATCHES]; // Open batches
 	bool starttls;
 	bool starttls_first;
 
@@ -160,6 +221,7 @@ struct irc_s {
 	uint64_t scto_us;     // Socket connect() timeout per A/AAAA record (0=inf)
 	bool tracking;        // Do we want chan/user tracking? by irc_set_track()
 	bool dumb;            // Connect only, leave logon sequence to the user
+	bool quietbatch;      // Keep netsplit/netjoin lines from user handlers
 
 
 
@@ -167,6 +229,10 @@ struct irc_s {
 	fp_con_read cb_con_read; // Callback for incoming messages at logon time
 	void *tag_con_read;      // Userdata handed back to the above callback
 	fp_mut_nick cb_mut_nick; // Callback for unavailable nick at logon time
+	struct irc_trkcb cb_track; // Callbacks for tracking changes
+	void *tag_track;           // Userdata handed back to the above callbacks
+	struct irc_moncb cb_mon;   // Callbacks for the notify list
+	void *tag_mon;             // Userdata handed back to the above callbacks
 
 	struct umsghnd *uprehnds;  // User-registered PRE message handlers
 	size_t uprehnds_cnt;       // Amount of the above
@@ -180,12 +246,94 @@ struct irc_s {
 	/* These are only used if irc_set_track() was used to enable tracking */
 	skmap *chans;       // The channels we're aware of (or in?)
 	skmap *users;       // The users we're aware of
+	struct irc_trkshare *trkshare; // Shared user store, by irc_set_track_share()
+	bool trkshared;     // `users` is that of `trkshare`
+	skmap *nickalias;   // Old nick -> user renamed by another context before we saw the NICK; NULL if none (see trkshare.c)
+	int trkcasemap;     // Casemapping the above are keyed by
+	uint64_t trkgrace_us;  // Keep stale channels this long, by irc_set_track_grace()
+	uint64_t trkgrace_end; // ...i.e. until then (lsi_b_tstamp_us())
+	size_t nsplit;      // Users QUIT in a netsplit batch, yet to be dropped
+	char **njoin;       // JOINed in a netjoin batch, yet to add (queue_netjoin())
+	size_t njoin_cnt;   // Amount of the above
+	size_t njoin_sz;    // Allocated size of the above
+	uint64_t trkgen;    // Bumped on every change to the above
+	size_t *usergen;    // Bumped when users come, go or reveal their host
+	size_t ownugen;     // ...points here unless `trkshared`
+	size_t *detgen;     // Bumped when a user's details change (user->ver)
+	size_t owndgen;     // ...points here unless `trkshared`
+	bool hostidx_on;    // Keep a host index, by irc_set_track_hostidx()
+	struct hostidx *hostidx; // Users by host, see hostidx.c
+	uint32_t mlseed;    // For picking levels of member list nodes, see mlist.c
+	bool trkfilt_on;    // Only track channels matching `trkfilt`
+	char **trkfilt;     // Channel masks, by irc_track_filter_add()
+	size_t trkfilt_cnt; // Amount of the above
+	size_t trkfilt_sz;  // Allocated size of the above
+	skmap *untrk;       // Channels we're in but don't track (name -> name)
+	size_t trkmemcap;   // Evict cold data beyond this, by irc_set_track_memcap()
+	uint64_t trkmemchk; // When we last checked against the above, see trkmem.c
+	bool whosync_on;    // WHO channels we JOIN, by irc_set_track_whosync()
+	char **whoq;        // Requests yet to send, see whoq_add() in irc_track.c
+	size_t whoq_first;  // Index of the next one in the above
+	size_t whoq_cnt;    // Amount of the above (including the ones done)
+	size_t whoq_sz;     // Allocated size of the above
+	char whocur[MAX_CHAN_LEN]; // Channel or nick our request is out for, "" if none
+	char whokind;       // What kind of request that is (WQ_*, see irc_track.c)
+	uint64_t whosent;   // When it was sent (lsi_b_tstamp_us())
+	void *snapcur;      // Published snapshot (irc_snap *), see trksnap.c
+	size_t snapreaders; // Threads in the middle of irc_snap_acquire()
+	struct irc_snap *snapretired; // Replaced snapshots, yet to be freed
+
+
+
+	/* These are only used if irc_monitor_add() was used */
+	skmap *mon;         // The notify list (nick -> struct montgt, see monitor.c)
+	int moncasemap;     // Casemapping the above is keyed by
+	size_t monsent;     // Nicks of it on the server's MONITOR list
+	bool mondirty;      // Some are yet to be MONITOR +'ed or -'ed
+	char **mondel;      // Nicks yet to be MONITOR -'ed
+	size_t mondel_cnt;  // Amount of the above
+	size_t mondel_sz;   // Allocated size of the above
+	char **monison;     // ISON batches ("nick nick ...") awaiting their 303
+	size_t monison_cnt; // Amount of the above
+	size_t monison_sz;  // Allocated size of the above
+	uint64_t monison_ival; // Poll this often, by irc_set_monitor_ison()
+	uint64_t monison_last; // When we last did (lsi_b_tstamp_us())
+
+	/* These are only used if irc_set_keepalive() was used */
+	uint64_t kaidle;    // PING after this long without traffic, 0 if off
+	unsigned kamaxmiss; // Give up after this many unanswered PINGs (0: never)
+	unsigned kamissed;  // Unanswered PINGs in a row
+	uint64_t kalastrx;  // When we last heard from the server
+	uint64_t kasent;    // When our outstanding PING went out, 0 if none
+	char katok[24];     // What our outstanding PING said
+	struct irc_lagstats lag; // Round trip times, see irc_lag_stats()
+
+	/* Metrics; the counters themselves are in con->st, see stats.c */
+	uint64_t statid;    // Identifies us in irc_stats_prom()'s output
+	struct irc_s *statprev; // All contexts, for irc_stats_prom()
+	struct irc_s *statnext;
+	bool everconn;      // If we ever logged on, to count reconnects
+	skmap *cmdstat;     // Command -> struct cmdstat, see irc_stats_cmd()
+	struct cmdstat *cmdv[MAX_CMDSTAT]; // The same, in the order first seen
+	size_t cmdv_cnt;    // Amount of the above
+	void *statlock;     // Guards the below, see stats.c
+	char statsrv[MAX_HOST_LEN]; // Server label for irc_stats_prom()
+	uint16_t statport;  // Port, likewise
+	char statnick[MAX_NICK_LEN]; // Nick label, likewise
+
+#if WITH_HNDTIME
+	/* Handler timing, see hndtime.c */
+	skmap *hndt;        // "module cmd" -> struct irc_hndtime
+	struct irc_hndtime **hndtv; // The same, in the order first seen
+	size_t hndtv_cnt;   // Amount of the above
+	size_t hndtv_sz;    // Allocated size of the above
+	uint64_t hndt_slow; // Complain about dispatches taking longer (ns), or 0
+#endif
 
 
 
 	/* These are internal helper structures */
 	bool tracking_enab;  // If `tracking`, set once we see 005 CASEMAPPING
-	bool endofnames;     // Helper flag for channel names update
 
 	struct iconn_s *con; // Connection-specifics (socket, read buffers, ...)
 };
@@ -24,6 +24,7 @@
 #include <logger/intlog.h>
 
 #include "common.h"
+#include "probes.h"
 
 #include <libsrsirc/util.h>
 
@@ -33,7 +34,8 @@
 
 /* local helpers */
 static char *find_delim(struct readctx *rctx);
-static int read_more(sckhld sh, struct readctx *rctx, uint64_t to_us);
+static int read_more(sckhld sh, struct readctx *rctx, uint64_t to_us,
+    struct irc_stats *st);
 static bool write_str(sckhld sh, const char *str);
 static long read_wrap(sckhld sh, void *buf, size_t sz, uint64_t to_us);
 static long send_wrap(sckhld sh, const void *buf, size_t len);
@@ -42,7 +44,7 @@ static long send_wrap(sckhld sh, const void *buf, size_t len);
 /* Documented in io.h */
 int
 lsi_io_read(sckhld sh, struct readctx *rctx, tokarr *tok,
-    char **tags, size_t *ntags, uint64_t to_us)
+    char **tags, size_t *ntags, uint64_t to_us, struct irc_stats *st)
 {
 	uint64_t tend = to_us ? lsi_b_tstamp_us() + to_us : 0;
 	uint64_t tnow, trem = 0;
@@ -68,7 +70,7 @@ lsi_io_read(sckhld sh, struct readctx *rctx, tokarr *tok,
 				trem = tnow >= tend ? 1 : tend - tnow;
 			}
 
-			int r = read_more(sh, rctx, trem);
+			int r = read_more(sh, rctx, trem, st);
 			if (r <= 0)
 				return r;
 		}
@@ -81,6 +83,7 @@ lsi_io_read(sckhld sh, struct readctx *rctx, tokarr *tok,
 	rctx->wptr += linelen;
 
 	*delim = '\0';
+	st->lines_in++;
 
 	I("Read: '%s'", linestart);
 
@@ -90,23 +93,41 @@ lsi_io_read(sckhld sh, struct readctx *rctx, tokarr *tok,
 
 		if (!linestart || !linestart[0]) {
 			E("protocol error (just tags?)");
+			st->parse_errs++;
 			return -1;
 		}
 	} else if (ntags)
 		*ntags = 0;
 
-	return lsi_ut_tokenize(linestart, tok) ? 1 : -1;
+	if (!lsi_ut_tokenize(linestart, tok)) {
+		st->parse_errs++;
+		return -1;
+	}
+
+	PROBE2(line_parsed, (*tok)[0], (*tok)[1]);
+	return 1;
 }
 
 /* Documented in io.h */
 bool
-lsi_io_write(sckhld sh, const void *buf, size_t n)
+lsi_io_write(sckhld sh, const void *buf, size_t n, struct irc_stats *st)
 {
 	bool suc = send_wrap(sh, buf, n) == n;
+	PROBE3(io_write, sh.sck, n, suc);
+
+	if (n)
+		st->writes++;
+
+	if (suc) {
+		const char *p = buf, *end = p + n;
+		st->bytes_out += n;
+		while ((p = memchr(p, '\n', (size_t)(end - p)))) {
+			st->lines_out++;
+			p++;
+		}
 
-	if (suc)
 		I("Wrote (%zu bytes): '%.*s'", n, (int) n, (const char *) buf);
-	else
+	} else
 		W("Failed to write '%.*s'", (int) n, (const char *) buf);
 
 	return suc;
@@ -126,7 +147,8 @@ find_delim(struct readctx *rctx)
 /* attempt to read more data from the ircd into our read buffer.
  * returns 1 if something was read; 0 on timeout; -1 on failure */
 static int
-read_more(sckhld sh, struct readctx *rctx, uint64_t to_us)
+read_more(sckhld sh, struct readctx *rctx, uint64_t to_us,
+    struct irc_stats *st)
 {
 	/* no sizeof rctx->workbuf here because it's one bigger than WORKBUF_SZ
 	 * and we don't want to fill the last byte with data; it's a dummy */
@@ -150,6 +172,8 @@ read_more(sckhld sh, struct readctx *rctx, uint64_t to_us)
 
 	V("Reading more data (max. %zu bytes, timeout: %"PRIu64, remain, to_us);
 	long n = read_wrap(sh, rctx->eptr, remain, to_us);
+	st->reads++;
+	PROBE2(io_read, sh.sck, n);
 	// >0: Amount of bytes read
 	// 0: timeout
 	// -1: Failure
@@ -163,6 +187,7 @@ read_more(sckhld sh, struct readctx *rctx, uint64_t to_us)
 	}
 
 	V("Got %ld more bytes", n);
+	st->bytes_in += (uint64_t)n;
 
 	rctx->eptr += n;
 	return 1;
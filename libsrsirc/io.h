@@ -26,11 +26,12 @@
  *                  (*tok)[2+n] will point to the n-th "argument", if it
  *                      exists; NULL otherwise (for 0 <= n < sizeof *tok - 2)
  *         `to_us': Timeout in microseconds (0 = no timeout)
+ *         `st':    Counters to update (bytes, lines, reads, parse errors)
  *
  * Returns 1 on success; 0 on timeout; -1 on failure
  */
 int lsi_io_read(sckhld sh, struct readctx *rctx, tokarr *tok,
-    char **tags, size_t *ntags, uint64_t to_us); // XXX
+    char **tags, size_t *ntags, uint64_t to_us, struct irc_stats *st); // XXX
 
 /* lsi_io_write
  * Send buffer contents to the ircd
@@ -39,10 +40,12 @@ int lsi_io_read(sckhld sh, struct readctx *rctx, tokarr *tok,
  *         `buf': Data to send. Typically all or part of a single IRC protocol
 *                 line (but may be multiple if properly separated by \r\n).
  *	   `n':   Size of the buffer specified by `buf' in bytes.
+ *         `st':  Counters to update (bytes, lines, writes)
  *
  * Returns true on success, false on failure
  */
-bool lsi_io_write(sckhld sh, const void *buf, size_t n);
+bool lsi_io_write(sckhld sh, const void *buf, size_t n,
+    struct irc_stats *st);
 
 
 #endif /* LIBSRSIRC_IO_H */
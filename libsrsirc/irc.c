@@ -24,10 +24,18 @@
 
 #include "common.h"
 #include "conn.h"
+#include "hostidx.h"
 #include "irc_msghnd.h"
 #include "irc_track_int.h"
+#include "hndtime.h"
+#include "keepalive.h"
+#include "monitor.h"
+#include "probes.h"
+#include "stats.h"
 #include "msg.h"
 #include "skmap.h"
+#include "trkshare.h"
+#include "trksnap.h"
 #include "v3.h"
 
 #include <libsrsirc/irc_track.h>
@@ -59,6 +67,12 @@ irc_init(void)
 	r->msghnds = NULL;
 	r->uprehnds = r->uposthnds = NULL;
 	r->chans = r->users = NULL;
+	r->njoin = NULL;
+	r->nsplit = r->njoin_cnt = r->njoin_sz = 0;
+	r->trkgen = 0;
+	r->snapcur = NULL;
+	r->snapreaders = 0;
+	r->snapretired = NULL;
 	r->m005chantypes = NULL;
 	r->m005attrs = NULL;
 
@@ -144,15 +158,69 @@ irc_init(void)
 	r->serv_con = false;
 	r->cb_con_read = NULL;
 	r->cb_mut_nick = lsi_ut_mut_nick;
+	memset(&r->cb_track, 0, sizeof r->cb_track);
+	r->tag_track = NULL;
+	memset(&r->cb_mon, 0, sizeof r->cb_mon);
+	r->tag_mon = NULL;
+	lsi_msg_idspan(&r->pfx, "");
 	r->conflags = DEF_CONFLAGS;
 	r->serv_type = DEF_SERV_TYPE;
 	r->scto_us = DEF_SCTO_US;
 	r->hcto_us = DEF_HCTO_US;
 	r->dumb = false;
+	r->quietbatch = false;
 	r->tracking_enab = r->tracking = false;
-	r->endofnames = false;
+	r->trkcasemap = CMAP_RFC1459;
+	r->trkgrace_us = r->trkgrace_end = 0;
+	r->ownugen = 0;
+	r->usergen = &r->ownugen;
+	r->owndgen = 0;
+	r->detgen = &r->owndgen;
+	r->trkshare = NULL;
+	r->trkshared = false;
+	r->nickalias = NULL;
+	r->hostidx_on = false;
+	r->hostidx = NULL;
+	r->mlseed = 0;
+	r->trkfilt_on = false;
+	r->trkfilt = NULL;
+	r->trkfilt_cnt = r->trkfilt_sz = 0;
+	r->untrk = NULL;
+	r->trkmemcap = 0;
+	r->trkmemchk = 0;
+	r->whosync_on = false;
+	r->whoq = NULL;
+	r->whoq_first = r->whoq_cnt = r->whoq_sz = 0;
+	r->whocur[0] = '\0';
+	r->whokind = 0;
+	r->whosent = 0;
+	r->mon = NULL;
+	r->moncasemap = CMAP_RFC1459;
+	r->monsent = 0;
+	r->mondirty = false;
+	r->mondel = r->monison = NULL;
+	r->mondel_cnt = r->mondel_sz = r->monison_cnt = r->monison_sz = 0;
+	r->monison_ival = DEF_MONISON_US;
+	r->monison_last = 0;
+	r->kaidle = DEF_KAIDLE_US;
+	r->kamaxmiss = 0;
+	lsi_ka_reset(r);
+	r->everconn = false;
+	r->cmdstat = NULL;
+	r->cmdv_cnt = 0;
+	r->statlock = NULL;
+	r->statsrv[0] = r->statnick[0] = '\0';
+	r->statport = 0;
+	lsi_stats_add(r);
+#if WITH_HNDTIME
+	r->hndt = NULL;
+	r->hndtv = NULL;
+	r->hndtv_cnt = r->hndtv_sz = 0;
+	r->hndt_slow = 0;
+#endif
 
 	reset_state(r);
+	lsi_imh_compile_005(r);
 
 	D("IRC context initialized (%p)", (void *)r->con);
 	return r;
@@ -196,6 +264,15 @@ void
 irc_dispose(irc *ctx)
 {
 	lsi_trk_deinit(ctx);
+	lsi_mon_dispose(ctx);
+	lsi_stats_del(ctx);
+	lsi_stats_dispose(ctx);
+	lsi_hndt_dispose(ctx);
+	lsi_snap_deinit(ctx);
+	lsi_hidx_free(ctx);
+	irc_track_filter_clear(ctx);
+	if (ctx->trkshare)
+		lsi_tsh_unref(ctx->trkshare);
 	lsi_conn_dispose(ctx->con);
 	free(ctx->lasterr);
 	free(ctx->banmsg);
@@ -243,7 +320,12 @@ irc_connect(irc *ctx)
 	uint64_t tend = ctx->hcto_us ?
 	    lsi_b_tstamp_us() + ctx->hcto_us : 0;
 
-	lsi_trk_deinit(ctx);
+	/* keep tracking state (and the tags in it) across reconnects; it is
+	 * reconciled as we re-JOIN the channels we were in */
+	if (ctx->tracking)
+		lsi_trk_suspend(ctx);
+	else
+		lsi_trk_deinit(ctx);
 	ctx->tracking_enab = false;
 
 	lsi_imh_unregall(ctx);
@@ -254,6 +336,16 @@ irc_connect(irc *ctx)
 	if (!lsi_v3_regall(ctx, ctx->dumb))
 		return false;
 
+	lsi_mon_unregall(ctx);
+	if (!lsi_mon_regall(ctx, ctx->dumb))
+		return false;
+
+	lsi_mon_reset(ctx);
+
+	lsi_ka_unregall(ctx);
+	if (!lsi_ka_regall(ctx, ctx->dumb))
+		return false;
+
 	reset_state(ctx);
 
 	for (size_t i = 0; i < COUNTOF(ctx->logonconv); i++) {
@@ -265,14 +357,23 @@ irc_connect(irc *ctx)
 	if (lsi_skmap_first(ctx->m005attrs, NULL, &v))
 		do free(v); while (lsi_skmap_next(ctx->m005attrs, NULL, &v));
 	lsi_skmap_clear(ctx->m005attrs);
+	lsi_imh_compile_005(ctx);
+
+	if (ctx->everconn)
+		ctx->con->st.reconnects++;
 
-	if (!lsi_conn_connect(ctx->con, ctx->scto_us, ctx->hcto_us))
+	if (!lsi_conn_connect(ctx->con, ctx->scto_us, ctx->hcto_us)) {
+		ctx->con->st.connfails++;
 		return false;
+	}
 
 	I("connection established");
 
-	if (ctx->dumb)
+	if (ctx->dumb) {
+		ctx->con->st.connects++;
+		ctx->everconn = true;
 		return true;
+	}
 
 	bool logon_sent = false;
 	if (ctx->starttls_first) {
@@ -283,6 +384,7 @@ irc_connect(irc *ctx)
 		if (!send_logon(ctx))
 			goto fail;
 		I("IRC logon sequence sent");
+		PROBE1(logon_sent, ctx);
 	}
 
 	STRACPY(ctx->mynick, ctx->nick);
@@ -334,14 +436,21 @@ irc_connect(irc *ctx)
 			if (!send_logon(ctx))
 				goto fail;
 			logon_sent = true;
+			PROBE1(logon_sent, ctx);
 		}
 
 	} while (!logged_on || (using_sasl && !sasl_authed));
 
 	N("logged on to IRC");
+	PROBE2(logon_done, ctx, ctx->mynick);
+	lsi_ka_reset(ctx);
+	ctx->con->st.connects++;
+	ctx->everconn = true;
 	return true;
 
 fail:
+	PROBE1(logon_fail, ctx);
+	ctx->con->st.connfails++;
 	irc_reset(ctx);
 	return false;
 }
@@ -354,15 +463,38 @@ irc_read(irc *ctx, tokarr *tok, uint64_t to_us)
 	if (!tok)
 		tok = &dummy;
 
-	for (size_t i = 0; i < COUNTOF(ctx->v3tags_dec); i++)
-		ctx->v3tags_dec[i][0] = '\0';
-	ctx->v3ntags = COUNTOF(ctx->v3tags_raw);
+	uint64_t tend = to_us ? lsi_b_tstamp_us() + to_us : 0;
+	uint64_t trem = to_us;
+	bool kawake;
+	int r;
+	do {
+		for (size_t i = 0; i < COUNTOF(ctx->v3tags_dec); i++)
+			ctx->v3tags_dec[i][0] = '\0';
+		ctx->v3ntags = COUNTOF(ctx->v3tags_raw);
 
-	int r = lsi_conn_read(ctx->con, tok, ctx->v3tags_raw, &ctx->v3ntags, to_us);
+		lsi_mon_tick(ctx);
+		lsi_trk_tick(ctx);
+
+		if (!lsi_ka_tick(ctx)) {
+			irc_reset(ctx);
+			return -1;
+		}
+
+		/* don't sleep through the next keepalive PING (or its timeout),
+		 * but don't return before `to_us` is up either */
+		uint64_t kato = lsi_ka_due(ctx);
+		kawake = kato && (!trem || kato < trem);
+
+		r = lsi_conn_read(ctx->con, tok, ctx->v3tags_raw, &ctx->v3ntags,
+		    kawake ? kato : trem);
+	} while (r == 0 && kawake && !lsi_com_check_timeout(tend, &trem));
 
 	if (r == 0)
 		return 0;
 
+	if (r > 0)
+		lsi_ka_rx(ctx);
+
 	if (r < 0 || lsi_msg_handle(ctx, tok, false) & CANT_PROCEED) {
 		irc_reset(ctx);
 		return -1;
@@ -517,7 +649,6 @@ irc_dump(irc *ctx)
 	N("tag_con_read: %p", (void *)ctx->tag_con_read);
 	N("tracking: %d", ctx->tracking);
 	N("tracking_enab: %d", ctx->tracking_enab);
-	N("endofnames: %d", ctx->endofnames);
 	N("v3ntags: %zu", ctx->v3ntags);
 	for (size_t i = 0; i < COUNTOF(ctx->v3tags_raw); i++)
 		N("v3tags_raw[%zu]: '%s'", i, ctx->v3tags_raw[i]);
@@ -567,5 +698,11 @@ reset_state(irc *ctx)
 	for (size_t i = 0; i < COUNTOF(ctx->v3tags_dec); i++)
 		ctx->v3tags_dec[i][0] = '\0';
 	ctx->v3ntags = 0;
+	/* what the last server offered says nothing about the next one */
+	for (size_t i = 0; i < COUNTOF(ctx->v3caps); i++)
+		if (ctx->v3caps[i])
+			ctx->v3caps[i]->offered = ctx->v3caps[i]->enabled = false;
+	lsi_v3_reset_batches(ctx);
+	lsi_stats_label(ctx);
 	return;
 }
@@ -20,8 +20,10 @@
 
 #include "common.h"
 #include "conn.h"
+#include "hostidx.h"
 #include "msg.h"
 #include "skmap.h"
+#include "stats.h"
 #include "v3.h"
 
 
@@ -132,6 +134,40 @@ irc_005attr(irc *ctx, const char *name)
 	return lsi_skmap_get(ctx->m005attrs, name);
 }
 
+size_t
+irc_005nicklen(irc *ctx)
+{
+	return ctx->isupp.nicklen;
+}
+
+size_t
+irc_005linelen(irc *ctx)
+{
+	return ctx->isupp.linelen;
+}
+
+size_t
+irc_005maxlist(irc *ctx, char mode)
+{
+	return ctx->isupp.maxlist[(unsigned char)mode];
+}
+
+size_t
+irc_005chanlimit(irc *ctx, char chantype)
+{
+	return ctx->isupp.chanlimit[(unsigned char)chantype];
+}
+
+size_t
+irc_005targmax(irc *ctx, const char *cmd)
+{
+	for (size_t i = 0; i < ctx->isupp.ntargmax; i++)
+		if (lsi_b_strcasecmp(ctx->isupp.targmax[i].cmd, cmd) == 0)
+			return ctx->isupp.targmax[i].max;
+
+	return 0;
+}
+
 bool
 irc_tracking_enab(irc *ctx)
 {
@@ -244,7 +280,9 @@ irc_get_dumb(irc *ctx)
 bool
 irc_set_server(irc *ctx, const char *host, uint16_t port)
 {
-	return lsi_conn_set_server(ctx->con, host, port);
+	bool ok = lsi_conn_set_server(ctx->con, host, port);
+	lsi_stats_label(ctx);
+	return ok;
 }
 
 bool
@@ -316,7 +354,9 @@ irc_set_sasl(irc *ctx, const char *mech, const void *msg, size_t n,
 bool
 irc_set_nick(irc *ctx, const char *nick)
 {
-	return lsi_com_update_strprop(&ctx->nick, nick);
+	bool ok = lsi_com_update_strprop(&ctx->nick, nick);
+	lsi_stats_label(ctx);
+	return ok;
 }
 
 bool
@@ -368,6 +408,41 @@ void
 irc_set_track(irc *ctx, bool on)
 {
 	ctx->tracking = on;
+
+	/* batch lets us deal with netsplits and netjoins in one go, the
+	 * others tell what we'd otherwise have to WHO for */
+	static const char *const caps[] = { "batch", "userhost-in-names",
+	    "extended-join", "account-notify", "away-notify", "chghost",
+	    "multi-prefix" };
+
+	for (size_t i = 0; i < COUNTOF(caps); i++)
+		if (on)
+			lsi_v3_want_cap(ctx, caps[i], false);
+		else
+			lsi_v3_clear_cap(ctx, caps[i]);
+	return;
+}
+
+void
+irc_set_track_grace(irc *ctx, uint64_t grace_us)
+{
+	ctx->trkgrace_us = grace_us;
+	return;
+}
+
+void
+irc_set_track_hostidx(irc *ctx, bool on)
+{
+	ctx->hostidx_on = on;
+	if (!on)
+		lsi_hidx_free(ctx);
+	return;
+}
+
+void
+irc_set_track_whosync(irc *ctx, bool on)
+{
+	ctx->whosync_on = on;
 	return;
 }
 
@@ -399,3 +474,10 @@ irc_set_dumb(irc *ctx, bool dumbmode)
 	ctx->dumb = dumbmode;
 	return;
 }
+
+void
+irc_set_quiet_batches(irc *ctx, bool on)
+{
+	ctx->quietbatch = on;
+	return;
+}
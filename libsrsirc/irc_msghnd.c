@@ -12,6 +12,7 @@
 #include "irc_msghnd.h"
 
 
+#include <ctype.h>
 #include <inttypes.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -108,7 +109,8 @@ handle_004(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 static uint16_t
 handle_PING(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 {
-	/* We only handle PINGs at logon. It's the user's job afterwards. */
+	/* We only handle PINGs at logon. It's the user's job afterwards,
+	 * unless they turned on the keepalive (see keepalive.c). */
 	if (!logon)
 		return 0;
 
@@ -391,6 +393,8 @@ handle_005(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 			return ret;
 	}
 
+	lsi_imh_compile_005(ctx);
+
 	if (have_casemap && ctx->tracking && !ctx->tracking_enab) {
 		/* Now that we know the casemapping used by the server, we
 		 * can enable tracking if it was originally (before connecting)
@@ -407,6 +411,111 @@ handle_005(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 }
 
 
+/* parses things like "beI:100,q:50" (MAXLIST) or "#&:20,+:" (CHANLIMIT)
+ * into a table indexed by the characters left of the colons.  a part
+ * without a colon is skipped, a limit that isn't a number counts as 0 */
+static void
+compile_charlimits(uint16_t *tbl, const char *val)
+{
+	for (size_t i = 0; i < 256; i++)
+		tbl[i] = 0;
+
+	while (val && *val) {
+		const char *comma = strchr(val, ',');
+		const char *colon = strchr(val, ':');
+		if (colon && (!comma || colon < comma)) {
+			unsigned long lim = isdigit((unsigned char)colon[1])
+			    ? strtoul(colon + 1, NULL, 10) : 0;
+			if (lim > UINT16_MAX)
+				lim = UINT16_MAX;
+
+			for (const char *p = val; p < colon; p++)
+				tbl[(unsigned char)*p] = (uint16_t)lim;
+		}
+
+		val = comma ? comma + 1 : NULL;
+	}
+
+	return;
+}
+
+/* rebuild ctx->isupp from the 005 strings/attributes we have.  the
+ * defaults (no 005 seen) come out of this just as well */
+void
+lsi_imh_compile_005(irc *ctx)
+{
+	struct isupp *is = &ctx->isupp;
+
+	for (size_t i = 0; i < 256; i++)
+		is->mdclass[i] = is->pfxrank[i] = is->pfxmdrank[i] = 0;
+
+	/* the first class a mode appears in wins, like it used to */
+	for (size_t z = COUNTOF(ctx->m005chanmodes); z > 0; z--)
+		for (const char *p = ctx->m005chanmodes[z-1]; *p; p++)
+			is->mdclass[(unsigned char)*p] = (uint8_t)z;
+
+	const char *mdpfx = ctx->m005modepfx[0];
+	const char *sympfx = ctx->m005modepfx[1];
+	for (is->npfx = 0; mdpfx[is->npfx] && sympfx[is->npfx]
+	    && is->npfx < 32; is->npfx++) {
+		uint8_t rank = (uint8_t)(is->npfx + 1);
+		if (!is->pfxmdrank[(unsigned char)mdpfx[is->npfx]])
+			is->pfxmdrank[(unsigned char)mdpfx[is->npfx]] = rank;
+		if (!is->pfxrank[(unsigned char)sympfx[is->npfx]])
+			is->pfxrank[(unsigned char)sympfx[is->npfx]] = rank;
+	}
+
+	const char *val = lsi_skmap_get(ctx->m005attrs, "NICKLEN");
+	is->nicklen = val ? strtoul(val, NULL, 10) : 0;
+
+	val = lsi_skmap_get(ctx->m005attrs, "LINELEN");
+	is->linelen = val ? strtoul(val, NULL, 10) : 0;
+	if (!is->linelen)
+		is->linelen = 512;
+
+	compile_charlimits(is->maxlist,
+	    lsi_skmap_get(ctx->m005attrs, "MAXLIST"));
+
+	val = lsi_skmap_get(ctx->m005attrs, "CHANLIMIT");
+	compile_charlimits(is->chanlimit, val);
+	if (!val && (val = lsi_skmap_get(ctx->m005attrs, "MAXCHANNELS"))) {
+		/* the old way of saying the same for all chantypes */
+		unsigned long lim = strtoul(val, NULL, 10);
+		for (const char *p = ctx->m005chantypes; *p; p++)
+			is->chanlimit[(unsigned char)*p] =
+			    lim > UINT16_MAX ? UINT16_MAX : (uint16_t)lim;
+	}
+
+	is->whox = lsi_skmap_get(ctx->m005attrs, "WHOX") != NULL;
+
+	/* "MONITOR" without a limit means there is none */
+	val = lsi_skmap_get(ctx->m005attrs, "MONITOR");
+	is->monitor = !val ? 0 : *val ? strtoul(val, NULL, 10) : SIZE_MAX;
+
+	is->ntargmax = 0;
+	val = lsi_skmap_get(ctx->m005attrs, "TARGMAX");
+	while (val && *val && is->ntargmax < COUNTOF(is->targmax)) {
+		const char *colon = strchr(val, ':');
+		const char *comma = strchr(val, ',');
+		if (!colon || (comma && comma < colon))
+			break;
+
+		size_t n = colon - val;
+		if (n < sizeof is->targmax[0].cmd) {
+			lsi_b_strNcpy(is->targmax[is->ntargmax].cmd, val, n + 1);
+			is->targmax[is->ntargmax++].max =
+			    strtoul(colon + 1, NULL, 10);
+		}
+
+		val = comma ? comma + 1 : NULL;
+	}
+
+	D("compiled 005: %zu prefixes, nicklen %zu, linelen %zu, %zu targmax",
+	    is->npfx, is->nicklen, is->linelen, is->ntargmax);
+	return;
+}
+
+
 bool
 lsi_imh_regall(irc *ctx, bool dumb)
 {
@@ -15,6 +15,7 @@
 
 bool lsi_imh_regall(irc *ctx, bool dumb);
 void lsi_imh_unregall(irc *ctx);
+void lsi_imh_compile_005(irc *ctx);
 
 
 #endif /* LIBSRSIRC_IRC_MSGHND_H */
@@ -16,7 +16,9 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include <platform/base_misc.h>
 #include <platform/base_string.h>
+#include <platform/base_time.h>
 
 #include <logger/intlog.h>
 
@@ -26,11 +28,36 @@
 #include "intdefs.h"
 #include "common.h"
 #include "msg.h"
+#include "hostidx.h"
+#include "mask.h"
+#include "probes.h"
+#include "trkmem.h"
+#include "trkshare.h"
 #include "ucbase.h"
+#include "v3.h"
 #include "irc_track_int.h"
 
+/* query token of our WHOX requests, to tell their 354s from anyone else's */
+#define WHOX_TOKEN "152"
+
+/* give up on a WHO that got no 315 (a TOPIC that got no 331/332, and so on)
+ * within this long (see h_PING()) */
+#define WHOSYNC_TIMEOUT_US (60 * 1000000ULL)
+
+/* kinds of whoq entries, see whoq_add() */
+#define WQ_CHAN 'c'  //WHO a channel we joined, for irc_set_track_whosync()
+#define WQ_USER 'u'  //WHO a user whose details were evicted (see trkmem.c)
+#define WQ_TOPIC 't' //TOPIC of a channel whose topic was evicted
+#define WQ_NAMES 'n' //NAMES of a channel the filter let in (see refilter())
+#define WQ_MODE 'm'  //MODE of such a channel
+
+/* don't take a 322 user count beyond this as a sizing hint, the number
+ * comes from the server and there's no channel that big anyway */
+#define MAX_LISTHINT 200000
+
 static uint16_t h_JOIN(irc *ctx, tokarr *msg, size_t nargs, bool logon);
 static uint16_t h_311(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_331(irc *ctx, tokarr *msg, size_t nargs, bool logon);
 static uint16_t h_332(irc *ctx, tokarr *msg, size_t nargs, bool logon);
 static uint16_t h_333(irc *ctx, tokarr *msg, size_t nargs, bool logon);
 static uint16_t h_352(irc *ctx, tokarr *msg, size_t nargs, bool logon);
@@ -45,6 +72,64 @@ static uint16_t h_PRIVMSG(irc *ctx, tokarr *msg, size_t nargs, bool logon);
 static uint16_t h_NOTICE(irc *ctx, tokarr *msg, size_t nargs, bool logon);
 static uint16_t h_324(irc *ctx, tokarr *msg, size_t nargs, bool logon);
 static uint16_t h_TOPIC(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_367(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_368(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_348(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_349(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_346(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_347(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_728(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_729(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_PING(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_322(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_BATCH(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_354(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_315(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_ACCOUNT(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_AWAY(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_CHGHOST(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+
+static chanrep *mkchanrep(chanrep *dest, chan *c);
+static userrep *mkuserrep(userrep *dest, user *u, const char *modepfx);
+static const char *mkident(char *dest, size_t destsz, user *u);
+static size_t match_users(irc *ctx, chan *c, const char *mask,
+    irc_user_visit_fn fn, void *arg);
+static userrep *mkmembrep(irc *ctx, userrep *dest, memb *m,
+    const char *ident, char *nick, size_t nick_sz);
+static void ev_join(irc *ctx, chan *c, memb *m, const char *ident);
+static void ev_part(irc *ctx, chan *c, memb *m, const char *ident,
+    const char *kicker, const char *reason);
+static void ev_quit(irc *ctx, user *u, const char *reason);
+static void ev_nick(irc *ctx, user *u, const char *oldnick);
+static void ev_prefix(irc *ctx, chan *c, memb *m, const char *oldpfx);
+static void ev_mode(irc *ctx, chan *c, char mode, bool set, const char *arg);
+static void ev_topic(irc *ctx, chan *c, const char *oldtopic);
+static void ev_netsplit(irc *ctx);
+static void ev_netjoin(irc *ctx, user **ua, size_t n);
+
+static bool queue_netjoin(irc *ctx, const char *chan, const char *ident,
+    const char *acct, const char *fname);
+static bool apply_netjoin(irc *ctx);
+static void drop_pending(irc *ctx);
+
+static bool whoq_add(irc *ctx, char kind, const char *name);
+static void whoq_next(irc *ctx);
+static void whoq_done(irc *ctx, char kind, const char *name);
+static void whoq_clear(irc *ctx);
+static const char *whoq_cmd(char kind);
+static void refetch_user(irc *ctx, user *u);
+static void refetch_chan(irc *ctx, chan *c);
+static void upd_details(irc *ctx, user *u, const char *uname,
+    const char *host, const char *fname, const char *acct);
+static void upd_away(irc *ctx, user *u, const char *msg);
+
+static bool isme(irc *ctx, const struct idspan *id);
+static bool chan_wanted(irc *ctx, const char *chnam);
+static chan *getchan(irc *ctx, const char *chnam);
+static bool untrk_add(irc *ctx, const char *chnam);
+static void untrk_del(irc *ctx, const char *chnam);
+static void untrk_clear(irc *ctx);
+static bool refilter(irc *ctx);
 
 bool
 lsi_trk_init(irc *ctx)
@@ -52,10 +137,13 @@ lsi_trk_init(irc *ctx)
 	bool fail = false;
 	fail = fail || !lsi_msg_reghnd(ctx, "JOIN", h_JOIN, "track");
 	fail = fail || !lsi_msg_reghnd(ctx, "311", h_311, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "331", h_331, "track");
 	fail = fail || !lsi_msg_reghnd(ctx, "332", h_332, "track");
 	fail = fail || !lsi_msg_reghnd(ctx, "333", h_333, "track");
 	fail = fail || !lsi_msg_reghnd(ctx, "353", h_353, "track");
 	fail = fail || !lsi_msg_reghnd(ctx, "352", h_352, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "354", h_354, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "315", h_315, "track");
 	fail = fail || !lsi_msg_reghnd(ctx, "366", h_366, "track");
 	fail = fail || !lsi_msg_reghnd(ctx, "PART", h_PART, "track");
 	fail = fail || !lsi_msg_reghnd(ctx, "QUIT", h_QUIT, "track");
@@ -66,24 +154,275 @@ lsi_trk_init(irc *ctx)
 	fail = fail || !lsi_msg_reghnd(ctx, "NOTICE", h_NOTICE, "track");
 	fail = fail || !lsi_msg_reghnd(ctx, "324", h_324, "track");
 	fail = fail || !lsi_msg_reghnd(ctx, "TOPIC", h_TOPIC, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "367", h_367, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "368", h_368, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "348", h_348, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "349", h_349, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "346", h_346, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "347", h_347, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "728", h_728, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "729", h_729, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "PING", h_PING, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "322", h_322, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "BATCH", h_BATCH, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "ACCOUNT", h_ACCOUNT, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "AWAY", h_AWAY, "track");
+	fail = fail || !lsi_msg_reghnd(ctx, "CHGHOST", h_CHGHOST, "track");
+
+	/* state kept across a reconnect is keyed by the old casemapping */
+	if (ctx->chans && ctx->trkcasemap != ctx->casemap) {
+		I("casemapping changed, dropping stale tracking state");
+		lsi_ucb_deinit(ctx);
+	}
 
-	if (fail || !lsi_ucb_init(ctx)) {
+	if (fail || (!ctx->chans && !lsi_ucb_init(ctx))
+	    || (!ctx->untrk && !(ctx->untrk = lsi_skmap_init(64, ctx->casemap)))) {
 		lsi_msg_unregall(ctx, "track");
 		return false;
 	}
 
-	ctx->endofnames = true;
+	ctx->trkcasemap = ctx->casemap;
+	ctx->trkgrace_end = lsi_b_tstamp_us() + ctx->trkgrace_us;
 	return true;
 }
 
 void
 lsi_trk_deinit(irc *ctx)
 {
+	drop_pending(ctx);
+	whoq_clear(ctx);
+	ctx->whocur[0] = '\0';
+	untrk_clear(ctx);
+	lsi_skmap_dispose(ctx->untrk);
+	ctx->untrk = NULL;
 	lsi_ucb_deinit(ctx);
 	lsi_msg_unregall(ctx, "track");
 	return;
 }
 
+/* like lsi_trk_deinit(), but keep the state around (marked stale) so that it
+ * can be reconciled rather than rebuilt after we reconnect */
+void
+lsi_trk_suspend(irc *ctx)
+{
+	drop_pending(ctx);
+	whoq_clear(ctx);
+	ctx->whocur[0] = '\0';
+	untrk_clear(ctx);
+	lsi_skmap_dispose(ctx->untrk); //might come back with another casemap
+	ctx->untrk = NULL;
+	lsi_msg_unregall(ctx, "track");
+	lsi_ucb_mark_stale(ctx);
+	return;
+}
+
+
+/* whether the channel filter (see irc_track_filter_add()) lets us track
+ * `chnam`.  this is only asked when we JOIN or the filter changes, so the
+ * masks aren't kept compiled */
+static bool
+chan_wanted(irc *ctx, const char *chnam)
+{
+	if (!ctx->trkfilt_on)
+		return true;
+
+	for (size_t i = 0; i < ctx->trkfilt_cnt; i++) {
+		mask m;
+		if (!lsi_mask_init(&m, ctx->trkfilt[i], ctx->casemap))
+			return true; //rather track too much than too little
+
+		bool match = lsi_mask_match(&m, chnam);
+		lsi_mask_fini(&m);
+		if (match)
+			return true;
+	}
+
+	return false;
+}
+
+/* the channel `chnam`, complaining if we ought to know it but don't */
+static chan *
+getchan(irc *ctx, const char *chnam)
+{
+	chan *c = lsi_ucb_get_chan(ctx, chnam, false);
+	if (!c && !(ctx->untrk && lsi_skmap_get(ctx->untrk, chnam)))
+		W("we don't know channel '%s'!", chnam);
+	return c;
+}
+
+/* channels we're in but don't track are only remembered by name, so we can
+ * start tracking them when the filter changes */
+static bool
+untrk_add(irc *ctx, const char *chnam)
+{
+	if (!ctx->untrk || lsi_skmap_get(ctx->untrk, chnam))
+		return true;
+
+	char *n = STRDUP(chnam);
+	if (!n || !lsi_skmap_put(ctx->untrk, chnam, n)) {
+		free(n);
+		return false;
+	}
+
+	D("in untracked channel '%s'", chnam);
+	return true;
+}
+
+static void
+untrk_del(irc *ctx, const char *chnam)
+{
+	if (ctx->untrk)
+		free(lsi_skmap_del(ctx->untrk, chnam));
+	return;
+}
+
+static void
+untrk_clear(irc *ctx)
+{
+	void *e;
+	if (!ctx->untrk || !lsi_skmap_first(ctx->untrk, NULL, &e))
+		return;
+
+	do free(e); while (lsi_skmap_next(ctx->untrk, NULL, &e));
+	lsi_skmap_clear(ctx->untrk);
+	return;
+}
+
+/* the filter changed.  forget the channels we no longer want, and start
+ * tracking the ones we now do, asking the server for what we'd have learned
+ * when JOINing them.  that's three or four lines per channel, so they go
+ * through the whoq rather than out right away */
+static bool
+refilter(irc *ctx)
+{
+	if (!ctx->chans || !ctx->untrk)
+		return true; //not tracking (yet); h_JOIN takes care
+
+	/* can't delete while iterating the maps; collect what moves first */
+	size_t nu = lsi_skmap_count(ctx->untrk), nc = lsi_skmap_count(ctx->chans);
+	size_t na = 0, nd = 0;
+	char **add = nu ? MALLOC(nu * sizeof *add) : NULL;
+	chan **drop = nc ? MALLOC(nc * sizeof *drop) : NULL;
+	if ((nu && !add) || (nc && !drop)) {
+		free(add);
+		free(drop);
+		return false;
+	}
+
+	void *e;
+	if (lsi_skmap_first(ctx->untrk, NULL, &e))
+		do
+			if (chan_wanted(ctx, e))
+				add[na++] = e;
+		while (lsi_skmap_next(ctx->untrk, NULL, &e));
+
+	skmap_iter it;
+	lsi_ucb_iter_chans(ctx, &it);
+	while (lsi_skmap_iter_next(&it, NULL, &e))
+		if (!chan_wanted(ctx, ((chan *)e)->name))
+			drop[nd++] = e;
+
+	bool fail = false;
+	for (size_t i = 0; i < nd; i++) {
+		I("no longer tracking '%s'", drop[i]->name);
+		if (!drop[i]->stale && !untrk_add(ctx, drop[i]->name))
+			fail = true;
+		lsi_ucb_drop_chan(ctx, drop[i]);
+	}
+
+	for (size_t i = 0; i < na; i++) {
+		lsi_skmap_del(ctx->untrk, add[i]);
+		I("starting to track '%s'", add[i]);
+		if (!lsi_ucb_add_chan(ctx, add[i]))
+			fail = true;
+		else if (irc_online(ctx))
+			fail = !whoq_add(ctx, WQ_NAMES, add[i])
+			    || !whoq_add(ctx, WQ_MODE, add[i])
+			    || !whoq_add(ctx, WQ_TOPIC, add[i])
+			    || !whoq_add(ctx, WQ_CHAN, add[i]) || fail;
+		free(add[i]);
+	}
+
+	free(add);
+	free(drop);
+	return !fail;
+}
+
+bool
+irc_track_filter_add(irc *ctx, const char *pat)
+{
+	for (size_t i = 0; i < ctx->trkfilt_cnt; i++)
+		if (lsi_ut_istrcmp(ctx->trkfilt[i], pat, ctx->casemap) == 0)
+			return true;
+
+	if (ctx->trkfilt_cnt == ctx->trkfilt_sz) {
+		size_t nsz = ctx->trkfilt_sz ? ctx->trkfilt_sz * 2 : 8;
+		char **nf = MALLOC(nsz * sizeof *nf);
+		if (!nf)
+			return false;
+
+		if (ctx->trkfilt_cnt)
+			memcpy(nf, ctx->trkfilt, ctx->trkfilt_cnt * sizeof *nf);
+		free(ctx->trkfilt);
+		ctx->trkfilt = nf;
+		ctx->trkfilt_sz = nsz;
+	}
+
+	if (!(ctx->trkfilt[ctx->trkfilt_cnt] = STRDUP(pat)))
+		return false;
+
+	ctx->trkfilt_cnt++;
+
+	/* the first pattern switches from tracking everything to tracking
+	 * just what matches, the others widen the filter */
+	bool narrow = !ctx->trkfilt_on;
+	ctx->trkfilt_on = true;
+	if (narrow || (ctx->untrk && lsi_skmap_count(ctx->untrk)))
+		return refilter(ctx);
+
+	return true;
+}
+
+bool
+irc_track_filter_del(irc *ctx, const char *pat)
+{
+	for (size_t i = 0; i < ctx->trkfilt_cnt; i++) {
+		if (lsi_ut_istrcmp(ctx->trkfilt[i], pat, ctx->casemap) != 0)
+			continue;
+
+		free(ctx->trkfilt[i]);
+		ctx->trkfilt[i] = ctx->trkfilt[--ctx->trkfilt_cnt];
+		return refilter(ctx);
+	}
+
+	return false;
+}
+
+bool
+irc_track_filter_clear(irc *ctx)
+{
+	for (size_t i = 0; i < ctx->trkfilt_cnt; i++)
+		free(ctx->trkfilt[i]);
+
+	free(ctx->trkfilt);
+	ctx->trkfilt = NULL;
+	ctx->trkfilt_cnt = ctx->trkfilt_sz = 0;
+
+	if (!ctx->trkfilt_on)
+		return true;
+
+	ctx->trkfilt_on = false;
+	return refilter(ctx);
+}
+
+
+/* whether the nick in `id` is ours */
+static bool
+isme(irc *ctx, const struct idspan *id)
+{
+	return lsi_ut_istrncmp(id->nick, ctx->mynick, id->nicklen,
+	    ctx->casemap) == 0 && !ctx->mynick[id->nicklen];
+}
 
 static uint16_t
 h_JOIN(irc *ctx, tokarr *msg, size_t nargs, bool logon)
@@ -91,24 +430,40 @@ h_JOIN(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 	if (!(*msg)[0] || nargs < 3)
 		return PROTO_ERR;
 
-	char nick[MAX_NICK_LEN];
-	lsi_ut_ident2nick(nick, sizeof nick, (*msg)[0]);
-
-	bool me = lsi_ut_istrcmp(nick, ctx->mynick, ctx->casemap) == 0;
-	chan *c = lsi_ucb_get_chan(ctx, (*msg)[2], !me);
+	const struct idspan *id = &ctx->pfx;
+	bool me = isme(ctx, id);
+	chan *c = me ? lsi_ucb_get_chan(ctx, (*msg)[2], false)
+	    : getchan(ctx, (*msg)[2]);
 
 	if (me) {
-		if (!c && !lsi_ucb_add_chan(ctx, (*msg)[2])) {
+		if (!chan_wanted(ctx, (*msg)[2])) {
+			if (c) //left over from before the filter changed
+				lsi_ucb_drop_chan(ctx, c);
+			return untrk_add(ctx, (*msg)[2]) ? 0 : ALLOC_ERR;
+		}
+
+		if (c && c->stale)
+			lsi_ucb_revive_chan(ctx, c);
+		else if (!c && !(c = lsi_ucb_add_chan(ctx, (*msg)[2]))) {
 			E("not tracking chan '%s'", (*msg)[2]);
 			return ALLOC_ERR;
 		}
+
+		ev_join(ctx, c, lsi_ucb_get_memb_sp(ctx, c, id, false), (*msg)[0]);
+		if (!whoq_add(ctx, WQ_CHAN, c->name))
+			return ALLOC_ERR;
 	} else {
-		if (!c) {
-			W("we don't know channel '%s'!", (*msg)[2]);
+		if (!c)
 			return 0;
-		}
 
-		user *u = lsi_ucb_get_user(ctx, (*msg)[0], false);
+		/* joins of a netjoin are applied in bulk once the batch ends */
+		const char *bt = lsi_v3_batch_type(ctx);
+		if (bt && strcmp(bt, "netjoin") == 0)
+			return queue_netjoin(ctx, c->name, (*msg)[0],
+			    nargs >= 5 ? (*msg)[3] : NULL,
+			    nargs >= 5 ? (*msg)[4] : NULL) ? 0 : ALLOC_ERR;
+
+		user *u = lsi_ucb_touch_user_sp(ctx, id, false);
 		bool uadd = false;
 		if (!u) {
 			uadd = true;
@@ -116,12 +471,20 @@ h_JOIN(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 				return ALLOC_ERR;
 		}
 
+		/* extended-join: "<channel> <account> :<real name>", where an
+		 * account of "*" means not logged in */
+		if (nargs >= 5)
+			upd_details(ctx, u, NULL, NULL, (*msg)[4],
+			    strcmp((*msg)[3], "*") == 0 ? "" : (*msg)[3]);
+
 		if (!lsi_ucb_add_memb(ctx, c, u, "")) {
 			E("chan '%s' desynced", c->name);
 			if (uadd)
 				lsi_ucb_drop_user(ctx, u);
 			return ALLOC_ERR;
 		}
+
+		ev_join(ctx, c, lsi_ucb_get_memb_sp(ctx, c, id, false), NULL);
 	}
 
 	return 0;
@@ -139,44 +502,175 @@ h_352(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 	if (!(*msg)[0] || nargs < 10)
 		return PROTO_ERR;
 
-	user *u = lsi_ucb_get_user(ctx, (*msg)[7], true);
+	/* the hopcount comes first */
+	const char *fname = strchr((*msg)[9], ' ');
+	if (!fname)
+		return PROTO_ERR;
+
+	user *u = lsi_ucb_get_user(ctx, (*msg)[7], !ctx->trkfilt_on);
 	if (!u)
 		return 0;
 
-	if (!u->uname || lsi_ut_istrcmp(u->uname, (*msg)[4], ctx->casemap) != 0) {
-		if (u->uname)
-			W("username for '%s' changed from '%s' to '%s'!",
-			    u->nick, u->uname, (*msg)[4]);
+	upd_details(ctx, u, (*msg)[4], (*msg)[5], fname + 1, NULL);
+	if ((*msg)[8][0] == 'G' && !u->away)
+		upd_away(ctx, u, "");
+	else if ((*msg)[8][0] == 'H' && u->away)
+		upd_away(ctx, u, NULL);
 
-		lsi_com_update_strprop(&u->uname, (*msg)[4]);
+	return 0;
+}
+
+/* 354    RPL_WHOSPCRPL (WHOX)
+ * the fields asked for, in a fixed order; for our "%tcuhnfar" (see
+ * whoq_next()) that's
+ * "<token> <channel> <user> <host> <nick> <flags> <account> :<real name>"
+ */
+static uint16_t
+h_354(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (!(*msg)[0] || nargs < 4 || strcmp((*msg)[3], WHOX_TOKEN) != 0)
+		return 0; //someone else's, we don't know what's in it
+
+	if (nargs < 11)
+		return PROTO_ERR;
+
+	user *u = lsi_ucb_get_user(ctx, (*msg)[7], !ctx->trkfilt_on);
+	if (!u)
+		return 0;
+
+	upd_details(ctx, u, (*msg)[5], (*msg)[6], (*msg)[10],
+	    strcmp((*msg)[9], "0") == 0 ? "" : (*msg)[9]);
+	if ((*msg)[8][0] == 'G' && !u->away)
+		upd_away(ctx, u, "");
+	else if ((*msg)[8][0] == 'H' && u->away)
+		upd_away(ctx, u, NULL);
+
+	return 0;
+}
+
+/* 315    RPL_ENDOFWHO
+ * "<name> :End of WHO list" */
+static uint16_t
+h_315(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (!(*msg)[0] || nargs < 4)
+		return PROTO_ERR;
+
+	whoq_done(ctx, WQ_CHAN, (*msg)[3]);
+	whoq_done(ctx, WQ_USER, (*msg)[3]);
+	return 0;
+}
+
+/* fill in what WHO (or WHOIS, or an extended JOIN) told us about `u`.  any of
+ * the details may be NULL if not told; an `acct` of "" means not logged in */
+static void
+upd_details(irc *ctx, user *u, const char *uname, const char *host,
+    const char *fname, const char *acct)
+{
+	bool dirty = false;
+	lsi_ucb_user_details(u);
+
+	if (uname && (!u->uname || strcmp(u->uname, uname) != 0)) {
+		lsi_com_update_strprop(&u->uname, uname);
+		dirty = true;
 	}
 
-	if (!u->host || lsi_ut_istrcmp(u->host, (*msg)[5], ctx->casemap) != 0) {
-		if (u->host)
-			W("host for '%s' changed from '%s' to '%s'!",
-			    u->nick, u->host, (*msg)[5]);
+	if (host && (!u->host || strcmp(u->host, host) != 0)) {
+		lsi_com_update_strprop(&u->host, host);
+		(*ctx->usergen)++;
+		dirty = true;
+	}
 
-		lsi_com_update_strprop(&u->host, (*msg)[5]);
+	if (fname && (!u->fname || strcmp(u->fname, fname) != 0)) {
+		lsi_com_update_strprop(&u->fname, fname);
+		dirty = true;
 	}
 
-	const char *fname = strchr((*msg)[9], ' ');
-	if (!fname)
+	if (acct && !*acct && u->acct) {
+		free(u->acct);
+		u->acct = NULL;
+		dirty = true;
+	} else if (acct && *acct && (!u->acct || strcmp(u->acct, acct) != 0)) {
+		lsi_com_update_strprop(&u->acct, acct);
+		dirty = true;
+	}
+
+	if (dirty)
+		lsi_ucb_dirty_user(ctx, u);
+
+	return;
+}
+
+/* `msg` is the away message ("" if we don't know it), NULL if back */
+static void
+upd_away(irc *ctx, user *u, const char *msg)
+{
+	if (!msg) {
+		free(u->away);
+		u->away = NULL;
+	} else
+		lsi_com_update_strprop(&u->away, msg);
+
+	lsi_ucb_dirty_user(ctx, u);
+	return;
+}
+
+/* account-notify: ":nick!uname@host ACCOUNT <account>", or "*" for logging
+ * out */
+static uint16_t
+h_ACCOUNT(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (!(*msg)[0] || nargs < 3)
 		return PROTO_ERR;
 
-	if (!u->fname || lsi_ut_istrcmp(u->fname, fname+1, ctx->casemap) != 0) {
-		if (u->fname)
-			W("fullname for '%s' changed from '%s' to '%s'!",
-			    u->nick, u->fname, fname+1);
+	user *u = lsi_ucb_touch_user_sp(ctx, &ctx->pfx, false);
+	if (u)
+		upd_details(ctx, u, NULL, NULL, NULL,
+		    strcmp((*msg)[2], "*") == 0 ? "" : (*msg)[2]);
+
+	return 0;
+}
 
-		lsi_com_update_strprop(&u->fname, fname+1);
-	}
+/* away-notify: ":nick!uname@host AWAY [:<message>]", without a message when
+ * they're back */
+static uint16_t
+h_AWAY(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (!(*msg)[0] || nargs < 2)
+		return PROTO_ERR;
+
+	user *u = lsi_ucb_get_user_sp(ctx, &ctx->pfx, false);
+	if (u)
+		upd_away(ctx, u, nargs > 2 ? (*msg)[2] : NULL);
 
 	return 0;
 }
 
-/*:rajaniemi.freenode.net 315 nvmme #fstd :End of /WHO list.*/
-//static uint16_t
-//h_315(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+/* chghost: ":nick!olduname@oldhost CHGHOST <uname> <host>" */
+static uint16_t
+h_CHGHOST(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (!(*msg)[0] || nargs < 4)
+		return PROTO_ERR;
+
+	user *u = lsi_ucb_get_user_sp(ctx, &ctx->pfx, false);
+	if (u)
+		upd_details(ctx, u, (*msg)[2], (*msg)[3], NULL, NULL);
+
+	return 0;
+}
+
+/* 331    RPL_NOTOPIC
+ * "<channel> :No topic is set" */
+static uint16_t
+h_331(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (!(*msg)[0] || nargs < 4)
+		return PROTO_ERR;
+
+	whoq_done(ctx, WQ_TOPIC, (*msg)[3]);
+	return 0;
+}
 
 static uint16_t
 h_332(irc *ctx, tokarr *msg, size_t nargs, bool logon)
@@ -184,11 +678,13 @@ h_332(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 	if (!(*msg)[0] || nargs < 5)
 		return PROTO_ERR;
 
-	chan *c = lsi_ucb_get_chan(ctx, (*msg)[3], true);
-	if (!c) {
-		W("we don't know channel '%s'!", (*msg)[3]);
+	whoq_done(ctx, WQ_TOPIC, (*msg)[3]);
+	chan *c = getchan(ctx, (*msg)[3]);
+	if (!c)
 		return 0;
-	}
+	lsi_ucb_dirty_chan(ctx, c);
+	/* this is the topic as it is (when joining, or refetched after
+	 * eviction), not a change -- those come as TOPIC, see h_TOPIC() */
 	free(c->topic);
 	if (!(c->topic = STRDUP((*msg)[4])))
 		return ALLOC_ERR;
@@ -202,11 +698,10 @@ h_333(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 	if (!(*msg)[0] || nargs < 6)
 		return PROTO_ERR;
 
-	chan *c = lsi_ucb_get_chan(ctx, (*msg)[3], true);
-	if (!c) {
-		W("we don't know channel '%s'!", (*msg)[3]);
+	chan *c = getchan(ctx, (*msg)[3]);
+	if (!c)
 		return 0;
-	}
+	lsi_ucb_dirty_chan(ctx, c);
 	free(c->topicnick);
 	if (!(c->topicnick = STRDUP((*msg)[4])))
 		return ALLOC_ERR;
@@ -222,53 +717,79 @@ h_353(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 	if (!(*msg)[0] || nargs < 6)
 		return PROTO_ERR;
 
-	chan *c = lsi_ucb_get_chan(ctx, (*msg)[4], true);
-	if (!c) {
-		W("we don't know channel '%s'!", (*msg)[4]);
+	chan *c = getchan(ctx, (*msg)[4]);
+	if (!c)
 		return 0;
-	}
 
-	if (ctx->endofnames) {
-		lsi_ucb_clear_memb(ctx, c);
-		ctx->endofnames = false;
+	/* first 353 of a NAMES reply; see who's left when the 366 comes */
+	if (!c->namesync) {
+		lsi_ucb_mark_memb(ctx, c);
+		c->namesync = true;
 	}
 
-	char nick[MAX_NICK_LEN];
-	const char *p = (*msg)[5];
+	/* the entries are cut out in place and fed to the tracker in
+	 * batches; the blanks are put back afterwards for whoever else
+	 * might want to look at this message */
+	struct namesent ents[NAMES_BATCH];
+	char *ends[NAMES_BATCH];
+	size_t n = 0;
+	bool fail = false;
+	char *p = (*msg)[5];
 	for (;;) {
-		char mpfx[2] = {'\0', '\0'};
+		while (*p == ' ')
+			p++;
+
+		if (*p) {
+			size_t np = 0;
+			while (ctx->isupp.pfxrank[(unsigned char)*p]
+			    && np + 1 < sizeof ents[n].mpfx)
+				ents[n].mpfx[np++] = *p++;
+			ents[n].mpfx[np] = '\0';
+
+			ents[n].ident = p;
+			if ((ends[n] = strchr(p, ' ')))
+				*ends[n] = '\0';
+
+			p = ends[n] ? ends[n] + 1 : p + strlen(p);
+			n++;
+		}
 
-		if (strchr(ctx->m005modepfx[1], *p))
-			mpfx[0] = *p++;
+		if (n == NAMES_BATCH || (!*p && n)) {
+			fail = fail || !lsi_ucb_sync_memb(ctx, c, ents, n);
+			for (size_t i = 0; i < n; i++)
+				if (ends[i])
+					*ends[i] = ' ';
+			n = 0;
+		}
 
-		const char *end = strchr(p, ' ');
-		if (!end)
-			end = p + strlen(p);
+		if (!*p)
+			break;
+	}
 
-		size_t len = end - p;
-		if (len >= sizeof nick)
-			len = sizeof nick - 1;
+	return fail ? ALLOC_ERR : 0;
+}
 
-		lsi_b_strNcpy(nick, p, len + 1);
+/* 322    RPL_LIST
+ * "<channel> <# visible> :<topic>"
+ *
+ * if we're in the channel (or about to be), the user count helps us size
+ * the maps before the NAMES reply comes flooding in */
+static uint16_t
+h_322(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (!(*msg)[0] || nargs < 5)
+		return PROTO_ERR;
 
-		user *u = lsi_ucb_get_user(ctx, nick, false);
-		bool uadd = false;
-		if (!u) {
-			uadd = true;
-			if (!(u = lsi_ucb_add_user(ctx, nick)))
-				return ALLOC_ERR;
-		}
+	chan *c = lsi_ucb_get_chan(ctx, (*msg)[3], false);
+	if (!c)
+		return 0;
 
-		if (!lsi_ucb_add_memb(ctx, c, u, mpfx)) {
-			if (uadd)
-				lsi_ucb_drop_user(ctx, u);
-			return ALLOC_ERR;
-		}
+	unsigned long long n = strtoull((*msg)[4], NULL, 10);
+	if (n > MAX_LISTHINT)
+		n = MAX_LISTHINT;
 
-		if (!*end)
-			break;
-		p = end + 1;
-	}
+	lsi_skmap_reserve(c->memb, (size_t)n);
+	lsi_skmap_reserve(ctx->users, lsi_ucb_num_users(ctx) + (size_t)n);
 
 	return 0;
 }
@@ -279,14 +800,19 @@ h_366(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 	if (!(*msg)[0] || nargs < 4)
 		return PROTO_ERR;
 
-	ctx->endofnames = true;
+	whoq_done(ctx, WQ_NAMES, (*msg)[3]);
 
-	chan *c = lsi_ucb_get_chan(ctx, (*msg)[3], true);
-	if (!c) {
-		W("we don't know channel '%s'!", (*msg)[3]);
+	chan *c = getchan(ctx, (*msg)[3]);
+	if (!c)
 		return 0;
+
+	if (c->namesync) {
+		c->namesync = false;
+		if (!lsi_ucb_sweep_memb(ctx, c))
+			return ALLOC_ERR;
 	}
 	c->desync = false;
+	lsi_tmem_enforce(ctx, false);
 
 	return 0;
 }
@@ -297,22 +823,29 @@ h_PART(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 	if (!(*msg)[0] || nargs < 3)
 		return PROTO_ERR;
 
-	char nick[MAX_NICK_LEN];
-	lsi_ut_ident2nick(nick, sizeof nick, (*msg)[0]);
-	lsi_ucb_touch_user(ctx, (*msg)[0], true);
+	const struct idspan *id = &ctx->pfx;
+	lsi_ucb_touch_user_sp(ctx, id, !ctx->trkfilt_on);
 
-	chan *c = lsi_ucb_get_chan(ctx, (*msg)[2], true);
+	bool me = isme(ctx, id);
+	chan *c = getchan(ctx, (*msg)[2]);
 	if (!c) {
-		W("we don't know channel '%s'!", (*msg)[2]);
+		if (me)
+			untrk_del(ctx, (*msg)[2]);
 		return 0;
 	}
 
-	if (lsi_ut_istrcmp(nick, ctx->mynick, ctx->casemap) == 0)
+	const char *reason = nargs > 3 ? (*msg)[3] : NULL;
+	memb *m = lsi_ucb_get_memb_sp(ctx, c, id, false);
+
+	if (me) {
+		ev_part(ctx, c, m, (*msg)[0], NULL, reason);
 		lsi_ucb_drop_chan(ctx, c);
-	else {
-		user *u = lsi_ucb_get_user(ctx, (*msg)[0], true);
-		if (u)
+	} else {
+		user *u = lsi_ucb_get_user_sp(ctx, id, true);
+		if (u) {
+			ev_part(ctx, c, m, (*msg)[0], NULL, reason);
 			lsi_ucb_drop_memb(ctx, c, u, true, true);
+		}
 	}
 
 	return 0;
@@ -324,103 +857,485 @@ h_QUIT(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 	if (!(*msg)[0])
 		return PROTO_ERR;
 
-	lsi_ucb_touch_user(ctx, (*msg)[0], true);
+	/* with a channel filter, we don't know everyone who can quit */
+	user *u = lsi_ucb_touch_user_sp(ctx, &ctx->pfx, !ctx->trkfilt_on);
+	if (!u)
+		return 0;
+
+	/* quits of a netsplit are applied in bulk once the batch ends.  not
+	 * with a shared user map though, where `quitting` would be seen by
+	 * contexts that haven't got to their own netsplit batch yet */
+	const char *bt = lsi_v3_batch_type(ctx);
+	bool bulk = bt && strcmp(bt, "netsplit") == 0 && !ctx->trkshared;
+
+	/* ...and reported in bulk, too, if there's a callback for that */
+	if (!u->quitting) {
+		if (bulk && ctx->cb_track.batch)
+			PROBE2(track_quit, ctx, u->nick); //see ev_netsplit()
+		else
+			ev_quit(ctx, u, nargs > 2 ? (*msg)[2] : NULL);
+	}
 
-	user *u = lsi_ucb_get_user(ctx, (*msg)[0], true);
-	if (u)
+	if (bulk) {
+		if (!u->quitting) {
+			u->quitting = true;
+			ctx->nsplit++;
+		}
+	} else
 		lsi_ucb_drop_user(ctx, u);
 
 	return 0;
 }
 
+/* BATCH +ref type [params]
+ * BATCH -ref */
 static uint16_t
-h_KICK(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+h_BATCH(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 {
-	if (!(*msg)[0] || nargs < 4)
+	if (nargs < 3)
 		return PROTO_ERR;
 
-	lsi_ucb_touch_user(ctx, (*msg)[0], true);
-	chan *c = lsi_ucb_get_chan(ctx, (*msg)[2], true);
-	if (!c) {
-		W("we don't know channel '%s'!", (*msg)[2]);
+	if ((*msg)[2][0] != '-')
 		return 0;
+
+	/* the batch table (v3.c) has already forgotten the batch; whatever is
+	 * pending belongs to it or to a batch that has ended before */
+	bool fail = false;
+	if (ctx->nsplit) {
+		D("applying netsplit of %zu users", ctx->nsplit);
+		ev_netsplit(ctx);
+		fail = !lsi_ucb_drop_quitting(ctx);
+		ctx->nsplit = 0;
 	}
 
-	if (lsi_ut_istrcmp((*msg)[3], ctx->mynick, ctx->casemap) == 0)
-		lsi_ucb_drop_chan(ctx, c);
-	else {
-		user *u = lsi_ucb_get_user(ctx, (*msg)[3], true);
-		if (u)
-			lsi_ucb_drop_memb(ctx, c, u, true, true);
+	if (ctx->njoin_cnt) {
+		D("applying netjoin of %zu memberships", ctx->njoin_cnt);
+		fail = !apply_netjoin(ctx) || fail;
 	}
 
-	return 0;
+	return fail ? ALLOC_ERR : 0;
 }
 
-static uint16_t
-h_NICK(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+/* entries are "chan\0ident\0acct\0fname"; with extended-join, `acct` is
+ * what the JOIN said ("*" if not logged in), otherwise "" and so is `fname` */
+static bool
+queue_netjoin(irc *ctx, const char *chan, const char *ident, const char *acct,
+    const char *fname)
 {
-	uint16_t res = 0;
+	if (ctx->njoin_cnt == ctx->njoin_sz) {
+		size_t nsz = ctx->njoin_sz ? ctx->njoin_sz * 2 : 64;
+		char **nj = MALLOC(nsz * sizeof *nj);
+		if (!nj)
+			return false;
+
+		if (ctx->njoin_cnt)
+			memcpy(nj, ctx->njoin, ctx->njoin_cnt * sizeof *nj);
+		free(ctx->njoin);
+		ctx->njoin = nj;
+		ctx->njoin_sz = nsz;
+	}
 
-	if (!(*msg)[0] || nargs < 3)
-		return PROTO_ERR;
+	if (!acct || !*acct)
+		acct = fname = "";
 
-	lsi_ucb_touch_user(ctx, (*msg)[0], true);
+	size_t clen = strlen(chan);
+	size_t ilen = strlen(ident);
+	size_t alen = strlen(acct);
+	size_t flen = strlen(fname);
+	char *e = MALLOC(clen + 1 + ilen + 1 + alen + 1 + flen + 1);
+	if (!e)
+		return false;
 
-	bool aerr;
-	if (!lsi_ucb_rename_user(ctx, (*msg)[0], (*msg)[2], &aerr)) {
-		E("failed renaming user '%s' ('%s')", (*msg)[0], (*msg)[2]);
-		if (aerr)
-			res |= ALLOC_ERR;
-	}
-	return res;
+	char *p = e;
+	memcpy(p, chan, clen + 1);
+	memcpy(p += clen + 1, ident, ilen + 1);
+	memcpy(p += ilen + 1, acct, alen + 1);
+	memcpy(p += alen + 1, fname, flen + 1);
+	ctx->njoin[ctx->njoin_cnt++] = e;
+	return true;
 }
 
-static uint16_t
-h_TOPIC(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+/* a queued netjoin membership, sorted by channel (see apply_netjoin()) */
+struct njent {
+	chan *c;  //NULL if we PARTed meanwhile
+	size_t i; //index in ctx->njoin, to keep the JOINs' order per channel
+};
+
+static int
+cmp_njent(const void *a, const void *b)
 {
-	if (!(*msg)[0] || nargs < 4)
-		return PROTO_ERR;
+	const struct njent *e1 = a, *e2 = b;
+	uintptr_t c1 = (uintptr_t)e1->c, c2 = (uintptr_t)e2->c;
+	if (c1 != c2)
+		return (c1 > c2) - (c1 < c2);
+	return (e1->i > e2->i) - (e1->i < e2->i);
+}
 
-	lsi_ucb_touch_user(ctx, (*msg)[0], true);
-	char nick[MAX_NICK_LEN];
-	lsi_ut_ident2nick(nick, sizeof nick, (*msg)[0]);
+/* add the queued netjoin memberships, one channel at a time, in batches the
+ * same way NAMES replies are added.  the queue is sorted by channel first, a
+ * netjoin can bring back thousands of memberships in hundreds of channels */
+static bool
+apply_netjoin(irc *ctx)
+{
+	struct namesent ents[NAMES_BATCH];
+	size_t idx[NAMES_BATCH];
+	size_t cnt = ctx->njoin_cnt;
+	bool fail = false;
 
-	chan *c = lsi_ucb_get_chan(ctx, (*msg)[2], true);
-	if (!c) {
-		W("we don't know channel '%s'!", (*msg)[2]);
-		return 0;
+	struct njent *q = MALLOC(cnt * sizeof *q);
+	if (!q) {
+		for (size_t i = 0; i < cnt; i++)
+			free(ctx->njoin[i]);
+		ctx->njoin_cnt = 0;
+		return false;
+	}
+
+	for (size_t i = 0; i < cnt; i++) {
+		q[i].c = lsi_ucb_get_chan(ctx, ctx->njoin[i], true);
+		q[i].i = i;
+	}
+
+	qsort(q, cnt, sizeof *q, cmp_njent);
+
+	/* who joined, if it's to be reported in one go (see ev_netjoin()) */
+	user **uj = ctx->cb_track.batch ? MALLOC(cnt * sizeof *uj) : NULL;
+	size_t n = 0, nj = 0;
+	for (size_t i = 0; i < cnt; i++) {
+		char *e = ctx->njoin[q[i].i];
+		ents[n].ident = e + strlen(e) + 1;
+		ents[n].mpfx[0] = '\0';
+		idx[n++] = q[i].i;
+
+		chan *c = q[i].c;
+		if (n < NAMES_BATCH && i + 1 < cnt && q[i + 1].c == c)
+			continue;
+
+		if (c) {
+			fail = !lsi_ucb_sync_memb(ctx, c, ents, n) || fail;
+			for (size_t k = 0; k < n; k++) {
+				memb *m = lsi_ucb_get_memb(ctx, c, ents[k].ident,
+				    false);
+				const char *acct = ents[k].ident
+				    + strlen(ents[k].ident) + 1;
+				if (m && *acct)
+					upd_details(ctx, m->u, NULL, NULL,
+					    acct + strlen(acct) + 1,
+					    strcmp(acct, "*") == 0 ? "" : acct);
+				if (!uj)
+					ev_join(ctx, c, m, NULL);
+				else if (m) {
+					PROBE3(track_join, ctx, c->name,
+					    m->u->nick);
+					uj[nj++] = m->u;
+				}
+			}
+		}
+
+		for (size_t k = 0; k < n; k++)
+			free(ctx->njoin[idx[k]]);
+		n = 0;
+	}
+
+	if (uj) {
+		ev_netjoin(ctx, uj, nj);
+		free(uj);
+	}
+
+	free(q);
+	ctx->njoin_cnt = 0;
+	return !fail;
+}
+
+/* forget queued netjoins; a netsplit whose batch never ended still happened */
+static void
+drop_pending(irc *ctx)
+{
+	if (ctx->nsplit)
+		lsi_ucb_drop_quitting(ctx);
+
+	for (size_t i = 0; i < ctx->njoin_cnt; i++)
+		free(ctx->njoin[i]);
+
+	free(ctx->njoin);
+	ctx->njoin = NULL;
+	ctx->njoin_cnt = ctx->njoin_sz = 0;
+	ctx->nsplit = 0;
+}
+
+/* With irc_set_track_whosync(), we WHO every channel we JOIN to learn the
+ * unames, hosts and fnames (and accounts, with WHOX) of its members.  Doing
+ * that for hundreds of channels at once would get us killed for flooding, so
+ * there's never more than one WHO out at a time; the next one is only sent
+ * once the server is done with the previous (315).  Channels we left by then
+ * are skipped.  What trkmem.c evicted is asked for again the same way (WHO
+ * for a user, TOPIC for a channel, see refetch_user()), since it's the user
+ * looking at it that brings it about, and they might look at a lot.  So is
+ * the NAMES, MODE and TOPIC for each channel a changed filter lets in (see
+ * refilter()), which ends with a 366, 324 and 331/332, respectively.
+ *
+ * Entries are the `kind` (WQ_*) followed by the name.  Nothing is sent from
+ * here, only from lsi_trk_tick() and the replies' handlers, so that queries
+ * like irc_user() never write to the server */
+static bool
+whoq_add(irc *ctx, char kind, const char *name)
+{
+	if (kind == WQ_CHAN && !ctx->whosync_on)
+		return true;
+
+	if (ctx->whoq_cnt == ctx->whoq_sz) {
+		/* reclaim the space taken by the ones already done */
+		size_t n = ctx->whoq_cnt - ctx->whoq_first;
+		size_t nsz = n * 2 > ctx->whoq_sz ? n * 2 : ctx->whoq_sz;
+		if (nsz < 16)
+			nsz = 16;
+
+		char **nq = MALLOC(nsz * sizeof *nq);
+		if (!nq)
+			return false;
+
+		if (n)
+			memcpy(nq, ctx->whoq + ctx->whoq_first, n * sizeof *nq);
+		free(ctx->whoq);
+		ctx->whoq = nq;
+		ctx->whoq_sz = nsz;
+		ctx->whoq_first = 0;
+		ctx->whoq_cnt = n;
+	}
+
+	size_t len = strlen(name);
+	char *e = MALLOC(len + 2);
+	if (!e)
+		return false;
+
+	e[0] = kind;
+	memcpy(e + 1, name, len + 1);
+	ctx->whoq[ctx->whoq_cnt++] = e;
+	return true;
+}
+
+void
+lsi_trk_tick(irc *ctx)
+{
+	if (!ctx->whocur[0] && ctx->whoq_first < ctx->whoq_cnt
+	    && irc_online(ctx))
+		whoq_next(ctx);
+	return;
+}
+
+static void
+whoq_next(irc *ctx)
+{
+	while (ctx->whoq_first < ctx->whoq_cnt) {
+		char *e = ctx->whoq[ctx->whoq_first++];
+		const char *name = e + 1;
+		bool ok = true, due;
+		switch (e[0]) {
+		case WQ_CHAN:
+			due = ctx->whosync_on
+			    && lsi_ucb_get_chan(ctx, name, false);
+			break;
+		case WQ_USER:
+			due = lsi_ucb_get_user(ctx, name, false);
+			break;
+		default:
+			due = lsi_ucb_get_chan(ctx, name, false);
+		}
+
+		if (due) {
+			const char *cmd = whoq_cmd(e[0]);
+			ok = e[0] != WQ_CHAN && e[0] != WQ_USER
+			    ? irc_printf(ctx, "%s %s", cmd, name)
+			    : ctx->isupp.whox
+			    ? irc_printf(ctx, "WHO %s %%tcuhnfar,%s", name,
+			    WHOX_TOKEN)
+			    : irc_printf(ctx, "WHO %s", name);
+			if (ok) {
+				STRACPY(ctx->whocur, name);
+				ctx->whokind = e[0];
+				ctx->whosent = lsi_b_tstamp_us();
+			} else
+				W("failed to send %s for '%s'", cmd, name);
+		}
+
+		free(e);
+		if (ctx->whocur[0] || !ok)
+			break;
+	}
+
+	if (ctx->whoq_first == ctx->whoq_cnt)
+		whoq_clear(ctx);
+
+	return;
+}
+
+/* the server is done with the `kind` request for `name`, if it was ours */
+static void
+whoq_done(irc *ctx, char kind, const char *name)
+{
+	if (!ctx->whocur[0] || ctx->whokind != kind
+	    || lsi_ut_istrcmp(name, ctx->whocur, ctx->casemap) != 0)
+		return;
+
+	ctx->whocur[0] = '\0';
+	whoq_next(ctx);
+	return;
+}
+
+/* what we send for a whoq entry of `kind` */
+static const char *
+whoq_cmd(char kind)
+{
+	return kind == WQ_TOPIC ? "TOPIC" :
+	       kind == WQ_NAMES ? "NAMES" :
+	       kind == WQ_MODE ? "MODE" : "WHO";
+}
+
+static void
+whoq_clear(irc *ctx)
+{
+	for (size_t i = ctx->whoq_first; i < ctx->whoq_cnt; i++)
+		free(ctx->whoq[i]);
+
+	free(ctx->whoq);
+	ctx->whoq = NULL;
+	ctx->whoq_first = ctx->whoq_cnt = ctx->whoq_sz = 0;
+	return;
+}
+
+/* queue asking for what was evicted from `u` (`c`) again, if anything */
+static void
+refetch_user(irc *ctx, user *u)
+{
+	if (u->evicted && irc_online(ctx) && whoq_add(ctx, WQ_USER, u->nick))
+		u->evicted = false;
+	return;
+}
+
+static void
+refetch_chan(irc *ctx, chan *c)
+{
+	if (c->evicted && irc_online(ctx) && whoq_add(ctx, WQ_TOPIC, c->name))
+		c->evicted = false;
+	return;
+}
+
+static uint16_t
+h_KICK(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (!(*msg)[0] || nargs < 4)
+		return PROTO_ERR;
+
+	lsi_ucb_touch_user_sp(ctx, &ctx->pfx, !ctx->trkfilt_on);
+	bool me = lsi_ut_istrcmp((*msg)[3], ctx->mynick, ctx->casemap) == 0;
+	chan *c = getchan(ctx, (*msg)[2]);
+	if (!c) {
+		if (me)
+			untrk_del(ctx, (*msg)[2]);
+		return 0;
+	}
+
+	char kicker[MAX_NICK_LEN];
+	lsi_ut_ident2nick(kicker, sizeof kicker, (*msg)[0]);
+	const char *reason = nargs > 4 ? (*msg)[4] : NULL;
+	memb *m = lsi_ucb_get_memb(ctx, c, (*msg)[3], false);
+
+	if (me) {
+		ev_part(ctx, c, m, (*msg)[3], kicker, reason);
+		lsi_ucb_drop_chan(ctx, c);
+	} else {
+		user *u = lsi_ucb_get_user(ctx, (*msg)[3], true);
+		if (u) {
+			ev_part(ctx, c, m, (*msg)[3], kicker, reason);
+			lsi_ucb_drop_memb(ctx, c, u, true, true);
+		}
 	}
-	free(c->topic);
-	free(c->topicnick);
-	c->topicnick = NULL;
-	if (!(c->topic = STRDUP((*msg)[3]))
-	    || !(c->topicnick = STRDUP(nick)))
-		return ALLOC_ERR;
 
 	return 0;
 }
 
 static uint16_t
-h_MODE_chanmode(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+h_NICK(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 {
 	uint16_t res = 0;
 
+	if (!(*msg)[0] || nargs < 3)
+		return PROTO_ERR;
+
+	char onick[MAX_NICK_LEN];
+	lsi_ut_ident2nick(onick, sizeof onick, (*msg)[0]);
+
+	/* a context sharing the user map with us may have seen this first and
+	 * renamed them for all of us (see trkshare.c) */
+	user *u;
+	if ((u = lsi_tsh_alias_del(ctx, (*msg)[0]))) {
+		ev_nick(ctx, u, onick);
+		return 0;
+	}
+
+	if (ctx->trkshared && !lsi_ucb_get_user_sp(ctx, &ctx->pfx, false)
+	    && (u = lsi_ucb_get_user(ctx, (*msg)[2], false))) {
+		ev_nick(ctx, u, onick);
+		return 0;
+	}
+
+	if (!lsi_ucb_touch_user_sp(ctx, &ctx->pfx, !ctx->trkfilt_on))
+		return 0;
+
+	bool aerr;
+	if (!lsi_ucb_rename_user(ctx, (*msg)[0], (*msg)[2], &aerr)) {
+		E("failed renaming user '%s' ('%s')", (*msg)[0], (*msg)[2]);
+		if (aerr)
+			res |= ALLOC_ERR;
+	} else
+		ev_nick(ctx, lsi_ucb_get_user(ctx, (*msg)[2], false), onick);
+
+	return res;
+}
+
+static uint16_t
+h_TOPIC(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
 	if (!(*msg)[0] || nargs < 4)
 		return PROTO_ERR;
 
+	lsi_ucb_touch_user_sp(ctx, &ctx->pfx, !ctx->trkfilt_on);
 	char nick[MAX_NICK_LEN];
 	lsi_ut_ident2nick(nick, sizeof nick, (*msg)[0]);
 
-	if (!strchr(nick, '.')) //servermode
-		lsi_ucb_touch_user(ctx, (*msg)[0], true);
-
-	chan *c = lsi_ucb_get_chan(ctx, (*msg)[2], true);
-	if (!c) {
-		W("we don't know channel '%s'!", (*msg)[2]);
+	chan *c = getchan(ctx, (*msg)[2]);
+	if (!c)
 		return 0;
+	lsi_ucb_dirty_chan(ctx, c);
+	char *otopic = c->topic;
+	free(c->topicnick);
+	c->topicnick = NULL;
+	if (!(c->topic = STRDUP((*msg)[3]))
+	    || !(c->topicnick = STRDUP(nick))) {
+		free(otopic);
+		return ALLOC_ERR;
 	}
 
+	ev_topic(ctx, c, otopic);
+	free(otopic);
+	return 0;
+}
+
+static uint16_t
+h_MODE_chanmode(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	uint16_t res = 0;
+
+	if (!(*msg)[0] || nargs < 4)
+		return PROTO_ERR;
+
+	const struct idspan *id = &ctx->pfx;
+	if (!memchr(id->nick, '.', id->nicklen)) //servermode
+		lsi_ucb_touch_user_sp(ctx, id, !ctx->trkfilt_on);
+
+	chan *c = getchan(ctx, (*msg)[2]);
+	if (!c)
+		return 0;
+
 	size_t num;
 	char **p = lsi_ut_parse_MODE(ctx, msg, &num, false);
 	if (!p)
@@ -428,10 +1343,25 @@ h_MODE_chanmode(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 
 	for (size_t i = 0; i < num; i++) {
 		bool enab = p[i][0] == '+';
-		char *ptr = strchr(ctx->m005modepfx[0], p[i][1]);
-		if (ptr) {
-			char sym = ctx->m005modepfx[1][ptr - ctx->m005modepfx[0]];
-			lsi_ucb_update_modepfx(ctx, c, p[i] + 3, sym, enab); //XXX chk
+		uint8_t rank = ctx->isupp.pfxmdrank[(unsigned char)p[i][1]];
+		if (rank) {
+			char sym = ctx->m005modepfx[1][rank - 1];
+			memb *m = lsi_ucb_get_memb(ctx, c, p[i] + 3, false);
+			char opfx[MAX_MODEPFX] = "";
+			if (m)
+				lsi_b_strNcpy(opfx, m->modepfx, sizeof opfx);
+
+			if (lsi_ucb_update_modepfx(ctx, c, p[i] + 3, sym, enab))
+				ev_prefix(ctx, c, m, opfx);
+			continue;
+		} else if (enab && p[i][2] == ' ' && lsi_ut_classify_chanmode(ctx,
+		    p[i][1]) == CHANMODE_CLASS_A) {
+			/* list modes carry who set them, and when */
+			char nick[MAX_NICK_LEN];
+			lsi_ut_ident2nick(nick, sizeof nick, (*msg)[0]);
+			if (!lsi_ucb_add_lmode(ctx, c, p[i][1], p[i] + 3, nick,
+			    lsi_b_tstamp_us() / 1000000u))
+				res |= ALLOC_ERR;
 		} else {
 			if (enab) {
 				if (!lsi_ucb_add_chanmode(ctx, c, p[i] + 1))
@@ -439,6 +1369,8 @@ h_MODE_chanmode(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 			} else
 				lsi_ucb_drop_chanmode(ctx, c, p[i] + 1);
 		}
+
+		ev_mode(ctx, c, p[i][1], enab, p[i][2] == ' ' ? p[i] + 3 : NULL);
 	}
 
 	for (size_t i = 0; i < num; i++)
@@ -469,11 +1401,9 @@ h_PRIVMSG(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 	if (!(*msg)[0] || nargs < 4)
 		return PROTO_ERR;
 
-	char nick[MAX_NICK_LEN];
-	lsi_ut_ident2nick(nick, sizeof nick, (*msg)[0]);
-
-	if (!logon && !strchr(nick, '.'))
-		lsi_ucb_touch_user(ctx, (*msg)[0], false);
+	const struct idspan *id = &ctx->pfx;
+	if (!logon && !memchr(id->nick, '.', id->nicklen))
+		lsi_ucb_touch_user_sp(ctx, id, false);
 
 	return 0;
 }
@@ -484,11 +1414,9 @@ h_NOTICE(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 	if (!(*msg)[0] || nargs < 4)
 		return PROTO_ERR;
 
-	char nick[MAX_NICK_LEN];
-	lsi_ut_ident2nick(nick, sizeof nick, (*msg)[0]);
-
-	if (!logon && !strchr(nick, '.'))
-		lsi_ucb_touch_user(ctx, (*msg)[0], false);
+	const struct idspan *id = &ctx->pfx;
+	if (!logon && !memchr(id->nick, '.', id->nicklen))
+		lsi_ucb_touch_user_sp(ctx, id, false);
 
 	return 0;
 }
@@ -502,11 +1430,11 @@ h_324(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 
 	uint16_t res = 0;
 
-	chan *c = lsi_ucb_get_chan(ctx, (*msg)[3], true);
-	if (!c) {
-		W("we don't know channel '%s'!", (*msg)[3]);
+	whoq_done(ctx, WQ_MODE, (*msg)[3]);
+
+	chan *c = getchan(ctx, (*msg)[3]);
+	if (!c)
 		return 0;
-	}
 
 	size_t num;
 	char **p = lsi_ut_parse_MODE(ctx, msg, &num, true);
@@ -532,6 +1460,157 @@ h_324(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 	return res;
 }
 
+/* the first PING after logon (and after irc_set_track_grace()'s grace
+ * period) marks the end of the time we give ourselves for re-JOINing
+ * channels we were in before a reconnect.  it's also a good time to see if
+ * we're over the memory cap (see trkmem.c), or a WHO got lost */
+static uint16_t
+h_PING(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	uint64_t now = lsi_b_tstamp_us();
+	if (!logon && now >= ctx->trkgrace_end)
+		lsi_ucb_sweep_stale(ctx);
+
+	if (ctx->whocur[0] && now - ctx->whosent >= WHOSYNC_TIMEOUT_US) {
+		W("no end of %s for '%s', moving on",
+		    whoq_cmd(ctx->whokind), ctx->whocur);
+		ctx->whocur[0] = '\0';
+		whoq_next(ctx);
+	}
+
+	lsi_tmem_enforce(ctx, false);
+
+	return 0;
+}
+
+/* one entry of a list mode's list (367, 348, 346, 728).
+ * `argi` is the index of the mask; the channel is always at 3.
+ * setter and timestamp are optional */
+static uint16_t
+lmode_entry(irc *ctx, tokarr *msg, size_t nargs, char mode, size_t argi)
+{
+	if (!(*msg)[0] || nargs < argi + 1)
+		return PROTO_ERR;
+
+	chan *c = getchan(ctx, (*msg)[3]);
+	if (!c)
+		return 0;
+
+	int ind = lsi_ucb_modeind(mode);
+	if (ind == -1)
+		return 0;
+
+	/* first line of a (re)listing; forget what we knew */
+	if (!(c->lmodes_sync & ((uint64_t)1 << ind))) {
+		lsi_ucb_clear_lmodes(ctx, c, mode);
+		c->lmodes_sync |= (uint64_t)1 << ind;
+	}
+
+	const char *setby = nargs > argi + 1 ? (*msg)[argi + 1] : NULL;
+	uint64_t tsset = nargs > argi + 2
+	    ? (uint64_t)strtoull((*msg)[argi + 2], NULL, 10) : 0;
+
+	if (!lsi_ucb_add_lmode(ctx, c, mode, (*msg)[argi], setby, tsset))
+		return ALLOC_ERR;
+
+	return 0;
+}
+
+/* end of a list mode's list (368, 349, 347, 729) */
+static uint16_t
+lmode_end(irc *ctx, tokarr *msg, size_t nargs, char mode)
+{
+	if (!(*msg)[0] || nargs < 4)
+		return PROTO_ERR;
+
+	chan *c = getchan(ctx, (*msg)[3]);
+	if (!c)
+		return 0;
+
+	int ind = lsi_ucb_modeind(mode);
+	if (ind == -1)
+		return 0;
+
+	/* an empty list comes without any entries to clear it */
+	if (!(c->lmodes_sync & ((uint64_t)1 << ind)))
+		lsi_ucb_clear_lmodes(ctx, c, mode);
+
+	c->lmodes_sync &= ~((uint64_t)1 << ind);
+	return 0;
+}
+
+/* 367    RPL_BANLIST
+ * "<channel> <banmask> [<setter> <time>]"
+ */
+static uint16_t
+h_367(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	return lmode_entry(ctx, msg, nargs, 'b', 4);
+}
+
+/* 368    RPL_ENDOFBANLIST */
+static uint16_t
+h_368(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	return lmode_end(ctx, msg, nargs, 'b');
+}
+
+/* 348    RPL_EXCEPTLIST
+ * "<channel> <exceptionmask> [<setter> <time>]"
+ */
+static uint16_t
+h_348(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	return lmode_entry(ctx, msg, nargs, 'e', 4);
+}
+
+/* 349    RPL_ENDOFEXCEPTLIST */
+static uint16_t
+h_349(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	return lmode_end(ctx, msg, nargs, 'e');
+}
+
+/* 346    RPL_INVITELIST
+ * "<channel> <invitemask> [<setter> <time>]"
+ */
+static uint16_t
+h_346(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	return lmode_entry(ctx, msg, nargs, 'I', 4);
+}
+
+/* 347    RPL_ENDOFINVITELIST */
+static uint16_t
+h_347(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	return lmode_end(ctx, msg, nargs, 'I');
+}
+
+/* 728    RPL_QUIETLIST (charybdis et al.)
+ * "<channel> <mode> <mask> [<setter> <time>]"
+ */
+static uint16_t
+h_728(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (!(*msg)[0] || nargs < 6)
+		return PROTO_ERR;
+
+	return lmode_entry(ctx, msg, nargs, (*msg)[4][0], 5);
+}
+
+/* 729    RPL_ENDOFQUIETLIST
+ * "<channel> <mode> :End of Channel Quiet List"
+ */
+static uint16_t
+h_729(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (!(*msg)[0] || nargs < 5)
+		return PROTO_ERR;
+
+	return lmode_end(ctx, msg, nargs, (*msg)[4][0]);
+}
+
 /* 302    RPL_USERHOST
  * ":*1<reply> *( " " <reply> )"
  * reply = nickname [ "*" ] "=" ( "+" / "-" ) hostname
@@ -551,36 +1630,189 @@ h_311(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 		return PROTO_ERR;
 
 	user *u = lsi_ucb_get_user(ctx, (*msg)[3], false);
-	if (!u)
-		return 0;
+	if (u)
+		upd_details(ctx, u, (*msg)[4], (*msg)[5], (*msg)[7], NULL);
 
-	if (!u->uname || lsi_ut_istrcmp(u->uname, (*msg)[4], ctx->casemap) != 0) {
-		if (u->uname)
-			W("username for '%s' changed from '%s' to '%s'!",
-			    u->nick, u->uname, (*msg)[4]);
+	return 0;
+}
 
-		lsi_com_update_strprop(&u->uname, (*msg)[4]);
-	}
 
-	if (!u->host || lsi_ut_istrcmp(u->host, (*msg)[5], ctx->casemap) != 0) {
-		if (u->host)
-			W("host for '%s' changed from '%s' to '%s'!",
-			    u->nick, u->host, (*msg)[5]);
 
-		lsi_com_update_strprop(&u->host, (*msg)[5]);
-	}
+/* change events, see struct irc_trkcb.  `ident` stands in for a member we
+ * don't (yet) have a membership for, e.g. ourselves before the NAMES reply */
+static void
+ev_join(irc *ctx, chan *c, memb *m, const char *ident)
+{
+	PROBE3(track_join, ctx, c->name, m ? m->u->nick : ident);
+	if (!ctx->cb_track.join)
+		return;
 
-	if (!u->fname || lsi_ut_istrcmp(u->fname, (*msg)[7], ctx->casemap) != 0) {
-		if (u->fname)
-			W("fullname for '%s' changed from '%s' to '%s'!",
-			    u->nick, u->fname, (*msg)[7]);
+	chanrep cr;
+	userrep ur;
+	char nick[MAX_NICK_LEN];
+	ctx->cb_track.join(ctx, mkchanrep(&cr, c),
+	    mkmembrep(ctx, &ur, m, ident, nick, sizeof nick), ctx->tag_track);
+	return;
+}
+
+static void
+ev_part(irc *ctx, chan *c, memb *m, const char *ident, const char *kicker,
+    const char *reason)
+{
+	PROBE3(track_part, ctx, c->name, m ? m->u->nick : ident);
+	if (!ctx->cb_track.part)
+		return;
 
-		lsi_com_update_strprop(&u->fname, (*msg)[7]);
+	chanrep cr;
+	userrep ur;
+	char nick[MAX_NICK_LEN];
+	ctx->cb_track.part(ctx, mkchanrep(&cr, c),
+	    mkmembrep(ctx, &ur, m, ident, nick, sizeof nick), kicker, reason,
+	    ctx->tag_track);
+	return;
+}
+
+static void
+ev_quit(irc *ctx, user *u, const char *reason)
+{
+	PROBE2(track_quit, ctx, u->nick);
+	if (!ctx->cb_track.quit)
+		return;
+
+	userrep ur;
+	ctx->cb_track.quit(ctx, mkuserrep(&ur, u, NULL), reason,
+	    ctx->tag_track);
+	return;
+}
+
+static void
+ev_nick(irc *ctx, user *u, const char *oldnick)
+{
+	PROBE3(track_nick, ctx, oldnick, u ? u->nick : NULL);
+	if (!ctx->cb_track.nick || !u)
+		return;
+
+	userrep ur;
+	ctx->cb_track.nick(ctx, mkuserrep(&ur, u, NULL), oldnick,
+	    ctx->tag_track);
+	return;
+}
+
+static void
+ev_prefix(irc *ctx, chan *c, memb *m, const char *oldpfx)
+{
+	PROBE3(track_prefix, ctx, c->name, m ? m->u->nick : NULL);
+	if (!ctx->cb_track.prefix || !m)
+		return;
+
+	chanrep cr;
+	userrep ur;
+	ctx->cb_track.prefix(ctx, mkchanrep(&cr, c),
+	    mkuserrep(&ur, m->u, m->modepfx), oldpfx, ctx->tag_track);
+	return;
+}
+
+static void
+ev_mode(irc *ctx, chan *c, char mode, bool set, const char *arg)
+{
+	PROBE4(track_mode, ctx, c->name, mode, set);
+	if (!ctx->cb_track.mode)
+		return;
+
+	chanrep cr;
+	ctx->cb_track.mode(ctx, mkchanrep(&cr, c), mode, set, arg,
+	    ctx->tag_track);
+	return;
+}
+
+static void
+ev_topic(irc *ctx, chan *c, const char *oldtopic)
+{
+	PROBE2(track_topic, ctx, c->name);
+	if (!ctx->cb_track.topic)
+		return;
+
+	chanrep cr;
+	ctx->cb_track.topic(ctx, mkchanrep(&cr, c), oldtopic, ctx->tag_track);
+	return;
+}
+
+/* the users QUIT in a netsplit batch, before they're dropped */
+static void
+ev_netsplit(irc *ctx)
+{
+	PROBE3(track_batch, ctx, true, ctx->nsplit);
+	if (!ctx->cb_track.batch)
+		return;
+
+	userrep one, *ur = MALLOC(ctx->nsplit * sizeof *ur);
+	size_t n = 0;
+	skmap_iter it;
+	user *u;
+	lsi_ucb_iter_users(ctx, &it);
+	while (lsi_skmap_iter_next(&it, NULL, (void **)&u)) {
+		if (!u->quitting)
+			continue;
+
+		if (ur && n < ctx->nsplit)
+			mkuserrep(&ur[n++], u, NULL);
+		else if (!ur) //no room for all of them; one at a time then
+			ctx->cb_track.batch(ctx, true, mkuserrep(&one, u, NULL),
+			    1, ctx->tag_track);
 	}
 
-	return 0;
+	if (n)
+		ctx->cb_track.batch(ctx, true, ur, n, ctx->tag_track);
+	free(ur);
+	return;
 }
 
+static int
+cmp_userp(const void *a, const void *b)
+{
+	uintptr_t u1 = (uintptr_t)*(user *const *)a;
+	uintptr_t u2 = (uintptr_t)*(user *const *)b;
+	return (u1 > u2) - (u1 < u2);
+}
+
+/* the users who JOINed in a netjoin batch; `ua` has one per membership, so
+ * a user who joined several channels is in there several times */
+static void
+ev_netjoin(irc *ctx, user **ua, size_t n)
+{
+	PROBE3(track_batch, ctx, false, n);
+	qsort(ua, n, sizeof *ua, cmp_userp);
+
+	size_t nu = 0;
+	for (size_t i = 0; i < n; i++)
+		if (!nu || ua[i] != ua[nu - 1])
+			ua[nu++] = ua[i];
+
+	userrep one, *ur = nu ? MALLOC(nu * sizeof *ur) : NULL;
+	for (size_t i = 0; i < nu; i++)
+		if (ur)
+			mkuserrep(&ur[i], ua[i], NULL);
+		else //no room for all of them; one at a time then
+			ctx->cb_track.batch(ctx, false,
+			    mkuserrep(&one, ua[i], NULL), 1, ctx->tag_track);
+
+	if (ur)
+		ctx->cb_track.batch(ctx, false, ur, nu, ctx->tag_track);
+	free(ur);
+	return;
+}
+
+void
+irc_regcb_track(irc *ctx, const struct irc_trkcb *cbs, void *tag)
+{
+	if (cbs)
+		ctx->cb_track = *cbs;
+	else
+		memset(&ctx->cb_track, 0, sizeof ctx->cb_track);
+
+	ctx->tag_track = tag;
+	return;
+}
 
 
 void
@@ -607,9 +1839,6 @@ lsi_trk_dump(irc *ctx, bool full)
 // :port80c.se.quakenet.org 324 mynick #srsbsns +sk *
 // :port80c.se.quakenet.org 329 mynick #srsbsns 1313083493
 
-static chanrep *mkchanrep(chanrep *dest, chan *c);
-static userrep *mkuserrep(userrep *dest, user *u, const char *modepfx);
-
 size_t
 irc_num_chans(irc *ctx)
 {
@@ -619,18 +1848,12 @@ irc_num_chans(irc *ctx)
 size_t
 irc_all_chans(irc *ctx, chanrep *chanarr, size_t chanarr_cnt)
 {
-	if (!chanarr_cnt)
-		return 0;
-
+	irc_chan_iter it;
 	size_t cnt = 0;
 
-	chan *c = lsi_ucb_first_chan(ctx);
-	if (!c)
-		return 0;
-
-	do {
-		mkchanrep(&chanarr[cnt++], c);
-	} while (cnt < chanarr_cnt && (c = lsi_ucb_next_chan(ctx)));
+	irc_chan_iter_init(ctx, &it);
+	while (cnt < chanarr_cnt && irc_chan_iter_next(&it, &chanarr[cnt]))
+		cnt++;
 
 	return cnt;
 }
@@ -644,6 +1867,7 @@ mkchanrep(chanrep *dest, chan *c)
 	dest->tscreate = c->tscreate;
 	dest->tstopic = c->tstopic;
 	dest->tag = c->tag;
+	c->tsread = lsi_b_tstamp_us();
 	return dest;
 }
 
@@ -654,6 +1878,7 @@ irc_chan(irc *ctx, chanrep *dest, const char *name)
 	if (!c)
 		return NULL;
 
+	refetch_chan(ctx, c);
 	return mkchanrep(dest, c);
 }
 
@@ -667,18 +1892,12 @@ irc_num_users(irc *ctx)
 size_t
 irc_all_users(irc *ctx, userrep *userarr, size_t userarr_cnt)
 {
-	if (!userarr_cnt)
-		return 0;
-
+	irc_user_iter it;
 	size_t cnt = 0;
 
-	user *u = lsi_ucb_first_user(ctx);
-	if (!u)
-		return 0;
-
-	do {
-		mkuserrep(&userarr[cnt++], u, NULL);
-	} while (cnt < userarr_cnt && (u = lsi_ucb_next_user(ctx)));
+	irc_user_iter_init(ctx, &it);
+	while (cnt < userarr_cnt && irc_user_iter_next(&it, &userarr[cnt]))
+		cnt++;
 
 	return cnt;
 }
@@ -686,16 +1905,42 @@ irc_all_users(irc *ctx, userrep *userarr, size_t userarr_cnt)
 static userrep *
 mkuserrep(userrep *dest, user *u, const char *modepfx)
 {
+	lsi_ucb_user_details(u);
 	dest->modepfx = modepfx;
 	dest->nick = u->nick;
 	dest->uname = u->uname;
 	dest->host = u->host;
 	dest->fname = u->fname;
+	dest->account = u->acct;
+	dest->away = u->away;
 	dest->tag = u->tag;
 	dest->nchans = u->nchans;
 	return dest;
 }
 
+/* a member, or just whatever `ident` tells if we have no membership (the
+ * nick then goes to `nick`) */
+static userrep *
+mkmembrep(irc *ctx, userrep *dest, memb *m, const char *ident, char *nick,
+    size_t nick_sz)
+{
+	if (m)
+		return mkuserrep(dest, m->u, m->modepfx);
+
+	user *u = lsi_ucb_get_user(ctx, ident, false);
+	if (u)
+		return mkuserrep(dest, u, "");
+
+	lsi_ut_ident2nick(nick, nick_sz, ident);
+	dest->modepfx = "";
+	dest->nick = nick;
+	dest->uname = dest->host = dest->fname = dest->account = NULL;
+	dest->away = NULL;
+	dest->nchans = 0;
+	dest->tag = NULL;
+	return dest;
+}
+
 userrep *
 irc_user(irc *ctx, userrep *dest, const char *ident)
 {
@@ -703,6 +1948,7 @@ irc_user(irc *ctx, userrep *dest, const char *ident)
 	if (!u)
 		return NULL;
 
+	refetch_user(ctx, u);
 	return mkuserrep(dest, u, NULL);
 }
 
@@ -720,26 +1966,69 @@ irc_num_members(irc *ctx, const char *chname)
 size_t
 irc_all_members(irc *ctx, const char *chname, userrep *userarr, size_t userarr_cnt)
 {
-	if (!userarr_cnt)
-		return 0;
+	irc_memb_iter it;
+	size_t cnt = 0;
 
-	chan *c = lsi_ucb_get_chan(ctx, chname, false);
+	irc_memb_iter_init(ctx, &it, chname);
+	while (cnt < userarr_cnt && irc_memb_iter_next(&it, &userarr[cnt]))
+		cnt++;
+
+	return cnt;
+}
+
+size_t
+irc_sorted_members(irc *ctx, const char *chnam, size_t first,
+    userrep *userarr, size_t userarr_cnt)
+{
+	chan *c = lsi_ucb_get_chan(ctx, chnam, false);
 	if (!c)
 		return 0;
 
 	size_t cnt = 0;
+	for (memb *m = lsi_mlist_at(&c->ml, first); m && cnt < userarr_cnt;
+	    m = m->lnk[0].next)
+		mkuserrep(&userarr[cnt++], m->u, m->modepfx);
 
-	memb *m = lsi_ucb_first_memb(ctx, c);
-	if (!m)
+	return cnt;
+}
+
+size_t
+irc_complete_member(irc *ctx, const char *chnam, const char *pfx,
+    userrep *userarr, size_t userarr_cnt)
+{
+	chan *c = lsi_ucb_get_chan(ctx, chnam, false);
+	if (!c)
 		return 0;
 
-	do {
-		mkuserrep(&userarr[cnt++], m->u, m->modepfx);
-	} while (cnt < userarr_cnt && (m = lsi_ucb_next_memb(ctx, c)));
+	/* within each rank, the candidates are next to each other */
+	size_t cnt = 0;
+	for (unsigned r = 0; r <= ctx->isupp.npfx; r++) {
+		unsigned rank = r < ctx->isupp.npfx ? r : MLIST_NORANK;
+		size_t pos;
+		memb *m = lsi_mlist_seek(&c->ml, rank, pfx, &pos);
+		for (; m && cnt < userarr_cnt; m = m->lnk[0].next) {
+			if (lsi_mlist_rank(m) != rank
+			    || !lsi_mlist_haspfx(&c->ml, m->u->nick, pfx))
+				break;
+
+			mkuserrep(&userarr[cnt++], m->u, m->modepfx);
+		}
+	}
 
 	return cnt;
 }
 
+size_t
+irc_num_prefixed(irc *ctx, const char *chnam, char sym)
+{
+	chan *c = lsi_ucb_get_chan(ctx, chnam, false);
+	uint8_t rank = ctx->isupp.pfxrank[(unsigned char)sym];
+	if (!c || !rank)
+		return 0;
+
+	return c->ml.npfx[rank - 1];
+}
+
 userrep *
 irc_member(irc *ctx, userrep *dest, const char *chname, const char *ident)
 {
@@ -751,16 +2040,336 @@ irc_member(irc *ctx, userrep *dest, const char *chname, const char *ident)
 	if (!m)
 		return NULL;
 
+	lsi_ucb_user_details(m->u);
+	refetch_user(ctx, m->u);
 	dest->modepfx = m->modepfx;
 	dest->nick = m->u->nick;
 	dest->uname = m->u->uname;
 	dest->host = m->u->host;
 	dest->fname = m->u->fname;
+	dest->account = m->u->acct;
+	dest->away = m->u->away;
 
 	return dest;
 }
 
 
+/* the public iterator is an skmap_iter in disguise */
+static void
+iter_load(skmap_iter *dst, const struct irc_iter *src)
+{
+	dst->m = src->map_;
+	dst->bit = src->bit_;
+	dst->pos = src->pos_;
+	return;
+}
+
+static void
+iter_save(struct irc_iter *dst, const skmap_iter *src)
+{
+	dst->map_ = src->m;
+	dst->bit_ = src->bit;
+	dst->pos_ = src->pos;
+	return;
+}
+
+static void *
+iter_next(struct irc_iter *it)
+{
+	skmap_iter si;
+	void *e;
+
+	iter_load(&si, it);
+	bool more = lsi_skmap_iter_next(&si, NULL, &e);
+	iter_save(it, &si);
+
+	return more ? e : NULL;
+}
+
+void
+irc_chan_iter_init(irc *ctx, irc_chan_iter *it)
+{
+	skmap_iter si;
+	lsi_ucb_iter_chans(ctx, &si);
+	iter_save(it, &si);
+	return;
+}
+
+chanrep *
+irc_chan_iter_next(irc_chan_iter *it, chanrep *dest)
+{
+	chan *c = iter_next(it);
+	return c ? mkchanrep(dest, c) : NULL;
+}
+
+void
+irc_user_iter_init(irc *ctx, irc_user_iter *it)
+{
+	skmap_iter si;
+	lsi_ucb_iter_users(ctx, &si);
+	iter_save(it, &si);
+	return;
+}
+
+userrep *
+irc_user_iter_next(irc_user_iter *it, userrep *dest)
+{
+	user *u = iter_next(it);
+	return u ? mkuserrep(dest, u, NULL) : NULL;
+}
+
+bool
+irc_memb_iter_init(irc *ctx, irc_memb_iter *it, const char *chnam)
+{
+	skmap_iter si = { NULL, 0, NULL };
+	chan *c = lsi_ucb_get_chan(ctx, chnam, false);
+	if (c)
+		lsi_ucb_iter_memb(ctx, c, &si);
+
+	iter_save(it, &si);
+	return c;
+}
+
+userrep *
+irc_memb_iter_next(irc_memb_iter *it, userrep *dest)
+{
+	memb *m = iter_next(it);
+	return m ? mkuserrep(dest, m->u, m->modepfx) : NULL;
+}
+
+size_t
+irc_foreach_chan(irc *ctx, irc_chan_visit_fn fn, void *arg)
+{
+	skmap_iter it;
+	chanrep r;
+	void *e;
+	size_t cnt = 0;
+
+	lsi_ucb_iter_chans(ctx, &it);
+	while (lsi_skmap_iter_next(&it, NULL, &e)) {
+		cnt++;
+		if (!fn(ctx, mkchanrep(&r, e), arg))
+			break;
+	}
+
+	return cnt;
+}
+
+size_t
+irc_foreach_user(irc *ctx, irc_user_visit_fn fn, void *arg)
+{
+	skmap_iter it;
+	userrep r;
+	void *e;
+	size_t cnt = 0;
+
+	lsi_ucb_iter_users(ctx, &it);
+	while (lsi_skmap_iter_next(&it, NULL, &e)) {
+		cnt++;
+		if (!fn(ctx, mkuserrep(&r, e, NULL), arg))
+			break;
+	}
+
+	return cnt;
+}
+
+size_t
+irc_foreach_member(irc *ctx, const char *chnam, irc_user_visit_fn fn,
+    void *arg)
+{
+	chan *c = lsi_ucb_get_chan(ctx, chnam, false);
+	if (!c)
+		return 0;
+
+	skmap_iter it;
+	userrep r;
+	void *e;
+	size_t cnt = 0;
+
+	lsi_ucb_iter_memb(ctx, c, &it);
+	while (lsi_skmap_iter_next(&it, NULL, &e)) {
+		memb *m = e;
+		cnt++;
+		if (!fn(ctx, mkuserrep(&r, m->u, m->modepfx), arg))
+			break;
+	}
+
+	return cnt;
+}
+
+/* nick!uname@host, with what we don't know left empty */
+static const char *
+mkident(char *dest, size_t destsz, user *u)
+{
+	lsi_ucb_user_details(u);
+	size_t nl = strlen(u->nick);
+	size_t ul = u->uname ? strlen(u->uname) : 0;
+	size_t hl = u->host ? strlen(u->host) : 0;
+	if (nl + ul + hl + 3 > destsz)
+		return NULL;
+
+	char *p = dest;
+	memcpy(p, u->nick, nl);
+	p += nl;
+	*p++ = '!';
+	if (ul)
+		memcpy(p, u->uname, ul);
+	p += ul;
+	*p++ = '@';
+	if (hl)
+		memcpy(p, u->host, hl);
+	p += hl;
+	*p = '\0';
+	return dest;
+}
+
+/* see irc_match_members(); c is NULL for irc_match_users() */
+static size_t
+match_users(irc *ctx, chan *c, const char *mask, irc_user_visit_fn fn,
+    void *arg)
+{
+	struct mask mk;
+	if (!lsi_mask_init(&mk, mask, ctx->trkcasemap))
+		return 0;
+
+	char ident[MAX_NICK_LEN + MAX_UNAME_LEN + MAX_HOST_LEN + 3];
+	userrep r;
+	size_t cnt = 0;
+
+	/* with a host suffix to go by, and fewer users having it than we
+	 * would otherwise look at, only look at those */
+	const char *sfx;
+	size_t sfxlen, first = 0, n = SIZE_MAX;
+	if (ctx->hostidx_on && (sfx = lsi_mask_hostsfx(&mk, &sfxlen)))
+		n = lsi_hidx_range(ctx, sfx, sfxlen, &first);
+
+	if (n < (c ? lsi_ucb_num_memb(ctx, c) : lsi_ucb_num_users(ctx))) {
+		for (size_t i = first; i < first + n; i++) {
+			user *u = lsi_hidx_user(ctx, i);
+			memb *m = c ? lsi_skmap_get(c->memb, u->nick) : NULL;
+			if ((c && !m) || !mkident(ident, sizeof ident, u)
+			    || !lsi_mask_match(&mk, ident))
+				continue;
+
+			cnt++;
+			if (!fn(ctx, mkuserrep(&r, u, m ? m->modepfx : ""), arg))
+				break;
+		}
+
+		lsi_mask_fini(&mk);
+		return cnt;
+	}
+
+	skmap_iter it;
+	void *e;
+	if (c)
+		lsi_ucb_iter_memb(ctx, c, &it);
+	else
+		lsi_ucb_iter_users(ctx, &it);
+
+	while (lsi_skmap_iter_next(&it, NULL, &e)) {
+		memb *m = c ? e : NULL;
+		user *u = c ? m->u : e;
+		if (!mkident(ident, sizeof ident, u)
+		    || !lsi_mask_match(&mk, ident))
+			continue;
+
+		cnt++;
+		if (!fn(ctx, mkuserrep(&r, u, m ? m->modepfx : ""), arg))
+			break;
+	}
+
+	lsi_mask_fini(&mk);
+	return cnt;
+}
+
+size_t
+irc_match_members(irc *ctx, const char *chnam, const char *mask,
+    irc_user_visit_fn fn, void *arg)
+{
+	chan *c = lsi_ucb_get_chan(ctx, chnam, false);
+	if (!c)
+		return 0;
+
+	return match_users(ctx, c, mask, fn, arg);
+}
+
+size_t
+irc_match_users(irc *ctx, const char *mask, irc_user_visit_fn fn, void *arg)
+{
+	if (!ctx->users)
+		return 0;
+
+	return match_users(ctx, NULL, mask, fn, arg);
+}
+
+
+bool
+irc_chanmode(irc *ctx, const char *chnam, char mode, const char **arg)
+{
+	chan *c = lsi_ucb_get_chan(ctx, chnam, false);
+	if (!c) {
+		if (arg)
+			*arg = NULL;
+		return false;
+	}
+
+	return lsi_ucb_get_chanmode(ctx, c, mode, arg);
+}
+
+size_t
+irc_num_chanlist(irc *ctx, const char *chnam, char mode)
+{
+	chan *c = lsi_ucb_get_chan(ctx, chnam, false);
+	if (!c)
+		return 0;
+
+	return lsi_ucb_num_lmodes(ctx, c, mode);
+}
+
+size_t
+irc_all_chanlist(irc *ctx, const char *chnam, char mode,
+    const char **maskarr, size_t maskarr_cnt)
+{
+	if (!maskarr_cnt)
+		return 0;
+
+	chan *c = lsi_ucb_get_chan(ctx, chnam, false);
+	if (!c)
+		return 0;
+
+	skmap_iter it;
+	char *mask;
+	size_t cnt = 0;
+
+	lsi_ucb_iter_lmodes(ctx, c, mode, &it);
+	while (cnt < maskarr_cnt && lsi_skmap_iter_next(&it, &mask, NULL))
+		maskarr[cnt++] = mask;
+
+	return cnt;
+}
+
+bool
+irc_chanlist_has(irc *ctx, const char *chnam, char mode, const char *mask,
+    const char **setby, uint64_t *tsset)
+{
+	chan *c = lsi_ucb_get_chan(ctx, chnam, false);
+	if (!c)
+		return false;
+
+	lmode *lm = lsi_ucb_get_lmode(ctx, c, mode, mask);
+	if (!lm)
+		return false;
+
+	if (setby)
+		*setby = lm->setby;
+	if (tsset)
+		*tsset = lm->tsset;
+
+	return true;
+}
+
+
 bool
 irc_tag_chan(irc *ctx, const char *chname, void *tag, bool autofree)
 {
@@ -8,6 +8,10 @@
 
 bool lsi_trk_init(irc *ctx);
 void lsi_trk_deinit(irc *ctx);
+void lsi_trk_suspend(irc *ctx);
+
+/* send what's due (see whoq_add() in irc_track.c) */
+void lsi_trk_tick(irc *ctx);
 
 
 #endif /* LIBSRSIRC_IRC_TRACK_INT_H */
@@ -0,0 +1,221 @@
+/* keepalive.c - library-driven PING/PONG and lag measurement
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_IRC
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include "keepalive.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <platform/base_string.h>
+#include <platform/base_time.h>
+
+#include <logger/intlog.h>
+
+#include <libsrsirc/irc_ext.h>
+
+#include "common.h"
+#include "conn.h"
+#include "intdefs.h"
+#include "msg.h"
+
+/* Only one PING of ours is out at a time.  It carries a token, which the
+ * PONG has to echo for it to count; PONGs to PINGs we already gave up on (or
+ * to the user's PINGs) are thus ignored.  Our PINGs and PONGs are written
+ * straight to the connection, without going through irc_write(), which would
+ * irc_reset() the context on failure while irc_read() is still using it. */
+
+
+static bool ping(irc *ctx, uint64_t now);
+static void record(irc *ctx, uint64_t rtt);
+
+static uint16_t h_PING(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_PONG(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+
+
+void
+irc_set_keepalive(irc *ctx, uint64_t idle_us, unsigned maxmiss)
+{
+	if (!ctx->kaidle) {
+		/* don't count the time it was off as idle */
+		ctx->kalastrx = lsi_b_tstamp_us();
+		ctx->kasent = 0;
+		ctx->kamissed = 0;
+	}
+
+	ctx->kaidle = idle_us;
+	ctx->kamaxmiss = maxmiss;
+	return;
+}
+
+bool
+irc_lag_stats(irc *ctx, struct irc_lagstats *dest)
+{
+	*dest = ctx->lag;
+	return ctx->lag.npong > 0;
+}
+
+
+bool
+lsi_ka_regall(irc *ctx, bool dumb)
+{
+	bool fail = false;
+	if (dumb)
+		return true;
+
+	fail = fail || !lsi_msg_reghnd(ctx, "PING", h_PING, "keepalive");
+	fail = fail || !lsi_msg_reghnd(ctx, "PONG", h_PONG, "keepalive");
+
+	return !fail;
+}
+
+void
+lsi_ka_unregall(irc *ctx)
+{
+	lsi_msg_unregall(ctx, "keepalive");
+	return;
+}
+
+void
+lsi_ka_reset(irc *ctx)
+{
+	memset(&ctx->lag, 0, sizeof ctx->lag);
+	ctx->kalastrx = lsi_b_tstamp_us();
+	ctx->kasent = 0;
+	ctx->kamissed = 0;
+	ctx->katok[0] = '\0';
+	return;
+}
+
+void
+lsi_ka_rx(irc *ctx)
+{
+	if (ctx->kaidle)
+		ctx->kalastrx = lsi_b_tstamp_us();
+	return;
+}
+
+bool
+lsi_ka_tick(irc *ctx)
+{
+	if (!ctx->kaidle || ctx->dumb || !irc_online(ctx))
+		return true;
+
+	uint64_t now = lsi_b_tstamp_us();
+	if (ctx->kasent) {
+		if (now - ctx->kasent < ctx->kaidle)
+			return true;
+
+		ctx->lag.nmissed++;
+		ctx->kamissed++;
+		W("no PONG within %" PRIu64 " ms (%u in a row)",
+		    ctx->kaidle / 1000, ctx->kamissed);
+
+		if (ctx->kamaxmiss && ctx->kamissed >= ctx->kamaxmiss) {
+			E("server didn't answer %u PINGs, giving up",
+			    ctx->kamissed);
+			lsi_com_update_strprop(&ctx->lasterr,
+			    "Ping timeout (no PONG from server)");
+			return false;
+		}
+	} else if (now - ctx->kalastrx < ctx->kaidle)
+		return true;
+
+	return ping(ctx, now);
+}
+
+uint64_t
+lsi_ka_due(irc *ctx)
+{
+	if (!ctx->kaidle || ctx->dumb || !irc_online(ctx))
+		return 0;
+
+	uint64_t now = lsi_b_tstamp_us();
+	uint64_t due = (ctx->kasent ? ctx->kasent : ctx->kalastrx) + ctx->kaidle;
+
+	return due > now ? due - now : 1;
+}
+
+
+static bool
+ping(irc *ctx, uint64_t now)
+{
+	char buf[64];
+	snprintf(ctx->katok, sizeof ctx->katok, "lsi%" PRIx64, now);
+	snprintf(buf, sizeof buf, "PING :%s\r\n", ctx->katok);
+
+	if (!lsi_conn_write(ctx->con, buf))
+		return false;
+
+	ctx->kasent = now;
+	ctx->lag.nping++;
+	return true;
+}
+
+static void
+record(irc *ctx, uint64_t rtt)
+{
+	struct irc_lagstats *st = &ctx->lag;
+	if (!st->npong || rtt < st->min_us)
+		st->min_us = rtt;
+	if (rtt > st->max_us)
+		st->max_us = rtt;
+
+	st->last_us = rtt;
+	st->sum_us += rtt;
+	st->npong++;
+
+	size_t i = 0;
+	for (uint64_t ms = rtt / 1000; ms && i < IRC_LAG_NBUCK - 1; ms >>= 1)
+		i++;
+
+	st->hist[i]++;
+	return;
+}
+
+
+/* logon-time PINGs are answered by the core handler */
+static uint16_t
+h_PING(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (logon || !ctx->kaidle)
+		return 0;
+
+	if (nargs < 3)
+		return PROTO_ERR;
+
+	char buf[256];
+	snprintf(buf, sizeof buf, "PONG :%s\r\n", (*msg)[2]);
+	if (!lsi_conn_write(ctx->con, buf))
+		return IO_ERR;
+
+	ctx->lag.nanswered++;
+	return 0;
+}
+
+/* :server PONG server :token */
+static uint16_t
+h_PONG(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (!ctx->kasent || nargs < 3)
+		return 0;
+
+	if (strcmp((*msg)[nargs - 1], ctx->katok) != 0)
+		return 0;
+
+	uint64_t rtt = lsi_b_tstamp_us() - ctx->kasent;
+	D("PONG after %" PRIu64 " us", rtt);
+	record(ctx, rtt);
+	ctx->kasent = 0;
+	ctx->kamissed = 0;
+	ctx->katok[0] = '\0';
+	return 0;
+}
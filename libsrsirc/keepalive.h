@@ -0,0 +1,32 @@
+/* keepalive.h - library-driven PING/PONG and lag measurement, interface
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_KEEPALIVE_H
+#define LIBSRSIRC_KEEPALIVE_H 1
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <libsrsirc/defs.h>
+
+
+bool lsi_ka_regall(irc *ctx, bool dumb);
+void lsi_ka_unregall(irc *ctx);
+
+/* we're (re)connecting; start counting over */
+void lsi_ka_reset(irc *ctx);
+
+/* we heard from the server */
+void lsi_ka_rx(irc *ctx);
+
+/* PING if due; false if the connection is to be considered dead.  called by
+ * irc_read() */
+bool lsi_ka_tick(irc *ctx);
+
+/* microseconds until lsi_ka_tick() will have something to do, 0 if never */
+uint64_t lsi_ka_due(irc *ctx);
+
+
+#endif /* LIBSRSIRC_KEEPALIVE_H */
@@ -0,0 +1,201 @@
+/* mask.c - compiled IRC mask (nick!user@host glob) matcher
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_TRACK
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include "mask.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/base_misc.h>
+
+#include <logger/intlog.h>
+
+#include "cmap.h"
+
+/* A mask is split at its runs of '*' into pieces, which are casefolded once
+ * at compile time.  Matching casefolds the subject (one table lookup per
+ * char), then checks the anchored first and last piece with memcmp() and
+ * looks for the ones in between, in order, leftmost first.  Since pieces
+ * have a fixed length ('?' matches exactly one char), that's all there is
+ * to it; no backtracking.  The search skips to candidates with memchr(),
+ * which libc vectorizes. */
+
+/* subjects (idents) are short; longer ones are folded into the heap */
+#define FOLDBUF_SZ 512
+
+
+static bool segeq(const struct maskseg *sg, const char *s);
+static const char *segfind(const struct maskseg *sg, const char *s,
+    const char *end);
+
+
+bool
+lsi_mask_init(mask *m, const char *str, int casemap)
+{
+	size_t len = strlen(str);
+	m->cmap = g_cmap[CMAP_WHOLE(casemap)];
+	m->anchl = len && str[0] != '*';
+	m->anchr = len && str[len-1] != '*';
+	m->nostar = !strchr(str, '*');
+	m->minlen = 0;
+	m->nseg = 0;
+
+	/* at most (len+1)/2 pieces, the folded text goes right behind them */
+	size_t maxseg = len / 2 + 1;
+	if (!(m->seg = MALLOC(maxseg * sizeof *m->seg + len + 1)))
+		return false;
+
+	char *pat = (char *)(m->seg + maxseg);
+	const char *p = str;
+	while (*p) {
+		while (*p == '*')
+			p++;
+
+		if (!*p)
+			break;
+
+		struct maskseg *sg = &m->seg[m->nseg++];
+		sg->s = pat;
+		sg->anyc = false;
+		for (; *p && *p != '*'; p++) {
+			if (*p == '?')
+				sg->anyc = true;
+			*pat++ = (char)m->cmap[(unsigned char)*p]; //'?' stays
+		}
+
+		sg->len = (size_t)(pat - sg->s);
+		m->minlen += sg->len;
+	}
+
+	return true;
+}
+
+void
+lsi_mask_fini(mask *m)
+{
+	free(m->seg);
+	m->seg = NULL;
+	return;
+}
+
+static bool
+segeq(const struct maskseg *sg, const char *s)
+{
+	if (!sg->anyc)
+		return memcmp(sg->s, s, sg->len) == 0;
+
+	for (size_t i = 0; i < sg->len; i++)
+		if (sg->s[i] != '?' && sg->s[i] != s[i])
+			return false;
+
+	return true;
+}
+
+/* leftmost occurrence of `sg` in [s, end) */
+static const char *
+segfind(const struct maskseg *sg, const char *s, const char *end)
+{
+	if ((size_t)(end - s) < sg->len)
+		return NULL;
+
+	const char *last = end - sg->len; //last possible start
+	if (sg->anyc || sg->s[0] == '?') {
+		for (; s <= last; s++)
+			if (segeq(sg, s))
+				return s;
+		return NULL;
+	}
+
+	while (s <= last) {
+		const char *c = memchr(s, sg->s[0], (size_t)(last - s) + 1);
+		if (!c)
+			return NULL;
+
+		if (memcmp(c + 1, sg->s + 1, sg->len - 1) == 0)
+			return c;
+
+		s = c + 1;
+	}
+
+	return NULL;
+}
+
+bool
+lsi_mask_match(const mask *m, const char *str)
+{
+	size_t len = strlen(str);
+	if (len < m->minlen || (m->nostar && len != m->minlen))
+		return false;
+
+	if (!m->nseg)
+		return true; //"*" (or "" against "")
+
+	char fbuf[FOLDBUF_SZ];
+	char *s = len < sizeof fbuf ? fbuf : MALLOC(len);
+	if (!s)
+		return false;
+
+	for (size_t i = 0; i < len; i++)
+		s[i] = (char)m->cmap[(unsigned char)str[i]];
+
+	bool res = false;
+	const char *pos = s, *end = s + len;
+	size_t first = 0, last = m->nseg;
+
+	if (m->anchl) {
+		if (!segeq(&m->seg[0], s))
+			goto done;
+		pos += m->seg[0].len;
+		first++;
+	}
+
+	if (m->anchr && first < last) {
+		const struct maskseg *sg = &m->seg[last-1];
+		if ((size_t)(end - pos) < sg->len
+		    || !segeq(sg, end - sg->len))
+			goto done;
+		end -= sg->len;
+		last--;
+	}
+
+	for (size_t i = first; i < last; i++) {
+		const char *f = segfind(&m->seg[i], pos, end);
+		if (!f)
+			goto done;
+		pos = f + m->seg[i].len;
+	}
+
+	res = true;
+
+done:
+	if (s != fbuf)
+		free(s);
+
+	return res;
+}
+
+const char *
+lsi_mask_hostsfx(const mask *m, size_t *len)
+{
+	if (!m->anchr || !m->nseg)
+		return NULL;
+
+	/* the host is last in an ident, so the literal tail of the last piece
+	 * (back to a '@' or '?') is a suffix of it; without an '@' it can't
+	 * reach into the user part, as hosts don't contain any */
+	const struct maskseg *sg = &m->seg[m->nseg-1];
+	const char *s = sg->s + sg->len;
+	while (s > sg->s && s[-1] != '@' && s[-1] != '?')
+		s--;
+
+	*len = (size_t)(sg->s + sg->len - s);
+	return *len ? s : NULL;
+}
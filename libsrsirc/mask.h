@@ -0,0 +1,44 @@
+/* mask.h - compiled IRC mask (nick!user@host glob) matcher, interface
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_MASK_H
+#define LIBSRSIRC_MASK_H 1
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* a piece of the mask between two runs of '*' */
+struct maskseg {
+	const char *s; //casefolded, not NUL-terminated
+	size_t len;
+	bool anyc; //contains '?'
+};
+
+typedef struct mask {
+	const uint8_t *cmap;
+	struct maskseg *seg; //the non-empty pieces, in order
+	size_t nseg;
+	bool anchl; //mask doesn't start with '*', seg[0] is a prefix
+	bool anchr; //mask doesn't end with '*', seg[nseg-1] is a suffix
+	bool nostar; //no '*' at all; must match exactly
+	size_t minlen; //sum of the lengths of all pieces
+} mask;
+
+
+/* compile `str` for matching according to CASEMAPPING `casemap` */
+bool lsi_mask_init(mask *m, const char *str, int casemap);
+void lsi_mask_fini(mask *m);
+
+bool lsi_mask_match(const mask *m, const char *str);
+
+/* a literal the host part of anything matching `m` must end with, NULL if
+ * there is none we can tell (e.g. "*!*@*.example.com" -> ".example.com").
+ * it's casefolded and not NUL-terminated */
+const char *lsi_mask_hostsfx(const mask *m, size_t *len);
+
+
+#endif /* LIBSRSIRC_MASK_H */
@@ -0,0 +1,238 @@
+/* mlist.c - channel members ordered by prefix rank and nick
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_UCBASE
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include "mlist.h"
+
+#include <string.h>
+
+#include <logger/intlog.h>
+
+#include "cmap.h"
+#include "ucbase.h"
+
+/* An indexable skip list, kept next to the member map of a channel.  The
+ * nodes are the members themselves (struct member ends in its links), so
+ * adding and removing doesn't allocate.  Members are ordered by the rank of
+ * their strongest prefix (ops first, no prefix last), then by casefolded
+ * nick.  Every link also knows how many positions it skips, which gets us
+ * to the i-th member in O(log n).
+ *
+ * The order depends on nick and prefixes, so members must be taken out
+ * before either changes, and put back in afterwards; see ucbase.c */
+
+
+static int keycmp(const mlist *l, const memb *m, unsigned rank,
+    const char *nick);
+static const memb *findpred(const mlist *l, unsigned rank, const char *nick,
+    const memb *stop, memb **upd, size_t *pos);
+
+
+#define LINKS(L, N) ((N) ? (N)->lnk : (L)->head)
+
+
+void
+lsi_mlist_init(mlist *l, int casemap)
+{
+	for (size_t i = 0; i < MLIST_MAXLVL; i++) {
+		l->head[i].next = NULL;
+		l->head[i].width = 0;
+	}
+
+	for (size_t i = 0; i < 32; i++)
+		l->npfx[i] = 0;
+
+	l->lvl = 1;
+	l->len = 0;
+	l->cmap = g_cmap[casemap];
+	return;
+}
+
+uint8_t
+lsi_mlist_rndlvl(uint32_t *seed)
+{
+	/* xorshift32; two bits per level, i.e. p = 1/4 */
+	uint32_t x = *seed ? *seed : 0x2545f491;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	*seed = x;
+
+	uint8_t lvl = 1;
+	while (lvl < MLIST_MAXLVL && (x & 3) == 0) {
+		lvl++;
+		x >>= 2;
+	}
+
+	return lvl;
+}
+
+unsigned
+lsi_mlist_rank(const memb *m)
+{
+	unsigned r = 0;
+	while (r < MLIST_NORANK && !(m->pfxmask & ((uint32_t)1 << r)))
+		r++;
+	return r;
+}
+
+/* <0, 0, >0 if `m` is ordered before, at, after (`rank`, `nick`) */
+static int
+keycmp(const mlist *l, const memb *m, unsigned rank, const char *nick)
+{
+	unsigned mr = lsi_mlist_rank(m);
+	if (mr != rank)
+		return mr < rank ? -1 : 1;
+
+	const unsigned char *a = (const unsigned char *)m->u->nick;
+	const unsigned char *b = (const unsigned char *)nick;
+	while (*a && l->cmap[*a] == l->cmap[*b])
+		a++, b++;
+
+	return (int)l->cmap[*a] - (int)l->cmap[*b];
+}
+
+bool
+lsi_mlist_haspfx(const mlist *l, const char *nick, const char *pfx)
+{
+	const unsigned char *a = (const unsigned char *)nick;
+	const unsigned char *b = (const unsigned char *)pfx;
+	while (*b && l->cmap[*a] == l->cmap[*b])
+		a++, b++;
+
+	return !*b;
+}
+
+/* the last node ordered before (`rank`, `nick`) (NULL for the head), and its
+ * position (head is 0, nodes count from 1).  if `upd` is given, it gets the
+ * last node before on every level, `pos` their positions.  the search never
+ * goes past `stop`, whose own key may be stale (see lsi_mlist_del()) */
+static const memb *
+findpred(const mlist *l, unsigned rank, const char *nick, const memb *stop,
+    memb **upd, size_t *pos)
+{
+	const memb *x = NULL;
+	size_t p = 0;
+	for (int i = l->lvl - 1; i >= 0; i--) {
+		const memb *nx;
+		while ((nx = LINKS(l, x)[i].next) && nx != stop
+		    && keycmp(l, nx, rank, nick) < 0) {
+			p += LINKS(l, x)[i].width;
+			x = nx;
+		}
+
+		if (upd) {
+			upd[i] = (memb *)x;
+			pos[i] = p;
+		}
+	}
+
+	if (!upd)
+		*pos = p;
+
+	return x;
+}
+
+void
+lsi_mlist_add(mlist *l, memb *m)
+{
+	memb *upd[MLIST_MAXLVL];
+	size_t pos[MLIST_MAXLVL];
+	findpred(l, lsi_mlist_rank(m), m->u->nick, NULL, upd, pos);
+
+	int lvl = m->lvl;
+	for (int i = l->lvl; i < lvl; i++) {
+		upd[i] = NULL;
+		pos[i] = 0;
+	}
+
+	if (lvl > l->lvl)
+		l->lvl = lvl;
+
+	size_t at = pos[0] + 1; //where m goes
+	for (int i = 0; i < lvl; i++) {
+		struct mlink *pl = &LINKS(l, upd[i])[i];
+		m->lnk[i].next = pl->next;
+		m->lnk[i].width = pl->next ? pos[i] + pl->width + 1 - at : 0;
+		pl->next = m;
+		pl->width = at - pos[i];
+	}
+
+	for (int i = lvl; i < l->lvl; i++) {
+		struct mlink *pl = &LINKS(l, upd[i])[i];
+		if (pl->next)
+			pl->width++;
+	}
+
+	for (unsigned r = 0; r < 32; r++)
+		if (m->pfxmask & ((uint32_t)1 << r))
+			l->npfx[r]++;
+
+	l->len++;
+	return;
+}
+
+void
+lsi_mlist_del(mlist *l, memb *m, const char *nick)
+{
+	memb *upd[MLIST_MAXLVL];
+	size_t pos[MLIST_MAXLVL];
+	findpred(l, lsi_mlist_rank(m), nick, m, upd, pos);
+
+	if (LINKS(l, upd[0])[0].next != m) {
+		W("member '%s' not where it should be", nick);
+		return;
+	}
+
+	for (int i = 0; i < l->lvl; i++) {
+		struct mlink *pl = &LINKS(l, upd[i])[i];
+		if (pl->next == m) {
+			pl->next = m->lnk[i].next;
+			pl->width = pl->next ? pl->width + m->lnk[i].width - 1 : 0;
+		} else if (pl->next)
+			pl->width--;
+	}
+
+	while (l->lvl > 1 && !l->head[l->lvl - 1].next)
+		l->lvl--;
+
+	for (unsigned r = 0; r < 32; r++)
+		if (m->pfxmask & ((uint32_t)1 << r))
+			l->npfx[r]--;
+
+	l->len--;
+	return;
+}
+
+memb *
+lsi_mlist_at(const mlist *l, size_t i)
+{
+	if (i >= l->len)
+		return NULL;
+
+	size_t target = i + 1, p = 0;
+	const memb *x = NULL;
+	for (int k = l->lvl - 1; k >= 0; k--) {
+		const struct mlink *lk;
+		while ((lk = &LINKS(l, x)[k])->next && p + lk->width <= target) {
+			p += lk->width;
+			x = lk->next;
+		}
+	}
+
+	return (memb *)x;
+}
+
+memb *
+lsi_mlist_seek(const mlist *l, unsigned rank, const char *nick, size_t *pos)
+{
+	const memb *x = findpred(l, rank, nick, NULL, NULL, pos);
+	return LINKS(l, x)[0].next;
+}
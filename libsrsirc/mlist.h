@@ -0,0 +1,61 @@
+/* mlist.h - channel members ordered by prefix rank and nick, interface
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_MLIST_H
+#define LIBSRSIRC_MLIST_H 1
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* levels of the skip list; 4^16 members is plenty */
+#define MLIST_MAXLVL 16
+
+/* rank of members without any prefix */
+#define MLIST_NORANK 32
+
+struct member;
+
+/* a forward link of a node (or the head) on one level */
+struct mlink {
+	struct member *next;
+	size_t width; //how many positions further `next` is
+};
+
+typedef struct mlist {
+	struct mlink head[MLIST_MAXLVL];
+	int lvl; //levels in use
+	size_t len;
+	const uint8_t *cmap;
+	size_t npfx[32]; //how many members have the prefix of rank n
+} mlist;
+
+
+void lsi_mlist_init(mlist *l, int casemap);
+
+/* pick the number of levels for a new node; `seed` is updated */
+uint8_t lsi_mlist_rndlvl(uint32_t *seed);
+
+/* m must not be in `l` yet / must be filed under `nick` (its current nick,
+ * unless in the middle of renaming it) and its current prefixes */
+void lsi_mlist_add(mlist *l, struct member *m);
+void lsi_mlist_del(mlist *l, struct member *m, const char *nick);
+
+/* the `i`th member (0-based), NULL if out of range */
+struct member *lsi_mlist_at(const mlist *l, size_t i);
+
+/* the first member not ordered before (`rank`, `nick`); its position goes
+ * to `pos`.  NULL if there is none */
+struct member *lsi_mlist_seek(const mlist *l, unsigned rank, const char *nick,
+    size_t *pos);
+
+unsigned lsi_mlist_rank(const struct member *m);
+
+/* whether `nick` starts with `pfx`, casemapping-wise */
+bool lsi_mlist_haspfx(const mlist *l, const char *nick, const char *pfx);
+
+
+#endif /* LIBSRSIRC_MLIST_H */
@@ -0,0 +1,599 @@
+/* monitor.c - library-managed notify list (MONITOR/ISON)
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_IRC
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include "monitor.h"
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/base_misc.h>
+#include <platform/base_string.h>
+#include <platform/base_time.h>
+
+#include <logger/intlog.h>
+
+#include <libsrsirc/irc_ext.h>
+#include <libsrsirc/irc_monitor.h>
+#include <libsrsirc/util.h>
+
+#include "intdefs.h"
+#include "msg.h"
+#include "skmap.h"
+
+/* The notify list is a map of nicks, keyed by the server's casemapping.  For
+ * every nick we remember whether it is on the server's MONITOR list, so that
+ * changes can be collected and sent in bulk by lsi_mon_tick() (i.e. at the
+ * start of irc_read()), packed into as few lines as the line length allows.
+ * We put no more nicks on the server's list than its 005 MONITOR limit says;
+ * the rest (all of them, if there's no MONITOR) are polled for using ISON.
+ * Only one round of ISONs is out at a time, and since 303 replies come in
+ * order, each answers the oldest batch still out.  (An ISON sent by the user
+ * meanwhile would confuse this; use the notify list instead.) */
+
+/* a nick on the notify list */
+struct montgt {
+	char nick[MAX_NICK_LEN]; // as given to irc_monitor_add()
+	int8_t state;  // 1 online, 0 offline, -1 unknown
+	bool sent;     // on the server's MONITOR list (or on its way there)
+	bool full;     // didn't fit on it (734), don't try again for now
+};
+
+/* collects nicks into as few `cmd` lines as possible */
+struct packer {
+	irc *ctx;
+	char buf[1024];
+	size_t hdr;    // length of the command part ("MONITOR + ")
+	size_t len;
+	size_t max;    // line length without CRLF
+	char sep;
+	bool ison;     // remember the batches in ctx->monison
+	bool ok;
+};
+
+
+static void flush(irc *ctx);
+static void ison(irc *ctx);
+static bool rekey(irc *ctx);
+static void setstate(irc *ctx, const char *nick, const char *ident, bool on);
+static bool strq_push(char ***q, size_t *cnt, size_t *sz, const char *s);
+static void strq_clear(char **q, size_t *cnt);
+
+static void pk_init(struct packer *pk, irc *ctx, const char *cmd, char sep,
+    bool ison);
+static void pk_add(struct packer *pk, const char *nick);
+static void pk_send(struct packer *pk);
+
+static uint16_t h_005(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_376(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_303(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_730(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_732(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t h_734(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+
+
+bool
+irc_monitor_add(irc *ctx, const char *nick)
+{
+	if (!ctx->mon) {
+		if (!(ctx->mon = lsi_skmap_init(64, ctx->casemap)))
+			return false;
+		ctx->moncasemap = ctx->casemap;
+	}
+
+	if (lsi_skmap_get(ctx->mon, nick))
+		return true;
+
+	struct montgt *t = MALLOC(sizeof *t);
+	if (!t)
+		return false;
+
+	STRACPY(t->nick, nick);
+	t->state = -1;
+	t->sent = t->full = false;
+	if (!lsi_skmap_put(ctx->mon, t->nick, t)) {
+		free(t);
+		return false;
+	}
+
+	ctx->mondirty = true;
+	return true;
+}
+
+bool
+irc_monitor_del(irc *ctx, const char *nick)
+{
+	struct montgt *t;
+	if (!ctx->mon || !(t = lsi_skmap_del(ctx->mon, nick)))
+		return false;
+
+	if (t->sent) {
+		ctx->monsent--;
+		ctx->mondirty = true;
+		if (!strq_push(&ctx->mondel, &ctx->mondel_cnt, &ctx->mondel_sz,
+		    t->nick))
+			W("out of memory, '%s' stays on the MONITOR list",
+			    t->nick);
+	}
+
+	free(t);
+	return true;
+}
+
+void
+irc_monitor_clear(irc *ctx)
+{
+	if (!ctx->mon)
+		return;
+
+	skmap_iter it;
+	struct montgt *t;
+	lsi_skmap_iter_init(ctx->mon, &it);
+	while (lsi_skmap_iter_next(&it, NULL, (void **)&t)) {
+		if (t->sent && !strq_push(&ctx->mondel, &ctx->mondel_cnt,
+		    &ctx->mondel_sz, t->nick))
+			W("out of memory, '%s' stays on the MONITOR list",
+			    t->nick);
+		free(t);
+	}
+
+	lsi_skmap_clear(ctx->mon);
+	ctx->monsent = 0;
+	ctx->mondirty = ctx->mondel_cnt > 0;
+	return;
+}
+
+size_t
+irc_monitor_count(irc *ctx)
+{
+	return ctx->mon ? lsi_skmap_count(ctx->mon) : 0;
+}
+
+int
+irc_monitor_state(irc *ctx, const char *nick)
+{
+	struct montgt *t = ctx->mon ? lsi_skmap_get(ctx->mon, nick) : NULL;
+	return t ? t->state : -1;
+}
+
+void
+irc_set_monitor_ison(irc *ctx, uint64_t ival_us)
+{
+	ctx->monison_ival = ival_us;
+	return;
+}
+
+void
+irc_regcb_monitor(irc *ctx, const struct irc_moncb *cbs, void *tag)
+{
+	if (cbs)
+		ctx->cb_mon = *cbs;
+	else
+		memset(&ctx->cb_mon, 0, sizeof ctx->cb_mon);
+
+	ctx->tag_mon = tag;
+	return;
+}
+
+
+bool
+lsi_mon_regall(irc *ctx, bool dumb)
+{
+	bool fail = false;
+	if (dumb)
+		return true;
+
+	fail = fail || !lsi_msg_reghnd(ctx, "005", h_005, "monitor");
+	fail = fail || !lsi_msg_reghnd(ctx, "376", h_376, "monitor");
+	fail = fail || !lsi_msg_reghnd(ctx, "422", h_376, "monitor");
+	fail = fail || !lsi_msg_reghnd(ctx, "303", h_303, "monitor");
+	fail = fail || !lsi_msg_reghnd(ctx, "730", h_730, "monitor");
+	fail = fail || !lsi_msg_reghnd(ctx, "731", h_730, "monitor");
+	fail = fail || !lsi_msg_reghnd(ctx, "732", h_732, "monitor");
+	fail = fail || !lsi_msg_reghnd(ctx, "734", h_734, "monitor");
+
+	return !fail;
+}
+
+void
+lsi_mon_unregall(irc *ctx)
+{
+	lsi_msg_unregall(ctx, "monitor");
+	return;
+}
+
+void
+lsi_mon_reset(irc *ctx)
+{
+	strq_clear(ctx->mondel, &ctx->mondel_cnt);
+	strq_clear(ctx->monison, &ctx->monison_cnt);
+	ctx->monsent = 0;
+	ctx->monison_last = lsi_b_tstamp_us(); //first round at end of MOTD
+	ctx->mondirty = false;
+	if (!ctx->mon)
+		return;
+
+	skmap_iter it;
+	struct montgt *t;
+	lsi_skmap_iter_init(ctx->mon, &it);
+	while (lsi_skmap_iter_next(&it, NULL, (void **)&t)) {
+		t->state = -1;
+		t->sent = t->full = false;
+	}
+
+	ctx->mondirty = lsi_skmap_count(ctx->mon) > 0;
+	return;
+}
+
+void
+lsi_mon_tick(irc *ctx)
+{
+	if (!ctx->mon || ctx->dumb || !irc_online(ctx))
+		return;
+
+	if (ctx->mondirty)
+		flush(ctx);
+
+	if (ctx->monison_ival && !ctx->monison_cnt
+	    && lsi_b_tstamp_us() - ctx->monison_last >= ctx->monison_ival)
+		ison(ctx);
+
+	return;
+}
+
+void
+lsi_mon_dispose(irc *ctx)
+{
+	if (ctx->mon) {
+		void *v;
+		if (lsi_skmap_first(ctx->mon, NULL, &v))
+			do free(v); while (lsi_skmap_next(ctx->mon, NULL, &v));
+		lsi_skmap_dispose(ctx->mon);
+		ctx->mon = NULL;
+	}
+
+	strq_clear(ctx->mondel, &ctx->mondel_cnt);
+	free(ctx->mondel);
+	ctx->mondel = NULL;
+	ctx->mondel_sz = 0;
+	strq_clear(ctx->monison, &ctx->monison_cnt);
+	free(ctx->monison);
+	ctx->monison = NULL;
+	ctx->monison_sz = 0;
+	return;
+}
+
+
+static void
+flush(irc *ctx)
+{
+	struct packer pk;
+	bool freed = ctx->mondel_cnt > 0;
+	ctx->mondirty = false;
+
+	if (ctx->mondel_cnt && ctx->isupp.monitor) {
+		pk_init(&pk, ctx, "MONITOR - ", ',', false);
+		for (size_t i = 0; i < ctx->mondel_cnt; i++)
+			pk_add(&pk, ctx->mondel[i]);
+		pk_send(&pk);
+	}
+
+	strq_clear(ctx->mondel, &ctx->mondel_cnt);
+
+	if (!ctx->isupp.monitor)
+		return;
+
+	pk_init(&pk, ctx, "MONITOR + ", ',', false);
+	skmap_iter it;
+	struct montgt *t;
+	lsi_skmap_iter_init(ctx->mon, &it);
+	while (lsi_skmap_iter_next(&it, NULL, (void **)&t)) {
+		if (freed)
+			t->full = false; //there might be room now
+		if (t->sent || t->full || ctx->monsent >= ctx->isupp.monitor)
+			continue;
+
+		pk_add(&pk, t->nick);
+		t->sent = true;
+		ctx->monsent++;
+	}
+
+	pk_send(&pk);
+	return;
+}
+
+static void
+ison(irc *ctx)
+{
+	struct packer pk;
+	pk_init(&pk, ctx, "ISON ", ' ', true);
+	ctx->monison_last = lsi_b_tstamp_us();
+
+	skmap_iter it;
+	struct montgt *t;
+	lsi_skmap_iter_init(ctx->mon, &it);
+	while (lsi_skmap_iter_next(&it, NULL, (void **)&t))
+		if (!t->sent)
+			pk_add(&pk, t->nick);
+
+	pk_send(&pk);
+	return;
+}
+
+/* the server's casemapping differs from what the list is keyed by */
+static bool
+rekey(irc *ctx)
+{
+	skmap *m = lsi_skmap_init(64, ctx->casemap);
+	if (!m || !lsi_skmap_reserve(m, lsi_skmap_count(ctx->mon))) {
+		lsi_skmap_dispose(m);
+		return false;
+	}
+
+	skmap_iter it;
+	struct montgt *t;
+	lsi_skmap_iter_init(ctx->mon, &it);
+	while (lsi_skmap_iter_next(&it, NULL, (void **)&t)) {
+		/* nicks that were different are the same now, keep one */
+		if (lsi_skmap_get(m, t->nick) || !lsi_skmap_put(m, t->nick, t))
+			free(t);
+	}
+
+	lsi_skmap_dispose(ctx->mon);
+	ctx->mon = m;
+	ctx->moncasemap = ctx->casemap;
+	return true;
+}
+
+static void
+setstate(irc *ctx, const char *nick, const char *ident, bool on)
+{
+	struct montgt *t = lsi_skmap_get(ctx->mon, nick);
+	if (!t || t->state == on)
+		return;
+
+	t->state = on;
+	if (on && ctx->cb_mon.online)
+		ctx->cb_mon.online(ctx, ident, ctx->tag_mon);
+	else if (!on && ctx->cb_mon.offline)
+		ctx->cb_mon.offline(ctx, nick, ctx->tag_mon);
+
+	return;
+}
+
+static bool
+strq_push(char ***q, size_t *cnt, size_t *sz, const char *s)
+{
+	if (*cnt == *sz) {
+		size_t nsz = *sz ? *sz * 2 : 16;
+		char **nq = MALLOC(nsz * sizeof *nq);
+		if (!nq)
+			return false;
+
+		if (*cnt)
+			memcpy(nq, *q, *cnt * sizeof *nq);
+		free(*q);
+		*q = nq;
+		*sz = nsz;
+	}
+
+	if (!((*q)[*cnt] = STRDUP(s)))
+		return false;
+
+	(*cnt)++;
+	return true;
+}
+
+static void
+strq_clear(char **q, size_t *cnt)
+{
+	for (size_t i = 0; i < *cnt; i++)
+		free(q[i]);
+	*cnt = 0;
+	return;
+}
+
+
+static void
+pk_init(struct packer *pk, irc *ctx, const char *cmd, char sep, bool ison)
+{
+	pk->ctx = ctx;
+	STRACPY(pk->buf, cmd);
+	pk->hdr = pk->len = strlen(pk->buf);
+	pk->max = ctx->isupp.linelen < sizeof pk->buf
+	    ? ctx->isupp.linelen - 2 : sizeof pk->buf - 1;
+	pk->sep = sep;
+	pk->ison = ison;
+	pk->ok = true;
+	return;
+}
+
+static void
+pk_add(struct packer *pk, const char *nick)
+{
+	size_t n = strlen(nick);
+	if (pk->hdr + n > pk->max) {
+		W("nick too long to %.*s: '%s'", (int)pk->hdr, pk->buf, nick);
+		return;
+	}
+
+	if (pk->len > pk->hdr && pk->len + 1 + n > pk->max)
+		pk_send(pk);
+
+	if (pk->len > pk->hdr)
+		pk->buf[pk->len++] = pk->sep;
+
+	memcpy(pk->buf + pk->len, nick, n + 1);
+	pk->len += n;
+	return;
+}
+
+static void
+pk_send(struct packer *pk)
+{
+	irc *ctx = pk->ctx;
+	if (pk->len == pk->hdr || !pk->ok)
+		goto done;
+
+	if (pk->ison && !strq_push(&ctx->monison, &ctx->monison_cnt,
+	    &ctx->monison_sz, pk->buf + pk->hdr)) {
+		W("out of memory, not sending '%s'", pk->buf);
+		goto done;
+	}
+
+	if (!irc_write(ctx, pk->buf)) {
+		W("failed to send '%s'", pk->buf);
+		pk->ok = false;
+	}
+
+done:
+	pk->buf[pk->len = pk->hdr] = '\0';
+	return;
+}
+
+
+static uint16_t
+h_005(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (!ctx->mon)
+		return 0;
+
+	if (ctx->moncasemap != ctx->casemap && !rekey(ctx))
+		E("out of memory, notify list keyed by the wrong casemapping");
+
+	if (ctx->isupp.monitor && lsi_skmap_count(ctx->mon))
+		ctx->mondirty = true;
+
+	return 0;
+}
+
+/* end of MOTD, i.e. 005 is through; see what MONITOR doesn't cover */
+static uint16_t
+h_376(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	ctx->monison_last = 0;
+	return 0;
+}
+
+static uint16_t
+h_303(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (!ctx->monison_cnt)
+		return 0; //not ours
+
+	char *batch = ctx->monison[0];
+	ctx->monison_cnt--;
+	memmove(ctx->monison, ctx->monison + 1,
+	    ctx->monison_cnt * sizeof *ctx->monison);
+
+	const char *reply = nargs > 3 ? (*msg)[3] : "";
+	for (char *nick = batch, *next; nick && *nick; nick = next) {
+		if ((next = strchr(nick, ' ')))
+			*next++ = '\0';
+
+		bool on = false;
+		size_t n = strlen(nick);
+		for (const char *r = reply; *r && !on; r += strcspn(r, " ")) {
+			r += strspn(r, " ");
+			on = strcspn(r, " ") == n
+			    && lsi_ut_istrncmp(r, nick, n, ctx->casemap) == 0;
+		}
+
+		setstate(ctx, nick, nick, on);
+	}
+
+	free(batch);
+	return 0;
+}
+
+/* 730 (online, nick!user@host,...) and 731 (offline, nick,...) */
+static uint16_t
+h_730(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (nargs < 4)
+		return PROTO_ERR;
+
+	if (!ctx->mon)
+		return 0;
+
+	bool on = strcmp((*msg)[1], "730") == 0;
+	for (char *tgt = (*msg)[3], *next; tgt && *tgt; tgt = next) {
+		if ((next = strchr(tgt, ',')))
+			*next = '\0';
+
+		char nick[MAX_NICK_LEN];
+		lsi_ut_ident2nick(nick, sizeof nick, tgt);
+		setstate(ctx, nick, tgt, on);
+
+		if (next)
+			*next++ = ','; // Others might want to handle this tokarr
+	}
+
+	return 0;
+}
+
+/* MONITOR L output, tells us what's on the server's list */
+static uint16_t
+h_732(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (nargs < 4)
+		return PROTO_ERR;
+
+	if (!ctx->mon)
+		return 0;
+
+	for (char *tgt = (*msg)[3], *next; tgt && *tgt; tgt = next) {
+		if ((next = strchr(tgt, ',')))
+			*next = '\0';
+
+		struct montgt *t = lsi_skmap_get(ctx->mon, tgt);
+		if (t && !t->sent) {
+			t->sent = true;
+			t->full = false;
+			ctx->monsent++;
+		}
+
+		if (next)
+			*next++ = ',';
+	}
+
+	return 0;
+}
+
+/* list full; "<limit> <nick,...> :text".  those go back to being ISON'ed */
+static uint16_t
+h_734(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (nargs < 5)
+		return PROTO_ERR;
+
+	if (!ctx->mon)
+		return 0;
+
+	for (char *tgt = (*msg)[4], *next; tgt && *tgt; tgt = next) {
+		if ((next = strchr(tgt, ',')))
+			*next = '\0';
+
+		struct montgt *t = lsi_skmap_get(ctx->mon, tgt);
+		if (t && t->sent) {
+			t->sent = false;
+			t->full = true;
+			ctx->monsent--;
+			if (ctx->cb_mon.full)
+				ctx->cb_mon.full(ctx, t->nick, ctx->tag_mon);
+		}
+
+		if (next)
+			*next++ = ',';
+	}
+
+	return 0;
+}
@@ -0,0 +1,26 @@
+/* monitor.h - library-managed notify list (MONITOR/ISON), interface
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_MONITOR_H
+#define LIBSRSIRC_MONITOR_H 1
+
+
+#include <stdbool.h>
+
+#include <libsrsirc/defs.h>
+
+
+bool lsi_mon_regall(irc *ctx, bool dumb);
+void lsi_mon_unregall(irc *ctx);
+
+/* we're (re)connecting; nothing is on the server's list anymore */
+void lsi_mon_reset(irc *ctx);
+
+/* send pending MONITOR changes, and ISON if due.  called by irc_read() */
+void lsi_mon_tick(irc *ctx);
+
+void lsi_mon_dispose(irc *ctx);
+
+
+#endif /* LIBSRSIRC_MONITOR_H */
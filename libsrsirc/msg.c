@@ -24,6 +24,10 @@
 
 #include "common.h"
 #include "conn.h"
+#include "hndtime.h"
+#include "probes.h"
+#include "stats.h"
+#include "v3.h"
 
 #include <libsrsirc/defs.h>
 #include <libsrsirc/util.h>
@@ -56,6 +60,9 @@ lsi_msg_reghnd(irc *ctx, const char *cmd, hnd_fn hndfn, const char *module)
 
 	ctx->msghnds[i].module = module;
 	ctx->msghnds[i].hndfn = hndfn;
+#if WITH_HNDTIME
+	ctx->msghnds[i].ht = NULL;
+#endif
 	STRACPY(ctx->msghnds[i].cmd, cmd);
 	return true;
 }
@@ -95,6 +102,9 @@ lsi_msg_reguhnd(irc *ctx, const char *cmd, uhnd_fn hndfn, bool pre)
 	}
 
 	harr[i].hndfn = hndfn;
+#if WITH_HNDTIME
+	harr[i].ht = NULL;
+#endif
 	STRACPY(harr[i].cmd, cmd);
 	return true;
 }
@@ -110,6 +120,9 @@ lsi_msg_unregall(irc *ctx, const char *module)
 	return;
 }
 
+/* what to call user handlers in place of a module, for timing and probes */
+#define UHND_MOD(PRE) ((PRE) ? "user-pre" : "user-post")
+
 static bool
 dispatch_uhnd(irc *ctx, tokarr *msg, size_t ac, bool pre)
 {
@@ -124,13 +137,45 @@ dispatch_uhnd(irc *ctx, tokarr *msg, size_t ac, bool pre)
 			continue;
 
 		D("dispatch a %s-'%s'", pre?"pre":"post", (*msg)[1]);
-		if (!harr[i].hndfn(ctx, msg, ac, pre))
+		PROBE3(dispatch_start, ctx, harr[i].cmd, UHND_MOD(pre));
+		HNDT_START(t0);
+		bool ok = harr[i].hndfn(ctx, msg, ac, pre);
+		HNDT_STOP(ctx, &harr[i].ht, harr[i].cmd, UHND_MOD(pre), i, t0);
+		PROBE4(dispatch_end, ctx, harr[i].cmd, UHND_MOD(pre), ok);
+		if (!ok)
 			return false;
 	}
 
 	return true;
 }
 
+void
+lsi_msg_idspan(struct idspan *dest, const char *ident)
+{
+	const char *p = ident;
+	while (*p && *p != '!' && *p != '@')
+		p++;
+
+	dest->nick = ident;
+	dest->nicklen = (size_t)(p - ident);
+	dest->user = dest->host = NULL;
+	dest->userlen = dest->hostlen = 0;
+
+	if (*p == '!') {
+		dest->user = ++p;
+		while (*p && *p != '@')
+			p++;
+		dest->userlen = (size_t)(p - dest->user);
+	}
+
+	if (*p == '@') {
+		dest->host = ++p;
+		dest->hostlen = strlen(p);
+	}
+
+	return;
+}
+
 uint16_t
 lsi_msg_handle(irc *ctx, tokarr *msg, bool logon)
 {
@@ -140,11 +185,21 @@ lsi_msg_handle(irc *ctx, tokarr *msg, bool logon)
 	while (ac < COUNTOF(*msg) && (*msg)[ac])
 		ac++;
 
-	if (!logon && !dispatch_uhnd(ctx, msg, ac, true)) {
+	/* with irc_set_quiet_batches(), the lines of a netsplit/netjoin batch
+	 * reach user handlers only by way of the BATCH lines around it */
+	bool uhnd = !logon && !(ctx->quietbatch && lsi_v3_bulk_batch(ctx));
+
+	lsi_stats_cmd(ctx, (*msg)[1]);
+	lsi_stats_label(ctx); //the last one might have changed our nick
+
+	if (uhnd && !dispatch_uhnd(ctx, msg, ac, true)) {
 		res |= USER_ERR;
 		goto fail;
 	}
 
+	/* handlers look at the prefix a lot; take it apart only once */
+	lsi_msg_idspan(&ctx->pfx, (*msg)[0] ? (*msg)[0] : "");
+
 	for (;i < ctx->msghnds_cnt; i++) {
 		if (!ctx->msghnds[i].cmd[0])
 			continue;
@@ -153,12 +208,19 @@ lsi_msg_handle(irc *ctx, tokarr *msg, bool logon)
 			continue;
 
 		D("dispatch a '%s' to '%s'", (*msg)[1], ctx->msghnds[i].module);
+		PROBE3(dispatch_start, ctx, ctx->msghnds[i].cmd,
+		    ctx->msghnds[i].module);
+		HNDT_START(t0);
 		res |= ctx->msghnds[i].hndfn(ctx, msg, ac, logon);
+		HNDT_STOP(ctx, &ctx->msghnds[i].ht, ctx->msghnds[i].cmd,
+		    ctx->msghnds[i].module, i, t0);
+		PROBE4(dispatch_end, ctx, ctx->msghnds[i].cmd,
+		    ctx->msghnds[i].module, res);
 		if (res & CANT_PROCEED)
 			goto fail;
 	}
 
-	if (!logon && !dispatch_uhnd(ctx, msg, ac, false)) {
+	if (uhnd && !dispatch_uhnd(ctx, msg, ac, false)) {
 		res |= USER_ERR;
 		goto fail;
 	}
@@ -184,6 +246,7 @@ fail:;
 		E("out of nicks");
 	} else if (r & PROTO_ERR) {
 		char line[1024];
+		ctx->con->st.proto_errs++;
 		E("proto error on '%s' (ct:%d)",
 		    lsi_ut_sndumpmsg(line, sizeof line, NULL, msg),
 		    lsi_conn_colon_trail(ctx->con));
@@ -34,6 +34,9 @@ void lsi_msg_unregall(irc *ctx, const char *module);
 bool lsi_msg_reguhnd(irc *ctx, const char *cmd, uhnd_fn hndfn, bool pre);
 
 
+/* take `ident` (nick!user@host, or any part of it) apart into `dest` */
+void lsi_msg_idspan(struct idspan *dest, const char *ident);
+
 /* returns the bitwise OR of one or more of the above
  * bitmasks, or 0 for nothing special */
 uint16_t lsi_msg_handle(irc *ctx, tokarr *msg, bool logon);
@@ -0,0 +1,35 @@
+/* probes.h - static tracepoints
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_PROBES_H
+#define LIBSRSIRC_PROBES_H 1
+
+/* If <sys/sdt.h> was found at configure time (and --disable-usdt wasn't
+ * given), these are USDT probes of the provider "libsrsirc": a nop where they
+ * are, plus a note in the binary telling tracers (bpftrace, perf, systemtap)
+ * where to find them and their arguments.  Otherwise they are nothing, and
+ * their arguments aren't evaluated.  Either way, arguments should be things
+ * at hand, not things computed for the probe.
+ *
+ * The probes and their arguments are listed in doc/probes.txt; keep that up
+ * to date when adding any. */
+
+#if WITH_USDT
+# include <sys/sdt.h>
+
+# define PROBE(NAME) DTRACE_PROBE(libsrsirc, NAME)
+# define PROBE1(NAME, A) DTRACE_PROBE1(libsrsirc, NAME, A)
+# define PROBE2(NAME, A, B) DTRACE_PROBE2(libsrsirc, NAME, A, B)
+# define PROBE3(NAME, A, B, C) DTRACE_PROBE3(libsrsirc, NAME, A, B, C)
+# define PROBE4(NAME, A, B, C, D) DTRACE_PROBE4(libsrsirc, NAME, A, B, C, D)
+#else
+# define PROBE(NAME) do {} while (0)
+# define PROBE1(NAME, A) do {} while (0)
+# define PROBE2(NAME, A, B) do {} while (0)
+# define PROBE3(NAME, A, B, C) do {} while (0)
+# define PROBE4(NAME, A, B, C, D) do {} while (0)
+#endif
+
+
+#endif /* LIBSRSIRC_PROBES_H */
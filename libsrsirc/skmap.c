@@ -36,14 +36,20 @@ struct skmap {
 	size_t bit;
 	size_t listiter;
 
-	skmap_hash_fn hfn;
-
 	const uint8_t *cmap;
 };
 
+/* grow once there are this many items per bucket on average */
+#define MAX_LOADFAC 2
+
 
-static size_t strhash_small(const char *s, const uint8_t *cmap);
-static size_t strhash_mid(const char *s, const uint8_t *cmap);
+static bool put_f(skmap *h, const char *key, const uint8_t *fk, size_t flen,
+    size_t hash, void *elem);
+static size_t strhash(const char *s, const uint8_t *cmap);
+static size_t fkhash(const uint8_t *fk, size_t flen);
+static uint64_t fkmix(uint64_t res, const uint8_t *fk, size_t flen);
+static size_t fkfin(uint64_t res, size_t flen);
+static bool rehash(skmap *h, size_t nbsz);
 
 
 skmap *
@@ -57,7 +63,6 @@ lsi_skmap_init(size_t bsz, int cmap)
 	h->count = 0;
 	h->iterating = false;
 	h->cmap = g_cmap[cmap];
-	h->hfn = bsz <= 256 ? strhash_small : strhash_mid;
 
 	h->buck = MALLOC(h->bsz * sizeof *h->buck);
 	if (!h->buck)
@@ -120,56 +125,77 @@ lsi_skmap_put(skmap *h, const char *key, void *elem)
 	if (!h || !key || !elem)
 		return false;
 
-	bool allocated = false;
-	size_t ind = h->hfn(key, h->cmap) % h->bsz;
-	char *kd = NULL;
-
-	bucklist *kl = h->buck[ind];
-	if (!kl) {
-		allocated = true;
-		if (!(kl = h->buck[ind] = lsi_bucklist_init(h->cmap)))
-			goto fail;
-	}
+	uint8_t buf[CMAP_FOLDBUF];
+	size_t flen;
+	uint8_t *fk = lsi_cmap_foldkey(buf, sizeof buf, key, SIZE_MAX, h->cmap,
+	    &flen);
+	if (!fk)
+		return false;
 
-	void *e = lsi_bucklist_find(kl, key, NULL);
-	if (!e) {
-		kd = STRDUP(key);
-		if (!kd)
-			goto fail;
+	bool r = put_f(h, key, fk, flen, fkhash(fk, flen), elem);
+	if (fk != buf)
+		free(fk);
+	return r;
+}
 
-		if (!lsi_bucklist_insert(kl, 0, kd, elem))
-			goto fail;
+/* like lsi_skmap_put(), but with `key` already folded by lsi_skmap_fold(),
+ * and hashed by lsi_skmap_hash_f(), for a map using the same casemapping
+ * (possibly this one) */
+bool
+lsi_skmap_put_f(skmap *h, const char *key, const uint8_t *fk, size_t flen,
+    size_t hash, void *elem)
+{
+	if (!h || !key || !elem)
+		return false;
 
-		h->count++;
-	} else
-		lsi_bucklist_replace(kl, key, elem);
+	return put_f(h, key, fk, flen, hash, elem);
+}
 
-	return true;
+/* keys are folded once per lookup (and once when added, see bucklist.c),
+ * the folded key is then hashed and compared with memcmp() */
+void *
+lsi_skmap_get(skmap *h, const char *key)
+{
+	return lsi_skmap_get_n(h, key, SIZE_MAX);
+}
 
-fail:
-	if (allocated) {
-		lsi_bucklist_dispose(kl);
-		h->buck[ind] = NULL;
-	}
+/* like lsi_skmap_get(), with the key folded and hashed as for
+ * lsi_skmap_put_f() */
+void *
+lsi_skmap_get_f(skmap *h, const uint8_t *fk, size_t flen, size_t hash)
+{
+	if (!h)
+		return NULL;
 
-	free(kd);
+	bucklist *kl = h->buck[hash % h->bsz];
+	if (!kl)
+		return NULL;
 
-	return false;
+	return lsi_bucklist_find_f(kl, fk, flen, NULL);
 }
 
+/* look up the first `len` chars of `key`, which needn't be terminated there */
 void *
-lsi_skmap_get(skmap *h, const char *key)
+lsi_skmap_get_n(skmap *h, const char *key, size_t len)
 {
 	if (!h)
 		return NULL;
 
-	size_t ind = h->hfn(key, h->cmap) % h->bsz;
-
-	bucklist *kl = h->buck[ind];
-	if (!kl)
+	uint8_t buf[CMAP_FOLDBUF];
+	size_t flen;
+	uint8_t *fk = lsi_cmap_foldkey(buf, sizeof buf, key, len, h->cmap,
+	    &flen);
+	if (!fk)
 		return NULL;
 
-	return lsi_bucklist_find(kl, key, NULL);
+	void *e = NULL;
+	bucklist *kl = h->buck[fkhash(fk, flen) % h->bsz];
+	if (kl)
+		e = lsi_bucklist_find_f(kl, fk, flen, NULL);
+
+	if (fk != buf)
+		free(fk);
+	return e;
 }
 
 void *
@@ -178,14 +204,21 @@ lsi_skmap_del(skmap *h, const char *key)
 	if (!h)
 		return NULL;
 
-	size_t ind = h->hfn(key, h->cmap) % h->bsz;
-
-	bucklist *kl = h->buck[ind];
-	if (!kl)
+	uint8_t buf[CMAP_FOLDBUF];
+	size_t flen;
+	uint8_t *fk = lsi_cmap_foldkey(buf, sizeof buf, key, SIZE_MAX, h->cmap,
+	    &flen);
+	if (!fk)
 		return NULL;
 
 	char *okey;
-	void *e = lsi_bucklist_remove(kl, key, &okey);
+	void *e = NULL;
+	bucklist *kl = h->buck[fkhash(fk, flen) % h->bsz];
+	if (kl)
+		e = lsi_bucklist_remove_f(kl, fk, flen, &okey);
+
+	if (fk != buf)
+		free(fk);
 
 	if (!e)
 		return NULL;
@@ -195,6 +228,42 @@ lsi_skmap_del(skmap *h, const char *key)
 	return e;
 }
 
+/* fold `key` the way our casemapping does, for the _f functions; the result
+ * and how it's returned are as for lsi_cmap_foldkey().  folded keys (and
+ * their hashes) are independent of the bucket count, so one can be used with
+ * all maps that share a casemapping (e.g. the user map and member maps) */
+uint8_t *
+lsi_skmap_fold(skmap *h, uint8_t *buf, size_t bufsz, const char *key,
+    size_t *flen)
+{
+	return lsi_cmap_foldkey(buf, bufsz, key, SIZE_MAX, h->cmap, flen);
+}
+
+size_t
+lsi_skmap_hash_f(const uint8_t *fk, size_t flen)
+{
+	return fkhash(fk, flen);
+}
+
+/* make room for `n` items in total, so that adding them doesn't have to grow
+ * the map step by step (and so that lookups stay short).  fails without
+ * touching the map if `n` is too large to ever fit */
+bool
+lsi_skmap_reserve(skmap *h, size_t n)
+{
+	if (!h || !h->bsz)
+		return false;
+
+	size_t nbsz = h->bsz;
+	while (nbsz * MAX_LOADFAC < n) {
+		if (nbsz > SIZE_MAX / 2 / MAX_LOADFAC / sizeof *h->buck)
+			return false;
+		nbsz *= 2;
+	}
+
+	return nbsz == h->bsz || rehash(h, nbsz);
+}
+
 size_t
 lsi_skmap_count(skmap *h)
 {
@@ -261,6 +330,40 @@ lsi_skmap_del_iter(skmap *h)
 	return;
 }
 
+/* unlike lsi_skmap_first()/_next(), the iteration state lives in `it`, which
+ * belongs to the caller, so iterations can be nested or interleaved.  the map
+ * must not be modified while `it` is in use */
+void
+lsi_skmap_iter_init(skmap *h, skmap_iter *it)
+{
+	it->m = h;
+	it->bit = 0;
+	it->pos = NULL;
+	return;
+}
+
+bool
+lsi_skmap_iter_next(skmap_iter *it, char **key, void **val)
+{
+	skmap *h = it->m;
+	if (!h)
+		return false;
+
+	while (it->bit < h->bsz) {
+		if (h->buck[it->bit]
+		    && lsi_bucklist_iter(h->buck[it->bit], &it->pos, key, val))
+			return true;
+
+		it->bit++;
+		it->pos = NULL;
+	}
+
+	if (key) *key = NULL;
+	if (val) *val = NULL;
+
+	return false;
+}
+
 void
 lsi_skmap_dump(skmap *h, skmap_op_fn valop)
 {
@@ -323,6 +426,20 @@ lsi_skmap_stat(skmap *h, size_t *nbuck, size_t *nbuckused, size_t *nitems,
 	return;
 }
 
+/* bytes taken by the map, including its keys but not the values */
+size_t
+lsi_skmap_memsize(skmap *h)
+{
+	if (!h)
+		return 0;
+
+	size_t sz = sizeof *h + h->bsz * sizeof *h->buck;
+	for (size_t i = 0; i < h->bsz; i++)
+		sz += lsi_bucklist_memsize(h->buck[i]);
+
+	return sz;
+}
+
 void
 lsi_skmap_dumpstat(skmap *h, const char *dbgname)
 {
@@ -344,31 +461,156 @@ lsi_skmap_dumpstat(skmap *h, const char *dbgname)
 }
 
 
+/* `fk` is `key` as folded by our cmap */
+static bool
+put_f(skmap *h, const char *key, const uint8_t *fk, size_t flen, size_t hash,
+    void *elem)
+{
+	/* not fatal if this fails, we'll just be slower */
+	if (h->count >= h->bsz * MAX_LOADFAC)
+		rehash(h, h->bsz * 2);
+
+	bool allocated = false;
+	size_t ind = hash % h->bsz;
+	char *kd = NULL;
+
+	bucklist *kl = h->buck[ind];
+	if (!kl) {
+		allocated = true;
+		if (!(kl = h->buck[ind] = lsi_bucklist_init(h->cmap)))
+			goto fail;
+	}
+
+	if (!lsi_bucklist_replace_f(kl, fk, flen, elem)) {
+		kd = STRDUP(key);
+		if (!kd)
+			goto fail;
+
+		if (!lsi_bucklist_insert_f(kl, 0, kd, fk, flen, elem))
+			goto fail;
+
+		h->count++;
+	}
+
+	return true;
+
+fail:
+	if (allocated) {
+		lsi_bucklist_dispose(kl);
+		h->buck[ind] = NULL;
+	}
+
+	free(kd);
+
+	return false;
+}
+
+/* Keys are hashed after folding them, 8 chars at a time.  The cmaps map '!'
+ * and '@' to '\0' for nick keys, so "nick!user@host" hashes the same as
+ * "nick".  strhash() does the folding itself, in chunks of CMAP_FOLDBUF
+ * (a multiple of 8) so that it doesn't need the heap for long keys */
+static size_t
+strhash(const char *s, const uint8_t *cmap)
+{
+	uint8_t buf[CMAP_FOLDBUF];
+	uint64_t res = 0;
+	size_t tot = 0, n;
+
+	while ((n = lsi_cmap_fold(buf, s + tot, sizeof buf, cmap))
+	    == sizeof buf) {
+		res = fkmix(res, buf, n);
+		tot += n;
+	}
+
+	return fkfin(fkmix(res, buf, n), tot + n);
+}
+
 static size_t
-strhash_small(const char *s, const uint8_t *cmap)
+fkhash(const uint8_t *fk, size_t flen)
+{
+	return fkfin(fkmix(0, fk, flen), flen);
+}
+
+static uint64_t
+fkmix(uint64_t res, const uint8_t *fk, size_t flen)
 {
-	uint8_t res = 0xaa;
-	uint8_t cur;
-	unsigned shift = 0;
+	uint64_t w;
+	for (; flen >= 8; fk += 8, flen -= 8) {
+		memcpy(&w, fk, 8);
+		res = (res ^ w) * 0x9e3779b97f4a7c15ull;
+		res ^= res >> 32;
+	}
 
-	while ((cur = cmap[(uint8_t)*s++]))
-		res ^= (cur << (++shift % 3));
+	if (flen) {
+		w = 0;
+		for (size_t i = 0; i < flen; i++)
+			w |= (uint64_t)fk[i] << (8 * i);
+		res = (res ^ w) * 0x9e3779b97f4a7c15ull;
+		res ^= res >> 32;
+	}
 
 	return res;
 }
 
+/* mix in the length and spread things over the low bits, which are the ones
+ * picking the bucket */
 static size_t
-strhash_mid(const char *s, const uint8_t *cmap)
+fkfin(uint64_t res, size_t flen)
 {
-	uint8_t res[2] = { 0xaa, 0xaa };
-	uint8_t cur;
-	unsigned shift = 0;
-	bool first = true;
+	res ^= flen;
+	res ^= res >> 33;
+	res *= 0xff51afd7ed558ccdull;
+	res ^= res >> 33;
+	return (size_t)res;
+}
 
-	while ((cur = cmap[(uint8_t)*s++]))
-		res[first = !first] ^= cur << (++shift % 3);
+/* move everything into `nbsz` new buckets.  on failure, the map is left as
+ * it was (the old buckets are only let go of once everything is moved) */
+static bool
+rehash(skmap *h, size_t nbsz)
+{
+	bucklist **nbuck = MALLOC(nbsz * sizeof *nbuck);
+	if (!nbuck)
+		return false;
+
+	for (size_t i = 0; i < nbsz; i++)
+		nbuck[i] = NULL;
+
+	for (size_t i = 0; i < h->bsz; i++) {
+		char *k;
+		void *v;
+		if (!h->buck[i] || !lsi_bucklist_first(h->buck[i], &k, &v))
+			continue;
+
+		do {
+			size_t ind = strhash(k, h->cmap) % nbsz;
+			if (!nbuck[ind] && !(nbuck[ind] =
+			    lsi_bucklist_init(h->cmap)))
+				goto fail;
 
-	return (res[0] << 8) | res[1];
+			if (!lsi_bucklist_insert(nbuck[ind], 0, k, v))
+				goto fail;
+		} while (lsi_bucklist_next(h->buck[i], &k, &v));
+	}
+
+	/* the keys live on in the new buckets */
+	for (size_t i = 0; i < h->bsz; i++)
+		lsi_bucklist_dispose(h->buck[i]);
+	free(h->buck);
+
+	D("rehashed from %zu to %zu buckets (%zu items)",
+	    h->bsz, nbsz, h->count);
+
+	h->buck = nbuck;
+	h->bsz = nbsz;
+	h->iterating = false;
+	return true;
+
+fail:
+	for (size_t i = 0; i < nbsz; i++)
+		lsi_bucklist_dispose(nbuck[i]);
+	free(nbuck);
+	return false;
 }
 
 /*void skmap_test(void) {
@@ -380,11 +622,9 @@ strhash_mid(const char *s, const uint8_t *cmap)
 	while ((linelen = getline(&line, &linesize, stdin)) != -1) {
 		char *s = strchr(line, '\n');
 		*s = 0;
-		size_t shs = strhash_small(line, g_cmap[0]);
-		size_t shm = strhash_mid(line, g_cmap[0]);
-		size_t shm4 = strhash_mid(line, g_cmap[0]) % 8192;
+		size_t sh = strhash(line, g_cmap[0]);
 
-		printf("'%s' %zu %zu %zu\n", line, shs, shm, shm4);
+		printf("'%s' %zu %zu\n", line, sh, sh % 8192);
 	}
 
 	if (ferror(stdin))
@@ -11,29 +11,48 @@
 #include <stdint.h>
 
 
-typedef size_t (*skmap_hash_fn)(const char *elem, const uint8_t *cmap);
 typedef void (*skmap_op_fn)(const void *elem);
 typedef void *(*skmap_keydup_fn)(const char *key);
 typedef bool (*skmap_eq_fn)(const void *elem1, const void *elem2);
 typedef struct skmap skmap;
 
+/* external iterator, see lsi_skmap_iter_init() */
+typedef struct skmap_iter {
+	skmap *m;
+	size_t bit;
+	void *pos;
+} skmap_iter;
+
 
 skmap *lsi_skmap_init(size_t bucketsz, int cmap);
 void lsi_skmap_clear(skmap *m);
 void lsi_skmap_dispose(skmap *m);
 bool lsi_skmap_put(skmap *m, const char *key, void *elem);
 void *lsi_skmap_get(skmap *m, const char *key);
+void *lsi_skmap_get_n(skmap *m, const char *key, size_t len);
 void *lsi_skmap_del(skmap *m, const char *key);
 size_t lsi_skmap_count(skmap *m);
 
+uint8_t *lsi_skmap_fold(skmap *m, uint8_t *buf, size_t bufsz, const char *key,
+    size_t *flen);
+size_t lsi_skmap_hash_f(const uint8_t *fk, size_t flen);
+bool lsi_skmap_put_f(skmap *m, const char *key, const uint8_t *fk, size_t flen,
+    size_t hash, void *elem);
+void *lsi_skmap_get_f(skmap *m, const uint8_t *fk, size_t flen, size_t hash);
+bool lsi_skmap_reserve(skmap *m, size_t n);
+
 bool lsi_skmap_first(skmap *m, char **key, void **val);
 bool lsi_skmap_next(skmap *m, char **key, void **val);
 void lsi_skmap_del_iter(skmap *h);
 
+void lsi_skmap_iter_init(skmap *m, skmap_iter *it);
+bool lsi_skmap_iter_next(skmap_iter *it, char **key, void **val);
+
 void lsi_skmap_dump(skmap *m, skmap_op_fn valop);
 void lsi_skmap_stat(skmap *h, size_t *nbuck, size_t *nbuckused, size_t *nitems,
     double *loadfac, double *avglistlen, size_t *maxlistlen);
 void lsi_skmap_dumpstat(skmap *m, const char *dbgname);
+size_t lsi_skmap_memsize(skmap *m);
 //void skmap_test(void);
 
 
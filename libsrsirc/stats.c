@@ -0,0 +1,455 @@
+/* stats.c - per-context counters and their Prometheus exposition
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_IRC
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include "stats.h"
+
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/base_misc.h>
+#include <platform/base_string.h>
+
+#include <logger/intlog.h>
+
+#include <libsrsirc/irc_ext.h>
+
+#include "common.h"
+#include "conn.h"
+#include "intdefs.h"
+#include "skmap.h"
+
+/* The byte, line and syscall counters live in the iconn and are bumped by
+ * io.c and conn.c; the rest is counted by the irc_s layer into the same
+ * struct irc_stats.  Messages are counted by command in a map plus an array
+ * (for irc_stats_cmd()), capped at MAX_CMDSTAT commands so that a server
+ * making up commands can't make us grow without bounds.
+ *
+ * All contexts are on one list for irc_stats_prom(), which walks it from
+ * whatever thread it is called by, and reads the counters as they are.  It
+ * must not touch anything the thread driving a context might free or move
+ * meanwhile, though: the array of commands is fixed-size and each entry is
+ * complete before `cmdv_cnt` is raised past it, and rather than the nick and
+ * server themselves, we print copies (ctx->statnick etc.) updated by
+ * lsi_stats_label() under a per-context lock. */
+
+struct cmdstat {
+	char cmd[32];
+	uint64_t n;
+};
+
+/* irc_stats_prom()'s output so far; `len` may exceed `sz` */
+struct promout {
+	char *buf;
+	size_t sz;
+	size_t len;
+};
+
+/* the counters in struct irc_stats we expose */
+static const struct {
+	const char *name;
+	const char *type;
+	const char *help;
+	size_t off;
+} s_metrics[] = {
+	{ "bytes_in_total", "counter", "Bytes read from the server.",
+	    offsetof(struct irc_stats, bytes_in) },
+	{ "bytes_out_total", "counter", "Bytes written to the server.",
+	    offsetof(struct irc_stats, bytes_out) },
+	{ "lines_in_total", "counter", "Lines read from the server.",
+	    offsetof(struct irc_stats, lines_in) },
+	{ "lines_out_total", "counter", "Lines written to the server.",
+	    offsetof(struct irc_stats, lines_out) },
+	{ "reads_total", "counter", "Calls to read() or SSL_read().",
+	    offsetof(struct irc_stats, reads) },
+	{ "writes_total", "counter", "Calls to write() or SSL_write().",
+	    offsetof(struct irc_stats, writes) },
+	{ "parse_errors_total", "counter", "Lines that couldn't be parsed.",
+	    offsetof(struct irc_stats, parse_errs) },
+	{ "protocol_errors_total", "counter", "Malformed messages.",
+	    offsetof(struct irc_stats, proto_errs) },
+	{ "connects_total", "counter", "Successful logons.",
+	    offsetof(struct irc_stats, connects) },
+	{ "connect_failures_total", "counter", "Failed connection attempts.",
+	    offsetof(struct irc_stats, connfails) },
+	{ "reconnects_total", "counter", "Connection attempts after the first "
+	    "successful one.", offsetof(struct irc_stats, reconnects) },
+};
+
+static irc *s_head;
+static irc *s_tail;
+static void *s_lock;
+
+
+static void lock(void **l);
+static void unlock(void **l);
+static void pout(struct promout *o, const char *fmt, ...);
+static void plabels(struct promout *o, irc *ctx, const char *le);
+static void pesc(struct promout *o, const char *s);
+static void plag(struct promout *o);
+static void pcmds(struct promout *o);
+
+
+bool
+irc_stats(irc *ctx, struct irc_stats *dest)
+{
+	*dest = ctx->con->st;
+	return true;
+}
+
+bool
+irc_stats_cmd(irc *ctx, size_t ind, const char **cmd, uint64_t *count)
+{
+	if (ind >= lsi_b_atomic_get(&ctx->cmdv_cnt))
+		return false;
+
+	if (cmd)
+		*cmd = ctx->cmdv[ind]->cmd;
+	if (count)
+		*count = ctx->cmdv[ind]->n;
+	return true;
+}
+
+size_t
+irc_stats_prom(char *dest, size_t destsz)
+{
+	struct promout o = { dest, destsz, 0 };
+	if (destsz)
+		dest[0] = '\0';
+
+	lock(&s_lock);
+
+	size_t nctx = 0;
+	for (irc *c = s_head; c; c = c->statnext)
+		nctx++;
+
+	pout(&o, "# HELP libsrsirc_contexts IRC contexts in existence.\n"
+	    "# TYPE libsrsirc_contexts gauge\nlibsrsirc_contexts %zu\n", nctx);
+
+	pout(&o, "# HELP libsrsirc_online Whether the context is connected.\n"
+	    "# TYPE libsrsirc_online gauge\n");
+	for (irc *c = s_head; c; c = c->statnext) {
+		pout(&o, "libsrsirc_online");
+		plabels(&o, c, NULL);
+		pout(&o, " %d\n", irc_online(c));
+	}
+
+	for (size_t i = 0; i < COUNTOF(s_metrics); i++) {
+		pout(&o, "# HELP libsrsirc_%s %s\n# TYPE libsrsirc_%s %s\n",
+		    s_metrics[i].name, s_metrics[i].help, s_metrics[i].name,
+		    s_metrics[i].type);
+
+		for (irc *c = s_head; c; c = c->statnext) {
+			const char *st = (const char *)&c->con->st;
+			uint64_t v;
+			memcpy(&v, st + s_metrics[i].off, sizeof v);
+			pout(&o, "libsrsirc_%s", s_metrics[i].name);
+			plabels(&o, c, NULL);
+			pout(&o, " %" PRIu64 "\n", v);
+		}
+	}
+
+	pout(&o, "# HELP libsrsirc_tls_handshake_seconds How long the last TLS "
+	    "handshake took.\n# TYPE libsrsirc_tls_handshake_seconds gauge\n");
+	for (irc *c = s_head; c; c = c->statnext) {
+		if (!c->con->st.tls_us)
+			continue;
+		pout(&o, "libsrsirc_tls_handshake_seconds");
+		plabels(&o, c, NULL);
+		pout(&o, " %.6f\n", c->con->st.tls_us / 1e6);
+	}
+
+	plag(&o);
+	pcmds(&o);
+
+	unlock(&s_lock);
+	return o.len;
+}
+
+
+void
+lsi_stats_add(irc *ctx)
+{
+	static uint64_t nextid;
+
+	lock(&s_lock);
+	ctx->statid = ++nextid;
+	ctx->statnext = NULL;
+	ctx->statprev = s_tail;
+	if (s_tail)
+		s_tail->statnext = ctx;
+	else
+		s_head = ctx;
+	s_tail = ctx;
+	unlock(&s_lock);
+	return;
+}
+
+void
+lsi_stats_del(irc *ctx)
+{
+	lock(&s_lock);
+	if (ctx->statprev)
+		ctx->statprev->statnext = ctx->statnext;
+	else if (s_head == ctx)
+		s_head = ctx->statnext;
+	if (ctx->statnext)
+		ctx->statnext->statprev = ctx->statprev;
+	else if (s_tail == ctx)
+		s_tail = ctx->statprev;
+	ctx->statprev = ctx->statnext = NULL;
+	unlock(&s_lock);
+	return;
+}
+
+void
+lsi_stats_cmd(irc *ctx, const char *cmd)
+{
+	struct cmdstat *cs;
+	if (!ctx->cmdstat && !(ctx->cmdstat = lsi_skmap_init(64, CMAP_ASCII)))
+		return;
+
+	/* it wouldn't fit as the key, and no real command is that long */
+	if (strlen(cmd) >= sizeof cs->cmd)
+		cmd = "*";
+
+	if ((cs = lsi_skmap_get(ctx->cmdstat, cmd))) {
+		cs->n++;
+		return;
+	}
+
+	if (ctx->cmdv_cnt >= MAX_CMDSTAT - 1) {
+		cmd = "*"; //the last slot takes all the rest
+		if ((cs = lsi_skmap_get(ctx->cmdstat, cmd))) {
+			cs->n++;
+			return;
+		}
+
+		if (ctx->cmdv_cnt == MAX_CMDSTAT)
+			return;
+	}
+
+	if (!(cs = MALLOC(sizeof *cs)))
+		return;
+
+	STRACPY(cs->cmd, cmd);
+	cs->n = 1;
+	if (!lsi_skmap_put(ctx->cmdstat, cs->cmd, cs)) {
+		free(cs);
+		return;
+	}
+
+	/* irc_stats_prom() may be looking, see above */
+	ctx->cmdv[ctx->cmdv_cnt] = cs;
+	lsi_b_atomic_set(&ctx->cmdv_cnt, ctx->cmdv_cnt + 1);
+	return;
+}
+
+void
+lsi_stats_label(irc *ctx)
+{
+	const char *nick = ctx->mynick[0] ? ctx->mynick
+	    : ctx->nick ? ctx->nick : "";
+	const char *host = lsi_conn_get_host(ctx->con);
+	uint16_t port = lsi_conn_get_port(ctx->con);
+	if (!host)
+		host = "";
+
+	/* nobody else writes these, so we can look without the lock */
+	if (port == ctx->statport && strcmp(nick, ctx->statnick) == 0
+	    && strcmp(host, ctx->statsrv) == 0)
+		return;
+
+	lock(&ctx->statlock);
+	STRACPY(ctx->statnick, nick);
+	STRACPY(ctx->statsrv, host);
+	ctx->statport = port;
+	unlock(&ctx->statlock);
+	return;
+}
+
+void
+lsi_stats_dispose(irc *ctx)
+{
+	for (size_t i = 0; i < ctx->cmdv_cnt; i++)
+		free(ctx->cmdv[i]);
+	ctx->cmdv_cnt = 0;
+	lsi_skmap_dispose(ctx->cmdstat);
+	ctx->cmdstat = NULL;
+	return;
+}
+
+
+static void
+lock(void **l)
+{
+	while (lsi_b_atomic_swapptr(l, (void *)1))
+		;
+	return;
+}
+
+static void
+unlock(void **l)
+{
+	lsi_b_atomic_swapptr(l, NULL);
+	return;
+}
+
+static void
+pout(struct promout *o, const char *fmt, ...)
+{
+	va_list vl;
+	va_start(vl, fmt);
+	char *p = o->len < o->sz ? o->buf + o->len : NULL;
+	int n = vsnprintf(p, p ? o->sz - o->len : 0, fmt, vl);
+	va_end(vl);
+
+	if (n > 0)
+		o->len += (size_t)n;
+	return;
+}
+
+/* the labels telling contexts apart, plus `le` for histogram buckets */
+static void
+plabels(struct promout *o, irc *ctx, const char *le)
+{
+	char srv[sizeof ctx->statsrv], nick[sizeof ctx->statnick];
+	lock(&ctx->statlock);
+	memcpy(srv, ctx->statsrv, sizeof srv);
+	memcpy(nick, ctx->statnick, sizeof nick);
+	uint16_t port = ctx->statport;
+	unlock(&ctx->statlock);
+
+	pout(o, "{ctx=\"%" PRIu64 "\",server=\"", ctx->statid);
+	pesc(o, srv);
+	pout(o, ":%" PRIu16 "\",nick=\"", port);
+	pesc(o, nick);
+	if (le)
+		pout(o, "\",le=\"%s", le);
+	pout(o, "\"}");
+	return;
+}
+
+/* label values need \, " and newlines escaped */
+static void
+pesc(struct promout *o, const char *s)
+{
+	for (; *s; s++) {
+		if (*s == '\\' || *s == '"')
+			pout(o, "\\%c", *s);
+		else if (*s == '\n')
+			pout(o, "\\n");
+		else
+			pout(o, "%c", *s);
+	}
+	return;
+}
+
+/* the keepalive's round trip times as a histogram; its buckets are powers
+ * of two in milliseconds, Prometheus' are cumulative and in seconds */
+static void
+plag(struct promout *o)
+{
+	pout(o, "# HELP libsrsirc_lag_seconds PING round trip times, see "
+	    "irc_set_keepalive().\n# TYPE libsrsirc_lag_seconds histogram\n");
+
+	for (irc *c = s_head; c; c = c->statnext) {
+		const struct irc_lagstats *ls = &c->lag;
+		if (!ls->npong)
+			continue;
+
+		uint64_t cum = 0;
+		for (size_t i = 0; i < IRC_LAG_NBUCK; i++) {
+			char le[16] = "+Inf";
+			if (i < IRC_LAG_NBUCK - 1)
+				snprintf(le, sizeof le, "%g",
+				    (double)(1u << i) / 1000);
+
+			cum += ls->hist[i];
+			pout(o, "libsrsirc_lag_seconds_bucket");
+			plabels(o, c, le);
+			pout(o, " %" PRIu64 "\n", cum);
+		}
+
+		pout(o, "libsrsirc_lag_seconds_sum");
+		plabels(o, c, NULL);
+		pout(o, " %.6f\n", ls->sum_us / 1e6);
+		pout(o, "libsrsirc_lag_seconds_count");
+		plabels(o, c, NULL);
+		pout(o, " %" PRIu64 "\n", ls->npong);
+	}
+	return;
+}
+
+/* messages by command, summed over all contexts; irc_stats_cmd() has them
+ * per context */
+static void
+pcmds(struct promout *o)
+{
+	skmap *sum = lsi_skmap_init(64, CMAP_ASCII);
+	if (!sum)
+		return;
+
+	struct cmdstat **order = NULL;
+	size_t cnt = 0, sz = 0;
+	for (irc *c = s_head; c; c = c->statnext) {
+		size_t ncmd = lsi_b_atomic_get(&c->cmdv_cnt);
+		for (size_t i = 0; i < ncmd; i++) {
+			struct cmdstat *cs = lsi_skmap_get(sum, c->cmdv[i]->cmd);
+			if (cs) {
+				cs->n += c->cmdv[i]->n;
+				continue;
+			}
+
+			if (cnt == sz) {
+				size_t nsz = sz ? sz * 2 : 64;
+				struct cmdstat **no = MALLOC(nsz * sizeof *no);
+				if (!no)
+					goto done;
+				if (cnt)
+					memcpy(no, order, cnt * sizeof *no);
+				free(order);
+				order = no;
+				sz = nsz;
+			}
+
+			if (!(cs = MALLOC(sizeof *cs)))
+				goto done;
+
+			*cs = *c->cmdv[i];
+			if (!lsi_skmap_put(sum, cs->cmd, cs)) {
+				free(cs);
+				goto done;
+			}
+
+			order[cnt++] = cs;
+		}
+	}
+
+	pout(o, "# HELP libsrsirc_messages_total Messages received, by "
+	    "command (all contexts).\n# TYPE libsrsirc_messages_total "
+	    "counter\n");
+	for (size_t i = 0; i < cnt; i++) {
+		pout(o, "libsrsirc_messages_total{cmd=\"");
+		pesc(o, order[i]->cmd);
+		pout(o, "\"} %" PRIu64 "\n", order[i]->n);
+	}
+
+done:
+	for (size_t i = 0; i < cnt; i++)
+		free(order[i]);
+	free(order);
+	lsi_skmap_dispose(sum);
+	return;
+}
@@ -0,0 +1,28 @@
+/* stats.h - per-context counters and their Prometheus exposition, interface
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_STATS_H
+#define LIBSRSIRC_STATS_H 1
+
+
+#include <stdbool.h>
+
+#include <libsrsirc/defs.h>
+
+
+/* (un)list a context for irc_stats_prom(); called by irc_init()/_dispose() */
+void lsi_stats_add(irc *ctx);
+void lsi_stats_del(irc *ctx);
+
+/* count a message, by command.  called by lsi_msg_handle() */
+void lsi_stats_cmd(irc *ctx, const char *cmd);
+
+/* update the server and nick irc_stats_prom() labels `ctx` with, if they
+ * changed.  called wherever they might have, by the thread driving `ctx` */
+void lsi_stats_label(irc *ctx);
+
+void lsi_stats_dispose(irc *ctx);
+
+
+#endif /* LIBSRSIRC_STATS_H */
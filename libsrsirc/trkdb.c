@@ -0,0 +1,608 @@
+/* trkdb.c - saving and loading the tracking state, for fast restarts
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_TRACK
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/base_io.h>
+#include <platform/base_misc.h>
+#include <platform/base_string.h>
+
+#include <logger/intlog.h>
+
+#include <libsrsirc/irc_track.h>
+
+#include "common.h"
+#include "conn.h"
+#include "intdefs.h"
+#include "irc_msghnd.h"
+#include "skmap.h"
+#include "ucbase.h"
+
+/* The file is a header followed by four arrays of fixed-size records (users,
+ * channels, members, list modes) and a string table.  Records refer to each
+ * other by index and to strings by their offset into the table (0 means
+ * NULL; the table starts with a NUL byte).  Nothing in there is a pointer, so
+ * the file can be mapped anywhere and used as-is.  Everything is in the byte
+ * order of the machine that wrote it; a file from a different one is
+ * rejected rather than converted. */
+
+#define TRKDB_MAGIC "LSITRKDB"
+#define TRKDB_VERSION 1
+#define TRKDB_ENDIAN 0x01020304u
+
+struct trkdb_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t endian;
+	int32_t casemap;
+	uint32_t nusers;
+	uint32_t nchans;
+	uint32_t nmemb;
+	uint32_t nlmodes;
+	uint32_t strsz;
+	uint32_t pfxmodes, pfxsyms; //005 PREFIX the mode prefixes are from
+};
+
+struct trkdb_user {
+	uint32_t nick, uname, host, fname;
+};
+
+struct trkdb_chan {
+	uint32_t name, topic, topicnick;
+	uint32_t memb, nmemb; //range in the member array
+	uint32_t lmode, nlmode; //range in the list mode array
+	uint32_t pad;
+	uint64_t tscreate, tstopic;
+	uint64_t dmodes;
+	uint32_t amodes[NUM_CHANMODES];
+};
+
+struct trkdb_memb {
+	uint32_t user; //index into the user array
+	uint32_t modepfx;
+};
+
+struct trkdb_lmode {
+	uint64_t tsset;
+	uint32_t mask, setby;
+	uint32_t mode;
+	uint32_t pad;
+};
+
+/* everything in a saved file, with pointers into it */
+struct trkdb {
+	const struct trkdb_hdr *hdr;
+	const struct trkdb_user *users;
+	const struct trkdb_chan *chans;
+	const struct trkdb_memb *memb;
+	const struct trkdb_lmode *lmodes;
+	const char *strtab;
+};
+
+/* the string table being built by irc_track_save() */
+struct strtab {
+	char *buf;
+	size_t len;
+	size_t sz;
+};
+
+
+static uint32_t addstr(struct strtab *st, const char *s);
+static bool dbmap(struct trkdb *db, const void *p, size_t len);
+static bool dbcheck(const struct trkdb *db);
+static bool okstr(const struct trkdb *db, uint32_t off);
+static const char *dbstr(const struct trkdb *db, uint32_t off);
+static bool adopt(irc *ctx, const struct trkdb *db);
+
+
+/* add `s` to the string table, return its offset or 0 if NULL.  UINT32_MAX
+ * on failure (can't be a valid offset since there's the NUL at 0) */
+static uint32_t
+addstr(struct strtab *st, const char *s)
+{
+	if (!s)
+		return 0;
+
+	size_t len = strlen(s) + 1;
+	if (st->len + len > UINT32_MAX)
+		return UINT32_MAX;
+
+	if (st->len + len > st->sz) {
+		size_t nsz = st->sz * 2;
+		while (nsz < st->len + len)
+			nsz *= 2;
+
+		char *nbuf = MALLOC(nsz);
+		if (!nbuf)
+			return UINT32_MAX;
+
+		memcpy(nbuf, st->buf, st->len);
+		free(st->buf);
+		st->buf = nbuf;
+		st->sz = nsz;
+	}
+
+	memcpy(st->buf + st->len, s, len);
+	st->len += len;
+	return (uint32_t)(st->len - len);
+}
+
+bool
+irc_track_save(irc *ctx, const char *path)
+{
+	if (!ctx->chans) {
+		E("nothing to save, tracking is not active");
+		return false;
+	}
+
+	if (ctx->trkshared) {
+		E("can't save a shared tracking store");
+		return false;
+	}
+
+	struct trkdb_hdr hdr;
+	memset(&hdr, 0, sizeof hdr);
+	memcpy(hdr.magic, TRKDB_MAGIC, sizeof hdr.magic);
+	hdr.version = TRKDB_VERSION;
+	hdr.endian = TRKDB_ENDIAN;
+	hdr.casemap = ctx->trkcasemap;
+
+	/* count first so everything can be allocated in one go */
+	size_t nusers = lsi_ucb_num_users(ctx), nchans = 0, nmemb = 0;
+	size_t nlmodes = 0;
+	skmap_iter it, mit;
+	void *e;
+	lsi_ucb_iter_chans(ctx, &it);
+	while (lsi_skmap_iter_next(&it, NULL, &e)) {
+		chan *c = e;
+		nchans++;
+		nmemb += lsi_ucb_num_memb(ctx, c);
+		for (size_t i = 0; i < NUM_CHANMODES; i++)
+			if (c->lmodes[i])
+				nlmodes += lsi_skmap_count(c->lmodes[i]);
+	}
+
+	if (nusers > UINT32_MAX || nmemb > UINT32_MAX
+	    || nlmodes > UINT32_MAX) {
+		E("too much state to save");
+		return false;
+	}
+
+	bool ok = false;
+	FILE *f = NULL;
+	char tmppath[4096];
+	struct strtab st = { NULL, 1, 4096 };
+	struct trkdb_user *dusers = MALLOC((nusers + 1) * sizeof *dusers);
+	struct trkdb_chan *dchans = MALLOC((nchans + 1) * sizeof *dchans);
+	struct trkdb_memb *dmemb = MALLOC((nmemb + 1) * sizeof *dmemb);
+	struct trkdb_lmode *dlmodes = MALLOC((nlmodes + 1) * sizeof *dlmodes);
+	skmap *uind = lsi_skmap_init(nusers + 1, ctx->trkcasemap);
+	if (!dusers || !dchans || !dmemb || !dlmodes || !uind
+	    || !(st.buf = MALLOC(st.sz)))
+		goto done;
+
+	st.buf[0] = '\0';
+
+	hdr.pfxmodes = addstr(&st, ctx->m005modepfx[0]);
+	hdr.pfxsyms = addstr(&st, ctx->m005modepfx[1]);
+	if (hdr.pfxmodes == UINT32_MAX || hdr.pfxsyms == UINT32_MAX)
+		goto done;
+
+	/* the members refer to users by index, so remember those */
+	size_t n = 0;
+	lsi_ucb_iter_users(ctx, &it);
+	while (lsi_skmap_iter_next(&it, NULL, &e)) {
+		user *u = e;
+		struct trkdb_user *du = &dusers[n];
+		lsi_ucb_user_details(u);
+		du->nick = addstr(&st, u->nick);
+		du->uname = addstr(&st, u->uname);
+		du->host = addstr(&st, u->host);
+		du->fname = addstr(&st, u->fname);
+		if (du->nick == UINT32_MAX || du->uname == UINT32_MAX
+		    || du->host == UINT32_MAX || du->fname == UINT32_MAX
+		    || !lsi_skmap_put(uind, u->nick, (void *)(uintptr_t)++n))
+			goto done;
+	}
+
+	size_t nc = 0, nm = 0, nl = 0;
+	lsi_ucb_iter_chans(ctx, &it);
+	while (lsi_skmap_iter_next(&it, NULL, &e)) {
+		chan *c = e;
+		struct trkdb_chan *dc = &dchans[nc++];
+		memset(dc, 0, sizeof *dc);
+		dc->name = addstr(&st, c->name);
+		dc->topic = addstr(&st, c->topic);
+		dc->topicnick = addstr(&st, c->topicnick);
+		dc->tscreate = c->tscreate;
+		dc->tstopic = c->tstopic;
+		dc->dmodes = c->dmodes;
+		if (dc->name == UINT32_MAX || dc->topic == UINT32_MAX
+		    || dc->topicnick == UINT32_MAX)
+			goto done;
+
+		for (size_t i = 0; i < NUM_CHANMODES; i++)
+			if ((dc->amodes[i] = addstr(&st, c->amodes[i]))
+			    == UINT32_MAX)
+				goto done;
+
+		dc->memb = (uint32_t)nm;
+		lsi_ucb_iter_memb(ctx, c, &mit);
+		while (lsi_skmap_iter_next(&mit, NULL, &e)) {
+			memb *m = e;
+			uintptr_t ui = (uintptr_t)lsi_skmap_get(uind, m->u->nick);
+			if (!ui) {
+				E("member '%s' of '%s' is not a known user",
+				    m->u->nick, c->name);
+				goto done;
+			}
+
+			dmemb[nm].user = (uint32_t)(ui - 1);
+			if ((dmemb[nm++].modepfx = addstr(&st, m->modepfx))
+			    == UINT32_MAX)
+				goto done;
+		}
+		dc->nmemb = (uint32_t)(nm - dc->memb);
+
+		dc->lmode = (uint32_t)nl;
+		for (size_t i = 0; i < NUM_CHANMODES; i++) {
+			if (!c->lmodes[i])
+				continue;
+
+			char mode = (char)(i < 26 ? 'a' + i : 'A' + (i - 26));
+			char *mask;
+			lsi_skmap_iter_init(c->lmodes[i], &mit);
+			while (lsi_skmap_iter_next(&mit, &mask, &e)) {
+				lmode *lm = e;
+				struct trkdb_lmode *dl = &dlmodes[nl++];
+				dl->tsset = lm->tsset;
+				dl->mode = (uint32_t)mode;
+				dl->pad = 0;
+				dl->mask = addstr(&st, mask);
+				dl->setby = addstr(&st, lm->setby);
+				if (dl->mask == UINT32_MAX
+				    || dl->setby == UINT32_MAX)
+					goto done;
+			}
+		}
+		dc->nlmode = (uint32_t)(nl - dc->lmode);
+	}
+
+	hdr.nusers = (uint32_t)nusers;
+	hdr.nchans = (uint32_t)nchans;
+	hdr.nmemb = (uint32_t)nmemb;
+	hdr.nlmodes = (uint32_t)nlmodes;
+	hdr.strsz = (uint32_t)st.len;
+
+	/* write to a temporary file first, so that we never leave a torn
+	 * one behind for the next irc_track_load() */
+	if ((size_t)snprintf(tmppath, sizeof tmppath, "%s.tmp", path)
+	    >= sizeof tmppath) {
+		E("path too long: '%s'", path);
+		goto done;
+	}
+
+	if (!(f = fopen(tmppath, "wb"))) {
+		EE("fopen '%s'", tmppath);
+		goto done;
+	}
+
+	if (fwrite(&hdr, sizeof hdr, 1, f) != 1
+	    || fwrite(dusers, sizeof *dusers, nusers, f) != nusers
+	    || fwrite(dchans, sizeof *dchans, nchans, f) != nchans
+	    || fwrite(dmemb, sizeof *dmemb, nmemb, f) != nmemb
+	    || fwrite(dlmodes, sizeof *dlmodes, nlmodes, f) != nlmodes
+	    || fwrite(st.buf, 1, st.len, f) != st.len) {
+		EE("fwrite '%s'", tmppath);
+		goto done;
+	}
+
+	int r = fclose(f);
+	f = NULL;
+	if (r != 0) {
+		EE("fclose '%s'", tmppath);
+		goto done;
+	}
+
+	if (rename(tmppath, path) != 0) {
+		EE("rename '%s' to '%s'", tmppath, path);
+		goto done;
+	}
+
+	I("saved %zu chans, %zu users, %zu memberships to '%s'",
+	    nchans, nusers, nmemb, path);
+	ok = true;
+
+done:
+	if (f) {
+		fclose(f);
+		remove(tmppath);
+	}
+
+	if (!ok)
+		E("failed to save tracking state to '%s'", path);
+
+	lsi_skmap_dispose(uind);
+	free(st.buf);
+	free(dusers);
+	free(dchans);
+	free(dmemb);
+	free(dlmodes);
+	return ok;
+}
+
+/* set up `db` to point into the file at `p`; false if it is truncated or not
+ * one of ours */
+static bool
+dbmap(struct trkdb *db, const void *p, size_t len)
+{
+	const char *base = p;
+	const struct trkdb_hdr *hdr = p;
+	if (len < sizeof *hdr || memcmp(hdr->magic, TRKDB_MAGIC,
+	    sizeof hdr->magic) != 0) {
+		E("not a tracking database");
+		return false;
+	}
+
+	if (hdr->version != TRKDB_VERSION || hdr->endian != TRKDB_ENDIAN) {
+		E("unsupported tracking database (version %"PRIu32", "
+		    "endian %#"PRIx32")", hdr->version, hdr->endian);
+		return false;
+	}
+
+	/* the counts are 32 bits, so none of this can overflow */
+	uint64_t need = sizeof *hdr;
+	uint64_t offusers = need;
+	need += (uint64_t)hdr->nusers * sizeof *db->users;
+	uint64_t offchans = need;
+	need += (uint64_t)hdr->nchans * sizeof *db->chans;
+	uint64_t offmemb = need;
+	need += (uint64_t)hdr->nmemb * sizeof *db->memb;
+	uint64_t offlmodes = need;
+	need += (uint64_t)hdr->nlmodes * sizeof *db->lmodes;
+	uint64_t offstr = need;
+	need += hdr->strsz;
+
+	if (need != len || hdr->strsz == 0) {
+		E("tracking database has bad size (%zu, expected %"PRIu64")",
+		    len, need);
+		return false;
+	}
+
+	db->hdr = hdr;
+	db->users = (const void *)(base + offusers);
+	db->chans = (const void *)(base + offchans);
+	db->memb = (const void *)(base + offmemb);
+	db->lmodes = (const void *)(base + offlmodes);
+	db->strtab = base + offstr;
+	return true;
+}
+
+static bool
+okstr(const struct trkdb *db, uint32_t off)
+{
+	return off < db->hdr->strsz;
+}
+
+static const char *
+dbstr(const struct trkdb *db, uint32_t off)
+{
+	return off ? db->strtab + off : NULL;
+}
+
+/* make sure every index and offset is in range before we trust any of it */
+static bool
+dbcheck(const struct trkdb *db)
+{
+	const struct trkdb_hdr *hdr = db->hdr;
+	if (hdr->casemap != CMAP_RFC1459 && hdr->casemap != CMAP_STRICT_RFC1459
+	    && hdr->casemap != CMAP_ASCII)
+		goto bad;
+
+	if (db->strtab[0] || db->strtab[hdr->strsz - 1]
+	    || !okstr(db, hdr->pfxmodes) || !okstr(db, hdr->pfxsyms)) {
+		E("tracking database has a bad string table");
+		return false;
+	}
+
+	for (uint32_t i = 0; i < hdr->nusers; i++) {
+		const struct trkdb_user *u = &db->users[i];
+		if (!u->nick || !okstr(db, u->nick) || !okstr(db, u->uname)
+		    || !okstr(db, u->host) || !okstr(db, u->fname))
+			goto bad;
+	}
+
+	for (uint32_t i = 0; i < hdr->nchans; i++) {
+		const struct trkdb_chan *c = &db->chans[i];
+		if (!c->name || !okstr(db, c->name) || !okstr(db, c->topic)
+		    || !okstr(db, c->topicnick)
+		    || c->memb > hdr->nmemb || c->nmemb > hdr->nmemb - c->memb
+		    || c->lmode > hdr->nlmodes
+		    || c->nlmode > hdr->nlmodes - c->lmode)
+			goto bad;
+
+		for (size_t j = 0; j < NUM_CHANMODES; j++)
+			if (!okstr(db, c->amodes[j]))
+				goto bad;
+	}
+
+	for (uint32_t i = 0; i < hdr->nmemb; i++)
+		if (db->memb[i].user >= hdr->nusers
+		    || !okstr(db, db->memb[i].modepfx))
+			goto bad;
+
+	for (uint32_t i = 0; i < hdr->nlmodes; i++) {
+		const struct trkdb_lmode *l = &db->lmodes[i];
+		if (!l->mask || !okstr(db, l->mask) || !okstr(db, l->setby)
+		    || l->mode > 127 || lsi_ucb_modeind((char)l->mode) == -1)
+			goto bad;
+	}
+
+	return true;
+
+bad:
+	E("tracking database is corrupt");
+	return false;
+}
+
+/* build the tracking state from what's in `db`.  the maps are keyed by the
+ * casemapping the file was written with, so make the ucbase use that.
+ * duplicate nicks, channels or members can only be told apart from here
+ * (it takes the casemapping), so this checks for those */
+static bool
+adopt(irc *ctx, const struct trkdb *db)
+{
+	const struct trkdb_hdr *hdr = db->hdr;
+	int cmap = ctx->casemap;
+	ctx->casemap = hdr->casemap;
+
+	/* same for the mode prefixes.  we're not connected, so this won't
+	 * confuse anyone; the next logon resets it anyway */
+	if (hdr->pfxmodes && hdr->pfxsyms) {
+		lsi_b_strNcpy(ctx->m005modepfx[0], dbstr(db, hdr->pfxmodes),
+		    MAX_005_MDPFX);
+		lsi_b_strNcpy(ctx->m005modepfx[1], dbstr(db, hdr->pfxsyms),
+		    MAX_005_MDPFX);
+		lsi_imh_compile_005(ctx);
+	}
+
+	user **uv = MALLOC((hdr->nusers + 1) * sizeof *uv);
+	if (!uv || !lsi_ucb_init(ctx))
+		goto fail;
+
+	if (!lsi_skmap_reserve(ctx->users, hdr->nusers)
+	    || !lsi_skmap_reserve(ctx->chans, hdr->nchans))
+		goto fail;
+
+	for (uint32_t i = 0; i < hdr->nusers; i++) {
+		const struct trkdb_user *du = &db->users[i];
+		if (lsi_skmap_get(ctx->users, dbstr(db, du->nick)))
+			goto bad;
+
+		user *u = uv[i] = lsi_ucb_add_user(ctx, dbstr(db, du->nick));
+		if (!u)
+			goto fail;
+
+		if ((du->uname && !(u->uname = STRDUP(dbstr(db, du->uname))))
+		    || (du->host && !(u->host = STRDUP(dbstr(db, du->host))))
+		    || (du->fname && !(u->fname = STRDUP(dbstr(db, du->fname)))))
+			goto fail;
+	}
+
+	for (uint32_t i = 0; i < hdr->nchans; i++) {
+		const struct trkdb_chan *dc = &db->chans[i];
+		if (lsi_skmap_get(ctx->chans, dbstr(db, dc->name)))
+			goto bad;
+
+		chan *c = lsi_ucb_add_chan(ctx, dbstr(db, dc->name));
+		if (!c)
+			goto fail;
+
+		if ((dc->topic && !(c->topic = STRDUP(dbstr(db, dc->topic))))
+		    || (dc->topicnick
+		    && !(c->topicnick = STRDUP(dbstr(db, dc->topicnick)))))
+			goto fail;
+
+		c->tscreate = dc->tscreate;
+		c->tstopic = dc->tstopic;
+		c->dmodes = dc->dmodes;
+		for (size_t j = 0; j < NUM_CHANMODES; j++)
+			if (dc->amodes[j] && !(c->amodes[j] =
+			    STRDUP(dbstr(db, dc->amodes[j]))))
+				goto fail;
+
+		if (!lsi_skmap_reserve(c->memb, dc->nmemb))
+			goto fail;
+
+		for (uint32_t j = dc->memb; j < dc->memb + dc->nmemb; j++) {
+			const struct trkdb_memb *dm = &db->memb[j];
+			if (lsi_skmap_get(c->memb, uv[dm->user]->nick))
+				goto bad;
+
+			if (!lsi_ucb_add_memb(ctx, c, uv[dm->user],
+			    dm->modepfx ? dbstr(db, dm->modepfx) : ""))
+				goto fail;
+		}
+
+		for (uint32_t j = dc->lmode; j < dc->lmode + dc->nlmode; j++) {
+			const struct trkdb_lmode *dl = &db->lmodes[j];
+			if (!lsi_ucb_add_lmode(ctx, c, (char)dl->mode,
+			    dbstr(db, dl->mask), dbstr(db, dl->setby),
+			    dl->tsset))
+				goto fail;
+		}
+	}
+
+	/* none of this is known to be true anymore; treat it like state kept
+	 * across a reconnect */
+	lsi_ucb_mark_stale(ctx);
+	ctx->trkcasemap = hdr->casemap;
+	ctx->casemap = cmap;
+	free(uv);
+	return true;
+
+bad:
+	E("tracking database is corrupt (duplicate entries)");
+	goto cleanup;
+
+fail:
+	E("out of memory while loading tracking state");
+
+cleanup:
+	if (ctx->chans)
+		lsi_ucb_deinit(ctx);
+
+	ctx->casemap = cmap;
+	free(uv);
+	return false;
+}
+
+bool
+irc_track_load(irc *ctx, const char *path)
+{
+	if (!ctx->tracking) {
+		E("tracking is not enabled, see irc_set_track()");
+		return false;
+	}
+
+	if (lsi_conn_online(ctx->con)) {
+		E("can't load tracking state while connected");
+		return false;
+	}
+
+	if (ctx->trkshare) {
+		E("can't load into a shared tracking store");
+		return false;
+	}
+
+	size_t len;
+	void *p = lsi_b_mapfile(path, &len);
+	if (!p)
+		return false;
+
+	struct trkdb db;
+	bool ok = dbmap(&db, p, len) && dbcheck(&db);
+	if (ok) {
+		if (ctx->chans)
+			lsi_ucb_deinit(ctx);
+
+		if ((ok = adopt(ctx, &db)))
+			I("loaded %"PRIu32" chans, %"PRIu32" users, %"PRIu32" "
+			    "memberships from '%s'", db.hdr->nchans,
+			    db.hdr->nusers, db.hdr->nmemb, path);
+	}
+
+	lsi_b_unmapfile(p, len);
+	return ok;
+}
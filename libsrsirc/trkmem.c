@@ -0,0 +1,239 @@
+/* trkmem.c - memory used by the tracking state, and the memory cap
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_TRACK
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include "trkmem.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/base_misc.h>
+#include <platform/base_time.h>
+
+#include <logger/intlog.h>
+
+#include <libsrsirc/irc_ext.h>
+#include <libsrsirc/irc_track.h>
+
+#include "intdefs.h"
+#include "skmap.h"
+
+/* Sizes are counted by walking the tracking state and adding up what we
+ * asked malloc() for; malloc()'s own overhead isn't known to us and thus not
+ * included.  Neither are tags, the host index or snapshots.
+ *
+ * With a cap set, we count again every so often (at most once a second, at
+ * the end of a NAMES reply and on PING), and if over the cap, evict what can
+ * be asked for again: first the uname and fname of the users who have been
+ * quiet for the longest, then the topics of the channels the user hasn't
+ * looked at for the longest.  Hosts, memberships and modes are kept.  What
+ * was evicted is asked for again (WHO, TOPIC) once the user looks up that
+ * very user or channel, see irc_user(), irc_member() and irc_chan().  Those
+ * only queue the request, it is sent from irc_read(), one at a time, along
+ * with the WHOs of irc_set_track_whosync() (see whoq_add() in irc_track.c) */
+
+/* don't count more often than this, unless forced */
+#define CHECK_IVAL_US 1000000
+
+
+static void count(irc *ctx, struct irc_trkmem *st);
+static size_t evict_users(irc *ctx, size_t want);
+static size_t evict_topics(irc *ctx, size_t want);
+static int cmp_tsact(const void *a, const void *b);
+static int cmp_tsread(const void *a, const void *b);
+
+
+#define STRSZ(S) ((S) ? strlen(S) + 1 : 0)
+
+
+bool
+irc_track_memstats(irc *ctx, struct irc_trkmem *dest)
+{
+	if (!ctx->chans)
+		return false;
+
+	count(ctx, dest);
+	return true;
+}
+
+void
+irc_set_track_memcap(irc *ctx, size_t bytes)
+{
+	ctx->trkmemcap = bytes;
+	if (ctx->chans)
+		lsi_tmem_enforce(ctx, true);
+	return;
+}
+
+static void
+count(irc *ctx, struct irc_trkmem *st)
+{
+	st->users = st->chans = st->members = st->modes = st->topics = 0;
+	st->maps = lsi_skmap_memsize(ctx->chans) + lsi_skmap_memsize(ctx->users)
+	    + lsi_skmap_memsize(ctx->untrk);
+
+	skmap_iter it;
+	user *u;
+	lsi_ucb_iter_users(ctx, &it);
+	while (lsi_skmap_iter_next(&it, NULL, (void **)&u))
+		st->users += sizeof *u + STRSZ(u->nick) + STRSZ(u->uname)
+		    + STRSZ(u->host) + STRSZ(u->fname) + STRSZ(u->pend)
+		    + STRSZ(u->acct) + STRSZ(u->away);
+
+	chan *c;
+	lsi_ucb_iter_chans(ctx, &it);
+	while (lsi_skmap_iter_next(&it, NULL, (void **)&c)) {
+		st->chans += sizeof *c;
+		st->topics += STRSZ(c->topic) + STRSZ(c->topicnick);
+		st->maps += lsi_skmap_memsize(c->memb);
+
+		skmap_iter mit;
+		memb *m;
+		lsi_ucb_iter_memb(ctx, c, &mit);
+		while (lsi_skmap_iter_next(&mit, NULL, (void **)&m))
+			st->members += sizeof *m + m->lvl * sizeof m->lnk[0];
+
+		for (size_t i = 0; i < NUM_CHANMODES; i++) {
+			st->modes += STRSZ(c->amodes[i]);
+			if (!c->lmodes[i])
+				continue;
+
+			st->maps += lsi_skmap_memsize(c->lmodes[i]);
+
+			skmap_iter lit;
+			lmode *lm;
+			lsi_skmap_iter_init(c->lmodes[i], &lit);
+			while (lsi_skmap_iter_next(&lit, NULL, (void **)&lm))
+				st->modes += sizeof *lm + STRSZ(lm->setby);
+		}
+	}
+
+	st->total = st->users + st->chans + st->members + st->modes
+	    + st->topics + st->maps;
+	return;
+}
+
+void
+lsi_tmem_enforce(irc *ctx, bool force)
+{
+	if (!ctx->trkmemcap)
+		return;
+
+	uint64_t now = lsi_b_tstamp_us();
+	if (!force && now - ctx->trkmemchk < CHECK_IVAL_US)
+		return;
+
+	ctx->trkmemchk = now;
+
+	struct irc_trkmem st;
+	count(ctx, &st);
+	if (st.total <= ctx->trkmemcap)
+		return;
+
+	size_t want = st.total - ctx->trkmemcap;
+	size_t got = evict_users(ctx, want);
+	if (got < want)
+		got += evict_topics(ctx, want - got);
+
+	D("%zu bytes over the cap, evicted %zu", want, got);
+	return;
+}
+
+static size_t
+evict_users(irc *ctx, size_t want)
+{
+	size_t n = 0;
+	skmap_iter it;
+	user *u;
+	lsi_ucb_iter_users(ctx, &it);
+	while (lsi_skmap_iter_next(&it, NULL, (void **)&u))
+		if (!u->pend && (u->uname || u->fname))
+			n++;
+
+	if (!n)
+		return 0;
+
+	user **ua = MALLOC(n * sizeof *ua);
+	if (!ua)
+		return 0;
+
+	n = 0;
+	lsi_ucb_iter_users(ctx, &it);
+	while (lsi_skmap_iter_next(&it, NULL, (void **)&u))
+		if (!u->pend && (u->uname || u->fname))
+			ua[n++] = u;
+
+	qsort(ua, n, sizeof *ua, cmp_tsact);
+
+	size_t got = 0;
+	for (size_t i = 0; i < n && got < want; i++) {
+		got += STRSZ(ua[i]->uname) + STRSZ(ua[i]->fname);
+		free(ua[i]->uname);
+		free(ua[i]->fname);
+		ua[i]->uname = ua[i]->fname = NULL;
+		ua[i]->evicted = true;
+	}
+
+	free(ua);
+	return got;
+}
+
+static size_t
+evict_topics(irc *ctx, size_t want)
+{
+	size_t n = 0;
+	skmap_iter it;
+	chan *c;
+	lsi_ucb_iter_chans(ctx, &it);
+	while (lsi_skmap_iter_next(&it, NULL, (void **)&c))
+		if (c->topic || c->topicnick)
+			n++;
+
+	if (!n)
+		return 0;
+
+	chan **ca = MALLOC(n * sizeof *ca);
+	if (!ca)
+		return 0;
+
+	n = 0;
+	lsi_ucb_iter_chans(ctx, &it);
+	while (lsi_skmap_iter_next(&it, NULL, (void **)&c))
+		if (c->topic || c->topicnick)
+			ca[n++] = c;
+
+	qsort(ca, n, sizeof *ca, cmp_tsread);
+
+	size_t got = 0;
+	for (size_t i = 0; i < n && got < want; i++) {
+		got += STRSZ(ca[i]->topic) + STRSZ(ca[i]->topicnick);
+		free(ca[i]->topic);
+		free(ca[i]->topicnick);
+		ca[i]->topic = ca[i]->topicnick = NULL;
+		ca[i]->evicted = true;
+	}
+
+	free(ca);
+	return got;
+}
+
+static int
+cmp_tsact(const void *a, const void *b)
+{
+	const user *u1 = *(user *const *)a, *u2 = *(user *const *)b;
+	return (u1->tsact > u2->tsact) - (u1->tsact < u2->tsact);
+}
+
+static int
+cmp_tsread(const void *a, const void *b)
+{
+	const chan *c1 = *(chan *const *)a, *c2 = *(chan *const *)b;
+	return (c1->tsread > c2->tsread) - (c1->tsread < c2->tsread);
+}
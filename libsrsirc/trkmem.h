@@ -0,0 +1,22 @@
+/* trkmem.h - memory used by the tracking state, and the memory cap, interface
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_TRKMEM_H
+#define LIBSRSIRC_TRKMEM_H 1
+
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <libsrsirc/defs.h>
+
+#include "ucbase.h"
+
+
+/* if we're over the cap set by irc_set_track_memcap(), evict cold data.
+ * unless `force`d, this does nothing if we checked less than a second ago */
+void lsi_tmem_enforce(irc *ctx, bool force);
+
+
+#endif /* LIBSRSIRC_TRKMEM_H */
@@ -0,0 +1,249 @@
+/* trkshare.c - user store shared by several contexts
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_TRACK
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include "trkshare.h"
+
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/base_misc.h>
+
+#include <logger/intlog.h>
+
+#include <libsrsirc/irc_track.h>
+
+#include "conn.h"
+#include "intdefs.h"
+#include "irc_track_int.h"
+#include "ucbase.h"
+
+/* Several contexts connected to the same network see mostly the same users.
+ * Attached to a share, they all use one user map (ctx->users), while each
+ * keeps its own channels.  A user's `nchans` then counts memberships across
+ * all of them, so users still go away along with their last membership,
+ * whichever context it was in.
+ *
+ * What happens to a user is seen by every context, each in its own time, and
+ * the first one to see it changes the shared record.  The others then find
+ * it changed already.  Since a rename re-keys the member maps, it is applied
+ * to every attached context at once.  A context that has the user in one of
+ * its channels but is yet to see the NICK may still get lines about them
+ * under the old nick (PART, KICK, MODE, NAMES...), so it is given an alias
+ * (ctx->nickalias) mapping the old nick to the user, which its lookups
+ * consult first.  The alias goes away once the context gets to the NICK
+ * (see h_NICK()), reconnects, or the user is gone.  Should a context
+ * nevertheless have learned about the user under the old nick, the two
+ * records are merged when it gets to the NICK (see lsi_ucb_rename_user()).
+ * Netsplit QUITs aren't deferred with a shared map, see h_QUIT(). */
+
+
+irc_trkshare *
+irc_trkshare_init(void)
+{
+	irc_trkshare *sh = MALLOC(sizeof *sh);
+	if (!sh)
+		return NULL;
+
+	sh->users = NULL;
+	sh->casemap = CMAP_RFC1459;
+	sh->usergen = 0;
+	sh->detgen = 0;
+	sh->refs = 1;
+	sh->att = NULL;
+	sh->natt = sh->attsz = 0;
+	return sh;
+}
+
+void
+irc_trkshare_dispose(irc_trkshare *sh)
+{
+	if (sh)
+		lsi_tsh_unref(sh);
+	return;
+}
+
+void
+lsi_tsh_unref(irc_trkshare *sh)
+{
+	if (--sh->refs)
+		return;
+
+	/* every attached context holds a reference, so nobody is attached
+	 * anymore, and the last to detach has disposed of the map */
+	free(sh->att);
+	free(sh);
+	D("disposed of shared tracking store");
+	return;
+}
+
+bool
+irc_set_track_share(irc *ctx, irc_trkshare *sh)
+{
+	if (lsi_conn_online(ctx->con)) {
+		E("can't change the tracking store while connected");
+		return false;
+	}
+
+	lsi_trk_deinit(ctx);
+
+	if (sh)
+		sh->refs++;
+
+	if (ctx->trkshare)
+		lsi_tsh_unref(ctx->trkshare);
+
+	ctx->trkshare = sh;
+	return true;
+}
+
+bool
+lsi_tsh_attach(irc *ctx)
+{
+	irc_trkshare *sh = ctx->trkshare;
+	if (sh->users && sh->casemap != ctx->casemap) {
+		W("casemapping differs from the shared store's, not sharing");
+		return false;
+	}
+
+	if (sh->natt == sh->attsz) {
+		size_t nsz = sh->attsz ? sh->attsz * 2 : 8;
+		irc **na = MALLOC(nsz * sizeof *na);
+		if (!na)
+			return false;
+
+		if (sh->natt)
+			memcpy(na, sh->att, sh->natt * sizeof *na);
+		free(sh->att);
+		sh->att = na;
+		sh->attsz = nsz;
+	}
+
+	if (!sh->users) {
+		if (!(sh->users = lsi_skmap_init(4096, ctx->casemap)))
+			return false;
+		sh->casemap = ctx->casemap;
+	}
+
+	/* our snapshots' user versions must not be ahead of the store's, and
+	 * a host index built on either map must not look current for the
+	 * other (see hostidx.c), so move past both */
+	if (sh->detgen < *ctx->detgen)
+		sh->detgen = *ctx->detgen;
+	if (sh->usergen < *ctx->usergen)
+		sh->usergen = *ctx->usergen;
+	sh->usergen++;
+
+	sh->att[sh->natt++] = ctx;
+	ctx->users = sh->users;
+	ctx->usergen = &sh->usergen;
+	ctx->detgen = &sh->detgen;
+	ctx->trkshared = true;
+	D("attached to shared tracking store (%zu contexts)", sh->natt);
+	return true;
+}
+
+skmap *
+lsi_tsh_detach(irc *ctx)
+{
+	irc_trkshare *sh = ctx->trkshare;
+	for (size_t i = 0; i < sh->natt; i++) {
+		if (sh->att[i] != ctx)
+			continue;
+
+		sh->att[i] = sh->att[--sh->natt];
+		break;
+	}
+
+	lsi_tsh_alias_clear(ctx);
+	ctx->users = NULL;
+	ctx->ownugen = sh->usergen + 1; //never go back, see lsi_tsh_attach()
+	ctx->usergen = &ctx->ownugen;
+	ctx->owndgen = sh->detgen;
+	ctx->detgen = &ctx->owndgen;
+	ctx->trkshared = false;
+	D("detached from shared tracking store (%zu contexts)", sh->natt);
+
+	if (sh->natt)
+		return NULL;
+
+	skmap *m = sh->users;
+	sh->users = NULL;
+	return m;
+}
+
+bool
+lsi_tsh_alias_add(irc *ctx, const char *oldnick, user *u)
+{
+	if (!ctx->nickalias
+	    && !(ctx->nickalias = lsi_skmap_init(16, ctx->casemap)))
+		return false;
+
+	lsi_skmap_del(ctx->nickalias, oldnick);
+	if (!lsi_skmap_put(ctx->nickalias, oldnick, u))
+		return false;
+
+	D("'%s' is '%s' until we see the NICK", oldnick, u->nick);
+	return true;
+}
+
+user *
+lsi_tsh_alias(irc *ctx, const char *nick, size_t len)
+{
+	return lsi_skmap_get_n(ctx->nickalias, nick, len);
+}
+
+user *
+lsi_tsh_alias_del(irc *ctx, const char *ident)
+{
+	if (!ctx->nickalias)
+		return NULL;
+
+	user *u = lsi_skmap_del(ctx->nickalias, ident);
+	if (!lsi_skmap_count(ctx->nickalias))
+		lsi_tsh_alias_clear(ctx);
+
+	return u;
+}
+
+void
+lsi_tsh_alias_forget(irc *ctx, user *u)
+{
+	irc_trkshare *sh = ctx->trkshare;
+	for (size_t i = 0; i < sh->natt; i++) {
+		irc *cx = sh->att[i];
+		bool found;
+		do {
+			/* there's hardly ever more than one or two; deleting
+			 * by the node's own key is fine, lsi_skmap_del() folds
+			 * it before freeing anything */
+			skmap_iter it;
+			char *key;
+			void *e;
+			found = false;
+			lsi_skmap_iter_init(cx->nickalias, &it);
+			while (!found && lsi_skmap_iter_next(&it, &key, &e))
+				found = e == u;
+
+			if (found)
+				lsi_tsh_alias_del(cx, key);
+		} while (found && cx->nickalias);
+	}
+	return;
+}
+
+void
+lsi_tsh_alias_clear(irc *ctx)
+{
+	lsi_skmap_dispose(ctx->nickalias);
+	ctx->nickalias = NULL;
+	return;
+}
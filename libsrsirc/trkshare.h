@@ -0,0 +1,60 @@
+/* trkshare.h - user store shared by several contexts, interface
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_TRKSHARE_H
+#define LIBSRSIRC_TRKSHARE_H 1
+
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <libsrsirc/defs.h>
+
+#include "skmap.h"
+
+
+struct user;
+
+struct irc_trkshare {
+	skmap *users;   // The users of all attached contexts, NULL if none
+	int casemap;    // Casemapping the above is keyed by
+	size_t usergen; // What the attached contexts' `usergen` points to
+	size_t detgen;  // What the attached contexts' `detgen` points to
+	size_t refs;    // Contexts set to use us, plus the creator
+	irc **att;      // Contexts whose tracking currently uses `users`
+	size_t natt;    // Amount of the above
+	size_t attsz;   // Allocated size of the above
+};
+
+
+/* make ctx->users the shared map (creating it if needed).  false if the
+ * casemapping doesn't match, or we ran out of memory */
+bool lsi_tsh_attach(irc *ctx);
+
+/* undo lsi_tsh_attach(); returns the map if `ctx` was the last one using it,
+ * for the caller to free what's left in it */
+skmap *lsi_tsh_detach(irc *ctx);
+
+/* drop a reference, freeing `sh` when it was the last */
+void lsi_tsh_unref(struct irc_trkshare *sh);
+
+/* `ctx` still knows `u` as `oldnick`, until it sees the NICK itself */
+bool lsi_tsh_alias_add(irc *ctx, const char *oldnick, struct user *u);
+
+/* whom `ctx` still knows as (the first `len` chars of) `nick`, NULL if
+ * nobody.  call only if ctx->nickalias is set */
+struct user *lsi_tsh_alias(irc *ctx, const char *nick, size_t len);
+
+/* forget the alias `ident` (nick or nick!uname@host) of `ctx`, returning
+ * whom it stood for (or NULL) */
+struct user *lsi_tsh_alias_del(irc *ctx, const char *ident);
+
+/* forget the aliases of `u`, in every context sharing the store */
+void lsi_tsh_alias_forget(irc *ctx, struct user *u);
+
+/* forget all aliases of `ctx` */
+void lsi_tsh_alias_clear(irc *ctx);
+
+
+#endif /* LIBSRSIRC_TRKSHARE_H */
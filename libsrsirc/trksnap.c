@@ -0,0 +1,497 @@
+/* trksnap.c - immutable snapshots of the tracking state
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#define LOG_MODULE MOD_TRACK
+
+#if HAVE_CONFIG_H
+# include <config.h>
+#endif
+
+
+#include "trksnap.h"
+
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <platform/base_misc.h>
+#include <platform/base_string.h>
+
+#include <logger/intlog.h>
+
+#include <libsrsirc/irc_track.h>
+#include <libsrsirc/util.h>
+
+#include "intdefs.h"
+#include "skmap.h"
+#include "ucbase.h"
+
+/* The I/O thread publishes snapshots, any thread may read them.
+ *
+ * A snapshot is an array of per-channel snapshots (struct snapchan), each a
+ * single allocation holding everything we know about the channel and its
+ * members.  They are never modified after being built.  A channel that
+ * hasn't changed since the last snapshot (see lsi_ucb_dirty_chan()), and
+ * none of whose members' details have (see lsi_ucb_dirty_user()), is shared
+ * with it instead of being copied again.  snapchan refcounts (and `uver`) are
+ * only ever touched by the I/O thread, so they're plain counters.
+ *
+ * Readers take a reference on the whole snapshot.  To close the window between
+ * loading the current snapshot pointer and taking the reference, they count
+ * themselves in `snapreaders` while doing so.  A replaced snapshot goes to
+ * the retired list and is only freed by the I/O thread once it has seen no
+ * reader in the middle of irc_snap_acquire() and no references left.  Neither
+ * side ever waits for the other. */
+
+struct snapmemb {
+	const char *key; //casefolded nick
+	const char *nick;
+	const char *uname;
+	const char *host;
+	const char *fname;
+	const char *acct;
+	const char *away;
+	char modepfx[MAX_MODEPFX];
+};
+
+struct snapchan {
+	size_t refs;
+	uint64_t ver; //chan->ver this was taken at
+	size_t uver; //*ctx->detgen as of when the members were last found current
+	const char *key; //casefolded name
+	const char *name;
+	const char *topic;
+	const char *topicnick;
+	uint64_t tscreate;
+	uint64_t tstopic;
+	uint64_t dmodes;
+	const char *amodes[NUM_CHANMODES];
+	size_t nmemb;
+	struct snapmemb *memb; //sorted by key
+};
+
+struct irc_snap {
+	size_t refs;
+	uint64_t gen; //ctx->trkgen this was taken at
+	size_t dgen; //*ctx->detgen this was taken at
+	int casemap;
+	size_t nchans;
+	struct snapchan **chans; //sorted by key
+	struct irc_snap *next; //on the retired list
+};
+
+
+static int cmp_snapmemb(const void *v1, const void *v2);
+static int cmp_snapchan(const void *v1, const void *v2);
+static bool memb_current(irc *ctx, chan *c);
+static struct snapchan *mksnapchan(irc *ctx, chan *c);
+static void unref_snapchan(struct snapchan *sc);
+static void free_snap(struct irc_snap *s);
+static void reclaim(irc *ctx);
+static const struct snapchan *find_chan(const irc_snap *s, const char *chnam);
+static const struct snapmemb *find_memb(const irc_snap *s,
+    const struct snapchan *sc, const char *ident);
+static chanrep *mkchanrep(chanrep *dest, const struct snapchan *sc);
+static userrep *mkuserrep(userrep *dest, const struct snapmemb *sm);
+
+
+bool
+irc_snap_publish(irc *ctx)
+{
+	struct irc_snap *cur = ctx->snapcur;
+	if (cur && cur->gen == ctx->trkgen && cur->dgen == *ctx->detgen) {
+		reclaim(ctx);
+		return true;
+	}
+
+	size_t n = lsi_ucb_num_chans(ctx);
+	struct irc_snap *s = MALLOC(sizeof *s + n * sizeof *s->chans);
+	if (!s)
+		return false;
+
+	s->refs = 1; //ours, for as long as it's current
+	s->gen = ctx->trkgen;
+	s->dgen = *ctx->detgen;
+	s->casemap = ctx->casemap;
+	s->nchans = 0;
+	s->chans = (struct snapchan **)(s + 1);
+	s->next = NULL;
+
+	size_t nnew = 0;
+	skmap_iter it;
+	void *e;
+	lsi_ucb_iter_chans(ctx, &it);
+	while (s->nchans < n && lsi_skmap_iter_next(&it, NULL, &e)) {
+		chan *c = e;
+		if (c->stale)
+			continue;
+
+		if (!c->snap || c->snap->ver != c->ver
+		    || !memb_current(ctx, c)) {
+			struct snapchan *sc = mksnapchan(ctx, c);
+			if (!sc) {
+				free_snap(s);
+				return false;
+			}
+
+			lsi_snap_drop_chan(c);
+			c->snap = sc;
+			nnew++;
+		}
+
+		c->snap->refs++;
+		s->chans[s->nchans++] = c->snap;
+	}
+
+	qsort(s->chans, s->nchans, sizeof *s->chans, cmp_snapchan);
+
+	D("publishing snapshot of %zu chans (%zu rebuilt)", s->nchans, nnew);
+
+	struct irc_snap *old = lsi_b_atomic_swapptr(&ctx->snapcur, s);
+	if (old) {
+		old->next = ctx->snapretired;
+		ctx->snapretired = old;
+		lsi_b_atomic_dec(&old->refs);
+	}
+
+	reclaim(ctx);
+	return true;
+}
+
+irc_snap *
+irc_snap_acquire(irc *ctx)
+{
+	lsi_b_atomic_inc(&ctx->snapreaders);
+	struct irc_snap *s = lsi_b_atomic_getptr(&ctx->snapcur);
+	if (s)
+		lsi_b_atomic_inc(&s->refs);
+	lsi_b_atomic_dec(&ctx->snapreaders);
+	return s;
+}
+
+void
+irc_snap_release(irc_snap *s)
+{
+	if (s)
+		lsi_b_atomic_dec(&s->refs);
+	return;
+}
+
+size_t
+irc_snap_num_chans(const irc_snap *s)
+{
+	return s->nchans;
+}
+
+chanrep *
+irc_snap_chan_at(const irc_snap *s, chanrep *dest, size_t i)
+{
+	if (i >= s->nchans)
+		return NULL;
+
+	return mkchanrep(dest, s->chans[i]);
+}
+
+chanrep *
+irc_snap_chan(const irc_snap *s, chanrep *dest, const char *chnam)
+{
+	const struct snapchan *sc = find_chan(s, chnam);
+	return sc ? mkchanrep(dest, sc) : NULL;
+}
+
+bool
+irc_snap_chanmode(const irc_snap *s, const char *chnam, char mode,
+    const char **arg)
+{
+	if (arg)
+		*arg = NULL;
+
+	const struct snapchan *sc = find_chan(s, chnam);
+	int ind = lsi_ucb_modeind(mode);
+	if (!sc || ind == -1)
+		return false;
+
+	if (sc->amodes[ind]) {
+		if (arg)
+			*arg = sc->amodes[ind];
+		return true;
+	}
+
+	return sc->dmodes & ((uint64_t)1 << ind);
+}
+
+size_t
+irc_snap_num_members(const irc_snap *s, const char *chnam)
+{
+	const struct snapchan *sc = find_chan(s, chnam);
+	return sc ? sc->nmemb : 0;
+}
+
+userrep *
+irc_snap_member_at(const irc_snap *s, userrep *dest, const char *chnam,
+    size_t i)
+{
+	const struct snapchan *sc = find_chan(s, chnam);
+	if (!sc || i >= sc->nmemb)
+		return NULL;
+
+	return mkuserrep(dest, &sc->memb[i]);
+}
+
+userrep *
+irc_snap_member(const irc_snap *s, userrep *dest, const char *chnam,
+    const char *ident)
+{
+	const struct snapchan *sc = find_chan(s, chnam);
+	if (!sc)
+		return NULL;
+
+	const struct snapmemb *sm = find_memb(s, sc, ident);
+	return sm ? mkuserrep(dest, sm) : NULL;
+}
+
+
+void
+lsi_snap_drop_chan(chan *c)
+{
+	if (c->snap)
+		unref_snapchan(c->snap);
+	c->snap = NULL;
+	return;
+}
+
+void
+lsi_snap_deinit(irc *ctx)
+{
+	struct irc_snap *s = lsi_b_atomic_swapptr(&ctx->snapcur, NULL);
+	if (s)
+		free_snap(s);
+
+	while ((s = ctx->snapretired)) {
+		ctx->snapretired = s->next;
+		free_snap(s);
+	}
+	return;
+}
+
+
+static int
+cmp_snapmemb(const void *v1, const void *v2)
+{
+	const struct snapmemb *m1 = v1, *m2 = v2;
+	return strcmp(m1->key, m2->key);
+}
+
+static int
+cmp_snapchan(const void *v1, const void *v2)
+{
+	const struct snapchan *const *c1 = v1, *const *c2 = v2;
+	return strcmp((*c1)->key, (*c2)->key);
+}
+
+static size_t
+strsz(const char *s)
+{
+	return s ? strlen(s) + 1 : 0;
+}
+
+/* copy `s` to `*p` and advance it.  NULL stays NULL */
+static const char *
+put(char **p, const char *s)
+{
+	if (!s)
+		return NULL;
+
+	char *r = *p;
+	size_t sz = strlen(s) + 1;
+	memcpy(r, s, sz);
+	*p += sz;
+	return r;
+}
+
+static const char *
+putkey(char **p, const char *s, int casemap)
+{
+	char *r = *p;
+	size_t sz = strlen(s) + 1;
+	lsi_ut_strtolower(r, sz, s, casemap);
+	*p += sz;
+	return r;
+}
+
+/* whether none of the members of `c` changed since c->snap was taken.  only
+ * needs to look if any user changed at all since we last looked */
+static bool
+memb_current(irc *ctx, chan *c)
+{
+	struct snapchan *sc = c->snap;
+	if (sc->uver == *ctx->detgen)
+		return true;
+
+	skmap_iter it;
+	void *e;
+	lsi_ucb_iter_memb(ctx, c, &it);
+	while (lsi_skmap_iter_next(&it, NULL, &e))
+		if (((memb *)e)->u->ver > sc->uver)
+			return false;
+
+	sc->uver = *ctx->detgen;
+	return true;
+}
+
+/* everything in one allocation: the struct, the members, the strings */
+static struct snapchan *
+mksnapchan(irc *ctx, chan *c)
+{
+	size_t nmemb = lsi_ucb_num_memb(ctx, c);
+	size_t sz = sizeof (struct snapchan) + nmemb * sizeof (struct snapmemb);
+
+	sz += 2 * strsz(c->name) + strsz(c->topic) + strsz(c->topicnick);
+	for (size_t i = 0; i < NUM_CHANMODES; i++)
+		sz += strsz(c->amodes[i]);
+
+	skmap_iter it;
+	void *e;
+	lsi_ucb_iter_memb(ctx, c, &it);
+	while (lsi_skmap_iter_next(&it, NULL, &e)) {
+		user *u = ((memb *)e)->u;
+		lsi_ucb_user_details(u);
+		sz += 2 * strsz(u->nick) + strsz(u->uname) + strsz(u->host)
+		    + strsz(u->fname) + strsz(u->acct)
+		    + strsz(u->away);
+	}
+
+	struct snapchan *sc = MALLOC(sz);
+	if (!sc)
+		return NULL;
+
+	sc->refs = 1; //the chan's, see lsi_snap_drop_chan()
+	sc->ver = c->ver;
+	sc->uver = *ctx->detgen;
+	sc->memb = (struct snapmemb *)(sc + 1);
+	char *p = (char *)(sc->memb + nmemb);
+
+	sc->key = putkey(&p, c->name, ctx->casemap);
+	sc->name = put(&p, c->name);
+	sc->topic = put(&p, c->topic);
+	sc->topicnick = put(&p, c->topicnick);
+	sc->tscreate = c->tscreate;
+	sc->tstopic = c->tstopic;
+	sc->dmodes = c->dmodes;
+	for (size_t i = 0; i < NUM_CHANMODES; i++)
+		sc->amodes[i] = put(&p, c->amodes[i]);
+
+	sc->nmemb = 0;
+	lsi_ucb_iter_memb(ctx, c, &it);
+	while (sc->nmemb < nmemb && lsi_skmap_iter_next(&it, NULL, &e)) {
+		memb *m = e;
+		struct snapmemb *sm = &sc->memb[sc->nmemb++];
+		sm->key = putkey(&p, m->u->nick, ctx->casemap);
+		sm->nick = put(&p, m->u->nick);
+		sm->uname = put(&p, m->u->uname);
+		sm->host = put(&p, m->u->host);
+		sm->fname = put(&p, m->u->fname);
+		sm->acct = put(&p, m->u->acct);
+		sm->away = put(&p, m->u->away);
+		memcpy(sm->modepfx, m->modepfx, sizeof sm->modepfx);
+	}
+
+	qsort(sc->memb, sc->nmemb, sizeof *sc->memb, cmp_snapmemb);
+	return sc;
+}
+
+static void
+unref_snapchan(struct snapchan *sc)
+{
+	if (--sc->refs == 0)
+		free(sc);
+	return;
+}
+
+static void
+free_snap(struct irc_snap *s)
+{
+	for (size_t i = 0; i < s->nchans; i++)
+		unref_snapchan(s->chans[i]);
+
+	free(s);
+	return;
+}
+
+/* free retired snapshots nobody holds anymore.  a reader in the middle of
+ * irc_snap_acquire() might be about to take a reference on any of them, so
+ * don't bother while there is one; we'll be back with the next publish */
+static void
+reclaim(irc *ctx)
+{
+	if (lsi_b_atomic_get(&ctx->snapreaders))
+		return;
+
+	struct irc_snap **sp = &ctx->snapretired;
+	while (*sp) {
+		struct irc_snap *s = *sp;
+		if (lsi_b_atomic_get(&s->refs)) {
+			sp = &s->next;
+			continue;
+		}
+
+		*sp = s->next;
+		free_snap(s);
+	}
+	return;
+}
+
+static const struct snapchan *
+find_chan(const irc_snap *s, const char *chnam)
+{
+	char key[MAX_CHAN_LEN];
+	lsi_b_strNcpy(key, chnam, sizeof key);
+	lsi_ut_strtolower(key, sizeof key, key, s->casemap);
+
+	struct snapchan kc = { .key = key };
+	struct snapchan *kp = &kc;
+	struct snapchan **r = bsearch(&kp, s->chans, s->nchans,
+	    sizeof *s->chans, cmp_snapchan);
+
+	return r ? *r : NULL;
+}
+
+static const struct snapmemb *
+find_memb(const irc_snap *s, const struct snapchan *sc, const char *ident)
+{
+	char key[MAX_NICK_LEN];
+	lsi_ut_ident2nick(key, sizeof key, ident);
+	lsi_ut_strtolower(key, sizeof key, key, s->casemap);
+
+	struct snapmemb km = { .key = key };
+	return bsearch(&km, sc->memb, sc->nmemb, sizeof *sc->memb,
+	    cmp_snapmemb);
+}
+
+static chanrep *
+mkchanrep(chanrep *dest, const struct snapchan *sc)
+{
+	dest->name = sc->name;
+	dest->topic = sc->topic;
+	dest->topicnick = sc->topicnick;
+	dest->tscreate = sc->tscreate;
+	dest->tstopic = sc->tstopic;
+	dest->tag = NULL;
+	return dest;
+}
+
+static userrep *
+mkuserrep(userrep *dest, const struct snapmemb *sm)
+{
+	dest->modepfx = sm->modepfx;
+	dest->nick = sm->nick;
+	dest->uname = sm->uname;
+	dest->host = sm->host;
+	dest->fname = sm->fname;
+	dest->account = sm->acct;
+	dest->away = sm->away;
+	dest->nchans = 0;
+	dest->tag = NULL;
+	return dest;
+}
@@ -0,0 +1,21 @@
+/* trksnap.h - immutable snapshots of the tracking state, interface
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#ifndef LIBSRSIRC_TRKSNAP_H
+#define LIBSRSIRC_TRKSNAP_H 1
+
+
+#include <libsrsirc/defs.h>
+
+#include "ucbase.h"
+
+
+/* a channel is gone (or its state dropped); let go of its last snapshot */
+void lsi_snap_drop_chan(chan *c);
+
+/* free all snapshots; nobody may be holding any at this point */
+void lsi_snap_deinit(irc *ctx);
+
+
+#endif /* LIBSRSIRC_TRKSNAP_H */
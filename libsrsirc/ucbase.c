@@ -18,16 +18,35 @@
 
 #include <platform/base_misc.h>
 #include <platform/base_string.h>
+#include <platform/base_time.h>
 
 #include <logger/intlog.h>
 
-#include "skmap.h"
+#include "cmap.h"
 #include "common.h"
+#include "msg.h"
+#include "probes.h"
+#include "skmap.h"
+#include "trkshare.h"
+#include "trksnap.h"
 
 #include <libsrsirc/util.h>
 
 
-static int compare_modepfx(irc *ctx, char c1, char c2);
+static void render_modepfx(irc *ctx, memb *m);
+static uint32_t pfxstr2mask(irc *ctx, const char *mpfxstr);
+static void free_chanmodes(irc *ctx, chan *c);
+static void free_user(irc *ctx, user *u);
+static user *add_user(irc *ctx, const char *ident, const uint8_t *fk,
+    size_t flen, size_t hash, bool defer);
+static bool learn_ident(user *u, const struct idspan *id);
+static char *spandup(const char *s, size_t len, size_t max);
+static void free_users(irc *ctx, skmap *users);
+static bool rekey_memb(irc *ctx, const char *ident, const char *nick,
+    const char *newnick, bool *found);
+static void drop_ghost(irc *ctx, chan *c, memb *m);
+static bool merge_user(irc *ctx, user *u, user *into, const char *ident,
+    const char *newnick);
 
 
 bool
@@ -36,6 +55,10 @@ lsi_ucb_init(irc *ctx)
 	if (!(ctx->chans = lsi_skmap_init(256, ctx->casemap)))
 		return false;
 
+	/* see trkshare.c */
+	if (ctx->trkshare && lsi_tsh_attach(ctx))
+		return true;
+
 	if (!(ctx->users = lsi_skmap_init(4096, ctx->casemap)))
 		return lsi_skmap_dispose(ctx->chans), false;
 
@@ -52,36 +75,36 @@ lsi_ucb_add_chan(irc *ctx, const char *name)
 	STRACPY(c->name, name);
 	c->topic = c->topicnick = NULL;
 	c->tscreate = c->tstopic = 0;
-	c->desync = false;
-	c->modes = NULL;
+	c->desync = c->namesync = c->stale = false;
+	c->lmodes_sync = c->dmodes = 0;
 	c->tag = NULL;
 	c->freetag = false;
+	c->ver = ++ctx->trkgen;
+	c->snap = NULL;
+	c->tsread = lsi_b_tstamp_us();
+	c->evicted = false;
+
+	for (size_t i = 0; i < NUM_CHANMODES; i++) {
+		c->lmodes[i] = NULL;
+		c->amodes[i] = NULL;
+	}
 
 	if (!(c->memb = lsi_skmap_init(256, ctx->casemap)))
 		goto fail;
 
-	c->modes_sz = 16; //grows
-	if (!(c->modes = MALLOC(c->modes_sz * sizeof *c->modes)))
-		goto fail;
-
-	for (size_t i = 0; i < c->modes_sz; i++)
-		c->modes[i] = NULL;
+	lsi_mlist_init(&c->ml, ctx->casemap);
 
 	if (!lsi_skmap_put(ctx->chans, name, c))
 		goto fail;
 
 	D("added chan '%s'", c->name);
+	PROBE2(chan_add, ctx, c->name);
 
 	return c;
 
 fail:
-	if (c) {
-		if (c->modes)
-			free(c->modes[0]);
-
-		free(c->modes);
+	if (c)
 		lsi_skmap_dispose(c->memb);
-	}
 
 	free(c);
 	return NULL;
@@ -103,13 +126,7 @@ lsi_ucb_drop_chan(irc *ctx, chan *c)
 				if (!lsi_skmap_del(ctx->users, m->u->nick))
 					W("user '%s' not in umap", m->u->nick);
 				D("implicitly dropped user '%s'", m->u->nick);
-				free(m->u->nick);
-				free(m->u->uname);
-				free(m->u->host);
-				free(m->u->fname);
-				if (m->u->freetag)
-					free(m->u->tag);
-				free(m->u);
+				free_user(ctx, m->u);
 			}
 			free(m);
 		} while (lsi_skmap_next(c->memb, NULL, &e));
@@ -118,12 +135,13 @@ lsi_ucb_drop_chan(irc *ctx, chan *c)
 	lsi_skmap_dispose(c->memb);
 
 	D("dropped channel '%s'", c->name);
+	PROBE2(chan_drop, ctx, c->name);
 
+	ctx->trkgen++;
+	lsi_snap_drop_chan(c);
 	free(c->topic);
 	free(c->topicnick);
-	for (size_t i = 0; i < c->modes_sz; i++)
-		free(c->modes[i]);
-	free(c->modes);
+	free_chanmodes(ctx, c);
 	if (c->freetag)
 		free(c->tag);
 	free(c);
@@ -148,28 +166,56 @@ lsi_ucb_get_chan(irc *ctx, const char *name, bool complain)
 memb *
 lsi_ucb_get_memb(irc *ctx, chan *c, const char *nick, bool complain)
 {
-	memb *m = lsi_skmap_get(c->memb, nick);
+	user *au = ctx->nickalias ? lsi_tsh_alias(ctx, nick, SIZE_MAX) : NULL;
+	memb *m = lsi_skmap_get(c->memb, au ? au->nick : nick);
 	if (!m && complain)
 		W("no such member '%s' in channel '%s'", nick, c->name);
 	return m;
 }
 
+memb *
+lsi_ucb_get_memb_sp(irc *ctx, chan *c, const struct idspan *id,
+    bool complain)
+{
+	user *au = ctx->nickalias
+	    ? lsi_tsh_alias(ctx, id->nick, id->nicklen) : NULL;
+	memb *m = au ? lsi_skmap_get(c->memb, au->nick)
+	    : lsi_skmap_get_n(c->memb, id->nick, id->nicklen);
+	if (!m && complain)
+		W("no such member '%.*s' in channel '%s'", (int)id->nicklen,
+		    id->nick, c->name);
+	return m;
+}
+
 size_t
 lsi_ucb_num_memb(irc *ctx, chan *c)
 {
 	return lsi_skmap_count(c->memb);
 }
 
+/* adding someone who is a member already (we missed them leaving, or the
+ * server repeats itself) just resets their prefixes to `mpfxstr` */
 bool
 lsi_ucb_add_memb(irc *ctx, chan *c, user *u, const char *mpfxstr)
 {
-	memb *m = lsi_ucb_alloc_memb(ctx, u, mpfxstr);
+	memb *m = lsi_skmap_get(c->memb, u->nick);
+	if (m && m->u == u) {
+		D("'%s' is in chan '%s' already", u->nick, c->name);
+		lsi_ucb_resync_modepfx(ctx, c, m, mpfxstr);
+		lsi_ucb_dirty_chan(ctx, c);
+		return true;
+	} else if (m)
+		drop_ghost(ctx, c, m);
+
+	m = lsi_ucb_alloc_memb(ctx, u, mpfxstr);
 	if (!m || !lsi_skmap_put(c->memb, u->nick, m)) {
 		free(m);
 		return false;
 	}
 
+	lsi_mlist_add(&c->ml, m);
 	u->nchans++;
+	lsi_ucb_dirty_chan(ctx, c);
 	D("added member '%s' to chan '%s'", u->nick, c->name);
 	return true;
 }
@@ -179,18 +225,14 @@ lsi_ucb_drop_memb(irc *ctx, chan *c, user *u, bool purge, bool complain)
 {
 	memb *m = lsi_skmap_del(c->memb, u->nick);
 	if (m) {
+		lsi_mlist_del(&c->ml, m, m->u->nick);
+		lsi_ucb_dirty_chan(ctx, c);
 		D("dropped '%s' from '%s'", m->u->nick, c->name);
 		if (--m->u->nchans == 0 && purge) {
 			if (!lsi_skmap_del(ctx->users, m->u->nick))
 				W("user '%s' not in user map", m->u->nick);
 			D("implicitly dropped user '%s'", m->u->nick);
-			free(m->u->nick);
-			free(m->u->uname);
-			free(m->u->host);
-			free(m->u->fname);
-			if (m->u->freetag)
-				free(m->u->tag);
-			free(m->u);
+			free_user(ctx, m->u);
 		}
 	} else if (complain)
 		W("no such member '%s' in channel '%s'", u->nick, c->name);
@@ -212,30 +254,173 @@ lsi_ucb_clear_memb(irc *ctx, chan *c)
 			if (!lsi_skmap_del(ctx->users, m->u->nick))
 				W("user '%s' not in user map", m->u->nick);
 			D("implicitly dropped user '%s'", m->u->nick);
-			free(m->u->nick);
-			free(m->u->uname);
-			free(m->u->host);
-			free(m->u->fname);
-			if (m->u->freetag)
-				free(m->u->tag);
-			free(m->u);
+			free_user(ctx, m->u);
 		}
 		free(m);
 	} while (lsi_skmap_next(c->memb, NULL, &e));
 	lsi_skmap_clear(c->memb);
+	lsi_mlist_init(&c->ml, ctx->casemap);
+	lsi_ucb_dirty_chan(ctx, c);
 	D("cleared members of channel '%s'", c->name);
 	return;
 }
 
+/* mark-and-sweep for NAMES: mark everyone, unmark whoever shows up in
+ * the 353s, then sweep those still marked.  unlike clearing and re-adding,
+ * this leaves users (and their tags) alone that are still around */
+void
+lsi_ucb_mark_memb(irc *ctx, chan *c)
+{
+	void *e;
+	if (!lsi_skmap_first(c->memb, NULL, &e))
+		return;
+
+	do ((memb *)e)->mark = true;
+	while (lsi_skmap_next(c->memb, NULL, &e));
+	return;
+}
+
+bool
+lsi_ucb_sweep_memb(irc *ctx, chan *c)
+{
+	size_t n = 0;
+	void *e;
+	if (lsi_skmap_first(c->memb, NULL, &e))
+		do n += ((memb *)e)->mark;
+		while (lsi_skmap_next(c->memb, NULL, &e));
+
+	if (!n)
+		return true;
+
+	/* can't delete while iterating the map, so collect first */
+	user **ua = MALLOC(n * sizeof *ua);
+	if (!ua)
+		return false;
+
+	size_t i = 0;
+	if (lsi_skmap_first(c->memb, NULL, &e))
+		do {
+			memb *m = e;
+			if (m->mark)
+				ua[i++] = m->u;
+		} while (lsi_skmap_next(c->memb, NULL, &e));
+
+	for (i = 0; i < n; i++)
+		lsi_ucb_drop_memb(ctx, c, ua[i], true, true);
+
+	D("swept %zu gone members of '%s'", n, c->name);
+	free(ua);
+	return true;
+}
+
+/* take in a batch of (at most NAMES_BATCH) NAMES entries.  everyone is
+ * folded and hashed once up front; that serves the member map as well as the
+ * user map.  known members are unmarked (see lsi_ucb_mark_memb()), the rest is
+ * added, without bothering to look at uname@host (if any) just yet */
+bool
+lsi_ucb_sync_memb(irc *ctx, chan *c, struct namesent *ents, size_t n)
+{
+	/* folding stops at '!', so nicks fit unless the server's are longer
+	 * than we'd expect; then lsi_skmap_fold() takes it to the heap */
+	uint8_t fbuf[NAMES_BATCH][MAX_NICK_LEN];
+	uint8_t *fk[NAMES_BATCH];
+	size_t flen[NAMES_BATCH];
+	size_t hash[NAMES_BATCH];
+	bool ok = true;
+	if (n > NAMES_BATCH)
+		n = NAMES_BATCH;
+
+	for (size_t i = 0; i < n; i++) {
+		if (!(fk[i] = lsi_skmap_fold(ctx->users, fbuf[i],
+		    sizeof fbuf[i], ents[i].ident, &flen[i]))) {
+			n = i;
+			ok = false;
+			goto out;
+		}
+		hash[i] = lsi_skmap_hash_f(fk[i], flen[i]);
+	}
+
+	lsi_ucb_dirty_chan(ctx, c);
+
+	/* failing these is not fatal, the maps just grow as they go */
+	lsi_skmap_reserve(c->memb, lsi_skmap_count(c->memb) + n);
+	lsi_skmap_reserve(ctx->users, lsi_skmap_count(ctx->users) + n);
+
+	for (size_t i = 0; i < n; i++) {
+		const uint8_t *k = fk[i];
+		size_t klen = flen[i], h = hash[i];
+
+		/* renamed by another context before we saw the NICK */
+		uint8_t abuf[MAX_NICK_LEN];
+		user *au = ctx->nickalias
+		    ? lsi_tsh_alias(ctx, ents[i].ident, SIZE_MAX) : NULL;
+		if (au) {
+			/* au->nick is shorter than MAX_NICK_LEN, so it fits */
+			k = lsi_skmap_fold(ctx->users, abuf, sizeof abuf,
+			    au->nick, &klen);
+			h = lsi_skmap_hash_f(k, klen);
+		}
+
+		memb *m = lsi_skmap_get_f(c->memb, k, klen, h);
+		if (m) {
+			/* userhost-in-names tells hosts we may not know yet */
+			if (!m->u->host && !m->u->pend
+			    && lsi_ucb_touch_user_int(m->u, ents[i].ident))
+				(*ctx->usergen)++;
+			m->mark = false;
+			lsi_ucb_resync_modepfx(ctx, c, m, ents[i].mpfx);
+			continue;
+		}
+
+		user *u = au ? au : lsi_skmap_get_f(ctx->users, k, klen, h);
+		bool uadd = false;
+		if (u && !u->host && !u->pend
+		    && lsi_ucb_touch_user_int(u, ents[i].ident))
+			(*ctx->usergen)++;
+
+		if (!u) {
+			uadd = true;
+			if (!(u = add_user(ctx, ents[i].ident, k, klen, h,
+			    true))) {
+				ok = false;
+				break;
+			}
+		}
+
+		m = lsi_ucb_alloc_memb(ctx, u, ents[i].mpfx);
+		if (!m || !lsi_skmap_put_f(c->memb, u->nick, k, klen, h, m)) {
+			free(m);
+			if (uadd)
+				lsi_ucb_drop_user(ctx, u);
+			ok = false;
+			break;
+		}
+
+		lsi_mlist_add(&c->ml, m);
+		u->nchans++;
+	}
+
+out:
+	for (size_t i = 0; i < n; i++)
+		if (fk[i] != fbuf[i])
+			free(fk[i]);
+
+	return ok;
+}
+
 memb *
 lsi_ucb_alloc_memb(irc *ctx, user *u, const char *mpfxstr)
 {
-	memb *m = MALLOC(sizeof *m);
+	uint8_t lvl = lsi_mlist_rndlvl(&ctx->mlseed);
+	memb *m = MALLOC(sizeof *m + lvl * sizeof m->lnk[0]);
 	if (!m)
 		goto fail;
 
+	m->lvl = lvl;
 	m->u = u;
-	STRACPY(m->modepfx, mpfxstr);
+	m->mark = false;
+	m->pfxmask = pfxstr2mask(ctx, mpfxstr);
+	render_modepfx(ctx, m);
 
 	return m;
 
@@ -251,165 +436,372 @@ lsi_ucb_update_modepfx(irc *ctx, chan *c, const char *nick, char mpfxsym, bool e
 	if (!m)
 		return false;
 
-	char *p = strchr(m->modepfx, mpfxsym);
+	uint8_t rank = ctx->isupp.pfxrank[(unsigned char)mpfxsym];
+	if (!rank) {
+		W("huh? '%c' is not a mode prefix", mpfxsym);
+		return false;
+	}
 
-	if (!!enab == !!p) {
-		W("enab: %d, p: '%s' (c: '%s', n: '%s', mpfx: '%s', sym: '%c')",
-		    enab, p, c->name, m->u->nick, m->modepfx, mpfxsym);
+	uint32_t bit = (uint32_t)1 << (rank - 1);
+	if (!!enab == !!(m->pfxmask & bit)) {
+		W("enab: %d, (c: '%s', n: '%s', mpfx: '%s', sym: '%c')",
+		    enab, c->name, m->u->nick, m->modepfx, mpfxsym);
 		return false;
 	}
 
-	if (!enab) {
-		*p++ = '\0';
-		while (*p) {
-			p[-1] = *p;
-			*p++ = '\0';
-		}
-	} else {
-		if (strlen(m->modepfx) + 1 >= sizeof m->modepfx) {
-			E("not enough space for yet another modepfx!");
-			return false;
-		}
-		p = m->modepfx;
-		while (*p && compare_modepfx(ctx, *p, mpfxsym) > 0)
-			p++;
-
-		char *o = p + strlen(p);
-		while (o >= p) {
-			o[1] = o[0];
-			o--;
-		}
+	/* the order depends on the prefixes */
+	lsi_mlist_del(&c->ml, m, m->u->nick);
+	if (enab)
+		m->pfxmask |= bit;
+	else
+		m->pfxmask &= ~bit;
+
+	lsi_mlist_add(&c->ml, m);
+	render_modepfx(ctx, m);
+	lsi_ucb_dirty_chan(ctx, c);
+	return true;
+}
+
+/* bring the prefixes of `m` in line with what a NAMES reply says.  unless
+ * multi-prefix is in effect, NAMES only shows the strongest prefix, in which
+ * case we keep our weaker ones as long as the strongest one agrees */
+void
+lsi_ucb_resync_modepfx(irc *ctx, chan *c, memb *m, const char *mpfxstr)
+{
+	uint32_t mask = pfxstr2mask(ctx, mpfxstr);
+	uint32_t mine = m->pfxmask;
+
+	if ((mask & (mask - 1)) == 0 && (mine & -mine) == mask)
+		return;
 
-		*p = mpfxsym;
+	if (mask != mine) {
+		D("prefixes of '%s' resynced from %#"PRIx32" to %#"PRIx32,
+		    m->u->nick, mine, mask);
+		lsi_mlist_del(&c->ml, m, m->u->nick);
+		m->pfxmask = mask;
+		lsi_mlist_add(&c->ml, m);
+		render_modepfx(ctx, m);
 	}
+	return;
+}
 
-	return true;
+static uint32_t
+pfxstr2mask(irc *ctx, const char *mpfxstr)
+{
+	uint32_t mask = 0;
+	for (const char *p = mpfxstr; *p; p++) {
+		uint8_t rank = ctx->isupp.pfxrank[(unsigned char)*p];
+		if (rank)
+			mask |= (uint32_t)1 << (rank - 1);
+	}
+	return mask;
 }
 
-/* returns positive if c1 is stronger than c2.  be sure only to call
- * for valid arguments (modepfx symbols like '@') */
-static int
-compare_modepfx(irc *ctx, char c1, char c2)
+/* turn the prefix bitmask into a string of symbols, strongest first */
+static void
+render_modepfx(irc *ctx, memb *m)
 {
-	const char *p1 = strchr(ctx->m005modepfx[1], c1);
-	const char *p2 = strchr(ctx->m005modepfx[1], c2);
+	size_t n = 0;
+	for (size_t i = 0; i < ctx->isupp.npfx && n + 1 < sizeof m->modepfx;
+	    i++)
+		if (m->pfxmask & ((uint32_t)1 << i))
+			m->modepfx[n++] = ctx->m005modepfx[1][i];
 
-	ptrdiff_t o1 = p1 - ctx->m005modepfx[1];
-	ptrdiff_t o2 = p2 - ctx->m005modepfx[1];
+	m->modepfx[n] = '\0';
+	return;
+}
 
-	return o1 < o2 ? 1 : o1 > o2 ? -1 : 0;
+int
+lsi_ucb_modeind(char mode)
+{
+	if (mode >= 'a' && mode <= 'z')
+		return mode - 'a';
+	if (mode >= 'A' && mode <= 'Z')
+		return 26 + (mode - 'A');
+	return -1;
 }
 
+/* list modes are not part of a 324, so leave those alone */
 void
 lsi_ucb_clear_chanmodes(irc *ctx, chan *c)
 {
-	for (size_t i = 0; i < c->modes_sz; i++)
-		free(c->modes[i]), c->modes[i] = NULL;
+	for (size_t i = 0; i < NUM_CHANMODES; i++)
+		free(c->amodes[i]), c->amodes[i] = NULL;
+	c->dmodes = 0;
+	lsi_ucb_dirty_chan(ctx, c);
 	return;
 }
 
+/* modestr is a mode char, optionally followed by a blank and an argument,
+ * i.e. one element of what lsi_ut_parse_MODE() gives us, minus the sign */
 bool
 lsi_ucb_add_chanmode(irc *ctx, chan *c, const char *modestr)
 {
-	size_t ind = 0;
-	for (; ind < c->modes_sz; ind++)
-		if (!c->modes[ind])
+	lsi_ucb_dirty_chan(ctx, c);
+	int ind = lsi_ucb_modeind(modestr[0]);
+	const char *arg = modestr[0] && modestr[1] == ' ' ? modestr + 2 : NULL;
+	int cls = ind == -1 ? 0 : lsi_ut_classify_chanmode(ctx, modestr[0]);
+	switch (cls) {
+	case CHANMODE_CLASS_A: //always has an argument (list-modes)
+		return lsi_ucb_add_lmode(ctx, c, modestr[0], arg ? arg : "*",
+		    NULL, 0);
+	case CHANMODE_CLASS_B: //has argument when unset but it's irrelevant
+	case CHANMODE_CLASS_C: //no argument when beig unset
+		return lsi_com_update_strprop(&c->amodes[ind], arg ? arg : "");
+	case CHANMODE_CLASS_D: //never has an argument
+		c->dmodes |= (uint64_t)1 << ind;
+		return true;
+	default:
+		W("huh? illegal modestr '%s'", modestr);
+		return true; //not worth a desync
+	}
+}
+
+bool
+lsi_ucb_drop_chanmode(irc *ctx, chan *c, const char *modestr)
+{
+	lsi_ucb_dirty_chan(ctx, c);
+	int ind = lsi_ucb_modeind(modestr[0]);
+	const char *arg = modestr[0] && modestr[1] == ' ' ? modestr + 2 : NULL;
+	int cls = ind == -1 ? 0 : lsi_ut_classify_chanmode(ctx, modestr[0]);
+	switch (cls) {
+	case CHANMODE_CLASS_A:
+		return lsi_ucb_drop_lmode(ctx, c, modestr[0], arg ? arg : "*");
+	case CHANMODE_CLASS_B:
+	case CHANMODE_CLASS_C:
+		if (!c->amodes[ind])
 			break;
+		free(c->amodes[ind]);
+		c->amodes[ind] = NULL;
+		return true;
+	case CHANMODE_CLASS_D:
+		if (!(c->dmodes & ((uint64_t)1 << ind)))
+			break;
+		c->dmodes &= ~((uint64_t)1 << ind);
+		return true;
+	default:
+		E("huh? illegal modestr '%s'", modestr);
+		return false;
+	}
 
-	if (ind == c->modes_sz) {
-		size_t nsz = c->modes_sz * 2;
-		char **nmodes = MALLOC(nsz * sizeof *nmodes);
-		if (!nmodes)
-			return false;
+	D("chanmode '%s' not found (for dropping)", modestr);
+	return false;
+}
 
-		size_t i;
-		for (i = 0; i < c->modes_sz; i++)
-			nmodes[i] = c->modes[i];
+/* tells whether a non-list mode is set, and its argument if it has one */
+bool
+lsi_ucb_get_chanmode(irc *ctx, chan *c, char mode, const char **arg)
+{
+	int ind = lsi_ucb_modeind(mode);
+	if (arg)
+		*arg = NULL;
 
-		for (; i < nsz; i++)
-			nmodes[i] = NULL;
+	if (ind == -1)
+		return false;
 
-		free(c->modes);
-		c->modes = nmodes;
-		c->modes_sz = nsz;
+	if (c->amodes[ind]) {
+		if (arg)
+			*arg = c->amodes[ind];
+		return true;
 	}
 
-	return (c->modes[ind] = STRDUP(modestr));
+	return c->dmodes & ((uint64_t)1 << ind);
 }
 
 bool
-lsi_ucb_drop_chanmode(irc *ctx, chan *c, const char *modestr)
+lsi_ucb_add_lmode(irc *ctx, chan *c, char mode, const char *mask,
+    const char *setby, uint64_t tsset)
 {
-	size_t i;
-	int cls = lsi_ut_classify_chanmode(ctx, modestr[0]);
-	switch (cls) {
-	case CHANMODE_CLASS_A: //always has an argument (list-modes)
-		for (i = 0; i < c->modes_sz; i++)
-			if (c->modes[i] && strcmp(c->modes[i], modestr) == 0)
-				break;
-		break;
-	case CHANMODE_CLASS_B: //has argument when unset but it's irrelevant
-	case CHANMODE_CLASS_C: //no argument when beig unset
-	case CHANMODE_CLASS_D: //never has an argument
-		for (i = 0; i < c->modes_sz; i++)
-			if (c->modes[i] && c->modes[i][0] == modestr[0])
-				break;
-		break;
-	default:
-		E("huh? illegal modestr '%s'", modestr);
+	int ind = lsi_ucb_modeind(mode);
+	if (ind == -1) {
+		W("huh? illegal list mode '%c'", mode);
+		return true;
+	}
+
+	if (!c->lmodes[ind] && !(c->lmodes[ind] =
+	    lsi_skmap_init(256, CMAP_WHOLE(ctx->casemap))))
 		return false;
+
+	lmode *lm = lsi_skmap_get(c->lmodes[ind], mask);
+	if (lm) { //already known (say, from a MODE before the 367); refresh
+		if (setby && !lsi_com_update_strprop(&lm->setby, setby))
+			return false;
+		if (tsset)
+			lm->tsset = tsset;
+		return true;
 	}
 
-	if (i == c->modes_sz) {
-		D("chanmode '%s' not found (for dropping)", modestr);
+	if (!(lm = MALLOC(sizeof *lm)))
+		return false;
+
+	lm->setby = NULL;
+	lm->tsset = tsset;
+	if ((setby && !(lm->setby = STRDUP(setby)))
+	    || !lsi_skmap_put(c->lmodes[ind], mask, lm)) {
+		free(lm->setby);
+		free(lm);
 		return false;
 	}
 
-	size_t last;
-	for (last = c->modes_sz - 1; last > 0; last--)
-		if (c->modes[last])
-			break;
+	D("added '%c %s' to chan '%s'", mode, mask, c->name);
+	return true;
+}
 
-	free(c->modes[i]);
-	if (last == i)
-		c->modes[i] = NULL;
-	else {
-		c->modes[i] = c->modes[last];
-		c->modes[last] = NULL;
+bool
+lsi_ucb_drop_lmode(irc *ctx, chan *c, char mode, const char *mask)
+{
+	int ind = lsi_ucb_modeind(mode);
+	lmode *lm = ind == -1 ? NULL : lsi_skmap_del(c->lmodes[ind], mask);
+	if (!lm) {
+		D("list mode '%c %s' not found (for dropping)", mode, mask);
+		return false;
 	}
 
+	free(lm->setby);
+	free(lm);
 	return true;
 }
 
+lmode *
+lsi_ucb_get_lmode(irc *ctx, chan *c, char mode, const char *mask)
+{
+	int ind = lsi_ucb_modeind(mode);
+	return ind == -1 ? NULL : lsi_skmap_get(c->lmodes[ind], mask);
+}
+
+size_t
+lsi_ucb_num_lmodes(irc *ctx, chan *c, char mode)
+{
+	int ind = lsi_ucb_modeind(mode);
+	return ind == -1 ? 0 : lsi_skmap_count(c->lmodes[ind]);
+}
+
 void
+lsi_ucb_clear_lmodes(irc *ctx, chan *c, char mode)
+{
+	int ind = lsi_ucb_modeind(mode);
+	if (ind == -1 || !c->lmodes[ind])
+		return;
+
+	void *e;
+	if (lsi_skmap_first(c->lmodes[ind], NULL, &e))
+		do {
+			lmode *lm = e;
+			free(lm->setby);
+			free(lm);
+		} while (lsi_skmap_next(c->lmodes[ind], NULL, &e));
+
+	lsi_skmap_clear(c->lmodes[ind]);
+	return;
+}
+
+static void
+free_chanmodes(irc *ctx, chan *c)
+{
+	for (size_t i = 0; i < NUM_CHANMODES; i++) {
+		if (c->lmodes[i]) {
+			lsi_ucb_clear_lmodes(ctx, c, i < 26 ? 'a' + i
+			    : 'A' + (i - 26));
+			lsi_skmap_dispose(c->lmodes[i]);
+			c->lmodes[i] = NULL;
+		}
+
+		free(c->amodes[i]);
+		c->amodes[i] = NULL;
+	}
+	c->dmodes = c->lmodes_sync = 0;
+	return;
+}
+
+/* fill in uname and host if we didn't know them; true if we learned any */
+bool
 lsi_ucb_touch_user_int(user *u, const char *ident)
 {
-	if (!u->uname && strchr(ident, '!')) {
-		char unam[MAX_UNAME_LEN];
-		lsi_ut_ident2uname(unam, sizeof unam, ident);
-		u->uname = STRDUP(unam); //pointless to check
+	struct idspan id;
+	lsi_msg_idspan(&id, ident);
+	return learn_ident(u, &id);
+}
+
+static bool
+learn_ident(user *u, const struct idspan *id)
+{
+	bool learned = false;
+	lsi_ucb_user_details(u);
+
+	if (!u->uname && id->user) {
+		u->uname = spandup(id->user, id->userlen, MAX_UNAME_LEN);
+		learned = true;
 	}
 
-	if (!u->host && strchr(ident, '@')) {
-		char host[MAX_HOST_LEN];
-		lsi_ut_ident2host(host, sizeof host, ident);
-		u->host = STRDUP(host); //pointless to check
+	if (!u->host && id->host) {
+		u->host = spandup(id->host, id->hostlen, MAX_HOST_LEN);
+		learned = true;
 	}
-	return;
+	return learned;
+}
+
+/* `len` chars of `s`, cut to fit a buffer of `max` like lsi_b_strNcpy()
+ * would, as a string on the heap (NULL if we're out of memory) */
+static char *
+spandup(const char *s, size_t len, size_t max)
+{
+	if (len >= max)
+		len = max - 1;
+
+	char *d = MALLOC(len + 1);
+	if (d) {
+		memcpy(d, s, len);
+		d[len] = '\0';
+	}
+	return d;
 }
 
 user *
 lsi_ucb_touch_user(irc *ctx, const char *ident, bool complain)
 {
-	user *u = lsi_ucb_get_user(ctx, ident, complain);
+	struct idspan id;
+	lsi_msg_idspan(&id, ident);
+	return lsi_ucb_touch_user_sp(ctx, &id, complain);
+}
+
+user *
+lsi_ucb_touch_user_sp(irc *ctx, const struct idspan *id, bool complain)
+{
+	user *u = lsi_ucb_get_user_sp(ctx, id, complain);
 	if (u)
-		lsi_ucb_touch_user_int(u, ident);
+		u->tsact = lsi_b_tstamp_us();
+
+	if (u && learn_ident(u, id)) {
+		(*ctx->usergen)++;
+		lsi_ucb_dirty_user(ctx, u);
+	}
 	return u;
 }
 
 
 user *
 lsi_ucb_add_user(irc *ctx, const char *ident) //ident may be a nick, or nick!uname@host
+{
+	uint8_t buf[CMAP_FOLDBUF];
+	size_t flen;
+	uint8_t *fk = lsi_skmap_fold(ctx->users, buf, sizeof buf, ident, &flen);
+	if (!fk)
+		return NULL;
+
+	user *u = add_user(ctx, ident, fk, flen, lsi_skmap_hash_f(fk, flen),
+	    false);
+	if (fk != buf)
+		free(fk);
+	return u;
+}
+
+/* `fk` is `ident` as folded by lsi_skmap_fold() (which stops at the '!', so
+ * it's the nick), `hash` is its lsi_skmap_hash_f().  if `defer` is set,
+ * splitting up the uname@host part of `ident` is left to whoever needs it
+ * (see lsi_ucb_user_details()) */
+static user *
+add_user(irc *ctx, const char *ident, const uint8_t *fk, size_t flen,
+    size_t hash, bool defer)
 {
 	char nick[MAX_NICK_LEN];
 	lsi_ut_ident2nick(nick, sizeof nick, ident);
@@ -418,38 +810,153 @@ lsi_ucb_add_user(irc *ctx, const char *ident) //ident may be a nick, or nick!una
 	if (!u)
 		goto fail;
 
-	u->uname = u->host = u->fname = NULL;
+	u->uname = u->host = u->fname = u->pend = u->acct = u->away = NULL;
 	u->nchans = 0;
+	u->quitting = false;
 	u->tag = NULL;
 	u->freetag = false;
+	u->tsact = lsi_b_tstamp_us();
+	u->evicted = false;
+	u->ver = 0;
 
 	if (!(u->nick = STRDUP(nick)))
 		goto fail;
 
-	if (!lsi_skmap_put(ctx->users, nick, u))
+	const char *ex = strchr(ident, '!');
+	if (defer && ex && !(u->pend = STRDUP(ex)))
+		goto fail;
+
+	if (!lsi_skmap_put_f(ctx->users, nick, fk, flen, hash, u))
 		goto fail;
 
-	lsi_ucb_touch_user_int(u, ident);
+	(*ctx->usergen)++;
+
+	if (!defer)
+		lsi_ucb_touch_user_int(u, ident);
 
 	D("added user '%s' ('%s@%s')", u->nick, u->uname, u->host);
+	PROBE2(user_add, ctx, u->nick);
 
 	return u;
 
 fail:
 	if (u) {
 		free(u->nick);
-		free(u->uname);
-		free(u->host);
+		free(u->pend);
 	}
 
 	free(u);
 	return NULL;
 }
 
+/* fill in what add_user() left for later */
+void
+lsi_ucb_user_details(user *u)
+{
+	if (!u->pend)
+		return;
+
+	char *pend = u->pend;
+	u->pend = NULL;
+	lsi_ucb_touch_user_int(u, pend);
+	free(pend);
+	return;
+}
+
+/* drop every user flagged `quitting`.  lsi_ucb_drop_user() visits every
+ * channel for each user, which hurts when a netsplit takes thousands of them
+ * at once; this visits every channel once, for all of them */
+bool
+lsi_ucb_drop_quitting(irc *ctx)
+{
+	user **ua = NULL;
+	size_t uasz = 0;
+	size_t total = 0;
+
+	chan *c = lsi_ucb_first_chan(ctx);
+	if (!c)
+		return true;
+
+	do {
+		size_t n = 0;
+		memb *m = lsi_ucb_first_memb(ctx, c);
+		if (!m)
+			continue;
+
+		do {
+			if (!m->u->quitting)
+				continue;
+
+			if (n == uasz) {
+				size_t nsz = uasz ? uasz * 2 : 64;
+				user **nua = MALLOC(nsz * sizeof *nua);
+				if (!nua) {
+					free(ua);
+					return false;
+				}
+				if (n)
+					memcpy(nua, ua, n * sizeof *nua);
+				free(ua);
+				ua = nua;
+				uasz = nsz;
+			}
+			ua[n++] = m->u;
+		} while ((m = lsi_ucb_next_memb(ctx, c)));
+
+		/* users go away along with their last membership */
+		for (size_t i = 0; i < n; i++)
+			lsi_ucb_drop_memb(ctx, c, ua[i], true, true);
+
+		total += n;
+	} while ((c = lsi_ucb_next_chan(ctx)));
+
+	D("dropped %zu memberships of quitting users", total);
+	free(ua);
+	return true;
+}
+
+/* note a change to `c` (or to one of its members) for the next snapshot,
+ * see trksnap.c */
+void
+lsi_ucb_dirty_chan(irc *ctx, chan *c)
+{
+	c->ver = ++ctx->trkgen;
+	return;
+}
+
+/* note a change to the details of `u`.  the channels it is in aren't
+ * touched; the next snapshot compares its members' versions instead */
+void
+lsi_ucb_dirty_user(irc *ctx, user *u)
+{
+	u->ver = ++*ctx->detgen;
+	return;
+}
+
+static void
+free_user(irc *ctx, user *u)
+{
+	PROBE2(user_drop, ctx, u->nick);
+	(*ctx->usergen)++;
+	if (ctx->trkshared)
+		lsi_tsh_alias_forget(ctx, u);
+	free(u->nick);
+	free(u->uname);
+	free(u->host);
+	free(u->fname);
+	free(u->pend);
+	free(u->acct);
+	free(u->away);
+	if (u->freetag)
+		free(u->tag);
+	free(u);
+	return;
+}
+
 bool
 lsi_ucb_drop_user(irc *ctx, user *u)
 {
-	if (!lsi_skmap_del(ctx->users, u->nick)) {
+	if (!lsi_skmap_get(ctx->users, u->nick)) {
 		W("no such user '%s' to drop", u->nick);
 		return false;
 	}
@@ -462,15 +969,17 @@ lsi_ucb_drop_user(irc *ctx, user *u)
 	else
 		W("dropping dangling user '%s'", u->nick);
 
+	/* still in channels of other contexts sharing the user map; they'll
+	 * drop them when they see the QUIT, too */
+	if (ctx->trkshared && u->nchans) {
+		D("dropped user '%s' (from here)", u->nick);
+		return true;
+	}
+
+	lsi_skmap_del(ctx->users, u->nick);
 	D("dropped user '%s'", u->nick);
 
-	free(u->nick);
-	free(u->uname);
-	free(u->host);
-	free(u->fname);
-	if (u->freetag)
-		free(u->tag);
-	free(u);
+	free_user(ctx, u);
 
 	return true;
 }
@@ -480,7 +989,12 @@ lsi_ucb_deinit(irc *ctx)
 {
 	lsi_ucb_clear(ctx);
 	lsi_skmap_dispose(ctx->chans);
-	lsi_skmap_dispose(ctx->users);
+	if (ctx->trkshared) {
+		skmap *users = lsi_tsh_detach(ctx);
+		free_users(ctx, users); //if we were the last, whoever's left
+		lsi_skmap_dispose(users);
+	} else
+		lsi_skmap_dispose(ctx->users);
 	ctx->chans = ctx->users = NULL;
 	return;
 }
@@ -497,33 +1011,103 @@ lsi_ucb_clear(irc *ctx)
 			chan *c = e;
 			lsi_ucb_clear_memb(ctx, c);
 			lsi_skmap_dispose(c->memb);
+			lsi_snap_drop_chan(c);
 			free(c->topicnick);
 			free(c->topic);
-			for (size_t i = 0; i < c->modes_sz; i++)
-				free(c->modes[i]);
-			free(c->modes);
+			free_chanmodes(ctx, c);
 			free(c);
 		} while (lsi_skmap_next(ctx->chans, NULL, &e));
 		lsi_skmap_clear(ctx->chans);
+		ctx->trkgen++;
 	}
 
-	if (ctx->users) {
-		if (!lsi_skmap_first(ctx->users, NULL, &e))
-			return;
+	/* with a shared user map, users went along with their last
+	 * membership; the rest may well be in other contexts' channels */
+	if (!ctx->trkshared)
+		free_users(ctx, ctx->users);
+	return;
+}
 
-		do {
-			user *u = e;
-			free(u->nick);
-			free(u->uname);
-			free(u->host);
-			free(u->fname);
-			free(u);
-		} while (lsi_skmap_next(ctx->users, NULL, &e));
-		lsi_skmap_clear(ctx->users);
+static void
+free_users(irc *ctx, skmap *users)
+{
+	void *e;
+	if (!users || !lsi_skmap_first(users, NULL, &e))
+		return;
+
+	do free_user(ctx, e);
+	while (lsi_skmap_next(users, NULL, &e));
+	lsi_skmap_clear(users);
+	return;
+}
+
+/* on reconnect, we keep what we know and consider every channel stale until
+ * we're back in it (see lsi_ucb_revive_chan()).  the leftovers are dropped
+ * by lsi_ucb_sweep_stale() */
+void
+lsi_ucb_mark_stale(irc *ctx)
+{
+	/* the NICKs those were waiting for are lost with the connection */
+	lsi_tsh_alias_clear(ctx);
+
+	chan *c = lsi_ucb_first_chan(ctx);
+	if (!c)
+		return;
+
+	do {
+		c->stale = true;
+		c->namesync = false;
+		c->lmodes_sync = 0;
+		lsi_ucb_dirty_chan(ctx, c);
+	} while ((c = lsi_ucb_next_chan(ctx)));
+	return;
+}
+
+void
+lsi_ucb_sweep_stale(irc *ctx)
+{
+	size_t n = 0;
+	chan *c = lsi_ucb_first_chan(ctx);
+	if (c)
+		do n += c->stale;
+		while ((c = lsi_ucb_next_chan(ctx)));
+
+	if (!n)
+		return;
+
+	/* can't delete while iterating the map; go one at a time */
+	while (n--) {
+		c = lsi_ucb_first_chan(ctx);
+		while (c && !c->stale)
+			c = lsi_ucb_next_chan(ctx);
+
+		if (!c)
+			break;
+
+		D("sweeping stale channel '%s'", c->name);
+		lsi_ucb_drop_chan(ctx, c);
 	}
 	return;
 }
 
+/* we re-JOINed a channel we knew from before a reconnect.  keep the members
+ * (the NAMES to come will reconcile them), but forget the rest, which might
+ * have changed while we were away */
+void
+lsi_ucb_revive_chan(irc *ctx, chan *c)
+{
+	free(c->topic);
+	free(c->topicnick);
+	c->topic = c->topicnick = NULL;
+	c->tstopic = 0;
+	free_chanmodes(ctx, c);
+	c->stale = false;
+	c->desync = true;
+	lsi_ucb_dirty_chan(ctx, c);
+	D("revived channel '%s'", c->name);
+	return;
+}
+
 void
 lsi_ucb_dump(irc *ctx, bool full)
 {
@@ -555,11 +1139,22 @@ lsi_ucb_dump(irc *ctx, bool full)
 			    lsi_skmap_count(c->memb), c->topic, c->topicnick,
 			    c->tscreate, c->tstopic);
 
-			for (size_t i = 0; i < c->modes_sz; i++) {
-				if (!c->modes[i])
-					break;
-
-				A("  mode '%s'", c->modes[i]);
+			for (size_t i = 0; i < NUM_CHANMODES; i++) {
+				char m = i < 26 ? 'a' + i : 'A' + (i - 26);
+				const char *arg;
+				if (lsi_ucb_get_chanmode(ctx, c, m, &arg))
+					A("  mode '%c%s%s'", m, arg ? " " : "",
+					    arg ? arg : "");
+
+				skmap_iter it;
+				char *mask;
+				void *lm;
+				lsi_ucb_iter_lmodes(ctx, c, m, &it);
+				while (lsi_skmap_iter_next(&it, &mask, &lm))
+					A("  mode '%c %s' (by %s at %"PRIu64")",
+					    m, mask, ((lmode *)lm)->setby
+					    ? ((lmode *)lm)->setby : "?",
+					    ((lmode *)lm)->tsset);
 			}
 
 			char *k;
@@ -567,6 +1162,7 @@ lsi_ucb_dump(irc *ctx, bool full)
 				continue;
 			do {
 				memb *m = e2;
+				lsi_ucb_user_details(m->u);
 				A("    member ('%s') '%s!%s@%s' ['%s']",
 				    m->modepfx, m->u->nick, m->u->uname,
 				    m->u->host, m->u->fname);
@@ -588,12 +1184,26 @@ lsi_ucb_dump(irc *ctx, bool full)
 user *
 lsi_ucb_get_user(irc *ctx, const char *ident, bool complain)
 {
-	user *u = lsi_skmap_get(ctx->users, ident);
+	user *u = ctx->nickalias ? lsi_tsh_alias(ctx, ident, SIZE_MAX) : NULL;
+	if (!u)
+		u = lsi_skmap_get(ctx->users, ident);
 	if (!u && complain)
 		W("no such user '%s'", ident);
 	return u;
 }
 
+user *
+lsi_ucb_get_user_sp(irc *ctx, const struct idspan *id, bool complain)
+{
+	user *u = ctx->nickalias
+	    ? lsi_tsh_alias(ctx, id->nick, id->nicklen) : NULL;
+	if (!u)
+		u = lsi_skmap_get_n(ctx->users, id->nick, id->nicklen);
+	if (!u && complain)
+		W("no such user '%.*s'", (int)id->nicklen, id->nick);
+	return u;
+}
+
 size_t
 lsi_ucb_num_users(irc *ctx)
 {
@@ -615,9 +1225,30 @@ lsi_ucb_rename_user(irc *ctx, const char *ident, const char *newnick, bool *allo
 	if (!u)
 		return false;
 
+	/* a context sharing the user map renamed them already, but we had
+	 * learned about them under the old nick in the meantime */
+	user *dup = !justcase ? lsi_skmap_get(ctx->users, newnick) : NULL;
+	if (dup && dup != u && ctx->trkshared) {
+		if (!merge_user(ctx, u, dup, ident, newnick)) {
+			if (allocerr)
+				*allocerr = true;
+			return false;
+		}
+		return true;
+	}
+
+	/* on our own, nobody can be using the new nick; whoever we think
+	 * does has left without us noticing */
+	if (dup && dup != u) {
+		W("'%s' took the nick of '%s', who we thought was still around",
+		    nick, newnick);
+		lsi_ucb_drop_user(ctx, dup);
+	}
+
 	char *nn = NULL;
 	if (justcase) {
 		lsi_b_strNcpy(u->nick, newnick, strlen(u->nick) + 1);
+		lsi_ucb_dirty_user(ctx, u);
 		return true;
 	} else {
 		if (!(nn = STRDUP(newnick)))
@@ -634,7 +1265,88 @@ lsi_ucb_rename_user(irc *ctx, const char *ident, const char *newnick, bool *allo
 
 	lsi_skmap_del(ctx->users, ident);
 
+	/* with a shared user map, the other contexts' member maps are keyed by
+	 * the old nick just the same.  those that have them in a channel are
+	 * yet to see the NICK, and until then know them by the old nick */
+	size_t n = ctx->trkshared ? ctx->trkshare->natt : 1;
+	for (size_t i = 0; i < n; i++) {
+		irc *cx = ctx->trkshared ? ctx->trkshare->att[i] : ctx;
+		bool found;
+		if (!rekey_memb(cx, ident, nick, newnick, &found)
+		    || (cx != ctx && found && !lsi_tsh_alias_add(cx, nick, u))) {
+			if (allocerr)
+				*allocerr = true;
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* hand the memberships of `u` (known as `ident`) over to `into` (known as
+ * `newnick`), in every context sharing the user map, and drop `u` */
+static bool
+merge_user(irc *ctx, user *u, user *into, const char *ident,
+    const char *newnick)
+{
+	D("merging '%s' into '%s'", u->nick, into->nick);
+	for (size_t i = 0; i < ctx->trkshare->natt; i++) {
+		irc *cx = ctx->trkshare->att[i];
+		void *e;
+		if (!lsi_skmap_first(cx->chans, NULL, &e))
+			continue;
+
+		do {
+			chan *c = e;
+			memb *m = lsi_skmap_get(c->memb, ident);
+			if (!m)
+				continue;
+
+			lsi_mlist_del(&c->ml, m, u->nick);
+			lsi_skmap_del(c->memb, ident);
+			u->nchans--;
+			if (lsi_skmap_get(c->memb, newnick)) {
+				free(m); //been there already
+			} else {
+				m->u = into;
+				if (!lsi_skmap_put(c->memb, newnick, m)) {
+					free(m);
+					return false;
+				}
+				lsi_mlist_add(&c->ml, m);
+				into->nchans++;
+			}
+			lsi_ucb_dirty_chan(cx, c);
+		} while (lsi_skmap_next(cx->chans, NULL, &e));
+	}
+
+	lsi_skmap_del(ctx->users, ident);
+	free_user(ctx, u);
+	return true;
+}
+
+/* forget member `m` of `c`, whose user isn't known by its nick anymore */
+static void
+drop_ghost(irc *ctx, chan *c, memb *m)
+{
+	user *u = m->u;
+	W("dropping stale member '%s' of '%s'", u->nick, c->name);
+	lsi_mlist_del(&c->ml, m, u->nick);
+	lsi_skmap_del(c->memb, u->nick);
+	free(m);
+	if (--u->nchans == 0 && lsi_skmap_get(ctx->users, u->nick) != u)
+		free_user(ctx, u);
+	return;
+}
+
+/* file the memberships of (already renamed) `ident` under `newnick`,
+ * telling whether there were any in `found` */
+static bool
+rekey_memb(irc *ctx, const char *ident, const char *nick, const char *newnick,
+    bool *found)
+{
 	void *e;
+	*found = false;
 	if (lsi_skmap_first(ctx->chans, NULL, &e))
 		do {
 			chan *c = e;
@@ -642,13 +1354,28 @@ lsi_ucb_rename_user(irc *ctx, const char *ident, const char *newnick, bool *allo
 			if (!m)
 				continue;
 
+			*found = true;
+			lsi_mlist_del(&c->ml, m, nick);
+			lsi_skmap_del(c->memb, ident);
+			lsi_ucb_dirty_chan(ctx, c);
+
+			/* never put over a member; if someone is still filed
+			 * under the new nick, they're long gone */
+			memb *o = lsi_skmap_get(c->memb, newnick);
+			if (o && o->u == m->u) {
+				m->u->nchans--;
+				free(m);
+				continue;
+			} else if (o)
+				drop_ghost(ctx, c, o);
+
 			if (!lsi_skmap_put(c->memb, newnick, m)) {
-				if (allocerr)
-					*allocerr = true;
+				m->u->nchans--;
+				free(m);
 				return false;
 			}
 
-			lsi_skmap_del(c->memb, ident);
+			lsi_mlist_add(&c->ml, m);
 		} while (lsi_skmap_next(ctx->chans, NULL, &e));
 
 	return true;
@@ -708,6 +1435,36 @@ lsi_ucb_next_memb(irc *ctx, chan *c)
 	return e;
 }
 
+void
+lsi_ucb_iter_chans(irc *ctx, skmap_iter *it)
+{
+	lsi_skmap_iter_init(ctx->chans, it);
+	return;
+}
+
+void
+lsi_ucb_iter_users(irc *ctx, skmap_iter *it)
+{
+	lsi_skmap_iter_init(ctx->users, it);
+	return;
+}
+
+void
+lsi_ucb_iter_memb(irc *ctx, chan *c, skmap_iter *it)
+{
+	lsi_skmap_iter_init(c->memb, it);
+	return;
+}
+
+/* `it` comes up empty for modes that aren't list modes */
+void
+lsi_ucb_iter_lmodes(irc *ctx, chan *c, char mode, skmap_iter *it)
+{
+	int ind = lsi_ucb_modeind(mode);
+	lsi_skmap_iter_init(ind == -1 ? NULL : c->lmodes[ind], it);
+	return;
+}
+
 void
 lsi_ucb_tag_chan(chan *c, void *tag, bool autofree)
 {
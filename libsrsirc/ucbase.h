@@ -11,11 +11,16 @@
 
 #include <libsrsirc/defs.h>
 #include "intdefs.h"
+#include "mlist.h"
 
 
+/* channel modes are indexed by letter; a-z go to 0-25, A-Z to 26-51 */
+#define NUM_CHANMODES 52
+
 typedef struct chan chan;
 typedef struct member memb;
 typedef struct user user;
+typedef struct lmode lmode;
 
 struct chan {
 	char name[MAX_CHAN_LEN];
@@ -24,16 +29,44 @@ struct chan {
 	uint64_t tscreate;
 	uint64_t tstopic;
 	skmap *memb; //map lnick to struct member
+	mlist ml; //the same members, in order; see mlist.c
 	bool desync;
-	char **modes; //one modechar per elem, i.e. "s" or "l 123"
-	size_t modes_sz;
+	bool namesync; //a NAMES reply (353s) is coming in, see h_353()
+	bool stale; //left over from before a reconnect, until we re-JOIN
+	skmap *lmodes[NUM_CHANMODES]; //class A; map mask to lmode, or NULL
+	uint64_t lmodes_sync; //bit set while a list (367 etc) is coming in
+	char *amodes[NUM_CHANMODES]; //class B and C; argument, NULL if unset
+	uint64_t dmodes; //class D; bit set if set
 	void *tag;
 	bool freetag;
+	uint64_t ver; //bumped on changes, see lsi_ucb_dirty_chan()
+	struct snapchan *snap; //last snapshot of this channel, see trksnap.c
+	uint64_t tsread; //last handed out to the user (chanrep), see trkmem.c
+	bool evicted; //topic dropped to save memory, see trkmem.c
+};
+
+/* NAMES entries are fed to lsi_ucb_sync_memb() in batches of this many */
+#define NAMES_BATCH 128
+
+/* one entry of a NAMES reply */
+struct namesent {
+	const char *ident; //nick, or nick!uname@host (userhost-in-names)
+	char mpfx[MAX_MODEPFX];
+};
+
+/* an entry of a list mode (ban, exception, ...), keyed by its mask */
+struct lmode {
+	char *setby; //whoever set it, or NULL if unknown
+	uint64_t tsset; //when it was set (seconds since Epoch), 0 if unknown
 };
 
 struct member {
 	user *u;
-	char modepfx[MAX_MODEPFX];
+	uint32_t pfxmask; //bit n set if the prefix of rank n is (0 = strongest)
+	bool mark; //not (yet) seen in the NAMES reply being processed
+	char modepfx[MAX_MODEPFX]; //pfxmask rendered as symbols, for userrep
+	uint8_t lvl; //how many links follow
+	struct mlink lnk[]; //in the chan's mlist
 };
 
 struct user {
@@ -41,22 +74,39 @@ struct user {
 	char *uname;
 	char *host;
 	char *fname;
+	char *pend; //"!uname@host" not yet split up, see lsi_ucb_user_details()
+	char *acct; //services account, NULL if unknown or not logged in
+	char *away; //away message ("" if unknown), NULL if not away (or unknown)
 	size_t nchans;
+	bool quitting; //QUIT in a netsplit batch, see lsi_ucb_drop_quitting()
 	bool dangling; //debug
 	void *tag;
 	bool freetag;
+	uint64_t tsact; //last seen saying or doing something, see trkmem.c
+	bool evicted; //uname and fname dropped to save memory, see trkmem.c
+	size_t ver; //*ctx->detgen as of the last change, see lsi_ucb_dirty_user()
 };
 
 bool   lsi_ucb_init(irc *ctx);
 void   lsi_ucb_deinit(irc *ctx);
 void   lsi_ucb_clear(irc *ctx);
 void   lsi_ucb_dump(irc *ctx, bool full);
+void   lsi_ucb_mark_stale(irc *ctx);
+void   lsi_ucb_sweep_stale(irc *ctx);
+void   lsi_ucb_revive_chan(irc *ctx, chan *c);
 
 user  *lsi_ucb_add_user(irc *ctx, const char *ident);
 bool   lsi_ucb_drop_user(irc *ctx, user *u);
+bool   lsi_ucb_drop_quitting(irc *ctx);
+void   lsi_ucb_dirty_chan(irc *ctx, chan *c);
+void   lsi_ucb_dirty_user(irc *ctx, user *u);
 size_t lsi_ucb_num_users(irc *ctx);
 user  *lsi_ucb_get_user(irc *ctx, const char *ident, bool complain);
 user  *lsi_ucb_touch_user(irc *ctx, const char *ident, bool complain);
+user  *lsi_ucb_get_user_sp(irc *ctx, const struct idspan *id, bool complain);
+user  *lsi_ucb_touch_user_sp(irc *ctx, const struct idspan *id, bool complain);
+bool   lsi_ucb_touch_user_int(user *u, const char *ident);
+void   lsi_ucb_user_details(user *u);
 bool   lsi_ucb_rename_user(irc *ctx, const char *ident, const char *newnick,
                            bool *allocerr);
 
@@ -65,18 +115,33 @@ bool   lsi_ucb_drop_chan(irc *ctx, chan *c);
 size_t lsi_ucb_num_chans(irc *ctx);
 chan  *lsi_ucb_get_chan(irc *ctx, const char *name, bool complain);
 
+int    lsi_ucb_modeind(char mode);
 void   lsi_ucb_clear_chanmodes(irc *ctx, chan *c);
 bool   lsi_ucb_add_chanmode(irc *ctx, chan *c, const char *modestr);
 bool   lsi_ucb_drop_chanmode(irc *ctx, chan *c, const char *modestr);
+bool   lsi_ucb_get_chanmode(irc *ctx, chan *c, char mode, const char **arg);
+bool   lsi_ucb_add_lmode(irc *ctx, chan *c, char mode, const char *mask,
+                         const char *setby, uint64_t tsset);
+bool   lsi_ucb_drop_lmode(irc *ctx, chan *c, char mode, const char *mask);
+lmode *lsi_ucb_get_lmode(irc *ctx, chan *c, char mode, const char *mask);
+size_t lsi_ucb_num_lmodes(irc *ctx, chan *c, char mode);
+void   lsi_ucb_clear_lmodes(irc *ctx, chan *c, char mode);
 
 size_t lsi_ucb_num_memb(irc *ctx, chan *c);
 memb  *lsi_ucb_get_memb(irc *ctx, chan *c, const char *nick, bool complain);
+memb  *lsi_ucb_get_memb_sp(irc *ctx, chan *c, const struct idspan *id,
+    bool complain);
 bool   lsi_ucb_add_memb(irc *ctx, chan *c, user *u, const char *mpfxstr);
 bool   lsi_ucb_drop_memb(irc *ctx, chan *c, user *u, bool purge, bool complain);
 void   lsi_ucb_clear_memb(irc *ctx, chan *c);
+void   lsi_ucb_mark_memb(irc *ctx, chan *c);
+bool   lsi_ucb_sweep_memb(irc *ctx, chan *c);
+bool   lsi_ucb_sync_memb(irc *ctx, chan *c, struct namesent *ents, size_t n);
 memb  *lsi_ucb_alloc_memb(irc *ctx, user *u, const char *mpfxstr);
 bool   lsi_ucb_update_modepfx(irc *ctx, chan *c, const char *nick, char sym,
                               bool enab);
+void   lsi_ucb_resync_modepfx(irc *ctx, chan *c, memb *m,
+                              const char *mpfxstr);
 
 /* these might be dangerous to use, be sure to complete the iteration
  * before any other state might change */
@@ -86,6 +151,16 @@ user *lsi_ucb_first_user(irc *ctx);
 user *lsi_ucb_next_user(irc *ctx);
 memb *lsi_ucb_first_memb(irc *ctx, chan *c);
 memb *lsi_ucb_next_memb(irc *ctx, chan *c);
+
+/* re-entrant versions of the above; the iteration state is kept in `it` (on
+ * the caller's stack), so they can be nested.  fetch with
+ * lsi_skmap_iter_next(it, NULL, &elem).  the map iterated over still must
+ * not change while at it */
+void   lsi_ucb_iter_chans(irc *ctx, skmap_iter *it);
+void   lsi_ucb_iter_users(irc *ctx, skmap_iter *it);
+void   lsi_ucb_iter_memb(irc *ctx, chan *c, skmap_iter *it);
+void   lsi_ucb_iter_lmodes(irc *ctx, chan *c, char mode, skmap_iter *it);
+
 void  lsi_ucb_tag_chan(chan *c, void *tag, bool autofree);
 void  lsi_ucb_tag_user(user *u, void *tag, bool autofree);
 
@@ -333,7 +333,7 @@ lsi_ut_parse_MODE(irc *ctx, tokarr *msg, size_t *num, bool is324)
 			case CHANMODE_CLASS_D:
 				break;
 			default:/*error?*/
-				if (strchr(ctx->m005modepfx[0], c))
+				if (ctx->isupp.pfxmdrank[(unsigned char)c])
 					arg = i >= ac ? "*" : (*msg)[i++];
 				else {
 					W("unknown chanmode '%c'", c);
@@ -381,12 +381,8 @@ fail:
 int
 lsi_ut_classify_chanmode(irc *ctx, char c)
 {
-	for (int z = 0; z < 4; ++z) {
-		if (ctx->m005chanmodes[z] && strchr(ctx->m005chanmodes[z], c))
-			/*XXX this locks the chantype class constants */
-			return z+1;
-	}
-	return 0;
+	/*XXX this locks the chantype class constants */
+	return ctx->isupp.mdclass[(unsigned char)c];
 }
 
 void
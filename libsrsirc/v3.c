@@ -22,6 +22,8 @@
 #include "common.h"
 #include "irc_msghnd.h"
 
+#include <libsrsirc/irc_ext.h>
+
 static uint16_t handle_CAP(irc *ctx, tokarr *msg, size_t nargs, bool logon);
 static uint16_t handle_CAP_ACK(irc *ctx, tokarr *msg, size_t nargs, bool logon);
 static uint16_t handle_CAP_NAK(irc *ctx, tokarr *msg, size_t nargs, bool logon);
@@ -33,6 +35,7 @@ static uint16_t handle_903(irc *ctx, tokarr *msg, size_t nargs, bool logon);
 static uint16_t handle_670(irc *ctx, tokarr *msg, size_t nargs, bool logon);
 static uint16_t handle_691(irc *ctx, tokarr *msg, size_t nargs, bool logon);
 static uint16_t handle_saslerr(irc *ctx, tokarr *msg, size_t nargs, bool logon);
+static uint16_t handle_BATCH(irc *ctx, tokarr *msg, size_t nargs, bool logon);
 static struct v3cap *find_cap(irc *ctx, const char *cap);
 static bool conclude_sasl_cap(irc *ctx);
 
@@ -167,7 +170,7 @@ handle_CAP(irc *ctx, tokarr *msg, size_t nargs, bool logon)
 			return 0;
 		if (!lsi_v3_check_caps(ctx, true))
 			return CAP_ERR;
-		char capreq[MAX_V3CAPLEN] = "CAP REQ :";
+		char capreq[MAX_V3CAPLINE] = "CAP REQ :";
 		size_t crlen = strlen(capreq);
 
 		if (!lsi_v3_mk_capreq(ctx, capreq + crlen,
@@ -359,6 +362,7 @@ lsi_v3_regall(irc *ctx, bool dumb)
 	fail = fail || !lsi_msg_reghnd(ctx, "905", handle_saslerr, "v3");
 	fail = fail || !lsi_msg_reghnd(ctx, "908", handle_saslerr, "v3");
 	fail = fail || !lsi_msg_reghnd(ctx, "CAP", handle_CAP, "v3");
+	fail = fail || !lsi_msg_reghnd(ctx, "BATCH", handle_BATCH, "v3");
 	fail = fail || !lsi_msg_reghnd(ctx, "AUTHENTICATE",
 	    handle_AUTHENTICATE, "v3");
 
@@ -372,6 +376,81 @@ lsi_v3_unregall(irc *ctx)
 	return;
 }
 
+/* BATCH +ref type [params] / BATCH -ref */
+static uint16_t
+handle_BATCH(irc *ctx, tokarr *msg, size_t nargs, bool logon)
+{
+	if (nargs < 3 || !(*msg)[2][0])
+		return PROTO_ERR;
+
+	const char *ref = (*msg)[2] + 1;
+	size_t i = 0;
+	if ((*msg)[2][0] == '+') {
+		if (nargs < 4)
+			return PROTO_ERR;
+
+		for (; i < COUNTOF(ctx->v3batches); i++)
+			if (!ctx->v3batches[i].ref[0])
+				break;
+
+		if (i == COUNTOF(ctx->v3batches)) {
+			W("too many open batches, ignoring '%s'", ref);
+			return 0;
+		}
+
+		STRACPY(ctx->v3batches[i].ref, ref);
+		STRACPY(ctx->v3batches[i].type, (*msg)[3]);
+		D("batch '%s' (%s) opened", ref, (*msg)[3]);
+	} else {
+		for (; i < COUNTOF(ctx->v3batches); i++)
+			if (strcmp(ctx->v3batches[i].ref, ref) == 0)
+				break;
+
+		if (i == COUNTOF(ctx->v3batches)) {
+			W("closing unknown batch '%s'", ref);
+			return 0;
+		}
+
+		ctx->v3batches[i].ref[0] = '\0';
+		D("batch '%s' (%s) closed", ref, ctx->v3batches[i].type);
+	}
+
+	return 0;
+}
+
+/* the type of the batch the message at hand belongs to, or NULL if none */
+const char *
+lsi_v3_batch_type(irc *ctx)
+{
+	const char *ref;
+	if (!ctx->v3ntags || !irc_v3tag_bykey(ctx, "batch", &ref) || !ref)
+		return NULL;
+
+	for (size_t i = 0; i < COUNTOF(ctx->v3batches); i++)
+		if (strcmp(ctx->v3batches[i].ref, ref) == 0)
+			return ctx->v3batches[i].type;
+
+	return NULL;
+}
+
+/* true if the message at hand is part of a batch that's best dealt with
+ * as a whole, rather than line by line */
+bool
+lsi_v3_bulk_batch(irc *ctx)
+{
+	const char *type = lsi_v3_batch_type(ctx);
+	return type && (strcmp(type, "netsplit") == 0
+	    || strcmp(type, "netjoin") == 0);
+}
+
+void
+lsi_v3_reset_batches(irc *ctx)
+{
+	for (size_t i = 0; i < COUNTOF(ctx->v3batches); i++)
+		ctx->v3batches[i].ref[0] = '\0';
+	return;
+}
+
 /* SASL success */
 static uint16_t
 handle_903(irc *ctx, tokarr *msg, size_t nargs, bool logon)
@@ -475,7 +554,7 @@ decode_v3tag(char *dest, size_t destsz, const char *v3tag)
 {
 	size_t bc = 0;
 	bool escnext = false;
-	W("decoding");
+	D("decoding");
 	while (bc < destsz) {
 		char c = *v3tag++;
 		switch (c) {
@@ -23,6 +23,10 @@ bool lsi_v3_mk_capreq(irc *ctx, char *dest, size_t destsz);
 void lsi_v3_update_cap(irc *ctx, const char *cap, const char *adddata,
     int offered, int enabled); //-1: don't upd
 
+const char *lsi_v3_batch_type(irc *ctx);
+bool lsi_v3_bulk_batch(irc *ctx);
+void lsi_v3_reset_batches(irc *ctx);
+
 bool lsi_v3_regall(irc *ctx, bool dumb);
 void lsi_v3_unregall(irc *ctx);
 
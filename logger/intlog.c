@@ -13,13 +13,25 @@
 #include <errno.h>
 #include <limits.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+
+#include <platform/base_misc.h>
 
 
 #define DEF_LVL LOG_CRIT
 
+/* async mode: default (and maximum) number of messages in flight, and how
+ * long each may be (sync mode allows 4096, see lsi_log_async()); also how
+ * long drain() naps when there is nothing to do */
+#define DEF_RING 1024
+#define MAX_RING 16384
+#define REC_PAYLOAD 1024
+#define DRAIN_NAP_US 1000
+
 #define COL_REDINV "\033[07;31;01m"
 #define COL_RED "\033[31;01m"
 #define COL_YELLOW "\033[33;01m"
@@ -61,12 +73,40 @@ const char *modnames[NUM_MODS] = {
 	[MOD_UNKNOWN] = "(??" "?)"
 };
 
+/* everything is enabled until lsi_log_init() ran, which is done by the
+ * first lsi_log_log() call that thus makes it through the inline check */
+int lsi_log_lvlarr[NUM_MODS] = {
+	[MOD_IRC] = INT_MAX,
+	[MOD_COMMON] = INT_MAX,
+	[MOD_IRC_UTIL] = INT_MAX,
+	[MOD_ICONN] = INT_MAX,
+	[MOD_IIO] = INT_MAX,
+	[MOD_PROXY] = INT_MAX,
+	[MOD_IMSG] = INT_MAX,
+	[MOD_SKMAP] = INT_MAX,
+	[MOD_PLST] = INT_MAX,
+	[MOD_TRACK] = INT_MAX,
+	[MOD_UCBASE] = INT_MAX,
+	[MOD_V3] = INT_MAX,
+	[MOD_BASEIO] = INT_MAX,
+	[MOD_BASENET] = INT_MAX,
+	[MOD_BASETIME] = INT_MAX,
+	[MOD_BASESTR] = INT_MAX,
+	[MOD_BASEMISC] = INT_MAX,
+	[MOD_ICATINIT] = INT_MAX,
+	[MOD_ICATCORE] = INT_MAX,
+	[MOD_ICATSERV] = INT_MAX,
+	[MOD_ICATUSER] = INT_MAX,
+	[MOD_ICATMISC] = INT_MAX,
+	[MOD_IWAT] = INT_MAX,
+	[MOD_UNKNOWN] = INT_MAX,
+};
+
 
 static bool s_open;
 static bool s_stderr = true;
 static bool s_fancy;
 static bool s_init;
-static int s_lvlarr[NUM_MODS];
 
 static int s_w_modnam = 20;
 static int s_w_file = 0;
@@ -75,6 +115,38 @@ static int s_w_func = 0;
 
 static int s_calldepth = 0;
 
+/* Asynchronous mode (see lsi_log_async()): lsi_log_log() renders the message
+ * into a slot of s_ring and returns; everything else (timestamp, decoration,
+ * the actual write) is done by drain(), on a thread of its own.  If the ring
+ * is full, messages are dropped and drain() says how many.  At exit,
+ * stop_async() sets s_ring back to NULL (so whatever is logged after that is
+ * output right away) and has drain() finish what's in it; the ring itself is
+ * never freed, a thread might still be pushing. */
+struct logrec {
+	size_t seq;           /* see push() */
+	int mod, lvl, errn, line;
+	const char *file, *func;
+	time_t t;
+	char payload[REC_PAYLOAD];
+};
+
+static void *s_ring;       /* struct logrec[], NULL unless async */
+static size_t s_ringmask;  /* number of slots minus one */
+static size_t s_head;      /* next slot to fill (producers) */
+static size_t s_tail;      /* next slot to output (drain() only) */
+static size_t s_dropped;
+static size_t s_stop;      /* tells drain() to finish up */
+static void *s_thr;
+
+static void emit(int mod, int lvl, int errn, const char *file, int line,
+    const char *func, char *payload, const char *timebuf);
+static void mktimestr(time_t t, char *dest);
+static void push(struct logrec *ring, int mod, int lvl, int errn,
+    const char *file, int line, const char *func, const char *fmt,
+    va_list vl);
+static void *drain(void *arg);
+static void stop_async(void);
+static void nap(uint64_t us);
 static const char *lvlnam(int lvl);
 static const char *lvlcol(int lvl);
 static int getenv_m(const char *nam, char *dest, size_t destsz);
@@ -132,13 +204,13 @@ lsi_log_getfancy(void)
 void
 lsi_log_setlvl(int mod, int lvl)
 {
-	s_lvlarr[mod] = lvl;
+	lsi_log_lvlarr[mod] = lvl;
 }
 
 int
 lsi_log_getlvl(int mod)
 {
-	return s_lvlarr[mod];
+	return lsi_log_lvlarr[mod];
 }
 
 void
@@ -150,89 +222,77 @@ lsi_log_log(int mod, int lvl, int errn, const char *file, int line,
 
 	bool always = lvl == INT_MIN;
 
-	if (lvl > s_lvlarr[mod])
+	if (!always && lvl > lsi_log_lvlarr[mod])
 		return;
 
-	char resmsg[4096];
-
-	char payload[4096];
 	va_list vl;
 	va_start(vl, fmt);
 
-	vsnprintf(payload, sizeof payload, fmt, vl);
-	char *c = payload;
-	while (*c) {
-		if (*c == '\n' || *c == '\r')
-			*c = '$';
-		c++;
+	struct logrec *ring = lsi_b_atomic_getptr(&s_ring);
+	if (ring) {
+		push(ring, mod, lvl, errn, file, line, func, fmt, vl);
+		va_end(vl);
+		return;
 	}
 
-	char errmsg[256];
-	errmsg[0] = '\0';
-	if (errn >= 0) {
-		errmsg[0] = ':';
-		errmsg[1] = ' ';
-		lsi_b_strerror(errn, errmsg + 2, sizeof errmsg - 2);
-	}
+	char payload[4096];
+	vsnprintf(payload, sizeof payload, fmt, vl);
+	va_end(vl);
 
-	if (s_stderr) {
-		if (always) {
-			fputs(payload, stderr);
-			fputs("\n", stderr);
-		} else {
-			char pad[256];
-			if (lvl == LOG_TRACE) {
-				size_t d = s_calldepth * 2;
-				if (d > sizeof pad)
-					d = sizeof pad - 1;
-				memset(pad, ' ', d);
-				pad[d] = '\0';
-			} else
-				pad[0] = '\0';
+	char timebuf[27];
+	mktimestr(time(NULL), timebuf);
+	emit(mod, lvl, errn, file, line, func, payload, timebuf);
+}
+
+bool
+lsi_log_async(size_t nrec)
+{
+	if (s_ring)
+		return true;
 
-			char timebuf[27];
-			time_t t = time(NULL);
-			if (!lsi_b_ctime(&t, timebuf))
-				strcpy(timebuf, "(lsi_b_ctime() failed)");
-			char *ptr = strchr(timebuf, '\n');
-			if (ptr)
-				*ptr = '\0';
+	if (lsi_b_atomic_get(&s_stop))
+		return false; //on our way out, see stop_async()
 
-			snprintf(resmsg, sizeof resmsg, "%s%s: %*s: "
-			    "%s: %s%*s:%*d:%*s(): %s%s%s\n",
-			    s_fancy ? lvlcol(lvl) : "",
-			    timebuf,
-			    s_w_modnam, modnames[mod],
-			    lvlnam(lvl),
-			    pad,
-			    s_w_file, file,
-			    s_w_line, line,
-			    s_w_func, func,
-			    payload,
-			    errmsg,
-			    s_fancy ? COL_RST : "");
+	if (nrec > MAX_RING)
+		nrec = MAX_RING;
 
-			fputs(resmsg, stderr);
-		}
-	} else {
-		if (always)
-			lsi_b_syslog(LOG_NOTICE, "%s", payload);
-		else {
-			snprintf(resmsg, sizeof resmsg, "%s: %s:%d:%s(): %s%s",
-			    modnames[mod], file, line, func, payload, errmsg);
-			lsi_b_syslog(lvl, "%s", resmsg);
-		}
+	size_t sz = 1;
+	while (sz < nrec)
+		sz *= 2;
+
+	struct logrec *ring = malloc(sz * sizeof *ring);
+	if (!ring)
+		return false;
+
+	for (size_t i = 0; i < sz; i++)
+		ring[i].seq = i;
+
+	s_ringmask = sz - 1;
+	s_head = s_tail = s_dropped = s_stop = 0;
+
+	if (!(s_thr = lsi_b_thread(drain, ring))) {
+		free(ring);
+		return false;
 	}
 
-	va_end(vl);
+	lsi_b_atomic_swapptr(&s_ring, ring);
+
+	atexit(stop_async);
+	return true;
+}
+
+size_t
+lsi_log_dropped(void)
+{
+	return lsi_b_atomic_get(&s_dropped);
 }
 
 void
 lsi_log_init(void)
 {
 	int deflvl = DEF_LVL;
-	for (size_t i = 0; i < COUNTOF(s_lvlarr); i++)
-		s_lvlarr[i] = INT_MIN;
+	for (size_t i = 0; i < COUNTOF(lsi_log_lvlarr); i++)
+		lsi_log_lvlarr[i] = INT_MIN;
 
 	char v[128];
 	if (getenv_m("LIBSRSIRC_DEBUG", v, sizeof v) == 0 && v[0]) {
@@ -248,8 +308,8 @@ lsi_log_init(void)
 					if (strcmp(modnames[mod], tok) == 0)
 						break;
 
-				if (mod < COUNTOF(s_lvlarr))
-					s_lvlarr[mod] =
+				if (mod < COUNTOF(lsi_log_lvlarr))
+					lsi_log_lvlarr[mod] =
 					    (int)strtol(eq+1, NULL, 10);
 
 				*eq = '=';
@@ -283,9 +343,9 @@ lsi_log_init(void)
 		}
 	}
 
-	for (size_t i = 0; i < COUNTOF(s_lvlarr); i++)
-		if (s_lvlarr[i] == INT_MIN)
-			s_lvlarr[i] = deflvl;
+	for (size_t i = 0; i < COUNTOF(lsi_log_lvlarr); i++)
+		if (lsi_log_lvlarr[i] == INT_MIN)
+			lsi_log_lvlarr[i] = deflvl;
 
 	const char *vv = getenv("LIBSRSIRC_DEBUG_TARGET");
 	if (vv && strcmp(vv, "syslog") == 0)
@@ -300,6 +360,13 @@ lsi_log_init(void)
 		lsi_log_setfancy(false);
 
 	s_init = true;
+
+	vv = getenv("LIBSRSIRC_DEBUG_ASYNC");
+	if (vv && vv[0] && vv[0] != '0') {
+		size_t n = isdigitstr(vv) ? strtoul(vv, NULL, 10) : 0;
+		if (!lsi_log_async(n > 1 ? n : DEF_RING))
+			fputs("libsrsirc: can't log asynchronously\n", stderr);
+	}
 }
 
 void
@@ -319,6 +386,189 @@ lsi_log_tcall(void) {
 
 // ---- local helpers ----
 
+/* format and output one message */
+static void
+emit(int mod, int lvl, int errn, const char *file, int line,
+    const char *func, char *payload, const char *timebuf)
+{
+	bool always = lvl == INT_MIN;
+	char resmsg[4096];
+
+	char *c = payload;
+	while (*c) {
+		if (*c == '\n' || *c == '\r')
+			*c = '$';
+		c++;
+	}
+
+	char errmsg[256];
+	errmsg[0] = '\0';
+	if (errn >= 0) {
+		errmsg[0] = ':';
+		errmsg[1] = ' ';
+		lsi_b_strerror(errn, errmsg + 2, sizeof errmsg - 2);
+	}
+
+	if (s_stderr) {
+		if (always) {
+			fputs(payload, stderr);
+			fputs("\n", stderr);
+		} else {
+			char pad[256];
+			if (lvl == LOG_TRACE) {
+				size_t d = s_calldepth * 2;
+				if (d > sizeof pad)
+					d = sizeof pad - 1;
+				memset(pad, ' ', d);
+				pad[d] = '\0';
+			} else
+				pad[0] = '\0';
+
+			snprintf(resmsg, sizeof resmsg, "%s%s: %*s: "
+			    "%s: %s%*s:%*d:%*s(): %s%s%s\n",
+			    s_fancy ? lvlcol(lvl) : "",
+			    timebuf,
+			    s_w_modnam, modnames[mod],
+			    lvlnam(lvl),
+			    pad,
+			    s_w_file, file,
+			    s_w_line, line,
+			    s_w_func, func,
+			    payload,
+			    errmsg,
+			    s_fancy ? COL_RST : "");
+
+			fputs(resmsg, stderr);
+		}
+	} else {
+		if (always)
+			lsi_b_syslog(LOG_NOTICE, "%s", payload);
+		else {
+			snprintf(resmsg, sizeof resmsg, "%s: %s:%d:%s(): %s%s",
+			    modnames[mod], file, line, func, payload, errmsg);
+			lsi_b_syslog(lvl, "%s", resmsg);
+		}
+	}
+}
+
+static void
+mktimestr(time_t t, char *dest)
+{
+	if (!lsi_b_ctime(&t, dest))
+		strcpy(dest, "(lsi_b_ctime() failed)");
+	char *ptr = strchr(dest, '\n');
+	if (ptr)
+		*ptr = '\0';
+}
+
+/* claim a slot, fill it in and hand it to drain(), or count it as dropped
+ * if the ring is full.  this is Vyukov's bounded queue: a slot is free for
+ * the producer at `pos' iff its seq is `pos', and ready for the consumer
+ * iff it is `pos'+1 */
+static void
+push(struct logrec *ring, int mod, int lvl, int errn, const char *file,
+    int line, const char *func, const char *fmt, va_list vl)
+{
+	size_t pos = lsi_b_atomic_get(&s_head);
+	struct logrec *r;
+	for (;;) {
+		r = &ring[pos & s_ringmask];
+		size_t seq = lsi_b_atomic_get(&r->seq);
+		if (seq == pos) {
+			if (lsi_b_atomic_cas(&s_head, &pos, pos + 1))
+				break;
+		} else if (seq < pos) {
+			lsi_b_atomic_inc(&s_dropped);
+			return;
+		} else
+			pos = lsi_b_atomic_get(&s_head);
+	}
+
+	r->mod = mod;
+	r->lvl = lvl;
+	r->errn = errn;
+	r->line = line;
+	r->file = file;
+	r->func = func;
+	r->t = time(NULL);
+	vsnprintf(r->payload, sizeof r->payload, fmt, vl);
+
+	lsi_b_atomic_set(&r->seq, pos + 1);
+}
+
+/* the background thread: output whatever is in the ring, nap if nothing */
+static void *
+drain(void *arg)
+{
+	struct logrec *ring = arg;
+	char timebuf[27];
+	time_t last = time(NULL);
+	size_t dropped = 0;
+	mktimestr(last, timebuf);
+
+	for (;;) {
+		bool stop = lsi_b_atomic_get(&s_stop);
+		bool any = false;
+
+		struct logrec *r = &ring[s_tail & s_ringmask];
+		while (lsi_b_atomic_get(&r->seq) == s_tail + 1) {
+			if (r->t != last) {
+				mktimestr(r->t, timebuf);
+				last = r->t;
+			}
+
+			emit(r->mod, r->lvl, r->errn, r->file, r->line,
+			    r->func, r->payload, timebuf);
+
+			lsi_b_atomic_set(&r->seq, s_tail + s_ringmask + 1);
+			s_tail++;
+			r = &ring[s_tail & s_ringmask];
+			any = true;
+		}
+
+		size_t d = lsi_b_atomic_get(&s_dropped);
+		if (d != dropped) {
+			char msg[64];
+			snprintf(msg, sizeof msg, "%zu log messages dropped "
+			    "(ring full)", d - dropped);
+			dropped = d;
+			emit(MOD_UNKNOWN, LOG_WARNING, -1, __FILE__, __LINE__,
+			    __func__, msg, timebuf);
+		}
+
+		if (any)
+			fflush(stderr);
+		else if (stop)
+			break;
+		else
+			nap(DRAIN_NAP_US);
+	}
+
+	return NULL;
+}
+
+/* registered with atexit(), so that what's in the ring makes it out, and
+ * what is logged later (by other atexit() handlers, say) isn't lost */
+static void
+stop_async(void)
+{
+	lsi_b_atomic_swapptr(&s_ring, NULL);
+	lsi_b_atomic_set(&s_stop, 1);
+	lsi_b_thread_join(s_thr);
+}
+
+/* lsi_b_usleep() would log */
+static void
+nap(uint64_t us)
+{
+#if HAVE_NANOSLEEP
+	struct timespec ts = { 0, (long)us * 1000 };
+	nanosleep(&ts, NULL);
+#else
+# error "We need something like nanosleep()"
+#endif
+}
+
 
 static const char *
 lvlnam(int lvl)
@@ -38,7 +38,8 @@
 #define MOD_ICATMISC 21
 #define MOD_IWAT 22
 #define MOD_UNKNOWN 23
-#define NUM_MODS 24 /* when adding modules, don't forget intlog.c's `modnames' */
+#define NUM_MODS 24 /* when adding modules, don't forget intlog.c's `modnames'
+                      * and `lsi_log_lvlarr' */
 
 /* our two higher-than-debug custom loglevels */
 #define LOG_TRACE (LOG_VIVI+1)
@@ -54,48 +55,42 @@
 
 // ----- logging interface -----
 
-#define V(...)                                                                 \
- lsi_log_log(LOG_MODULE,LOG_VIVI,-1,__FILE__,__LINE__,__func__,__VA_ARGS__)
-
-#define VE(...)                                                                \
- lsi_log_log(LOG_MODULE,LOG_VIVI,errno,__FILE__,__LINE__,__func__,__VA_ARGS__)
-
-#define D( ...)                                                                \
- lsi_log_log(LOG_MODULE,LOG_DEBUG,-1,__FILE__,__LINE__,__func__,__VA_ARGS__)
-
-#define DE(...)                                                                \
- lsi_log_log(LOG_MODULE,LOG_DEBUG,errno,__FILE__,__LINE__,__func__,__VA_ARGS__)
-
-#define I(...)                                                                 \
- lsi_log_log(LOG_MODULE,LOG_INFO,-1,__FILE__,__LINE__,__func__,__VA_ARGS__)
-
-#define IE(...)                                                                \
- lsi_log_log(LOG_MODULE,LOG_INFO,errno,__FILE__,__LINE__,__func__,__VA_ARGS__)
-
-#define N(...)                                                                 \
- lsi_log_log(LOG_MODULE,LOG_NOTICE,-1,__FILE__,__LINE__,__func__,__VA_ARGS__)
-
-#define NE(...)                                                                \
- lsi_log_log(LOG_MODULE,LOG_NOTICE,errno,__FILE__,__LINE__,__func__,__VA_ARGS__)
-
-#define W(...)                                                                 \
- lsi_log_log(LOG_MODULE,LOG_WARNING,-1,__FILE__,__LINE__,__func__,__VA_ARGS__)
-
-#define WE(...)                                                                \
- lsi_log_log(LOG_MODULE,LOG_WARNING,errno,__FILE__,__LINE__,__func__,__VA_ARGS__)
-
-#define E(...)                                                                 \
- lsi_log_log(LOG_MODULE,LOG_ERR,-1,__FILE__,__LINE__,__func__,__VA_ARGS__)
+/* Levels above this are compiled out; see configure's --with-max-loglevel */
+#ifndef LSI_MAX_LOGLVL
+# define LSI_MAX_LOGLVL INT_MAX
+#endif
 
-#define EE(...)                                                                \
- lsi_log_log(LOG_MODULE,LOG_ERR,errno,__FILE__,__LINE__,__func__,__VA_ARGS__)
+/* The level is checked here rather than in lsi_log_log(), so that disabled
+ * levels cost a load and a compare, and their arguments aren't evaluated.
+ * Levels above LSI_MAX_LOGLVL make this a constant false, which leaves no
+ * code behind (but the arguments are still type-checked, and variables used
+ * only for logging don't look unused) */
+#define LOG_ON(LVL)                                                            \
+ ((LVL) <= LSI_MAX_LOGLVL && (LVL) <= lsi_log_lvlarr[LOG_MODULE])
+
+#define LOG_CALL(LVL, ERRN, ...)                                               \
+ (LOG_ON(LVL) ? lsi_log_log(LOG_MODULE,(LVL),(ERRN),__FILE__,__LINE__,        \
+     __func__,__VA_ARGS__) : (void)0)
+
+#define V(...) LOG_CALL(LOG_VIVI,-1,__VA_ARGS__)
+#define VE(...) LOG_CALL(LOG_VIVI,errno,__VA_ARGS__)
+#define D(...) LOG_CALL(LOG_DEBUG,-1,__VA_ARGS__)
+#define DE(...) LOG_CALL(LOG_DEBUG,errno,__VA_ARGS__)
+#define I(...) LOG_CALL(LOG_INFO,-1,__VA_ARGS__)
+#define IE(...) LOG_CALL(LOG_INFO,errno,__VA_ARGS__)
+#define N(...) LOG_CALL(LOG_NOTICE,-1,__VA_ARGS__)
+#define NE(...) LOG_CALL(LOG_NOTICE,errno,__VA_ARGS__)
+#define W(...) LOG_CALL(LOG_WARNING,-1,__VA_ARGS__)
+#define WE(...) LOG_CALL(LOG_WARNING,errno,__VA_ARGS__)
+#define E(...) LOG_CALL(LOG_ERR,-1,__VA_ARGS__)
+#define EE(...) LOG_CALL(LOG_ERR,errno,__VA_ARGS__)
 
 #define C(...) do {                                                            \
- lsi_log_log(LOG_MODULE,LOG_CRIT,-1,__FILE__,__LINE__,__func__,__VA_ARGS__);   \
+ LOG_CALL(LOG_CRIT,-1,__VA_ARGS__);                                            \
  exit(EXIT_FAILURE); } while (0)
 
 #define CE(...) do {                                                           \
- lsi_log_log(LOG_MODULE,LOG_CRIT,errno,__FILE__,__LINE__,__func__,__VA_ARGS__);\
+ LOG_CALL(LOG_CRIT,errno,__VA_ARGS__);                                         \
  exit(EXIT_FAILURE); } while (0)
 
 /* special: always printed, never decorated */
@@ -108,19 +103,18 @@
 # define TC(...) do{}while(0)
 # define TR(...) do{}while(0)
 #else
-# define T(...)                                                                \
- lsi_log_log(LOG_MODULE,LOG_TRACE,-1,__FILE__,__LINE__,__func__,__VA_ARGS__)
+# define T(...) LOG_CALL(LOG_TRACE,-1,__VA_ARGS__)
 
 # define TC(...)                                                               \
  do{                                                                           \
- lsi_log_log(LOG_MODULE,LOG_TRACE,-1,__FILE__,__LINE__,__func__,__VA_ARGS__);  \
+ LOG_CALL(LOG_TRACE,-1,__VA_ARGS__);                                           \
  lsi_log_tcall();                                                              \
  } while (0)
 
 # define TR(...)                                                               \
  do{                                                                           \
  lsi_log_tret();                                                               \
- lsi_log_log(LOG_MODULE,LOG_TRACE,-1,__FILE__,__LINE__,__func__,__VA_ARGS__);  \
+ LOG_CALL(LOG_TRACE,-1,__VA_ARGS__);                                           \
  } while (0)
 #endif
 
@@ -138,7 +132,21 @@ bool lsi_log_getfancy(void);
 void lsi_log_tret(void);
 void lsi_log_tcall(void);
 
+/* from now on, have a thread of our own do the output, with room for `nrec'
+ * messages in flight (rounded up to a power of two, at most 16384).  can't
+ * be undone, except that we're back to synchronous output at exit.
+ * messages are cut at 1023 characters (instead of 4095) while in this mode,
+ * each slot of the ring has room for that much.
+ * LIBSRSIRC_DEBUG_ASYNC=1 (or =<nrec>) does this at startup */
+bool lsi_log_async(size_t nrec);
+/* messages dropped so far for lack of room */
+size_t lsi_log_dropped(void);
+
 // ----- backend -----
+
+/* the current level of each module; don't touch, see lsi_log_setlvl() */
+extern int lsi_log_lvlarr[NUM_MODS];
+
 void lsi_log_log(int mod, int lvl, int errn, const char *file, int line,
     const char *func, const char *fmt, ...)
 #ifdef __GNUC__
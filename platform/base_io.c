@@ -14,8 +14,21 @@
 #include <inttypes.h>
 #include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
 
+#if HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>
+#endif
+
+#if HAVE_SYS_STAT_H
+# include <sys/stat.h>
+#endif
+
 #if HAVE_SYS_SELECT_H
 # include <sys/select.h>
 #endif
@@ -113,3 +126,78 @@ lsi_b_stdin_canread(void)
 
 	return r;
 }
+
+void *
+lsi_b_mapfile(const char *path, size_t *len)
+{
+#if HAVE_MMAP && HAVE_SYS_MMAN_H && HAVE_OPEN && HAVE_FSTAT
+	int fd = open(path, O_RDONLY);
+	if (fd == -1) {
+		EE("open '%s'", path);
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) == -1) {
+		EE("fstat '%s'", path);
+		close(fd);
+		return NULL;
+	}
+
+	if (st.st_size <= 0 || (uintmax_t)st.st_size > SIZE_MAX) {
+		E("'%s': bad size %jd", path, (intmax_t)st.st_size);
+		close(fd);
+		return NULL;
+	}
+
+	void *p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		EE("mmap '%s'", path);
+		return NULL;
+	}
+
+	*len = (size_t)st.st_size;
+	return p;
+#else
+	/* no mmap(), read it into memory instead */
+	FILE *f = fopen(path, "rb");
+	if (!f) {
+		EE("fopen '%s'", path);
+		return NULL;
+	}
+
+	long sz;
+	if (fseek(f, 0, SEEK_END) != 0 || (sz = ftell(f)) <= 0
+	    || fseek(f, 0, SEEK_SET) != 0) {
+		E("'%s': cannot tell size", path);
+		fclose(f);
+		return NULL;
+	}
+
+	void *p = malloc((size_t)sz);
+	if (!p || fread(p, 1, (size_t)sz, f) != (size_t)sz) {
+		E("'%s': cannot read", path);
+		free(p);
+		fclose(f);
+		return NULL;
+	}
+
+	fclose(f);
+	*len = (size_t)sz;
+	return p;
+#endif
+}
+
+void
+lsi_b_unmapfile(void *p, size_t len)
+{
+#if HAVE_MMAP && HAVE_SYS_MMAN_H && HAVE_OPEN && HAVE_FSTAT
+	if (munmap(p, len) == -1)
+		EE("munmap");
+#else
+	(void)len;
+	free(p);
+#endif
+	return;
+}
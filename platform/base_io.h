@@ -13,5 +13,10 @@ long lsi_b_stdin_read(void *buf, size_t nbytes);
 int lsi_b_stdin_canread(void);
 int lsi_b_stdin_fd(void);
 
+/* map a whole file into memory, read-only; NULL on failure or if the file
+ * is empty.  give it back using lsi_b_unmapfile() */
+void *lsi_b_mapfile(const char *path, size_t *len);
+void lsi_b_unmapfile(void *p, size_t len);
+
 
 #endif /* LIBSRSIRC_BASE_IO_H */
@@ -13,6 +13,11 @@
 
 #include <inttypes.h>
 #include <signal.h>
+#include <stdlib.h>
+
+#if HAVE_PTHREAD_H
+# include <pthread.h>
+#endif
 
 #if HAVE_UNISTD_H
 # include <unistd.h>
@@ -97,3 +102,103 @@ lsi_b_malloc(size_t sz, const char *file, int line, const char *func)
 		EE("malloc in %s() at %s:%d", func, file, line);
 	return r;
 }
+
+size_t
+lsi_b_atomic_inc(size_t *p)
+{
+#if HAVE_ATOMIC_BUILTINS
+	return __atomic_add_fetch(p, 1, __ATOMIC_SEQ_CST);
+#else
+# error "We need something like __atomic_add_fetch()"
+#endif
+}
+
+size_t
+lsi_b_atomic_dec(size_t *p)
+{
+#if HAVE_ATOMIC_BUILTINS
+	return __atomic_sub_fetch(p, 1, __ATOMIC_SEQ_CST);
+#else
+# error "We need something like __atomic_sub_fetch()"
+#endif
+}
+
+size_t
+lsi_b_atomic_get(size_t *p)
+{
+#if HAVE_ATOMIC_BUILTINS
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+#else
+# error "We need something like __atomic_load_n()"
+#endif
+}
+
+void *
+lsi_b_atomic_getptr(void **p)
+{
+#if HAVE_ATOMIC_BUILTINS
+	return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+#else
+# error "We need something like __atomic_load_n()"
+#endif
+}
+
+void *
+lsi_b_atomic_swapptr(void **p, void *v)
+{
+#if HAVE_ATOMIC_BUILTINS
+	return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST);
+#else
+# error "We need something like __atomic_exchange_n()"
+#endif
+}
+
+void
+lsi_b_atomic_set(size_t *p, size_t v)
+{
+#if HAVE_ATOMIC_BUILTINS
+	__atomic_store_n(p, v, __ATOMIC_SEQ_CST);
+#else
+# error "We need something like __atomic_store_n()"
+#endif
+}
+
+bool
+lsi_b_atomic_cas(size_t *p, size_t *expect, size_t v)
+{
+#if HAVE_ATOMIC_BUILTINS
+	return __atomic_compare_exchange_n(p, expect, v, false,
+	    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+#else
+# error "We need something like __atomic_compare_exchange_n()"
+#endif
+}
+
+void *
+lsi_b_thread(void *(*fn)(void *), void *arg)
+{
+#if HAVE_PTHREAD_H
+	pthread_t *t = malloc(sizeof *t);
+	if (!t)
+		return NULL;
+
+	if (pthread_create(t, NULL, fn, arg) != 0) {
+		free(t);
+		return NULL;
+	}
+
+	return t;
+#else
+	return NULL;
+#endif
+}
+
+void
+lsi_b_thread_join(void *thr)
+{
+#if HAVE_PTHREAD_H
+	pthread_join(*(pthread_t *)thr, NULL);
+	free(thr);
+#endif
+	return;
+}
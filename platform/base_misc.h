@@ -6,6 +6,7 @@
 #define LIBSRSIRC_BASE_MISC_H 1
 
 
+#include <stdbool.h>
 #include <stdint.h>
 #include <stddef.h>
 
@@ -19,4 +20,19 @@ int lsi_b_optind(void);
 void lsi_b_regsig(int sig, void (*sigfn)(int));
 void *lsi_b_malloc(size_t sz, const char *file, int line, const char *func);
 
+/* sequentially consistent atomics; inc/dec return the new value */
+size_t lsi_b_atomic_inc(size_t *p);
+size_t lsi_b_atomic_dec(size_t *p);
+size_t lsi_b_atomic_get(size_t *p);
+void *lsi_b_atomic_getptr(void **p);
+void *lsi_b_atomic_swapptr(void **p, void *v);
+void lsi_b_atomic_set(size_t *p, size_t v);
+/* if *p is *expect, make it v and return true; else set *expect to *p */
+bool lsi_b_atomic_cas(size_t *p, size_t *expect, size_t v);
+
+/* threads.  these don't log, for the logger uses them.  lsi_b_thread()
+ * returns NULL if it failed, or if we have no threads */
+void *lsi_b_thread(void *(*fn)(void *), void *arg);
+void lsi_b_thread_join(void *thr);
+
 #endif /* LIBSRSIRC_BASE_MISC_H */
@@ -8,5 +8,9 @@
 
 uint64_t lsi_b_tstamp_us(void);
 
+/* monotonic nanoseconds since some unspecified point, for measuring durations;
+ * falls back to lsi_b_tstamp_us() where there is no monotonic clock */
+uint64_t lsi_b_mono_ns(void);
+
 
 #endif /* LIBSRSIRC_BASE_TIME_H */
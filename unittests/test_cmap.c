@@ -0,0 +1,149 @@
+/* test_cmap.c -
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <libsrsirc/cmap.h>
+#include <libsrsirc/defs.h>
+
+#define MAXLEN 64
+#define NTABLES 6
+
+/* what lsi_cmap_fold() does without SIMD */
+static size_t
+reffold(uint8_t *dst, const char *s, size_t n, const uint8_t *cmap)
+{
+	size_t len = 0;
+	uint8_t c;
+	while (len < n && (c = cmap[(uint8_t)s[len]]))
+		dst[len++] = c;
+	return len;
+}
+
+/* `len` chars at `s`, a mix of everything the tables treat specially (both
+ * ends of every folding range, '!', '@', chars >= 0x80) and plain ones */
+static void
+fill(char *s, size_t len, unsigned *seed)
+{
+	static const char spec[] = "aAzZ{}|~^[]\\`!@_-09 \x7f\x80\xfe\xff";
+	for (size_t i = 0; i < len; i++) {
+		*seed = *seed * 1103515245u + 12345u;
+		unsigned r = *seed >> 16;
+		s[i] = r % 3 ? spec[r % (sizeof spec - 1)] : (char)(1 + r % 255);
+	}
+}
+
+/* fold `s` with all tables and a few limits, checking against reffold() */
+static const char *
+check(const char *s, size_t len)
+{
+	uint8_t d1[MAXLEN + 16], d2[MAXLEN + 16];
+	size_t lims[] = { SIZE_MAX, len, len / 2, len ? len - 1 : 0 };
+	for (int t = 0; t < NTABLES; t++)
+		for (size_t i = 0; i < sizeof lims / sizeof lims[0]; i++) {
+			size_t n = lims[i];
+			size_t l1 = reffold(d1, s, n, g_cmap[t]);
+			size_t l2 = lsi_cmap_fold(d2, s, n, g_cmap[t]);
+			if (l1 != l2)
+				return "folded length differs from the table's";
+			if (memcmp(d1, d2, l1) != 0)
+				return "folded chars differ from the table's";
+		}
+
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_random(void)
+{
+	char buf[MAXLEN + 32];
+	unsigned seed = 1;
+	for (size_t len = 0; len <= MAXLEN; len++)
+		for (size_t off = 0; off < 16; off++)
+			for (int rep = 0; rep < 20; rep++) {
+				fill(buf + off, len, &seed);
+				buf[off + len] = '\0';
+				const char *err = check(buf + off, len);
+				if (err)
+					return err;
+			}
+
+	return NULL;
+}
+
+/* every position of '!' and '@' in an otherwise foldable string, since
+ * the nick tables stop there and the others must not */
+const char * /*UNITTEST*/
+test_stopchars(void)
+{
+	char buf[MAXLEN + 1];
+	for (size_t len = 1; len <= MAXLEN; len++)
+		for (size_t p = 0; p < len; p++)
+			for (int w = 0; w < 2; w++) {
+				for (size_t i = 0; i < len; i++)
+					buf[i] = "aBz}~["[i % 6];
+				buf[p] = w ? '@' : '!';
+				buf[len] = '\0';
+				const char *err = check(buf, len);
+				if (err)
+					return err;
+			}
+
+	return NULL;
+}
+
+/* strings that end right where an inaccessible page begins, so that any
+ * read past their end faults.  once terminated (the '\0' being the last
+ * byte of the page), once not (the limit being the length) */
+const char * /*UNITTEST*/
+test_pageend(void)
+{
+	long psz = sysconf(_SC_PAGESIZE);
+	if (psz <= 0)
+		return "can't tell the page size";
+
+	char *pg = mmap(NULL, 2 * (size_t)psz, PROT_READ | PROT_WRITE,
+	    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (pg == MAP_FAILED)
+		return "mmap() failed";
+
+	if (mprotect(pg + psz, (size_t)psz, PROT_NONE) != 0)
+		return "mprotect() failed";
+
+	char *end = pg + psz;
+	unsigned seed = 2;
+	for (size_t len = 0; len <= MAXLEN; len++)
+		for (int rep = 0; rep < 20; rep++) {
+			/* the nick tables stop at '!' and '@', the others
+			 * read on up to the end */
+			char *s = end - len - 1;
+			for (size_t i = 0; i < len; i++) {
+				seed = seed * 1103515245u + 12345u;
+				s[i] = "abcxyz{|}~ABC019_!@"[(seed >> 16) % 19];
+			}
+			s[len] = '\0';
+
+			const char *err = check(s, len);
+			if (err)
+				return err;
+
+			s = end - len;
+			memmove(s, end - len - 1, len);
+			uint8_t d1[MAXLEN], d2[MAXLEN];
+			for (int t = 0; t < NTABLES; t++) {
+				size_t l1 = reffold(d1, s, len, g_cmap[t]);
+				size_t l2 = lsi_cmap_fold(d2, s, len, g_cmap[t]);
+				if (l1 != l2 || memcmp(d1, d2, l1) != 0)
+					return "unterminated fold at page end "
+					    "differs from the table's";
+			}
+		}
+
+	munmap(pg, 2 * (size_t)psz);
+	return NULL;
+}
@@ -0,0 +1,194 @@
+/* test_isupp.c -
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <stdint.h>
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/util.h>
+#include <libsrsirc/defs.h>
+#include <libsrsirc/intdefs.h>
+#include <libsrsirc/irc_msghnd.h>
+#include <libsrsirc/msg.h>
+
+/* a context with the core handlers, having seen a 005 with `tokens' */
+static irc *
+mkctx(const char *tokens)
+{
+	irc *ctx = irc_init();
+	if (!ctx || !lsi_imh_regall(ctx, false))
+		return NULL;
+
+	char buf[512];
+	tokarr tok;
+	snprintf(buf, sizeof buf, ":srv 005 me %s :are supported", tokens);
+	if (!lsi_ut_tokenize(buf, &tok))
+		return NULL;
+
+	lsi_msg_handle(ctx, &tok, false);
+	return ctx;
+}
+
+/* `tbl' must hold what `expect' says ("<char><limit> ..."), and 0 for
+ * every other char */
+static bool
+tblis(const uint16_t *tbl, const char *expect)
+{
+	uint16_t want[256] = { 0 };
+	for (const char *p = expect; *p; p += strspn(p, " ")) {
+		char *end;
+		want[(unsigned char)*p] = (uint16_t)strtoul(p + 1, &end, 10);
+		p = end;
+	}
+
+	return memcmp(tbl, want, sizeof want) == 0;
+}
+
+const char * /*UNITTEST*/
+test_charlimits(void)
+{
+	static const struct {
+		const char *tokens;
+		bool chanlimit; // check CHANLIMIT rather than MAXLIST
+		const char *expect;
+	} cases[] = {
+		{ "WHOX", false, "" },
+		{ "MAXLIST=beI:100,q:50", false, "b100 e100 I100 q50" },
+		{ "MAXLIST=beI:", false, "" },
+		{ "MAXLIST=#:,", false, "" },
+		{ "MAXLIST=:", false, "" },
+		{ "MAXLIST=:5", false, "" },
+		{ "MAXLIST=,,,", false, "" },
+		{ "MAXLIST=", false, "" },
+		{ "MAXLIST", false, "" },
+		{ "MAXLIST=beI", false, "" },
+		{ "MAXLIST=beI100", false, "" },
+		{ "MAXLIST=b:10,eI", false, "b10" },
+		{ "MAXLIST=eI,b:10", false, "b10" },
+		{ "MAXLIST=eI,,b:10,", false, "b10" },
+		{ "MAXLIST=b:10x,e:5", false, "b10 e5" },
+		{ "MAXLIST=b:10,b:20", false, "b20" },
+		{ "MAXLIST=b:x,e:5", false, "e5" },
+		{ "MAXLIST=b:-1", false, "" },
+		{ "MAXLIST=b:65535", false, "b65535" },
+		{ "MAXLIST=b:65536", false, "b65535" },
+		{ "MAXLIST=b:70000,e:4294967296", false, "b65535 e65535" },
+		{ "MAXLIST=b:99999999999999999999999", false, "b65535" },
+		{ "MAXLIST=b:1:2", false, "b1" },
+		{ "CHANLIMIT=#&:20,+:", true, "#20 &20" },
+		{ "CHANLIMIT=#:70000", true, "#65535" },
+		{ "CHANLIMIT=#&", true, "" },
+		{ "CHANTYPES=#& MAXCHANNELS=70000", true, "#65535 &65535" },
+		{ "CHANTYPES=#&+ MAXCHANNELS=10", true, "#10 &10 +10" },
+		{ "MAXCHANNELS=10 CHANLIMIT=#:5", true, "#5" },
+	};
+
+	for (size_t i = 0; i < sizeof cases / sizeof cases[0]; i++) {
+		irc *ctx = mkctx(cases[i].tokens);
+		if (!ctx)
+			return "setup failed";
+
+		if (!tblis(cases[i].chanlimit ? ctx->isupp.chanlimit
+		    : ctx->isupp.maxlist, cases[i].expect)) {
+			fprintf(stderr, "'%s': ", cases[i].tokens);
+			return "limits compiled wrongly";
+		}
+
+		irc_dispose(ctx);
+	}
+
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_prefix(void)
+{
+	static const struct {
+		const char *tokens;
+		const char *modes; // expected, strongest first
+		const char *syms;
+	} cases[] = {
+		{ "WHOX", "ov", "@+" },
+		{ "PREFIX=(qaohv)~&@%+", "qaohv", "~&@%+" },
+		{ "PREFIX=(ov)@", "ov", "@+" },
+		{ "PREFIX=(o)@+", "ov", "@+" },
+		{ "PREFIX=", "ov", "@+" },
+		{ "PREFIX=()", "ov", "@+" },
+		{ "PREFIX=ov@+", "ov", "@+" },
+		{ "PREFIX=(oo)@+", "o", "@+" },
+		{ "PREFIX=(ov)@@", "ov", "@" },
+	};
+
+	for (size_t i = 0; i < sizeof cases / sizeof cases[0]; i++) {
+		irc *ctx = mkctx(cases[i].tokens);
+		if (!ctx)
+			return "setup failed";
+
+		/* a duplicate keeps the rank it had first, but still counts */
+		const struct isupp *is = &ctx->isupp;
+		size_t npfx = strlen(ctx->m005modepfx[0]);
+		if (is->npfx != npfx) {
+			fprintf(stderr, "'%s': ", cases[i].tokens);
+			return "wrong number of prefixes";
+		}
+
+		uint8_t rank[256] = { 0 }, mdrank[256] = { 0 };
+		const char *m = cases[i].modes, *s = cases[i].syms;
+		for (size_t j = 0; m[j]; j++)
+			mdrank[(unsigned char)m[j]] = (uint8_t)(j + 1);
+		for (size_t j = 0; s[j]; j++)
+			rank[(unsigned char)s[j]] = (uint8_t)(j + 1);
+
+		if (memcmp(is->pfxmdrank, mdrank, sizeof mdrank) != 0
+		    || memcmp(is->pfxrank, rank, sizeof rank) != 0) {
+			fprintf(stderr, "'%s': ", cases[i].tokens);
+			return "prefix ranks compiled wrongly";
+		}
+
+		irc_dispose(ctx);
+	}
+
+	return NULL;
+}
+
+/* more prefixes than the member bitmask has room for; those past the 32nd
+ * are ignored.  (a PREFIX= that long doesn't even make it through 005, so
+ * the strings are put in place directly) */
+const char * /*UNITTEST*/
+test_manyprefixes(void)
+{
+	irc *ctx = irc_init();
+	if (!ctx)
+		return "setup failed";
+
+	char modes[41], syms[41];
+	for (size_t i = 0; i < 40; i++) {
+		modes[i] = (char)('A' + i);
+		syms[i] = (char)(0x80 + i);
+	}
+	modes[40] = syms[40] = '\0';
+
+	free(ctx->m005modepfx[0]);
+	free(ctx->m005modepfx[1]);
+	if (!(ctx->m005modepfx[0] = strdup(modes))
+	    || !(ctx->m005modepfx[1] = strdup(syms)))
+		return "out of memory";
+
+	lsi_imh_compile_005(ctx);
+
+	const struct isupp *is = &ctx->isupp;
+	if (is->npfx != 32)
+		return "prefix count not capped at 32";
+
+	for (size_t i = 0; i < 40; i++) {
+		uint8_t want = i < 32 ? (uint8_t)(i + 1) : 0;
+		if (is->pfxmdrank[(unsigned char)modes[i]] != want
+		    || is->pfxrank[(unsigned char)syms[i]] != want)
+			return "prefix past the 32nd ranked";
+	}
+
+	irc_dispose(ctx);
+	return NULL;
+}
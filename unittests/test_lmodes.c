@@ -0,0 +1,230 @@
+/* test_lmodes.c -
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <stdint.h>
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+#include <libsrsirc/irc_track.h>
+#include <libsrsirc/util.h>
+#include <libsrsirc/defs.h>
+#include <libsrsirc/intdefs.h>
+#include <libsrsirc/irc_msghnd.h>
+#include <libsrsirc/msg.h>
+#include <libsrsirc/ucbase.h>
+
+/* have the context handle `line' as if it came from the server */
+static void
+feed(irc *ctx, const char *line)
+{
+	char buf[512];
+	tokarr tok;
+	snprintf(buf, sizeof buf, "%s", line);
+	if (lsi_ut_tokenize(buf, &tok))
+		lsi_msg_handle(ctx, &tok, false);
+}
+
+/* a tracking context (enabled by the 005, as when connecting) in #chan */
+static irc *
+mkctx(const char *casemap)
+{
+	irc *ctx = irc_init();
+	if (!ctx || !irc_set_track(ctx, true) || !lsi_imh_regall(ctx, false))
+		return NULL;
+
+	char line[128];
+	snprintf(line, sizeof line, ":srv 005 me CASEMAPPING=%s "
+	    "CHANMODES=beIq,k,l,imnt PREFIX=(ov)@+ :are supported", casemap);
+	feed(ctx, line);
+	if (!ctx->tracking_enab || !lsi_ucb_add_chan(ctx, "#chan"))
+		return NULL;
+
+	return ctx;
+}
+
+static bool
+has(irc *ctx, char mode, const char *mask, const char *setby, uint64_t ts)
+{
+	const char *sb;
+	uint64_t t;
+	if (!irc_chanlist_has(ctx, "#chan", mode, mask, &sb, &t))
+		return false;
+
+	return t == ts && (setby ? sb && strcmp(sb, setby) == 0 : !sb);
+}
+
+/* each list is forgotten when it's listed anew, and only that list */
+const char * /*UNITTEST*/
+test_relist(void)
+{
+	static const struct {
+		const char *entry, *end; // numerics, with the mode for 728/729
+		char mode;
+	} lists[] = {
+		{ "367 me #chan", "368 me #chan", 'b' },
+		{ "348 me #chan", "349 me #chan", 'e' },
+		{ "346 me #chan", "347 me #chan", 'I' },
+		{ "728 me #chan q", "729 me #chan q", 'q' },
+	};
+
+	irc *ctx = mkctx("rfc1459");
+	if (!ctx)
+		return "setup failed";
+
+	char line[256];
+	for (size_t i = 0; i < sizeof lists / sizeof lists[0]; i++) {
+		char m = lists[i].mode;
+		for (int n = 0; n < 3; n++) {
+			snprintf(line, sizeof line,
+			    ":srv %s *!*@h%d.example op %d", lists[i].entry,
+			    n, 100 + n);
+			feed(ctx, line);
+		}
+		snprintf(line, sizeof line, ":srv %s :End of list",
+		    lists[i].end);
+		feed(ctx, line);
+
+		if (irc_num_chanlist(ctx, "#chan", m) != 3
+		    || !has(ctx, m, "*!*@h0.example", "op", 100)
+		    || !has(ctx, m, "*!*@h2.example", "op", 102))
+			return "list not taken in";
+
+		/* again, with h1 gone, and h2 without setter and time */
+		snprintf(line, sizeof line, ":srv %s *!*@h0.example op2 200",
+		    lists[i].entry);
+		feed(ctx, line);
+		snprintf(line, sizeof line, ":srv %s *!*@h2.example",
+		    lists[i].entry);
+		feed(ctx, line);
+		snprintf(line, sizeof line, ":srv %s :End of list",
+		    lists[i].end);
+		feed(ctx, line);
+
+		if (irc_num_chanlist(ctx, "#chan", m) != 2
+		    || !has(ctx, m, "*!*@h0.example", "op2", 200)
+		    || !has(ctx, m, "*!*@h2.example", NULL, 0)
+		    || irc_chanlist_has(ctx, "#chan", m, "*!*@h1.example",
+		    NULL, NULL))
+			return "relisting didn't replace the list";
+
+		/* the lists done before are untouched */
+		for (size_t j = 0; j < i; j++)
+			if (irc_num_chanlist(ctx, "#chan", lists[j].mode) != 0)
+				return "relisting touched another list";
+
+		/* an empty list has no entries to clear it with */
+		feed(ctx, line);
+		if (irc_num_chanlist(ctx, "#chan", m) != 0)
+			return "empty list not taken in";
+	}
+
+	/* lists of unknown channels are ignored */
+	feed(ctx, ":srv 367 me #other *!*@x.example");
+	feed(ctx, ":srv 368 me #other :End of list");
+	if (irc_num_chanlist(ctx, "#other", 'b') != 0)
+		return "list of an unknown channel kept";
+
+	irc_dispose(ctx);
+	return NULL;
+}
+
+/* MODE changes go into the same lists; adding a mask that is already there
+ * refreshes it rather than duplicating it */
+const char * /*UNITTEST*/
+test_mode(void)
+{
+	irc *ctx = mkctx("rfc1459");
+	if (!ctx)
+		return "setup failed";
+
+	const char *setby;
+	feed(ctx, ":op!o@h MODE #chan +bbe a!b@c d!e@f g!h@i");
+	if (irc_num_chanlist(ctx, "#chan", 'b') != 2
+	    || irc_num_chanlist(ctx, "#chan", 'e') != 1
+	    || !irc_chanlist_has(ctx, "#chan", 'b', "a!b@c", &setby, NULL)
+	    || !setby || strcmp(setby, "op") != 0)
+		return "MODE + not tracked";
+
+	feed(ctx, ":op!o@h MODE #chan -b+I d!e@f j!k@l");
+	if (irc_num_chanlist(ctx, "#chan", 'b') != 1
+	    || irc_num_chanlist(ctx, "#chan", 'I') != 1
+	    || irc_chanlist_has(ctx, "#chan", 'b', "d!e@f", NULL, NULL))
+		return "MODE - not tracked";
+
+	chan *c = lsi_ucb_get_chan(ctx, "#chan", false);
+	if (!c || !lsi_ucb_add_lmode(ctx, c, 'b', "A!B@C", "op", 5)
+	    || lsi_ucb_num_lmodes(ctx, c, 'b') != 1
+	    || !has(ctx, 'b', "a!b@c", "op", 5))
+		return "adding a known mask again duplicated it";
+
+	if (!lsi_ucb_drop_lmode(ctx, c, 'b', "A!b@c")
+	    || lsi_ucb_drop_lmode(ctx, c, 'b', "a!b@c")
+	    || lsi_ucb_num_lmodes(ctx, c, 'b') != 0)
+		return "dropping failed";
+
+	/* no list modes for chars that can't be one */
+	if (lsi_ucb_add_lmode(ctx, c, '#', "x", NULL, 0)
+	    && lsi_ucb_num_lmodes(ctx, c, '#') != 0)
+		return "list kept for an impossible mode";
+
+	lsi_ucb_clear_lmodes(ctx, c, 'e');
+	if (lsi_ucb_num_lmodes(ctx, c, 'e') != 0
+	    || lsi_ucb_num_lmodes(ctx, c, 'I') != 1)
+		return "clearing failed";
+
+	irc_dispose(ctx);
+	return NULL;
+}
+
+/* masks are folded as a whole, unlike nicks, which end at '!' or '@' */
+const char * /*UNITTEST*/
+test_casemap(void)
+{
+	static const struct {
+		const char *casemap;
+		const char *mask, *same, *other;
+	} cases[] = {
+		{ "rfc1459", "Nick[1]!Us|er@Host", "nick{1}!us\\ER@hOST",
+		    "nick{1}!us\\ER@hOST2" },
+		{ "rfc1459", "a!b@c", "A!B@C", "a!b@d" },
+		{ "rfc1459", "a!b@c", "A!B@C", "a!x@c" },
+		{ "rfc1459", "*!*@[x]", "*!*@{X}", "*!*@[y]" },
+		{ "strict-rfc1459", "*!*@~x", "*!*@^X", "*!*@[y]" },
+		{ "ascii", "*!*@X", "*!*@x", "*!*@{x}" },
+		{ "ascii", "a[b]!c@d", "A[B]!C@D", "a{b}!c@d" },
+	};
+
+	for (size_t i = 0; i < sizeof cases / sizeof cases[0]; i++) {
+		irc *ctx = mkctx(cases[i].casemap);
+		if (!ctx)
+			return "setup failed";
+
+		char line[256];
+		snprintf(line, sizeof line, ":srv 367 me #chan %s op 1",
+		    cases[i].mask);
+		feed(ctx, line);
+		snprintf(line, sizeof line, ":srv 367 me #chan %s op 2",
+		    cases[i].other);
+		feed(ctx, line);
+		feed(ctx, ":srv 368 me #chan :End of list");
+
+		if (irc_num_chanlist(ctx, "#chan", 'b') != 2
+		    || !has(ctx, 'b', cases[i].same, "op", 1)
+		    || !has(ctx, 'b', cases[i].other, "op", 2)) {
+			fprintf(stderr, "'%s' (%s): ", cases[i].mask,
+			    cases[i].casemap);
+			return "masks folded wrongly";
+		}
+
+		const char *masks[4];
+		if (irc_all_chanlist(ctx, "#chan", 'b', masks, 4) != 2)
+			return "irc_all_chanlist() doesn't agree";
+
+		irc_dispose(ctx);
+	}
+
+	return NULL;
+}
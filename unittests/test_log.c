@@ -0,0 +1,179 @@
+/* test_log.c -
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <fcntl.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <logger/intlog.h>
+
+#define NMSG 100
+
+/* async mode can only be switched on once per process, so each test runs
+ * `fn' in a child whose stderr is a pipe; `junk' bytes are written into the
+ * pipe first.  the child reports a number through `*res', and whatever it
+ * logged ends up in `buf' */
+static const char *
+inchild(size_t (*fn)(void), size_t junk, size_t *res, char *buf, size_t bufsz)
+{
+	int lp[2], rp[2];
+	if (pipe(lp) != 0 || pipe(rp) != 0)
+		return "pipe() failed";
+
+	pid_t pid = fork();
+	if (pid == -1)
+		return "fork() failed";
+
+	if (pid == 0) {
+		close(lp[0]);
+		close(rp[0]);
+		if (dup2(lp[1], STDERR_FILENO) == -1)
+			_exit(EXIT_FAILURE);
+		close(lp[1]);
+
+		/* fill the pipe up, so that drain() blocks on its first write
+		 * until the parent starts reading */
+		fcntl(STDERR_FILENO, F_SETFL, O_NONBLOCK);
+		char c = '.';
+		for (size_t i = 0; i < junk; i++)
+			if (write(STDERR_FILENO, &c, 1) != 1)
+				break;
+		fcntl(STDERR_FILENO, F_SETFL, 0);
+
+		size_t r = fn();
+		if (write(rp[1], &r, sizeof r) != sizeof r)
+			_exit(EXIT_FAILURE);
+		exit(EXIT_SUCCESS); //not _exit(), drain at exit is tested too
+	}
+
+	close(lp[1]);
+	close(rp[1]);
+
+	ssize_t n = read(rp[0], res, sizeof *res);
+	close(rp[0]);
+
+	size_t len = 0;
+	ssize_t r;
+	while ((r = read(lp[0], buf + len, bufsz - 1 - len)) > 0)
+		len += (size_t)r;
+	buf[len] = '\0';
+	close(lp[0]);
+
+	int st;
+	if (waitpid(pid, &st, 0) != pid || !WIFEXITED(st)
+	    || WEXITSTATUS(st) != EXIT_SUCCESS || n != sizeof *res)
+		return "child failed";
+
+	return NULL;
+}
+
+/* check that the messages "m<i>" in `buf' are in order; count them in
+ * `*nmsg', and add up what the "dropped" warnings say in `*ndrop' */
+static const char *
+scan(char *buf, size_t *nmsg, size_t *ndrop)
+{
+	long last = -1;
+	*nmsg = *ndrop = 0;
+	for (char *tok = strtok(buf, "\n"); tok; tok = strtok(NULL, "\n")) {
+		tok += strspn(tok, ".");
+		char *d = strstr(tok, " log messages dropped");
+		if (d) {
+			while (d > tok && d[-1] >= '0' && d[-1] <= '9')
+				d--;
+			*ndrop += strtoul(d, NULL, 10);
+		} else if (tok[0] == 'm') {
+			long i = strtol(tok + 1, NULL, 10);
+			if (i <= last)
+				return "messages out of order";
+			last = i;
+			(*nmsg)++;
+		}
+	}
+	return NULL;
+}
+
+static void
+late(void)
+{
+	A("late");
+}
+
+static size_t
+logsome(void)
+{
+	/* registered before lsi_log_async(), so it runs after stop_async() */
+	atexit(late);
+
+	if (!lsi_log_async(NMSG))
+		return 0;
+
+	for (int i = 0; i < NMSG; i++)
+		A("m%d", i);
+
+	return lsi_log_dropped() + 1;
+}
+
+static size_t
+flood(void)
+{
+	if (!lsi_log_async(16))
+		return 0;
+
+	for (int i = 0; i < NMSG; i++)
+		A("m%d", i);
+
+	return lsi_log_dropped();
+}
+
+const char * /*UNITTEST*/
+test_drainatexit(void)
+{
+	static char buf[1 << 16];
+	size_t res, nmsg, ndrop;
+	const char *err = inchild(logsome, 0, &res, buf, sizeof buf);
+	if (err)
+		return err;
+
+	if (res != 1)
+		return "messages dropped although there was room";
+
+	if (!strstr(buf, "\nlate\n"))
+		return "message logged after stop_async() lost";
+
+	if ((err = scan(buf, &nmsg, &ndrop)))
+		return err;
+
+	if (nmsg != NMSG || ndrop)
+		return "not everything was drained at exit";
+
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_ringfull(void)
+{
+	static char buf[1 << 20];
+	size_t res, nmsg, ndrop;
+	const char *err = inchild(flood, SIZE_MAX, &res, buf, sizeof buf);
+	if (err)
+		return err;
+
+	if (!res)
+		return "nothing dropped although drain() was stuck";
+
+	if ((err = scan(buf, &nmsg, &ndrop)))
+		return err;
+
+	if (ndrop != res)
+		return "drop count reported wrongly";
+
+	if (nmsg + ndrop != NMSG)
+		return "messages lost without being counted";
+
+	return NULL;
+}
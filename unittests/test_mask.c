@@ -0,0 +1,155 @@
+/* test_mask.c -
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <ctype.h>
+
+#include <libsrsirc/mask.h>
+#include <libsrsirc/defs.h>
+
+static const struct {
+	const char *mask;
+	const char *str;
+	int casemap;
+	bool match;
+} s_cases[] = {
+	{ "*", "", CMAP_ASCII, true },
+	{ "*", "nick!user@host", CMAP_ASCII, true },
+	{ "", "", CMAP_ASCII, true },
+	{ "", "x", CMAP_ASCII, false },
+	{ "nick!user@host", "NICK!User@HOST", CMAP_ASCII, true },
+	{ "nick!user@host", "nick!user@hostx", CMAP_ASCII, false },
+	{ "*!*@*.example.com", "a!b@irc.example.com", CMAP_ASCII, true },
+	{ "*!*@*.example.com", "a!b@example.com", CMAP_ASCII, false },
+	{ "*!*@*.example.com", "a!b@x.example.com.evil", CMAP_ASCII, false },
+	{ "n?ck!*@*", "nick!u@h", CMAP_ASCII, true },
+	{ "n?ck!*@*", "nck!u@h", CMAP_ASCII, false },
+	{ "*a*a*a*", "aaa", CMAP_ASCII, true },
+	{ "*a*a*a*", "aa", CMAP_ASCII, false },
+	{ "*ab*ab", "abab", CMAP_ASCII, true },
+	{ "*ab*ab", "ab", CMAP_ASCII, false },
+	{ "a*b*c", "abc", CMAP_ASCII, true },
+	{ "a*b*c", "acb", CMAP_ASCII, false },
+	{ "*?*", "", CMAP_ASCII, false },
+	{ "*??", "ab", CMAP_ASCII, true },
+	{ "foo[]!*@*", "FOO{}!u@h", CMAP_RFC1459, true },
+	{ "foo\\!*@*", "FOO|!u@h", CMAP_STRICT_RFC1459, true },
+	{ "foo[]!*@*", "FOO{}!u@h", CMAP_ASCII, false },
+};
+
+/* the obvious backtracking matcher, ascii only */
+static bool
+refmatch(const char *p, const char *s)
+{
+	if (!*p)
+		return !*s;
+
+	if (*p == '*') {
+		for (;; s++) {
+			if (refmatch(p + 1, s))
+				return true;
+			if (!*s)
+				return false;
+		}
+	}
+
+	if (!*s)
+		return false;
+
+	if (*p != '?'
+	    && tolower((unsigned char)*p) != tolower((unsigned char)*s))
+		return false;
+
+	return refmatch(p + 1, s + 1);
+}
+
+const char * /*UNITTEST*/
+test_match(void)
+{
+	for (size_t i = 0; i < sizeof s_cases / sizeof *s_cases; i++) {
+		mask m;
+		if (!lsi_mask_init(&m, s_cases[i].mask, s_cases[i].casemap))
+			return "mask alloc failed";
+
+		bool r = lsi_mask_match(&m, s_cases[i].str);
+		lsi_mask_fini(&m);
+		if (r != s_cases[i].match) {
+			fprintf(stderr, "'%s' vs. '%s': %d\n", s_cases[i].mask,
+			    s_cases[i].str, r);
+			return "mask matched wrongly";
+		}
+	}
+
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_random(void)
+{
+	static const char al[] = "aAb*?!@.";
+	srand(7);
+	for (int k = 0; k < 100000; k++) {
+		char p[12], s[16];
+		int pl = rand() % 10, sl = rand() % 14;
+		for (int i = 0; i < pl; i++)
+			p[i] = al[rand() % (sizeof al - 1)];
+		p[pl] = '\0';
+		for (int i = 0; i < sl; i++) {
+			char c = al[rand() % (sizeof al - 1)];
+			s[i] = c == '*' || c == '?' ? 'x' : c;
+		}
+		s[sl] = '\0';
+
+		mask m;
+		if (!lsi_mask_init(&m, p, CMAP_ASCII))
+			return "mask alloc failed";
+
+		bool r = lsi_mask_match(&m, s);
+		lsi_mask_fini(&m);
+		if (r != refmatch(p, s)) {
+			fprintf(stderr, "'%s' vs. '%s': %d\n", p, s, r);
+			return "mask disagrees with the reference matcher";
+		}
+	}
+
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_hostsfx(void)
+{
+	static const struct {
+		const char *mask;
+		const char *sfx; //casefolded, NULL if none
+	} cases[] = {
+		{ "*!*@*.Example.com", ".EXAMPLE.COM" },
+		{ "*!*@host", "HOST" },
+		{ "nick!*@*", NULL },
+		{ "*!*@*.exa?ple.com", "PLE.COM" },
+		{ "*.example.com", ".EXAMPLE.COM" },
+		{ "*", NULL },
+		{ "*!*@*", NULL },
+	};
+
+	for (size_t i = 0; i < sizeof cases / sizeof *cases; i++) {
+		mask m;
+		if (!lsi_mask_init(&m, cases[i].mask, CMAP_ASCII))
+			return "mask alloc failed";
+
+		size_t len;
+		const char *sfx = lsi_mask_hostsfx(&m, &len);
+		bool ok = cases[i].sfx
+		    ? sfx && len == strlen(cases[i].sfx)
+		    && memcmp(sfx, cases[i].sfx, len) == 0
+		    : !sfx;
+		lsi_mask_fini(&m);
+		if (!ok) {
+			fprintf(stderr, "'%s'\n", cases[i].mask);
+			return "wrong host suffix";
+		}
+	}
+
+	return NULL;
+}
@@ -0,0 +1,156 @@
+/* test_mlist.c -
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+#include <libsrsirc/cmap.h>
+#include <libsrsirc/defs.h>
+#include <libsrsirc/mlist.h>
+#include <libsrsirc/skmap.h>
+#include <libsrsirc/ucbase.h>
+
+#define NMEMB 300
+
+static const char *s_pfx[] = { "@", "+", "", "@+", "" };
+
+/* a context tracking an empty channel #chan */
+static irc *
+mkctx(chan **c)
+{
+	irc *ctx = irc_init();
+	if (!ctx || !irc_set_track(ctx, true) || !lsi_ucb_init(ctx))
+		return NULL;
+
+	return (*c = lsi_ucb_add_chan(ctx, "#chan")) ? ctx : NULL;
+}
+
+static int
+nickcmp(const char *a, const char *b)
+{
+	const uint8_t *cm = g_cmap[CMAP_RFC1459];
+	while (*a && cm[(unsigned char)*a] == cm[(unsigned char)*b])
+		a++, b++;
+	return (int)cm[(unsigned char)*a] - (int)cm[(unsigned char)*b];
+}
+
+/* the list has the map's members, ordered by rank, then nick */
+static const char *
+check(irc *ctx, chan *c)
+{
+	if (c->ml.len != lsi_skmap_count(c->memb))
+		return "list and map disagree on the count";
+
+	size_t npfx[2] = { 0, 0 };
+	memb *prev = NULL;
+	for (size_t i = 0; i < c->ml.len; i++) {
+		memb *m = lsi_mlist_at(&c->ml, i);
+		if (!m || lsi_skmap_get(c->memb, m->u->nick) != m)
+			return "list has a member the map doesn't";
+
+		npfx[0] += strchr(m->modepfx, '@') != NULL;
+		npfx[1] += strchr(m->modepfx, '+') != NULL;
+
+		if (prev && (lsi_mlist_rank(prev) > lsi_mlist_rank(m)
+		    || (lsi_mlist_rank(prev) == lsi_mlist_rank(m)
+		    && nickcmp(prev->u->nick, m->u->nick) >= 0)))
+			return "list out of order";
+
+		size_t pos;
+		if (lsi_mlist_seek(&c->ml, lsi_mlist_rank(m), m->u->nick,
+		    &pos) != m || pos != i)
+			return "seek didn't find a member where it is";
+
+		prev = m;
+	}
+
+	if (lsi_mlist_at(&c->ml, c->ml.len))
+		return "list goes on past its length";
+
+	if (npfx[0] != c->ml.npfx[0] || npfx[1] != c->ml.npfx[1])
+		return "wrong prefix counts";
+
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_order(void)
+{
+	chan *c;
+	irc *ctx = mkctx(&c);
+	if (!ctx)
+		return "setup failed";
+
+	char nick[32];
+	const char *err;
+	srand(3);
+	for (size_t i = 0; i < NMEMB; i++) {
+		snprintf(nick, sizeof nick, "%c%cn[%d]", 'a' + rand() % 26,
+		    'A' + rand() % 26, rand() % 1000);
+		user *u = lsi_ucb_get_user(ctx, nick, false);
+		if (!u && !(u = lsi_ucb_add_user(ctx, nick)))
+			return "adding a user failed";
+
+		if (!lsi_ucb_add_memb(ctx, c, u, s_pfx[i % 5]))
+			return "adding a member failed";
+	}
+
+	if ((err = check(ctx, c)))
+		return err;
+
+	/* drop about every third */
+	size_t n = 0;
+	while (n < c->ml.len) {
+		memb *m = lsi_mlist_at(&c->ml, n);
+		if (rand() % 3 == 0)
+			lsi_ucb_drop_memb(ctx, c, m->u, true, true);
+		else
+			n++;
+	}
+
+	if ((err = check(ctx, c)))
+		return err;
+
+	if (lsi_ucb_num_users(ctx) != c->ml.len)
+		return "users of dropped members weren't purged";
+
+	irc_dispose(ctx);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_dupadd(void)
+{
+	chan *c;
+	irc *ctx = mkctx(&c);
+	if (!ctx)
+		return "setup failed";
+
+	user *u = lsi_ucb_add_user(ctx, "bob!b@h");
+	if (!u || !lsi_ucb_add_memb(ctx, c, u, "@"))
+		return "adding a member failed";
+
+	/* e.g. a JOIN after a PART we missed */
+	if (!lsi_ucb_add_memb(ctx, c, u, ""))
+		return "adding a member again failed";
+
+	const char *err = check(ctx, c);
+	if (err)
+		return err;
+
+	if (c->ml.len != 1 || u->nchans != 1)
+		return "member counted twice";
+
+	memb *m = lsi_mlist_at(&c->ml, 0);
+	if (m->modepfx[0])
+		return "prefix not reset by adding again";
+
+	lsi_ucb_drop_memb(ctx, c, u, true, true);
+	if (c->ml.len || lsi_skmap_count(c->memb) || lsi_ucb_num_users(ctx))
+		return "member or user left behind";
+
+	irc_dispose(ctx);
+	return NULL;
+}
@@ -0,0 +1,446 @@
+/* test_monitor.c -
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+#include <libsrsirc/irc_monitor.h>
+#include <libsrsirc/util.h>
+#include <libsrsirc/defs.h>
+#include <libsrsirc/intdefs.h>
+#include <libsrsirc/irc_msghnd.h>
+#include <libsrsirc/monitor.h>
+#include <libsrsirc/msg.h>
+
+static int s_online, s_offline, s_full;
+
+static void
+cb_online(irc *ctx, const char *ident, void *tag)
+{
+	s_online++;
+}
+
+static void
+cb_offline(irc *ctx, const char *nick, void *tag)
+{
+	s_offline++;
+}
+
+static void
+cb_full(irc *ctx, const char *nick, void *tag)
+{
+	s_full++;
+}
+
+/* a context that is "online", with its socket connected to `*peer', and
+ * the handlers irc_connect() would register */
+static irc *
+mkctx(int *peer)
+{
+	static const struct irc_moncb cbs = { cb_online, cb_offline, cb_full };
+	int sv[2];
+	irc *ctx = irc_init();
+	if (!ctx || socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+		return NULL;
+
+	if (!lsi_imh_regall(ctx, false) || !lsi_mon_regall(ctx, false))
+		return NULL;
+
+	lsi_mon_reset(ctx);
+	irc_regcb_monitor(ctx, &cbs, NULL);
+	irc_set_monitor_ison(ctx, 1);
+	s_online = s_offline = s_full = 0;
+
+	ctx->con->sh.sck = sv[0];
+	ctx->con->online = true;
+	*peer = sv[1];
+	return ctx;
+}
+
+/* have the context handle `line' as if it came from the server */
+static void
+feed(irc *ctx, const char *line)
+{
+	char buf[1024];
+	tokarr tok;
+	snprintf(buf, sizeof buf, "%s", line);
+	if (lsi_ut_tokenize(buf, &tok))
+		lsi_msg_handle(ctx, &tok, false);
+}
+
+/* whatever the context sent so far */
+static char *
+sent(int peer)
+{
+	static char buf[1 << 16];
+	size_t len = 0;
+	ssize_t r;
+	while ((r = recv(peer, buf + len, sizeof buf - 1 - len, MSG_DONTWAIT))
+	    > 0)
+		len += (size_t)r;
+
+	buf[len] = '\0';
+	return buf;
+}
+
+/* the `i'th nick we use; of varying length, "n", some x's, and `i' */
+static const char *
+mknick(int i)
+{
+	static char nick[32];
+	snprintf(nick, sizeof nick, "n%.*s%d", i % 9, "xxxxxxxx", i);
+	return nick;
+}
+
+/* which mknick() `nick' is, or -1 */
+static int
+nickidx(const char *nick, size_t len)
+{
+	if (len == 0 || nick[0] != 'n')
+		return -1;
+
+	int i = atoi(nick + 1 + strspn(nick + 1, "x"));
+	return strlen(mknick(i)) == len && strncmp(mknick(i), nick, len) == 0
+	    ? i : -1;
+}
+
+/* go through the lines in `out' that start with `hdr', which must consist
+ * of mknick()s separated by `sep', be at most `max' chars (without CRLF)
+ * and not end any earlier than necessary.  count the nicks in `seen' and
+ * the lines in `*nlines'.  with `batch', compare the nicks to the ISON
+ * batch the context remembers for each line */
+static const char *
+checklines(irc *ctx, const char *out, const char *hdr, char sep, size_t max,
+    int *seen, size_t *nlines, bool batch)
+{
+	size_t hlen = strlen(hdr);
+	size_t prevlen = 0;
+	*nlines = 0;
+	for (const char *l = out, *e; (e = strstr(l, "\r\n")); l = e + 2) {
+		size_t len = (size_t)(e - l);
+		if (len < hlen || strncmp(l, hdr, hlen) != 0)
+			continue;
+
+		if (len > max)
+			return "line too long";
+
+		const char *nick = l + hlen;
+		size_t n = strcspn(nick, (char[]){sep, '\r', '\0'});
+		if (prevlen && prevlen + 1 + n <= max)
+			return "line ended although the next nick would fit";
+
+		if (batch && (*nlines >= ctx->monison_cnt
+		    || strlen(ctx->monison[*nlines]) != len - hlen
+		    || strncmp(ctx->monison[*nlines], nick, len - hlen) != 0))
+			return "ISON batch remembered wrongly";
+
+		for (; nick < e; nick += n + 1) {
+			n = strcspn(nick, (char[]){sep, '\r', '\0'});
+			int i = nickidx(nick, n);
+			if (i < 0)
+				return "unexpected nick sent";
+			seen[i]++;
+		}
+
+		prevlen = len;
+		(*nlines)++;
+	}
+
+	return NULL;
+}
+
+#define NNICK 40
+
+/* nicks are packed into as few lines as LINELEN allows, both for MONITOR
+ * (comma-separated) and ISON (space-separated), and ones that can't fit in
+ * a line at all are left out */
+const char * /*UNITTEST*/
+test_packer(void)
+{
+	static const struct {
+		const char *isupp;
+		const char *hdr;
+		char sep;
+	} cases[] = {
+		{ "MONITOR=100", "MONITOR + ", ',' },
+		{ "WHOX", "ISON ", ' ' },
+	};
+
+	for (size_t c = 0; c < sizeof cases / sizeof cases[0]; c++)
+		for (size_t linelen = 32; linelen <= 512; linelen *= 4) {
+			int peer;
+			irc *ctx = mkctx(&peer);
+			if (!ctx)
+				return "setup failed";
+
+			for (int i = 0; i < NNICK; i++)
+				if (!irc_monitor_add(ctx, mknick(i)))
+					return "adding failed";
+
+			/* more than fits in a line of 32 */
+			char toolong[MAX_NICK_LEN];
+			memset(toolong, 'y', sizeof toolong - 1);
+			toolong[sizeof toolong - 1] = '\0';
+			if (linelen == 32 && !irc_monitor_add(ctx, toolong))
+				return "adding failed";
+
+			char line[128];
+			snprintf(line, sizeof line,
+			    ":srv 005 me LINELEN=%zu %s :are supported",
+			    linelen, cases[c].isupp);
+			feed(ctx, line);
+			feed(ctx, ":srv 376 me :End of MOTD");
+			lsi_mon_tick(ctx);
+
+			int seen[NNICK] = { 0 };
+			size_t nlines;
+			const char *err = checklines(ctx, sent(peer),
+			    cases[c].hdr, cases[c].sep, linelen - 2, seen,
+			    &nlines, cases[c].sep == ' ');
+			if (err)
+				return err;
+
+			for (int i = 0; i < NNICK; i++)
+				if (seen[i] != 1)
+					return "nick not sent exactly once";
+
+			if (linelen < 512 && nlines < 2)
+				return "expected more than one line";
+
+			if (cases[c].sep == ' ' && ctx->monison_cnt != nlines)
+				return "ISON batches not remembered";
+
+			irc_dispose(ctx);
+			close(peer);
+		}
+
+	return NULL;
+}
+
+/* no more nicks go on the server's list than its MONITOR= says, the rest
+ * are polled for with ISON */
+const char * /*UNITTEST*/
+test_cap(void)
+{
+	static const struct {
+		const char *isupp;
+		size_t nmon;
+	} cases[] = {
+		{ "MONITOR=3", 3 },
+		{ "MONITOR=5", 5 },
+		{ "MONITOR", 5 },
+		{ "MONITOR=0", 0 },
+		{ "WHOX", 0 },
+	};
+
+	for (size_t c = 0; c < sizeof cases / sizeof cases[0]; c++) {
+		int peer;
+		irc *ctx = mkctx(&peer);
+		if (!ctx)
+			return "setup failed";
+
+		for (int i = 0; i < 5; i++)
+			if (!irc_monitor_add(ctx, mknick(i)))
+				return "adding failed";
+
+		char line[128];
+		snprintf(line, sizeof line, ":srv 005 me %s :are supported",
+		    cases[c].isupp);
+		feed(ctx, line);
+		feed(ctx, ":srv 376 me :End of MOTD");
+		lsi_mon_tick(ctx);
+
+		const char *out = sent(peer);
+		int mon[5] = { 0 }, ison[5] = { 0 };
+		size_t nmon, nison;
+		const char *err = checklines(ctx, out, "MONITOR + ", ',', 510,
+		    mon, &nmon, false);
+		if (!err)
+			err = checklines(ctx, out, "ISON ", ' ', 510, ison,
+			    &nison, true);
+		if (err)
+			return err;
+
+		size_t cnt = 0;
+		for (int i = 0; i < 5; i++) {
+			if (mon[i] + ison[i] != 1)
+				return "nick neither MONITORed nor ISON'ed";
+			cnt += (size_t)mon[i];
+		}
+
+		if (cnt != cases[c].nmon || ctx->monsent != cases[c].nmon)
+			return "MONITOR limit not kept";
+
+		irc_dispose(ctx);
+		close(peer);
+	}
+
+	return NULL;
+}
+
+/* 734 takes nicks off the server's list, and into ISON; they're tried
+ * again only once there might be room */
+const char * /*UNITTEST*/
+test_full(void)
+{
+	int peer;
+	irc *ctx = mkctx(&peer);
+	if (!ctx)
+		return "setup failed";
+
+	for (int i = 0; i < 4; i++)
+		if (!irc_monitor_add(ctx, mknick(i)))
+			return "adding failed";
+
+	feed(ctx, ":srv 005 me MONITOR=10 :are supported");
+	lsi_mon_tick(ctx);
+	if (ctx->monsent != 4)
+		return "not all nicks MONITORed";
+
+	char line[128];
+	snprintf(line, sizeof line, ":srv 734 me 10 %s", mknick(0));
+	snprintf(line + strlen(line), sizeof line - strlen(line),
+	    ",%s,nobody :Monitor list is full", mknick(1));
+	feed(ctx, line);
+	feed(ctx, line); //again, mustn't count twice
+	if (ctx->monsent != 2 || s_full != 2)
+		return "734 not accounted for";
+
+	sent(peer);
+	feed(ctx, ":srv 376 me :End of MOTD");
+	lsi_mon_tick(ctx);
+
+	int seen[4] = { 0 };
+	size_t nlines;
+	const char *out = sent(peer);
+	const char *err = checklines(ctx, out, "ISON ", ' ', 510, seen,
+	    &nlines, true);
+	if (err)
+		return err;
+
+	if (nlines != 1 || seen[0] != 1 || seen[1] != 1 || seen[2] || seen[3])
+		return "nicks off the MONITOR list not ISON'ed";
+
+	if (strstr(out, "MONITOR"))
+		return "full nicks MONITORed again right away";
+
+	feed(ctx, ":srv 303 me :");
+
+	/* room again; the nicks that didn't fit are retried */
+	if (!irc_monitor_del(ctx, mknick(2)))
+		return "deleting failed";
+
+	lsi_mon_tick(ctx);
+	out = sent(peer);
+	int del[4] = { 0 }, add[4] = { 0 };
+	size_t ndel, nadd;
+	if ((err = checklines(ctx, out, "MONITOR - ", ',', 510, del, &ndel,
+	    false)) || (err = checklines(ctx, out, "MONITOR + ", ',', 510,
+	    add, &nadd, false)))
+		return err;
+
+	if (ndel != 1 || !del[2] || nadd != 1 || add[0] != 1 || add[1] != 1
+	    || add[2] || add[3])
+		return "full nicks not retried after MONITOR -";
+
+	if (strstr(out, "MONITOR + ") < strstr(out, "MONITOR - "))
+		return "MONITOR + sent before the MONITOR -";
+
+	if (ctx->monsent != 3)
+		return "MONITOR count wrong";
+
+	irc_dispose(ctx);
+	close(peer);
+	return NULL;
+}
+
+/* each 303 answers the oldest ISON batch still out; nicks in the reply
+ * count only for their own batch */
+const char * /*UNITTEST*/
+test_ison(void)
+{
+	int peer;
+	irc *ctx = mkctx(&peer);
+	if (!ctx)
+		return "setup failed";
+
+	for (int i = 0; i < 12; i++)
+		if (!irc_monitor_add(ctx, mknick(i)))
+			return "adding failed";
+
+	feed(ctx, ":srv 005 me LINELEN=40 :are supported");
+	feed(ctx, ":srv 303 me :nobody"); //not ours, nothing out yet
+	feed(ctx, ":srv 376 me :End of MOTD");
+	lsi_mon_tick(ctx);
+
+	int seen[12] = { 0 };
+	size_t nlines;
+	const char *err = checklines(ctx, sent(peer), "ISON ", ' ', 38,
+	    seen, &nlines, true);
+	if (err)
+		return err;
+
+	if (nlines < 2 || ctx->monison_cnt != nlines)
+		return "expected several ISON batches";
+
+	lsi_mon_tick(ctx);
+	if (*sent(peer))
+		return "new ISON round while the last is still out";
+
+	/* the first of batch 0 is online (in another case), and so is the
+	 * first of batch 1 -- but that's for batch 1's 303 to say */
+	int b0[12] = { 0 };
+	char nick0[32], nick1[32];
+	snprintf(nick0, sizeof nick0, "%.*s",
+	    (int)strcspn(ctx->monison[0], " "), ctx->monison[0]);
+	snprintf(nick1, sizeof nick1, "%.*s",
+	    (int)strcspn(ctx->monison[1], " "), ctx->monison[1]);
+	for (char *n = ctx->monison[0]; *n; n += strcspn(n, " "), n += !!*n)
+		b0[nickidx(n, strcspn(n, " "))] = 1;
+
+	char line[128];
+	snprintf(line, sizeof line, ":srv 303 me :someone N%s %s", nick0 + 1,
+	    nick1);
+	feed(ctx, line);
+
+	if (ctx->monison_cnt != nlines - 1)
+		return "303 didn't take an ISON batch";
+
+	int nb0 = 0;
+	for (int i = 0; i < 12; i++) {
+		int want = !b0[i] ? -1 : strcmp(mknick(i), nick0) == 0;
+		nb0 += b0[i];
+		if (irc_monitor_state(ctx, mknick(i)) != want)
+			return "wrong state after the first 303";
+	}
+
+	if (s_online != 1 || s_offline != nb0 - 1)
+		return "wrong callbacks after the first 303";
+
+	for (size_t i = 1; i < nlines; i++)
+		feed(ctx, ":srv 303 me :");
+
+	if (ctx->monison_cnt)
+		return "ISON batches left over";
+
+	for (int i = 0; i < 12; i++)
+		if (irc_monitor_state(ctx, mknick(i))
+		    != (strcmp(mknick(i), nick0) == 0))
+			return "wrong state after all 303s";
+
+	/* a 303 nobody of ours asked for changes nothing */
+	int on = s_online, off = s_offline;
+	feed(ctx, line);
+	if (s_online != on || s_offline != off
+	    || irc_monitor_state(ctx, nick1) != 0)
+		return "stray 303 taken for ours";
+
+	irc_dispose(ctx);
+	close(peer);
+	return NULL;
+}
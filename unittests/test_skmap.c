@@ -0,0 +1,193 @@
+/* test_skmap.c -
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <stdint.h>
+
+#include <libsrsirc/skmap.h>
+#include <libsrsirc/cmap.h>
+#include <libsrsirc/defs.h>
+
+#define NKEYS 5000
+
+static void
+mkkey(char *dest, size_t destsz, size_t i)
+{
+	snprintf(dest, destsz, "Nick[%zu]", i);
+}
+
+static size_t
+nbuckets(skmap *m)
+{
+	size_t nbuck, nused, nitems, maxlen;
+	double loadfac, avglen;
+	lsi_skmap_stat(m, &nbuck, &nused, &nitems, &loadfac, &avglen, &maxlen);
+	return nbuck;
+}
+
+const char * /*UNITTEST*/
+test_basic(void)
+{
+	static int v1, v2;
+	skmap *m = lsi_skmap_init(4, CMAP_RFC1459);
+	if (!m)
+		return "skmap alloc failed";
+
+	if (lsi_skmap_count(m) != 0)
+		return "newly allocated map not empty";
+
+	if (!lsi_skmap_put(m, "Foo[]", &v1) || !lsi_skmap_put(m, "bar", &v2))
+		return "put failed";
+
+	if (lsi_skmap_count(m) != 2)
+		return "count wrong after put";
+
+	/* rfc1459 casemapping folds []\ onto {}| */
+	if (lsi_skmap_get(m, "fOO{}") != &v1)
+		return "casemapped get failed";
+
+	if (lsi_skmap_get_n(m, "BARbaz", 3) != &v2)
+		return "get_n failed";
+
+	if (lsi_skmap_get(m, "baz"))
+		return "got something for a missing key";
+
+	if (lsi_skmap_del(m, "FOO{}") != &v1 || lsi_skmap_get(m, "foo[]"))
+		return "del failed";
+
+	if (lsi_skmap_count(m) != 1)
+		return "count wrong after del";
+
+	lsi_skmap_dispose(m);
+
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_grow(void)
+{
+	static int vals[NKEYS];
+	char key[32];
+	skmap *m = lsi_skmap_init(2, CMAP_RFC1459);
+	if (!m)
+		return "skmap alloc failed";
+
+	for (size_t i = 0; i < NKEYS; i++) {
+		mkkey(key, sizeof key, i);
+		if (!lsi_skmap_put(m, key, &vals[i]))
+			return "put failed";
+	}
+
+	if (lsi_skmap_count(m) != NKEYS)
+		return "count wrong after growing";
+
+	for (size_t i = 0; i < NKEYS; i++) {
+		mkkey(key, sizeof key, i);
+		if (lsi_skmap_get(m, key) != &vals[i])
+			return "lost an item while growing";
+	}
+
+	if (nbuckets(m) < NKEYS / 2)
+		return "map didn't grow";
+
+	/* the iterator must see each item exactly once */
+	static bool seen[NKEYS];
+	size_t n = 0;
+	skmap_iter it;
+	void *v;
+	lsi_skmap_iter_init(m, &it);
+	while (lsi_skmap_iter_next(&it, NULL, &v)) {
+		size_t i = (size_t)((int *)v - vals);
+		if (i >= NKEYS || seen[i])
+			return "iterator returned a bogus or duplicate item";
+		seen[i] = true;
+		n++;
+	}
+
+	if (n != NKEYS)
+		return "iterator missed items";
+
+	lsi_skmap_dispose(m);
+
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_reserve(void)
+{
+	static int vals[NKEYS];
+	char key[32];
+	skmap *m = lsi_skmap_init(4, CMAP_ASCII);
+	if (!m)
+		return "skmap alloc failed";
+
+	for (size_t i = 0; i < 10; i++) {
+		mkkey(key, sizeof key, i);
+		if (!lsi_skmap_put(m, key, &vals[i]))
+			return "put failed";
+	}
+
+	if (!lsi_skmap_reserve(m, NKEYS))
+		return "reserve failed";
+
+	size_t nbuck = nbuckets(m);
+	if (nbuck < NKEYS / 2)
+		return "reserve didn't make room";
+
+	/* absurd sizes must fail (rather than wrap around or loop) */
+	if (lsi_skmap_reserve(m, SIZE_MAX)
+	    || lsi_skmap_reserve(m, SIZE_MAX / 2 + 2))
+		return "reserve accepted an absurd size";
+
+	if (nbuckets(m) != nbuck)
+		return "failed reserve changed the map";
+
+	for (size_t i = 0; i < 10; i++) {
+		mkkey(key, sizeof key, i);
+		if (lsi_skmap_get(m, key) != &vals[i])
+			return "lost an item while reserving";
+	}
+
+	if (lsi_skmap_count(m) != 10)
+		return "count changed by reserve";
+
+	lsi_skmap_dispose(m);
+
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_folded(void)
+{
+	static int v1, v2;
+	skmap *m = lsi_skmap_init(4, CMAP_RFC1459);
+	skmap *m2 = lsi_skmap_init(64, CMAP_RFC1459);
+	if (!m || !m2)
+		return "skmap alloc failed";
+
+	/* folding stops at '!', so an ident's folded key is the nick's */
+	uint8_t buf[CMAP_FOLDBUF];
+	size_t flen;
+	uint8_t *fk = lsi_skmap_fold(m, buf, sizeof buf, "Foo[]!u@h", &flen);
+	if (fk != buf || flen != 5)
+		return "fold failed";
+
+	size_t h = lsi_skmap_hash_f(fk, flen);
+	if (!lsi_skmap_put_f(m, "Foo[]", fk, flen, h, &v1)
+	    || !lsi_skmap_put_f(m2, "Foo[]", fk, flen, h, &v2))
+		return "put_f failed";
+
+	/* the same fold and hash do for maps with another bucket count */
+	if (lsi_skmap_get_f(m, fk, flen, h) != &v1
+	    || lsi_skmap_get_f(m2, fk, flen, h) != &v2)
+		return "get_f failed";
+
+	if (lsi_skmap_get(m, "fOO{}") != &v1 || lsi_skmap_get(m2, "foo[]") != &v2)
+		return "put_f key not found by get";
+
+	lsi_skmap_dispose(m);
+	lsi_skmap_dispose(m2);
+	return NULL;
+}
@@ -0,0 +1,114 @@
+/* test_snap.c -
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+#include <libsrsirc/irc_track.h>
+#include <libsrsirc/defs.h>
+#include <libsrsirc/intdefs.h>
+#include <libsrsirc/ucbase.h>
+
+/* #a with alice and bob, and a topic; #b with carl */
+static irc *
+mkstate(void)
+{
+	irc *ctx = irc_init();
+	if (!ctx || !irc_set_track(ctx, true) || !lsi_ucb_init(ctx))
+		return NULL;
+
+	chan *a = lsi_ucb_add_chan(ctx, "#a");
+	chan *b = lsi_ucb_add_chan(ctx, "#b");
+	user *u1 = lsi_ucb_add_user(ctx, "alice!al@a.example");
+	user *u2 = lsi_ucb_add_user(ctx, "bob!bo@b.example");
+	user *u3 = lsi_ucb_add_user(ctx, "carl!ca@c.example");
+	if (!a || !b || !u1 || !u2 || !u3
+	    || !lsi_ucb_add_memb(ctx, a, u1, "@")
+	    || !lsi_ucb_add_memb(ctx, a, u2, "")
+	    || !lsi_ucb_add_memb(ctx, b, u3, "")
+	    || !(a->topic = strdup("old topic")))
+		return NULL;
+
+	return ctx;
+}
+
+static const char *
+fname_of(irc_snap *s, const char *chnam, const char *nick)
+{
+	userrep ur;
+	if (!irc_snap_member(s, &ur, chnam, nick))
+		return "(none)";
+	return ur.fname ? ur.fname : "(null)";
+}
+
+const char * /*UNITTEST*/
+test_publish(void)
+{
+	irc *ctx = mkstate();
+	if (!ctx)
+		return "setup failed";
+
+	if (irc_snap_acquire(ctx))
+		return "got a snapshot before publishing one";
+
+	if (!irc_snap_publish(ctx))
+		return "publishing failed";
+
+	irc_snap *s1 = irc_snap_acquire(ctx);
+	if (!s1 || irc_snap_num_chans(s1) != 2
+	    || irc_snap_num_members(s1, "#A") != 2)
+		return "first snapshot wrong";
+
+	/* bob leaves, the topic changes, carl's details become known */
+	chan *a = lsi_ucb_get_chan(ctx, "#a", false);
+	user *bob = lsi_ucb_get_user(ctx, "bob", false);
+	user *carl = lsi_ucb_get_user(ctx, "carl", false);
+	lsi_ucb_drop_memb(ctx, a, bob, true, true);
+	free(a->topic);
+	a->topic = strdup("new topic");
+	lsi_ucb_dirty_chan(ctx, a);
+	lsi_ucb_user_details(carl);
+	carl->fname = strdup("Carl Real");
+	lsi_ucb_dirty_user(ctx, carl);
+
+	if (!irc_snap_publish(ctx))
+		return "publishing again failed";
+
+	irc_snap *s2 = irc_snap_acquire(ctx);
+	if (!s2 || s2 == s1)
+		return "no new snapshot";
+
+	chanrep cr;
+	if (irc_snap_num_members(s1, "#a") != 2
+	    || !irc_snap_chan(s1, &cr, "#a") || !cr.topic
+	    || strcmp(cr.topic, "old topic") != 0
+	    || strcmp(fname_of(s1, "#b", "carl"), "(null)") != 0)
+		return "old snapshot changed";
+
+	if (irc_snap_num_members(s2, "#a") != 1
+	    || !irc_snap_chan(s2, &cr, "#a") || !cr.topic
+	    || strcmp(cr.topic, "new topic") != 0
+	    || strcmp(fname_of(s2, "#b", "CARL"), "Carl Real") != 0)
+		return "new snapshot doesn't reflect the changes";
+
+	/* held, so it can't go yet */
+	if (!ctx->snapretired)
+		return "replaced snapshot not retired";
+
+	irc_snap_release(s1);
+	if (!irc_snap_publish(ctx)) //nothing changed, just reclaims
+		return "publishing unchanged state failed";
+
+	if (ctx->snapretired)
+		return "released snapshot not reclaimed";
+
+	if (irc_snap_acquire(ctx) != s2)
+		return "unchanged state made a new snapshot";
+
+	irc_snap_release(s2);
+	irc_snap_release(s2);
+	irc_dispose(ctx);
+	return NULL;
+}
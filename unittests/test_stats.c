@@ -0,0 +1,72 @@
+/* test_stats.c -
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+#include <libsrsirc/defs.h>
+#include <libsrsirc/intdefs.h>
+#include <libsrsirc/stats.h>
+
+static uint64_t
+count(irc *ctx, const char *cmd, size_t *ncmds)
+{
+	const char *c;
+	uint64_t n, r = 0;
+	size_t i = 0;
+	for (; irc_stats_cmd(ctx, i, &c, &n); i++)
+		if (strcmp(c, cmd) == 0)
+			r = n;
+	*ncmds = i;
+	return r;
+}
+
+const char * /*UNITTEST*/
+test_longcmd(void)
+{
+	irc *ctx = irc_init();
+	if (!ctx)
+		return "setup failed";
+
+	static const char lcmd[] = "THIS_IS_A_MADE_UP_COMMAND_WAY_TOO_LONG";
+	for (int i = 0; i < 500; i++)
+		lsi_stats_cmd(ctx, lcmd);
+	lsi_stats_cmd(ctx, "PRIVMSG");
+
+	size_t ncmds;
+	if (count(ctx, "*", &ncmds) != 500)
+		return "over-long command not counted as '*'";
+
+	if (count(ctx, "PRIVMSG", &ncmds) != 1 || ncmds != 2)
+		return "over-long command used up slots";
+
+	irc_dispose(ctx);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_cap(void)
+{
+	irc *ctx = irc_init();
+	if (!ctx)
+		return "setup failed";
+
+	char cmd[16];
+	for (int i = 0; i < 1000; i++) {
+		snprintf(cmd, sizeof cmd, "C%d", i);
+		lsi_stats_cmd(ctx, cmd);
+	}
+
+	size_t ncmds;
+	uint64_t rest = count(ctx, "*", &ncmds);
+	if (ncmds != MAX_CMDSTAT)
+		return "wrong number of distinct commands";
+
+	if (rest != 1000 - (MAX_CMDSTAT - 1))
+		return "wrong count for the rest";
+
+	irc_dispose(ctx);
+	return NULL;
+}
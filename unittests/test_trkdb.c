@@ -0,0 +1,154 @@
+/* test_trkdb.c -
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <unistd.h>
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+#include <libsrsirc/irc_track.h>
+#include <libsrsirc/defs.h>
+#include <libsrsirc/ucbase.h>
+
+/* offset of `casemap` in struct trkdb_hdr (see trkdb.c) */
+#define HDR_CASEMAP_OFF 16
+
+static char s_path[64];
+
+/* a context with tracking state as if we had joined #chan */
+static irc *
+mkstate(void)
+{
+	irc *ctx = irc_init();
+	if (!ctx || !irc_set_track(ctx, true) || !lsi_ucb_init(ctx))
+		return NULL;
+
+	chan *c = lsi_ucb_add_chan(ctx, "#chan");
+	user *u1 = lsi_ucb_add_user(ctx, "alice!al@a.example");
+	user *u2 = lsi_ucb_add_user(ctx, "bobby!bo@b.example");
+	if (!c || !u1 || !u2
+	    || !lsi_ucb_add_memb(ctx, c, u1, "@")
+	    || !lsi_ucb_add_memb(ctx, c, u2, "")
+	    || !lsi_ucb_add_lmode(ctx, c, 'b', "*!*@bad.example", "alice", 42)
+	    || !(c->topic = strdup("the topic")))
+		return NULL;
+
+	return ctx;
+}
+
+static bool
+savefile(void)
+{
+	snprintf(s_path, sizeof s_path, "/tmp/test_trkdb.%ld",
+	    (long)getpid());
+
+	irc *ctx = mkstate();
+	bool ok = ctx && irc_track_save(ctx, s_path);
+	irc_dispose(ctx);
+	return ok;
+}
+
+/* overwrite every occurrence of `from` in the saved file with `to` (same
+ * length), or write `to` at `off` if `from` is NULL */
+static bool
+patchfile(const char *from, const void *to, size_t len, long off)
+{
+	FILE *f = fopen(s_path, "r+b");
+	if (!f)
+		return false;
+
+	static char buf[1 << 16];
+	size_t n = fread(buf, 1, sizeof buf, f);
+	if (from) {
+		for (size_t i = 0; i + len <= n; i++)
+			if (memcmp(buf + i, from, len) == 0)
+				memcpy(buf + i, to, len);
+	} else if (off >= 0 && (size_t)off + len <= n)
+		memcpy(buf + off, to, len);
+
+	rewind(f);
+	bool ok = fwrite(buf, 1, n, f) == n;
+	return fclose(f) == 0 && ok;
+}
+
+static bool
+loads(void)
+{
+	irc *ctx = irc_init();
+	bool ok = ctx && irc_set_track(ctx, true)
+	    && irc_track_load(ctx, s_path);
+	irc_dispose(ctx);
+	return ok;
+}
+
+const char * /*UNITTEST*/
+test_roundtrip(void)
+{
+	if (!savefile())
+		return "saving failed";
+
+	irc *ctx = irc_init();
+	if (!ctx || !irc_set_track(ctx, true))
+		return "setup failed";
+
+	if (!irc_track_load(ctx, s_path))
+		return "loading failed";
+
+	unlink(s_path);
+
+	chanrep cr;
+	if (!irc_chan(ctx, &cr, "#CHAN"))
+		return "channel missing";
+
+	if (!cr.topic || strcmp(cr.topic, "the topic") != 0)
+		return "topic wrong";
+
+	if (irc_num_users(ctx) != 2 || irc_num_members(ctx, "#chan") != 2)
+		return "wrong number of users or members";
+
+	const char *setby;
+	uint64_t tsset;
+	if (!irc_chanlist_has(ctx, "#chan", 'b', "*!*@bad.example", &setby,
+	    &tsset) || !setby || strcmp(setby, "alice") != 0 || tsset != 42)
+		return "list mode wrong";
+
+	userrep ur;
+	if (!irc_user(ctx, &ur, "ALICE") || !ur.host
+	    || strcmp(ur.host, "a.example") != 0)
+		return "user wrong";
+
+	irc_dispose(ctx);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_badcasemap(void)
+{
+	int32_t cm = 7;
+	if (!savefile() || !patchfile(NULL, &cm, sizeof cm, HDR_CASEMAP_OFF))
+		return "setup failed";
+
+	bool ok = loads();
+	unlink(s_path);
+	if (ok)
+		return "loaded a file with a bogus casemapping";
+
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_dupuser(void)
+{
+	/* make bobby another alice, as far as rfc1459 casemapping goes */
+	if (!savefile() || !patchfile("bobby", "ALICE", 5, -1))
+		return "setup failed";
+
+	bool ok = loads();
+	unlink(s_path);
+	if (ok)
+		return "loaded a file with duplicate users";
+
+	return NULL;
+}
@@ -0,0 +1,139 @@
+/* test_trkshare.c -
+ * libsrsirc - a lightweight serious IRC lib - (C) 2012-20, Timo Buhrmester
+ * See README for contact-, COPYING for license information. */
+
+#include "unittests_common.h"
+
+#include <libsrsirc/irc.h>
+#include <libsrsirc/irc_ext.h>
+#include <libsrsirc/irc_track.h>
+#include <libsrsirc/defs.h>
+#include <libsrsirc/intdefs.h>
+#include <libsrsirc/skmap.h>
+#include <libsrsirc/trkshare.h>
+#include <libsrsirc/ucbase.h>
+
+/* a context sharing `sh`, tracking a channel #chan with bob in it */
+static irc *
+mkctx(irc_trkshare *sh, chan **c)
+{
+	irc *ctx = irc_init();
+	if (!ctx || !irc_set_track_share(ctx, sh) || !irc_set_track(ctx, true)
+	    || !lsi_ucb_init(ctx) || !(*c = lsi_ucb_add_chan(ctx, "#chan")))
+		return NULL;
+
+	user *u = lsi_ucb_get_user(ctx, "bob", false);
+	if (!u && !(u = lsi_ucb_add_user(ctx, "bob!b@h")))
+		return NULL;
+
+	return lsi_ucb_add_memb(ctx, *c, u, "") ? ctx : NULL;
+}
+
+/* a context renames bob while the other one lags behind */
+static const char *
+setup(irc_trkshare **sh, irc **a, irc **b, chan **cb, user **u)
+{
+	chan *ca;
+	if (!(*sh = irc_trkshare_init()) || !(*a = mkctx(*sh, &ca))
+	    || !(*b = mkctx(*sh, cb)))
+		return "setup failed";
+
+	*u = lsi_ucb_get_user(*a, "bob", false);
+	if (!*u || !lsi_ucb_rename_user(*a, "bob!b@h", "rob", NULL))
+		return "renaming failed";
+
+	if (lsi_ucb_get_user(*a, "bob", false))
+		return "renaming context still knows the old nick";
+
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_lagging(void)
+{
+	irc_trkshare *sh;
+	irc *a, *b;
+	chan *cb;
+	user *u;
+	const char *err = setup(&sh, &a, &b, &cb, &u);
+	if (err)
+		return err;
+
+	/* e.g. a MODE, then a PART, before the NICK */
+	if (lsi_ucb_get_user(b, "BOB", false) != u
+	    || !lsi_ucb_get_memb(b, cb, "bob", false))
+		return "lagging context doesn't know the old nick";
+
+	if (!lsi_ucb_drop_memb(b, cb, lsi_ucb_get_user(b, "bob", false),
+	    true, true))
+		return "dropping by the old nick failed";
+
+	if (cb->ml.len || lsi_skmap_count(cb->memb))
+		return "ghost member left behind";
+
+	if (lsi_tsh_alias_del(b, "bob!b@h") != u || b->nickalias)
+		return "the NICK didn't end the alias";
+
+	if (lsi_ucb_get_user(b, "bob", false))
+		return "old nick still known after the NICK";
+
+	irc_dispose(b);
+	irc_dispose(a);
+	irc_trkshare_dispose(sh);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_forget(void)
+{
+	irc_trkshare *sh;
+	irc *a, *b;
+	chan *cb;
+	user *u;
+	const char *err = setup(&sh, &a, &b, &cb, &u);
+	if (err)
+		return err;
+
+	if (!b->nickalias)
+		return "no alias for the lagging context";
+
+	/* the user is gone before `b` gets to the NICK */
+	if (!lsi_ucb_drop_user(a, u) || !lsi_ucb_drop_user(b, u))
+		return "dropping the user failed";
+
+	if (b->nickalias || lsi_ucb_get_user(b, "bob", false))
+		return "alias outlived the user";
+
+	irc_dispose(b);
+	irc_dispose(a);
+	irc_trkshare_dispose(sh);
+	return NULL;
+}
+
+const char * /*UNITTEST*/
+test_usergen(void)
+{
+	irc_trkshare *sh = irc_trkshare_init();
+	irc *ctx = irc_init();
+	if (!sh || !ctx || !irc_set_track(ctx, true) || !lsi_ucb_init(ctx))
+		return "setup failed";
+
+	/* a host index built on our own map must not look current for the
+	 * shared one, and vice versa */
+	size_t own = *ctx->usergen;
+	lsi_ucb_deinit(ctx);
+	if (!irc_set_track_share(ctx, sh) || !lsi_ucb_init(ctx))
+		return "attaching failed";
+
+	size_t shared = *ctx->usergen;
+	if (shared == own)
+		return "attaching kept the user generation";
+
+	lsi_ucb_deinit(ctx);
+	if (*ctx->usergen == shared)
+		return "detaching kept the user generation";
+
+	irc_dispose(ctx);
+	irc_trkshare_dispose(sh);
+	return NULL;
+}